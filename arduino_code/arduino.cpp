@@ -8,14 +8,54 @@
  * 4. Two-way LoRa communication with ESP32 gateway
  * 
  * Communication Protocol:
- * TX Format: "Weather:{CLEAR|RAINING}|Temp:{°C}|Hum:{%}|Light level:{0-10}|Moisture:{0-100}|Valve:{OPEN|CLOSE}"
- * RX Format: "CMD:{TRUE|FALSE}" - TRUE=open valve, FALSE=close valve
+ * TX Format: 11 byte binary uplink v1 (see include/lora_frame.h) carrying
+ *            node ID, sequence, rain/valve flags and fixed-point readings;
+ *            between heartbeats only a 6-12 byte delta, and only when a
+ *            field moved past its deadband (report by exception)
+ * RX Format: 5 byte binary valve command addressed to NODE_ID or broadcast;
+ *            legacy "CMD:{TRUE|FALSE}" is still accepted (TRUE=open valve);
+ *            with AUTH_FRAMES only frames addressed to NODE_ID
+ * ACK:       unicast commands are answered with a 5 byte ACK carrying the
+ *            command sequence and the resulting valve state
+ * Trace:     with TRACE_FRAMES uplinks carry the sample age and ACKs the
+ *            time since the command was applied (2 byte trailer), for the
+ *            gateway's end-to-end latency histograms
+ * ADR:       8-9 byte link ADR command sets SF / TX power (and bandwidth /
+ *            coding rate) after its ACK; with no downlink for ADR_ACK_LIMIT
+ *            uplinks the node asks for one (FLAG_ADR_REQ) and after
+ *            ADR_ACK_DELAY more it falls back to SF_FALLBACK at full power,
+ *            where the gateway looks for it
+ * Config:    10 byte config command sets the uplink and heartbeat
+ *            intervals, ACKed like a valve command; it and the link
+ *            settings are kept in EEPROM across resets
+ * Listen:    with SCHEDULED_LISTEN the node flags FLAG_RX_WINDOW and only
+ *            hears downlinks in the short RX window after its own frames
+ * Channels:  each uplink goes out on one of the gateway's CHANNELS
+ *            (include/channel_plan.h), fixed by NODE_ID or hopping per
+ *            frame; downlinks are heard on the channel last sent on
+ * Relay:     with RELAY a mains-powered node also forwards, once each,
+ *            uplinks and ACKs it hears from other nodes and the gateway's
+ *            downlinks for the nodes it forwards for, wrapped in a relay
+ *            frame with hop count and TTL, so plots beyond the gateway's
+ *            range are reached at the network SF instead of SF12
+ * Auth:      with AUTH_FRAMES every frame sent ends in a frame counter and
+ *            a truncated AES-CMAC under the network key (6 byte trailer,
+ *            include/frame_auth.h), and only signed downlinks newer than
+ *            the last one accepted can move the valve or the link; ASCII
+ *            commands are then ignored. At boot, and when downlinks stop
+ *            as for ADR, a 12 byte sync request takes the place of an
+ *            uplink and the gateway's sync reply sets both counters
  * 
  * Features:
- * - Efficient radio switching between RX/TX modes
+ * - Non-blocking, DIO0 interrupt driven RX/TX (async endPacket)
  * - Optimized LoRa parameters for reliability
  * - Automated valve control based on commands
- * - Calibrated sensor readings
+ * - Calibrated sensor readings, sampled in the background on per-sensor
+ *   cadences so the TX path never waits on the DHT11
+ * - Oversampled, median + EMA filtered analog sensors (fixed point),
+ *   one ADC read per idle loop pass
+ * - Scheduled listen for battery plots: MCU and radio power down between
+ *   wakes, the radio only transmits and then listens briefly
  * 
  * Author: Nimesh, Pamith and Udith
  * Last Updated: May 2025
@@ -26,6 +66,17 @@
 #include <LoRa.h>
 #include <DHT.h>
 #include <Servo.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#include <EEPROM.h>
+
+#include "../include/lora_frame.h"  // Binary uplink format shared with gateway
+#include "../include/airtime.h"     // Airtime calculator + duty-cycle budget
+#include "../include/sample_ring.h" // Recent-sample rings for the sampler
+#include "../include/sensor_filter.h" // Oversample/median/EMA for analog inputs
+#include "../include/channel_plan.h"  // Uplink channels shared with gateway
+#include "../include/lru_set.h"       // Frames already relayed
+#include "../include/frame_auth.h"    // Frame MIC and replay counters
 
 /* ───── Pin map (Mega 2560) ───── */
 constexpr uint8_t PIN_DHT   = 7;       // DHT11 
@@ -39,26 +90,211 @@ constexpr uint8_t L_RST  = 9;          // LoRa RESET
 constexpr uint8_t L_DIO0 = 3;          // LoRa DIO0/IRQ
 
 /* ───── LoRa settings ───── */
-constexpr long     RF_FREQ   = 433E6;  //433 MHz
+constexpr uint8_t  CHANNELS  = 1;      // Channels the gateway listens on (one per radio), must match gateway
+constexpr bool     CHANNEL_HOPPING = true;  // false = fixed channel NODE_ID % CHANNELS
 constexpr uint8_t  SYNC_WORD = 0xA5;
 constexpr uint32_t SEND_INTERVAL = 10000;  // 10 seconds for TX
+constexpr uint8_t  NODE_ID   = 1;          // Unique per field node
+
+typedef airtime::Profile<7, 125000, 5> LinkProfile;  // SF7 / 125 kHz / 4:5 at boot, must match gateway
+constexpr uint16_t DUTY_PERMILLE = 90;           // 9 % long-run airtime
+constexpr uint32_t DUTY_BURST_US = 36000000UL;   // 36 s bucket => <= 10 % in any hour
+
+/* ───── Adaptive data rate ───── */
+constexpr uint8_t ADR_ACK_LIMIT = 16;  // Uplinks without a downlink before setting FLAG_ADR_REQ
+constexpr uint8_t ADR_ACK_DELAY = 8;   // Further unanswered uplinks before falling back
+
+/* ───── Report by exception ───── */
+constexpr bool     DELTA_UPLINKS      = true;      // false = full frame every SEND_INTERVAL
+constexpr uint32_t HEARTBEAT_INTERVAL = 120000;    // Full frame at least every 2 min so the gateway can resync
+constexpr frame::Deadband DEADBAND    = {5, 20, 5, 2};  // 0.5 °C, 2 %RH, 0.5 light, 2 % soil
+
+/* ───── Latency tracing ───── */
+constexpr bool TRACE_FRAMES = true;    // Append the 2 byte trace trailer to uplinks and ACKs
+
+/* ───── Scheduled listen (class-A style) ───── */
+constexpr bool     SCHEDULED_LISTEN = true;    // false = continuous RX (mains-powered node)
+constexpr uint32_t WAKE_INTERVAL    = 60000;   // Replaces SEND_INTERVAL: one sample/uplink cycle per wake
+constexpr uint32_t SAMPLE_PHASE_MS  = 2500;    // Awake with the radio asleep: two DHT reads, settled filters
+
+/* ───── Relay (mesh forwarding) ───── */
+constexpr bool     RELAY             = false;  // Forward other nodes' frames; needs continuous RX
+constexpr uint8_t  RELAY_TTL         = 3;      // Relays a frame may pass, this one included
+constexpr uint16_t RELAY_HOLD_MIN_MS = 40;     // Random hold before forwarding, so relays hearing
+constexpr uint16_t RELAY_HOLD_RAND_MS = 120;   //   the same frame do not all collide
+constexpr uint8_t  RELAY_RECENT      = 16;     // Frames remembered as already forwarded
+constexpr uint8_t  RELAY_DOWNSTREAM  = 8;      // Nodes whose downlinks we forward, learnt from their uplinks
+static_assert(!RELAY || !SCHEDULED_LISTEN, "A relay must listen continuously");
+static_assert(!RELAY || CHANNELS == 1, "A relay hears one channel only");
+static_assert(RELAY_TTL >= 1 && RELAY_TTL <= frame::RELAY_MAX_HOPS, "RELAY_TTL out of range");
+static_assert(RELAY_HOLD_MIN_MS + RELAY_HOLD_RAND_MS < frame::RELAY_HOLD_MAX_MS, "Relay hold beyond the gateway's allowance");
+
+/* ───── Frame authentication ───── */
+constexpr bool     AUTH_FRAMES  = true;        // Sign frames, accept only signed downlinks; must match gateway
+const uint8_t      NETWORK_KEY[auth::KEY_LEN] = {  // Must match gateway
+  0x3a, 0x91, 0x5e, 0xc4, 0x07, 0xd2, 0x6b, 0xf8, 0x21, 0x4c, 0xa7, 0x90, 0xe5, 0x1f, 0x68, 0xb3,
+};
+constexpr uint16_t AUTH_RESERVE = 256;         // Counters per block, one EEPROM write each
+constexpr bool     AUTH_BENCH   = false;       // Print the cost of signing an uplink at boot
+constexpr size_t   AUTH_LEN     = AUTH_FRAMES ? auth::TRAILER_LEN : 0;
+
+/* ───── Settings kept in EEPROM ───── */
+constexpr uint8_t  SETTINGS_MAGIC   = 0xA7;    // Change when Settings changes layout
+constexpr int      SETTINGS_ADDR    = 0;
+constexpr uint8_t  COUNTERS_MAGIC   = 0xC5;    // Frame counters, a record of their own
+constexpr int      COUNTERS_ADDR    = 32;
+constexpr uint32_t MIN_INTERVAL     = 1000;    // Shortest uplink interval accepted from EEPROM
 
 /* ───── Objects ───── */
 DHT   dht(PIN_DHT, DHT11);
 Servo valve;
 
+// Current link settings, moved by the gateway's ADR
+struct PendingAdr {
+  bool     active;
+  uint8_t  sf;
+  int8_t   txPower;
+  uint32_t bw;                      // 0 = unchanged
+  uint8_t  cr;                      // 0 = unchanged
+  uint32_t at;                      // nowMs() to switch
+};
+airtime::Link link    = LinkProfile::link();
+int8_t        txPower = frame::TX_POWER_MAX;
+uint8_t       rfChannel = 0;        // Channel tuned to, the last one sent on
+PendingAdr    adrPending = {false, 0, 0, 0, 0, 0};
+uint8_t       adrAckCnt  = 0;       // Uplinks since the last downlink for us
+
+// Settings pushed by the gateway, layout of the EEPROM record
+struct Settings {
+  uint8_t  magic;
+  uint16_t cfgVersion;
+  uint32_t uplinkMs;
+  uint32_t heartbeatMs;
+  uint8_t  sf;
+  uint8_t  bwCode;
+  uint8_t  cr;
+  int8_t   txPower;
+};
+uint32_t uplinkInterval    = SCHEDULED_LISTEN ? WAKE_INTERVAL : SEND_INTERVAL;
+uint32_t heartbeatInterval = HEARTBEAT_INTERVAL;
+uint16_t cfgVersion        = 0;     // Gateway's version of the settings above, 0 = built-in
+static_assert(SETTINGS_ADDR + sizeof(Settings) <= COUNTERS_ADDR, "Settings overlap the counters");
+
+// Frame counters, layout of their EEPROM record, both moved in
+// AUTH_RESERVE blocks ahead of use: uplinks resume at the reserved
+// bound, above any counter sent, and downlinks pass again only from the
+// floor, above any accepted, so no old command replays after a reset.
+struct Counters {
+  uint8_t  magic;
+  uint32_t upReserved;
+  uint32_t downFloor;
+};
+const auth::Cmac frameKey(NETWORK_KEY);  // Key schedule and subkeys, built once
+uint32_t upCounter   = 0;           // Next uplink counter
+uint32_t upReserved  = 0;           // Counters below this are reserved in EEPROM
+uint32_t downCounter = 0;           // Highest downlink counter accepted
+uint32_t downFloor   = 0;           // In EEPROM: after a reset only counters from here pass
+bool     downKnown   = false;       // downCounter valid (record or sync); else syncs only
+bool     syncDue     = AUTH_FRAMES; // Next uplink is a sync request
+
 /* ───── State tracking ───── */
-enum RadioState { RECEIVING, TRANSMITTING };
+enum RadioState { RECEIVING, TRANSMITTING, SLEEPING };
 RadioState radioState = RECEIVING;  //RX mode by default, only switch to TX when needed to send data
 
+uint32_t sleptMs    = 0;            // Time powered down, which millis() does not count
+uint32_t cycleStart = 0;            // nowMs() of the last wake
+uint32_t windowEnd  = 0;            // nowMs() when the RX window closes
+uint32_t nextSend   = 0;            // nowMs() of the next uplink check (continuous RX)
+
 String valveState = "CLOSE";
+uint16_t txSeq = 0;                 // Uplink sequence number, wraps at 65535
+
+frame::Uplink baseUp;               // Last full uplink sent; deltas extend it
+frame::Uplink reportedUp;           // Gateway's view after our last uplink
+bool     haveBase   = false;
+uint32_t lastFullAt = 0;            // nowMs() of the last full uplink
+
+/* ───── Radio events (written in DIO0 ISR) ───── */
+constexpr uint32_t TX_GUARD_MS = 500;  // Force RX this long after the expected TxDone
+
+volatile bool    rxReady = false;   // Downlink captured in rxBuf
+volatile bool    txDone  = false;   // Async TX finished
+volatile uint8_t rxLen   = 0;
+volatile int16_t rxRssi  = 0;
+uint8_t          rxBuf[32];         // Downlinks are a few bytes; larger frames are truncated
+
+uint32_t txStartedAt = 0;           // nowMs() when current TX began
+uint32_t txTimeout   = 0;           // Airtime of current TX + guard
+airtime::DutyCycle dutyCycle(DUTY_PERMILLE, DUTY_BURST_US);
+bool     ackPending  = false;       // ACK waiting for the radio to be free
+uint16_t ackSeq      = 0;
+uint32_t appliedAt   = 0;           // nowMs() the command behind ackSeq was first applied
+bool     appliedAny  = false;       // ackSeq holds a real command
+
+/* ───── Relay state ───── */
+LruSet<RELAY_RECENT> relayed;       // frameId of frames already forwarded
+uint8_t  relayBuf[frame::RELAY_OVERHEAD + frame::DELTA_MAX_LEN + frame::TRACE_LEN + AUTH_LEN];
+uint8_t  relayLen    = 0;           // Frame waiting in relayBuf, 0 = none
+uint16_t relayHold   = 0;           // Its hold before it reached us (earlier hops)
+uint32_t relayHeard  = 0;           // nowMs() we received it
+uint32_t relayAt     = 0;           // nowMs() to forward it
+uint8_t  downstream[RELAY_DOWNSTREAM];
+uint8_t  downstreamCount = 0;
+uint8_t  downstreamNext  = 0;       // Slot replaced next once the table is full
+
+/* ───── Sensor sampling ───── */
+constexpr uint32_t DHT_PERIOD    = 2000;            // DHT11 needs >= 1 s between reads
+constexpr uint32_t ANALOG_PERIOD = 4;               // One ADC read per channel every 4 ms
+constexpr uint32_t RAIN_PERIOD   = 500;
+constexpr uint32_t DHT_STALE     = 3 * DHT_PERIOD;  // Report invalid after this long without a good read
+
+SampleRing<float, 4>   tempSamples;   // Valid DHT reads only
+SampleRing<float, 4>   humSamples;
+// Analog filter chain: 16x oversample (64 ms per decimated value),
+// median of 5, EMA alpha 1/8 => ~0.5 s time constant
+constexpr uint8_t ADC_OVERSAMPLE = 16;
+constexpr uint8_t ADC_MEDIAN_K   = 5;
+constexpr uint8_t ADC_EMA_SHIFT  = 3;
+typedef AnalogFilter<ADC_OVERSAMPLE, ADC_MEDIAN_K, ADC_EMA_SHIFT> AdcFilter;
+
+AdcFilter lightFilter;
+AdcFilter moistFilter;
+SampleRing<uint8_t, 5> rainSamples;   // 1 = wet
+uint32_t lastGoodDht = 0;             // nowMs() of last valid DHT read
 
 /* ───── Helpers ───── */
-float readLight();    //light sensor
-int   readMoist();    //soil moisture
+float lightFromAdc(float adc);   //light sensor calibration
+int   moistFromAdc(float adc);   //soil moisture calibration
+float mapFloat(float x, float in_min, float in_max, float out_min, float out_max);
 bool  isRaining();    //rain sensor
+uint32_t nowMs();
 void  switchToReceive(); 
-void  switchToTransmit();
+void  tune(uint8_t ch);
+bool  startTransmit(const uint8_t* pkt, size_t len);
+bool  transmitOwn(uint8_t* pkt, size_t len, size_t cap);
+void  handleCommand(const uint8_t* rx, size_t n, int rssi);
+void  handleSync(const uint8_t* rx, size_t n);
+void  handleLinkAdr(const uint8_t* rx, size_t n);
+void  handleConfig(const uint8_t* rx, size_t n);
+void  applyLink(uint8_t sf, uint32_t bw, uint8_t cr, int8_t power);
+void  loadSettings();
+void  saveSettings();
+void  loadCounters();
+void  saveCounters();
+void  reserveUp(uint32_t next);
+void  acceptDown(uint32_t counter);
+void  sendAck(uint16_t seq);
+void  relayFrame(const uint8_t* rx, size_t n, const frame::Relay* via);
+void  sendRelay();
+bool  isDownstream(uint8_t id);
+bool  sendUplink();
+bool  sendSyncRequest();
+void  sampleSensors(uint32_t now);
+void  runSchedule();
+void  sleepUntilWake();
+void  powerDown(uint32_t ms);
+void  onRxDone(int size);
+void  onTxDone();
 
 /* ───── Setup ───── */
 void setup() {
@@ -74,13 +310,26 @@ void setup() {
   // Configure DIO0 pin as input with pullup
   pinMode(L_DIO0, INPUT_PULLUP);
 
+  loadSettings();   //link and cadence from before the reset, if any
+  loadCounters();
+
+  if (AUTH_BENCH) {
+    //on-target cost of one MIC over a full uplink with trace trailer
+    uint8_t pkt[frame::UPLINK_LEN + frame::TRACE_LEN + auth::TRAILER_LEN] = {frame::header(frame::TYPE_UPLINK), NODE_ID};
+    const uint32_t t0 = micros();
+    for (uint8_t i = 0; i < 100; ++i) {
+      auth::sign(frameKey, auth::DIR_UPLINK, i, pkt, frame::UPLINK_LEN + frame::TRACE_LEN, sizeof(pkt));
+    }
+    Serial.print(F("Auth: ")); Serial.print((micros() - t0) / 100); Serial.println(F(" us per signed uplink"));
+  }
+
   /* LoRa init */
   SPI.begin();
   LoRa.setPins(L_CS, L_RST, L_DIO0);
   LoRa.setSPIFrequency(4E6);  // Increased SPI speed -- 4MHz
   
   //verify LoRa communication
-  if (!LoRa.begin(RF_FREQ)) {
+  if (!LoRa.begin(channel::hz(rfChannel))) {
     Serial.println(F("LoRa init failed"));
     while (true) {
       digitalWrite(LED_BUILTIN, !digitalRead(LED_BUILTIN));
@@ -90,150 +339,766 @@ void setup() {
   
   LoRa.setSyncWord(SYNC_WORD);    //differentiate network from other nearby networks
   LoRa.enableCrc();               //verify data integrity
-  LoRa.setSpreadingFactor(7);    // control data rate & range -- slightly faster, shorter range, less power
-  LoRa.setSignalBandwidth(125E3); // Standard bandwidth
-  LoRa.setCodingRate4(5);        // Lower coding rate for speed
+  LoRa.setSpreadingFactor(link.sf);  // control data rate & range -- SF7: faster, shorter range, less power
+  LoRa.setSignalBandwidth(link.bw);  // Standard bandwidth
+  LoRa.setCodingRate4(link.cr);      // Lower coding rate for speed
+  LoRa.setPreambleLength(LinkProfile::PREAMBLE);
+  LoRa.setTxPower(txPower);
   
-  switchToReceive();
+  //DIO0 interrupt drives both directions: RxDone while listening,
+  //TxDone after an async endPacket(true)
+  LoRa.onReceive(onRxDone);
+  LoRa.onTxDone(onTxDone);
+  if (SCHEDULED_LISTEN) {
+    LoRa.sleep();   //radio wakes only to send, then listens in the RX window
+    radioState = SLEEPING;
+  } else {
+    switchToReceive();
+  }
   Serial.println(F("Valve node ready"));
 }
 
 /* ───── Main Loop ───── */
+/*
+ * Event-driven: nothing in here blocks. The DIO0 ISR flags RxDone/TxDone,
+ * and the loop only reacts to those flags and to nowMs() deadlines, so the
+ * node is deaf only for the real on-air time of its own frames. In
+ * scheduled-listen mode runSchedule() instead decides when to sleep.
+ */
 void loop() {
-    static uint32_t lastSend = 0;
-
-    /* ---------- Command Reception (RX Mode) ---------- 
-     * The node spends most of its time in RX mode listening for valve commands
-     * from the gateway. Commands are processed immediately upon receipt.
-     */
-    if (radioState == RECEIVING) {
-        int packetSize = LoRa.parsePacket();  
-    /*Check if packet has been received,
-    and if so extract the message/command*/
-    if (packetSize > 0) {
-      String cmd = "";
-      while (LoRa.available()) {
-        cmd += (char)LoRa.read();
-      }
-      cmd.trim();
-      cmd.toUpperCase();
-      
-      Serial.println("RX → " + cmd + " (RSSI: " + String(LoRa.packetRssi()) + ")"); //track the RX message recieved
-
-      if (cmd == "CMD:TRUE") {
-        valve.write(90);  //open the valve
-        valveState = "OPEN";
-        Serial.println("Valve OPEN");
-      } else if (cmd == "CMD:FALSE") {
-        valve.write(0);   //close the valve
-        valveState = "CLOSE";
-        Serial.println("Valve CLOSE");
-      }
+  /* ---------- TX completion ---------- */
+  if (radioState == TRANSMITTING) {
+    if (txDone) {
+      txDone = false;
+      switchToReceive();
+    } else if (nowMs() - txStartedAt >= txTimeout) {
+      Serial.println(F("TX timeout, back to RX"));
+      switchToReceive();
     }
   }
 
-  /* ---------- Sensor Data Transmission (TX Mode) ----------
-   * Every SEND_INTERVAL (10s), the node:
-   * 1. Switches to TX mode
-   * 2. Collects readings from all sensors
-   * 3. Formats and sends data packet
-   * 4. Returns to RX mode
-   * 
-   * The transmission time is minimized to avoid missing incoming commands
+  /* ---------- Command Reception ---------- 
+   * The node spends most of its time in RX mode listening for valve commands
+   * from the gateway. Commands are processed immediately upon receipt.
    */
-  if (millis() - lastSend >= SEND_INTERVAL) {
-    lastSend = millis();
-    
-    switchToTransmit(); //transmit sensor data every 10s to the esp32 over LoRa
-    
+  if (rxReady) {
+    uint8_t rx[sizeof(rxBuf)];
+    noInterrupts();
+    size_t n = rxLen;
+    memcpy(rx, rxBuf, n);
+    int rssi = rxRssi;
+    rxReady = false;
+    interrupts();
+    handleCommand(rx, n, rssi);
+  }
+
+  /* ---------- Background Sampling ----------
+   * Only while the radio is idle (listening, or asleep during the
+   * scheduled sample phase) and no downlink is waiting, so the DHT11's
+   * interrupts-off read never overlaps a TX or delays a command.
+   */
+  if (radioState == (SCHEDULED_LISTEN ? SLEEPING : RECEIVING) && !rxReady && !ackPending) {
+    sampleSensors(nowMs());
+  }
+
+  /* ---------- Link Adaptation ----------
+   * New settings apply only once the ACK confirming them is off the air
+   * and the gateway-chosen switch time has come.
+   */
+  if (adrPending.active && radioState != TRANSMITTING && !ackPending &&
+      (int32_t)(nowMs() - adrPending.at) >= 0) {
+    adrPending.active = false;
+    applyLink(adrPending.sf, adrPending.bw ? adrPending.bw : link.bw, adrPending.cr ? adrPending.cr : link.cr,
+              adrPending.txPower);
+  }
+
+  /* ---------- Transmissions (radio free only) ----------
+   * ACKs go first so the gateway stops retransmitting quickly; the sensor
+   * uplink is evaluated every uplinkInterval (10s) and only goes on air if
+   * something changed or a heartbeat is due. Both are gated by the
+   * duty-cycle budget; an uplink that does not fit is rescheduled for the
+   * moment enough airtime has accrued.
+   */
+  if (SCHEDULED_LISTEN) {
+    runSchedule();
+  } else if (radioState == RECEIVING) {
+    const uint32_t now = nowMs();
+    if (ackPending) {
+      sendAck(ackSeq);
+    } else if (relayLen > 0 && (int32_t)(now - relayAt) >= 0) {
+      sendRelay();
+    } else if ((int32_t)(now - nextSend) >= 0) {
+      const uint32_t wait = dutyCycle.waitMs(link.us(frame::UPLINK_LEN + AUTH_LEN), now);
+      if (wait > 0) {
+        nextSend = now + wait;
+        Serial.print(F("Duty cycle: uplink deferred ")); Serial.print(wait); Serial.println(F(" ms"));
+      } else {
+        sendUplink();
+        nextSend = now + uplinkInterval;
+      }
+    }
+  }
+}
+
+/* ───── Command Handling ───── */
+/**
+ * Apply a received downlink (binary or, without AUTH_FRAMES, legacy
+ * ASCII valve command)
+ * @param rx Frame bytes
+ * @param n Frame length
+ * @param rssi Packet RSSI for logging
+ */
+void handleCommand(const uint8_t* rx, size_t n, int rssi) {
+  //a relay copy: forward it further if we relay, act on it if it is for us
+  if (n > 0 && frame::isBinary(rx[0]) && frame::headerType(rx[0]) == frame::TYPE_RELAY) {
+    frame::Relay via;
+    if (!frame::decodeRelay(rx, n, via)) return;
+    if (RELAY) relayFrame(rx, n, &via);
+    rx += frame::RELAY_OVERHEAD;
+    n  -= frame::RELAY_OVERHEAD;
+    if (!frame::isDownlink(frame::headerType(rx[0]))) return;
+  } else if (RELAY && n >= frame::FRAME_MIN_LEN && frame::isBinary(rx[0])) {
+    relayFrame(rx, n, nullptr);
+  }
+
+  //only a signed downlink for us, newer than the last, gets parsed; the
+  //address comes first, so other nodes' traffic costs no AES at all.
+  //Counters are per node, so the gateway unicasts even its broadcasts
+  if (AUTH_FRAMES) {
+    if (n < frame::FRAME_MIN_LEN || !frame::isBinary(rx[0]) || !frame::isDownlink(frame::headerType(rx[0]))) return;
+    if (rx[1] != NODE_ID) return;
+    uint32_t counter;
+    if (frame::headerType(rx[0]) == frame::TYPE_SYNC) {
+      handleSync(rx, n);
+      return;
+    }
+    if (!downKnown) return;  //no record: a sync first
+    if (auth::verify(frameKey, auth::DIR_DOWNLINK, rx, n, downCounter, counter) != auth::AUTH_OK) return;
+    acceptDown(counter);
+    n -= auth::TRAILER_LEN;
+  }
+
+  if (n > 0 && frame::isBinary(rx[0]) && frame::headerType(rx[0]) == frame::TYPE_LINK_ADR) {
+    handleLinkAdr(rx, n);
+    return;
+  }
+  if (n > 0 && frame::isBinary(rx[0]) && frame::headerType(rx[0]) == frame::TYPE_CONFIG) {
+    handleConfig(rx, n);
+    return;
+  }
+
+  frame::ValveCmd vc = {0, 0, false};
+  bool haveCmd = false;
+  if (n > 0 && frame::isBinary(rx[0])) {
+    //binary command: act only if addressed to this node (or broadcast)
+    haveCmd = frame::decodeValveCmd(rx, n, vc) && vc.addressedTo(NODE_ID);
+    Serial.print(F("RX → binary cmd for node ")); Serial.print(vc.nodeId);
+  } else {
+    //legacy ASCII command from an older gateway
+    String cmd = "";
+    for (size_t i = 0; i < n; ++i) cmd += (char)rx[i];
+    cmd.trim();
+    cmd.toUpperCase();
+    vc.open = (cmd == "CMD:TRUE");
+    haveCmd = vc.open || cmd == "CMD:FALSE";
+    Serial.print("RX → " + cmd);
+  }
+  Serial.println(" (RSSI: " + String(rssi) + ")"); //track the RX message recieved
+
+  if (haveCmd && vc.open) {
+    valve.write(90);  //open the valve
+    valveState = "OPEN";
+    Serial.println("Valve OPEN");
+  } else if (haveCmd) {
+    valve.write(0);   //close the valve
+    valveState = "CLOSE";
+    Serial.println("Valve CLOSE");
+  }
+
+  //confirm unicast commands so the gateway stops retransmitting;
+  //retransmits of an already applied command are simply re-ACKed
+  if (haveCmd && frame::isBinary(rx[0]) && vc.nodeId == NODE_ID) {
+    if (!appliedAny || vc.seq != ackSeq) appliedAt = nowMs();  //retransmits keep the first time
+    appliedAny = true;
+    ackPending = true;
+    ackSeq = vc.seq;
+  }
+  if (haveCmd) adrAckCnt = 0;  //the gateway can reach us
+}
+
+/**
+ * Take the gateway's counters from a signed sync: its downlinks go on
+ * from the one naming them, ours from the floor it has for us. ACKed
+ * like a command; each retransmit is signed anew and taken again.
+ */
+void handleSync(const uint8_t* rx, size_t n) {
+  frame::Sync s;
+  uint32_t counter;
+  const auth::Verdict v = auth::verifySync(frameKey, auth::DIR_DOWNLINK, rx, n, downCounter, downKnown, counter);
+  if (v != auth::AUTH_OK || !frame::decodeSync(rx, n - auth::TRAILER_LEN, s)) return;
+  downKnown = true;
+  acceptDown(counter);
+  if (s.floor > upCounter) {
+    upCounter = s.floor;
+    reserveUp(upCounter);
+  }
+  syncDue    = false;
+  adrAckCnt  = 0;  //the gateway can reach us
+  if (!appliedAny || s.seq != ackSeq) appliedAt = nowMs();
+  appliedAny = true;
+  ackPending = true;
+  ackSeq     = s.seq;
+  Serial.print(F("SYNC: up ")); Serial.print(upCounter); Serial.print(F(", down ")); Serial.println(downCounter);
+}
+
+/* ───── Relay ───── */
+/**
+ * Queue a frame heard from another node or the gateway for forwarding,
+ * once per frame: uplinks and ACKs of any other node, downlinks only for
+ * nodes whose uplinks we forwarded. One frame waits at a time; a second
+ * arriving meanwhile is dropped.
+ * @param via Relay header when rx is already a relay copy, else nullptr
+ */
+void relayFrame(const uint8_t* rx, size_t n, const frame::Relay* via) {
+  const uint8_t* inner = via ? rx + frame::RELAY_OVERHEAD : rx;
+  const size_t   len   = via ? n - frame::RELAY_OVERHEAD : n;
+  const bool     down  = frame::isDownlink(frame::headerType(inner[0]));
+  if (down ? !isDownstream(inner[1]) : inner[1] == NODE_ID) return;
+  if (via && via->ttl == 0) return;
+  if (relayed.seen(frame::frameId(inner))) return;  //forwarded already
+
+  if (!down && !isDownstream(inner[1])) {
+    if (downstreamCount < RELAY_DOWNSTREAM) {
+      downstream[downstreamCount++] = inner[1];
+    } else {
+      downstream[downstreamNext] = inner[1];
+      downstreamNext = (downstreamNext + 1) % RELAY_DOWNSTREAM;
+    }
+  }
+  if (relayLen > 0) {
+    Serial.println(F("Relay busy, frame dropped"));
+    return;
+  }
+
+  const frame::Relay r = {NODE_ID, (uint8_t)(via ? via->hops + 1 : 1), (uint8_t)(via ? via->ttl - 1 : RELAY_TTL - 1),
+                          0};
+  relayLen   = (uint8_t)frame::encodeRelay(r, inner, len, relayBuf, sizeof(relayBuf));
+  relayHold  = via ? via->holdMs + link.ms(n) : 0;
+  relayHeard = nowMs();
+  relayAt    = relayHeard + RELAY_HOLD_MIN_MS + random(RELAY_HOLD_RAND_MS);
+}
+
+/**
+ * Forward the queued relay frame, stamped with its total hold; one the
+ * duty-cycle budget holds back past RELAY_HOLD_MAX_MS is dropped, since
+ * the gateway's retransmit timing no longer covers it
+ */
+void sendRelay() {
+  const uint32_t held = nowMs() - relayHeard;
+  if (held > frame::RELAY_HOLD_MAX_MS) {
+    relayLen = 0;
+    Serial.println(F("Relay frame expired"));
+    return;
+  }
+  frame::put16(relayBuf + 3, relayHold + held);
+  if (startTransmit(relayBuf, relayLen)) {
+    relayLen = 0;
+    Serial.print(F("Relay → #")); Serial.println(relayBuf[frame::RELAY_OVERHEAD + 1]);
+  }
+}
+
+// Node we forward for, or a broadcast while we forward for anyone
+bool isDownstream(uint8_t id) {
+  if (id == frame::NODE_BROADCAST) return downstreamCount > 0;
+  for (uint8_t i = 0; i < downstreamCount; ++i) {
+    if (downstream[i] == id) return true;
+  }
+  return false;
+}
+
+/**
+ * Schedule new link settings from the gateway's ADR. They are ACKed at the
+ * current settings and applied switchIn later, which the gateway recomputes
+ * on every retransmit so all nodes switch together with it.
+ */
+void handleLinkAdr(const uint8_t* rx, size_t n) {
+  frame::LinkAdr la;
+  if (!frame::decodeLinkAdr(rx, n, la) || la.nodeId != NODE_ID) return;
+
+  adrPending.active  = true;
+  adrPending.sf      = la.sf;
+  adrPending.txPower = la.txPower;
+  adrPending.bw      = la.bw;
+  adrPending.cr      = la.cr;
+  adrPending.at      = nowMs() + la.switchIn100ms * 100UL;
+  adrAckCnt  = 0;
+  if (!appliedAny || la.seq != ackSeq) appliedAt = nowMs();
+  appliedAny = true;
+  ackPending = true;
+  ackSeq     = la.seq;
+  Serial.print(F("RX → ADR SF")); Serial.print(la.sf);
+  if (la.bw) { Serial.print(F(" BW")); Serial.print(la.bw); Serial.print(F(" 4/")); Serial.print(la.cr); }
+  Serial.print(F(" ")); Serial.print(la.txPower); Serial.print(F(" dBm in "));
+  Serial.print(la.switchIn100ms * 100UL); Serial.println(F(" ms"));
+}
+
+/**
+ * Take new uplink / heartbeat intervals from the gateway. Unlike link
+ * settings they apply at once: only our own schedule depends on them.
+ */
+void handleConfig(const uint8_t* rx, size_t n) {
+  frame::Config c;
+  if (!frame::decodeConfig(rx, n, c) || c.nodeId != NODE_ID) return;
+
+  if (c.intervalS) uplinkInterval = c.intervalS * 1000UL;
+  if (c.heartbeatS) heartbeatInterval = (uint32_t)c.heartbeatS * 1000UL;
+  if (c.version != cfgVersion) {
+    cfgVersion = c.version;
+    saveSettings();
+  }
+  if ((int32_t)(nextSend - (nowMs() + uplinkInterval)) > 0) nextSend = nowMs() + uplinkInterval;  //a shorter interval applies from now
+  adrAckCnt  = 0;
+  if (!appliedAny || c.seq != ackSeq) appliedAt = nowMs();
+  appliedAny = true;
+  ackPending = true;
+  ackSeq     = c.seq;
+  Serial.print(F("RX → config v")); Serial.print(c.version);
+  Serial.print(F(": uplink ")); Serial.print(uplinkInterval);
+  Serial.print(F(" ms, heartbeat ")); Serial.print(heartbeatInterval); Serial.println(F(" ms"));
+}
+
+/**
+ * Reconfigure the radio for new link settings and resume listening
+ * Registers are writable in sleep mode, so this also works between wakes
+ */
+void applyLink(uint8_t sf, uint32_t bw, uint8_t cr, int8_t power) {
+  link.sf = sf;
+  link.bw = bw;
+  link.cr = cr;
+  txPower = power;
+  LoRa.setSpreadingFactor(sf);
+  LoRa.setSignalBandwidth(bw);
+  LoRa.setCodingRate4(cr);
+  LoRa.setTxPower(power);
+  if (radioState == RECEIVING) switchToReceive();  //an asleep radio stays asleep
+  saveSettings();
+  Serial.print(F("Link now SF")); Serial.print(sf);
+  Serial.print(F(" BW")); Serial.print(bw); Serial.print(F(" 4/")); Serial.print(cr);
+  Serial.print(F(" ")); Serial.print(power); Serial.println(F(" dBm"));
+}
+
+/* ───── Settings ───── */
+/**
+ * Restore link and cadence from EEPROM; an erased or foreign record
+ * (wrong magic, values out of range) leaves the built-in defaults
+ */
+void loadSettings() {
+  Settings st;
+  EEPROM.get(SETTINGS_ADDR, st);
+  const uint32_t bw = frame::bandwidthHz(st.bwCode);
+  if (st.magic != SETTINGS_MAGIC || st.sf < 7 || st.sf > 12 || bw == 0 || st.cr < 5 || st.cr > 8 ||
+      st.txPower < frame::TX_POWER_MIN || st.txPower > frame::TX_POWER_MAX || st.uplinkMs < MIN_INTERVAL ||
+      st.heartbeatMs == 0) {
+    return;
+  }
+  link.sf = st.sf;
+  link.bw = bw;
+  link.cr = st.cr;
+  txPower = st.txPower;
+  uplinkInterval    = st.uplinkMs;
+  heartbeatInterval = st.heartbeatMs;
+  cfgVersion        = st.cfgVersion;
+  Serial.print(F("Settings v")); Serial.print(cfgVersion);
+  Serial.print(F(" restored, SF")); Serial.println(link.sf);
+}
+
+// Only changed bytes are written, so unchanged settings cost no wear
+void saveSettings() {
+  const Settings st = {SETTINGS_MAGIC, cfgVersion, uplinkInterval, heartbeatInterval,
+                       link.sf, frame::bandwidthCode(link.bw), link.cr, txPower};
+  EEPROM.put(SETTINGS_ADDR, st);
+}
+
+// Resume the counters; without a record uplinks start from zero and
+// downlinks wait for a sync
+void loadCounters() {
+  Counters c;
+  EEPROM.get(COUNTERS_ADDR, c);
+  if (c.magic != COUNTERS_MAGIC) return;
+  upCounter   = c.upReserved;
+  upReserved  = c.upReserved;
+  downFloor   = c.downFloor;
+  downCounter = c.downFloor - 1;
+  downKnown   = c.downFloor > 0;
+}
+
+// Written once per AUTH_RESERVE counters either way
+void saveCounters() {
+  const Counters c = {COUNTERS_MAGIC, upReserved, downFloor};
+  EEPROM.put(COUNTERS_ADDR, c);
+}
+
+// Reserve uplink counters past next before it is sent
+void reserveUp(uint32_t next) {
+  if (next < upReserved) return;
+  upReserved = auth::blockAbove(next, AUTH_RESERVE);
+  saveCounters();
+}
+
+// Take an accepted downlink counter; past the floor the floor moves on
+void acceptDown(uint32_t counter) {
+  downCounter = counter;
+  if (counter < downFloor) return;
+  downFloor = auth::blockAbove(counter, AUTH_RESERVE);
+  saveCounters();
+}
+
+/* ───── Radio Control Functions ───── */
+/**
+ * RxDone callback, runs inside the DIO0 interrupt
+ * Copies the frame out of the radio FIFO before the next one overwrites it
+ */
+void onRxDone(int size) {
+  uint8_t n = 0;
+  while (n < size && n < sizeof(rxBuf) && LoRa.available()) rxBuf[n++] = (uint8_t)LoRa.read();
+  rxLen   = n;
+  rxRssi  = LoRa.packetRssi();
+  rxReady = true;
+}
+
+/**
+ * TxDone callback, runs inside the DIO0 interrupt
+ */
+void onTxDone() {
+  txDone = true;
+}
+
+/**
+ * Switch radio to receive mode (RX)
+ * This is the default state where the node listens for valve commands;
+ * in scheduled-listen mode it opens the RX window, long enough for the
+ * longest downlink started at its very end
+ */
+void switchToReceive() {
+  LoRa.receive();   //also remaps DIO0 to RxDone
+  radioState = RECEIVING;
+  windowEnd = nowMs() + frame::RX_WINDOW_MS + link.ms(frame::SYNC_LEN + AUTH_LEN);
+}
+
+/**
+ * Move the radio to channel ch for the next uplink; it keeps listening
+ * if it was, so downlinks are then heard there. Registers are writable
+ * in sleep mode, so an asleep radio stays asleep.
+ */
+void tune(uint8_t ch) {
+  if (ch == rfChannel) return;
+  rfChannel = ch;
+  if (radioState == RECEIVING) LoRa.idle();
+  LoRa.setFrequency(channel::hz(ch));
+  if (radioState == RECEIVING) switchToReceive();
+}
+
+/**
+ * Start an asynchronous transmission; TxDone arrives via DIO0
+ * @return bool False if the duty-cycle budget or the radio refused it
+ */
+bool startTransmit(const uint8_t* pkt, size_t len) {
+  const uint32_t airUs = link.us(len);
+  if (!dutyCycle.tryConsume(airUs, nowMs())) return false;
+  if (!LoRa.beginPacket()) return false;  //leaves RX (idle) for TX
+  LoRa.write(pkt, len);
+  txDone = false;
+  radioState = TRANSMITTING;
+  txStartedAt = nowMs();
+  txTimeout = airUs / 1000 + TX_GUARD_MS;
+  LoRa.endPacket(true);   //async: returns immediately
+  return true;
+}
+
+/**
+ * Sign one of our own frames and start it. A frame the duty-cycle budget
+ * would refuse is not signed, so retrying it spends no counter.
+ * @param cap Size of pkt, room for the auth trailer included
+ */
+bool transmitOwn(uint8_t* pkt, size_t len, size_t cap) {
+  if (AUTH_FRAMES) {
+    if (dutyCycle.waitMs(link.us(len + auth::TRAILER_LEN), nowMs()) > 0) return false;
+    reserveUp(upCounter);
+    len = auth::sign(frameKey, auth::DIR_UPLINK, upCounter++, pkt, len, cap);
+  }
+  return startTransmit(pkt, len);
+}
+
+/**
+ * Acknowledge a valve command with the node's post-actuation state
+ * @param seq Sequence number of the command being confirmed
+ */
+void sendAck(uint16_t seq) {
+  frame::Ack ack;
+  ack.nodeId = NODE_ID;
+  ack.seq    = seq;
+  ack.flags  = (valveState == "OPEN" ? frame::FLAG_VALVE_OPEN : 0) |
+               (SCHEDULED_LISTEN ? frame::FLAG_RX_WINDOW : 0);
+
+  uint8_t pkt[frame::ACK_LEN + frame::TRACE_LEN + AUTH_LEN];
+  size_t  pktLen = frame::encodeAck(ack, pkt, sizeof(pkt));
+  if (TRACE_FRAMES) pktLen = frame::appendTrace(pkt, pktLen, sizeof(pkt), nowMs() - appliedAt);
+
+  if (transmitOwn(pkt, pktLen, sizeof(pkt))) {
+    ackPending = false;
+    Serial.print(F("ACK → #")); Serial.println(seq);
+  }
+}
+
+/**
+ * Ask the gateway for a counter sync, in place of an uplink. The request
+ * names the counter it is signed with, so it passes however far that is
+ * from what the gateway has, and our downlink floor. Once we know the
+ * gateway's counters, one request is enough: a lost reply is only
+ * retried when downlinks stop again.
+ * @return bool False if nothing was sent
+ */
+bool sendSyncRequest() {
+  uint8_t pkt[frame::SYNC_LEN + AUTH_LEN];
+  const frame::Sync s = {NODE_ID, txSeq, upCounter, downKnown ? downCounter + 1 : 0};
+  const size_t pktLen = frame::encodeSync(s, frame::TYPE_SYNC_REQ, pkt, sizeof(pkt));
+  tune(channel::uplink(NODE_ID, txSeq, CHANNELS, CHANNEL_HOPPING));
+  if (!transmitOwn(pkt, pktLen, sizeof(pkt))) return false;
+  txSeq++;
+  syncDue = !downKnown;
+  Serial.print(F("TX → sync request #")); Serial.println(s.seq);
+  return true;
+}
+
+/**
+ * Serialize the latest filtered readings and start the binary uplink
+ * Never touches a sensor; a DHT outage is reported as invalid fields
+ * instead of costing the whole slot. Between heartbeats nothing is sent
+ * unless a field crossed its deadband since the last report, and then
+ * only a delta against the last full frame.
+ * @return bool False if nothing was sent
+ */
+bool sendUplink() {
+  const uint32_t now = nowMs();
+  const bool adrFallback = link.sf == frame::SF_FALLBACK && txPower == frame::TX_POWER_MAX;
+
+  //ADR backoff: settings the gateway may no longer hear us on are dropped
+  //for the most robust ones, which it falls back to as well
+  if (!adrFallback && adrAckCnt >= ADR_ACK_LIMIT + ADR_ACK_DELAY) {
+    Serial.println(F("ADR: no downlink, falling back"));
+    adrAckCnt = 0;
+    adrPending.active = false;
+    applyLink(frame::SF_FALLBACK, link.bw, link.cr, frame::TX_POWER_MAX);
+    return false;
+  }
+  if (AUTH_FRAMES && syncDue) return sendSyncRequest();
+  const bool dhtFresh = !tempSamples.empty() && now - lastGoodDht < DHT_STALE;
+
+  //filtered values: mean of recent DHT reads, filter chain output for
+  //analog inputs, majority vote for rain
+  float t     = dhtFresh ? tempSamples.sum<float>() / tempSamples.count() : NAN;
+  float h     = dhtFresh ? humSamples.sum<float>() / humSamples.count() : NAN;
+  float light = lightFilter.ready() ? lightFromAdc(lightFilter.counts()) : 0;
+  int   moist = moistFilter.ready() ? moistFromAdc(moistFilter.counts()) : 0;
+  bool  rain  = rainSamples.sum<uint8_t>() * 2 > rainSamples.count();
+
+  if (!dhtFresh) Serial.println(F("DHT stale, sending without temp/hum"));
+
+  //binary uplink sent to the esp32 detailing the data received from all sensors including the current state of the valve
+  frame::Uplink up;
+  up.nodeId  = NODE_ID;
+  up.seq     = txSeq;
+  up.flags   = (rain ? frame::FLAG_RAINING : 0) |
+               (valveState == "OPEN" ? frame::FLAG_VALVE_OPEN : 0) |
+               (!adrFallback && adrAckCnt >= ADR_ACK_LIMIT ? frame::FLAG_ADR_REQ : 0) |
+               (SCHEDULED_LISTEN ? frame::FLAG_RX_WINDOW : 0);
+  up.temp10  = frame::toTemp10(t);
+  up.hum10   = frame::toHum10(h);
+  up.light10 = frame::toLight10(light);
+  up.moist   = (uint8_t)moist;
+
+  //when only checked once per wake, a heartbeat due before the next wake goes now
+  const uint32_t beat = SCHEDULED_LISTEN && heartbeatInterval > uplinkInterval / 2
+                            ? heartbeatInterval - uplinkInterval / 2 : heartbeatInterval;
+  const bool heartbeat = !DELTA_UPLINKS || !haveBase || now - lastFullAt >= beat ||
+                         (uint16_t)(up.seq - baseUp.seq) > frame::DELTA_MAX_AGE;
+  frame::Delta delta = {baseUp.seq, 0, up};
+  if (!heartbeat) {
+    //nothing new since the last report: stay off the air
+    if (frame::deltaMask(reportedUp, up, DEADBAND) == 0 && reportedUp.flags == up.flags) return false;
+    delta.mask = frame::deltaMask(baseUp, up, DEADBAND);
+  }
+  const bool full = heartbeat || delta.mask == frame::DELTA_ALL;  //a full frame is shorter then
+
+  uint8_t pkt[frame::DELTA_MAX_LEN + frame::TRACE_LEN + AUTH_LEN];  //fits either frame
+  size_t  pktLen = full ? frame::encodeUplink(up, pkt, sizeof(pkt))
+                        : frame::encodeDelta(delta, pkt, sizeof(pkt));
+  //sample age at TX start: the DHT read is the oldest input in the frame
+  if (TRACE_FRAMES) pktLen = frame::appendTrace(pkt, pktLen, sizeof(pkt), dhtFresh ? now - lastGoodDht : frame::TRACE_NONE);
+  tune(channel::uplink(NODE_ID, txSeq, CHANNELS, CHANNEL_HOPPING));
+  if (!transmitOwn(pkt, pktLen, sizeof(pkt))) return false;
+  txSeq++;
+  if (adrAckCnt < 0xFF) adrAckCnt++;
+  if (adrAckCnt == ADR_ACK_LIMIT) syncDue = AUTH_FRAMES;  //the gateway may have lost our counters
+
+  if (full) {
+    baseUp     = up;
+    reportedUp = up;
+    haveBase   = true;
+    lastFullAt = now;
+  } else {
+    reportedUp = baseUp;
+    frame::applyDelta(delta, reportedUp);
+  }
+  
+  Serial.print(F("TX → #")); Serial.print(up.seq);    //track the TX msg
+  if (!full) { Serial.print(F(" delta 0x")); Serial.print(delta.mask, HEX); }
+  Serial.print(F(" W:")); Serial.print(up.raining() ? F("Raining") : F("Clear"));
+  Serial.print(F(" T:")); Serial.print(t, 1);
+  Serial.print(F(" H:")); Serial.print(h, 1);
+  Serial.print(F(" L:")); Serial.print(light, 1);
+  Serial.print(F(" M:")); Serial.print(moist);
+  Serial.print(F(" V:")); Serial.println(valveState);
+  return true;
+}
+
+/**
+ * Background sampler: reads at most one sensor per call, each on its
+ * own cadence, into the sample rings / filter chains. Analog channels
+ * alternate, so each idle pass costs a single ~110 us analogRead.
+ * @param now Current nowMs()
+ */
+void sampleSensors(uint32_t now) {
+  static uint32_t nextDht = 0, nextAnalog = 0, nextRain = 0;
+  static bool     lightTurn = true;
+
+  if ((int32_t)(now - nextDht) >= 0) {
+    nextDht = now + DHT_PERIOD;
     float h = dht.readHumidity();     //read humidity data
     float t = dht.readTemperature();  //read temperature data
     
-    //validate the dht11 data received
+    //validate the dht11 data received; a glitch just skips this sample
     if (isnan(h) || isnan(t)) {
       Serial.println(F("DHT error"));
-      switchToReceive();
       return;
     }
-
-    //capture the data received from the other sensors
-    float light = readLight();
-    int   moist = readMoist();
-    String weather = isRaining() ? "Raining" : "Clear"; //display "Clear" for periods of no rain
-
-    //message sent to the esp32 detailing the data received from all sensors including the current state of the valve
-    String pkt = "Weather:" + weather +
-                 "|Temp:" + String(t, 1) +
-                 "|Hum:" + String(h, 1) +
-                 "|Light level:" + String(light, 1) +
-                 "|Moisture:" + String(moist) +
-                 "|Valve:" + valveState;
-
-    LoRa.beginPacket(); //switch to TX mode
-    LoRa.print(pkt);    //send LoRa msg
-    LoRa.endPacket();   
-    
-    Serial.println("TX → " + pkt);  //track the TX msg
-    
-    /*Purpose: We want to spend minimum time for TX while ensuring high reliability so
-    we can receive data during the remaining 99.9% of the time to avoid missing packets*/
-    // Wait for transmission to complete (estimate based on packet size)
-    int txTime = pkt.length() + 50;  // roughly 1ms per byte +50ms buffer, ex: 75ms for 25 byte msg pkt
-    delay(txTime);
-    
-    // Small delay before switching back to RX
-    delay(100);
-    switchToReceive();
+    humSamples.push(h);
+    tempSamples.push(t);
+    lastGoodDht = now;
+  } else if ((int32_t)(now - nextAnalog) >= 0) {
+    if (lightTurn) {
+      lightFilter.add(analogRead(PIN_LDR));
+    } else {
+      moistFilter.add(analogRead(PIN_SOIL));
+      nextAnalog = now + ANALOG_PERIOD;   //both channels read, wait for next round
+    }
+    lightTurn = !lightTurn;
+  } else if ((int32_t)(now - nextRain) >= 0) {
+    nextRain = now + RAIN_PERIOD;
+    rainSamples.push(isRaining() ? 1 : 0);
   }
-  
-  delay(10);  // Prevent excessive CPU usage while maintaining responsiveness
 }
 
-/* ───── Radio Control Functions ───── */
+/* ───── Scheduled Listen ───── */
 /**
- * Switch radio to receive mode (RX)
- * This is the default state where the node listens for valve commands
+ * One scheduled-listen cycle: after SAMPLE_PHASE_MS of sampling with the
+ * radio asleep the uplink goes out if it has something to report, its
+ * TxDone opens the RX window and every ACK we send reopens it. Once the
+ * window closes the node powers down until the next wake. No uplink
+ * means no window, so command latency is bounded by the heartbeat.
  */
-void switchToReceive() {
-  if (radioState != RECEIVING) {
-    LoRa.receive();
-    radioState = RECEIVING;
-    delay(10);  // Allow mode switch to settle
+void runSchedule() {
+  const uint32_t now = nowMs();
+  if (radioState == SLEEPING) {
+    if (now - cycleStart < SAMPLE_PHASE_MS) return;
+    const uint32_t wait = dutyCycle.waitMs(link.us(frame::UPLINK_LEN + AUTH_LEN), now);
+    if (wait > 0) {
+      Serial.print(F("Duty cycle: uplink skipped, ")); Serial.print(wait); Serial.println(F(" ms short"));
+    } else if (sendUplink()) {
+      return;   //window opens at TxDone
+    }
+    sleepUntilWake();
+  } else if (radioState == RECEIVING && !rxReady) {
+    if (ackPending) sendAck(ackSeq);
+    if (radioState == RECEIVING && (int32_t)(now - windowEnd) >= 0) sleepUntilWake();
   }
 }
 
 /**
- * Switch radio to transmit mode (TX)
- * Used briefly every SEND_INTERVAL to send sensor data
+ * Put radio and MCU to sleep for the rest of uplinkInterval
+ * An ACK that did not fit the duty-cycle budget is dropped; the gateway
+ * repeats the command in our next window.
  */
-void switchToTransmit() {
-  if (radioState != TRANSMITTING) {
-    LoRa.idle();  // Stop receiving first
-    radioState = TRANSMITTING;
-    delay(10);    // Allow mode switch to settle
+void sleepUntilWake() {
+  const uint32_t awake = nowMs() - cycleStart;
+  LoRa.sleep();
+  radioState = SLEEPING;
+  ackPending = false;
+  valve.detach();     //no half pulses when the timers stop
+  Serial.flush();
+  powerDown(awake < uplinkInterval ? uplinkInterval - awake : 0);
+
+  valve.attach(PIN_SERVO);
+  valve.write(valveState == "OPEN" ? 90 : 0);
+  tempSamples.clear();  //a wake old; the analog filters just keep smoothing
+  humSamples.clear();
+  cycleStart = nowMs();
+}
+
+/**
+ * Power the MCU down for about ms, woken by the watchdog in chunks of up
+ * to 8 s. Timer0 stops as well, so each chunk's nominal length is added
+ * to sleptMs (the WDT oscillator is only good to ~10 %, plenty for a
+ * sampling cadence).
+ */
+void powerDown(uint32_t ms) {
+  const uint8_t adcsra = ADCSRA;
+  ADCSRA = 0;   //ADC off while asleep
+  while (ms >= 16) {
+    uint8_t k = 9;                      //WDT period is 16 ms << k
+    while ((16UL << k) > ms) --k;
+    cli();
+    MCUSR &= ~(1 << WDRF);
+    WDTCSR = (1 << WDCE) | (1 << WDE);  //timed sequence to change the prescaler
+    WDTCSR = (1 << WDIE) | ((k & 8) ? (1 << WDP3) : 0) | (k & 7);
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+    wdt_disable();
+    sleptMs += 16UL << k;
+    ms -= 16UL << k;
   }
+  ADCSRA = adcsra;
+  delay(ms);    //remainder below the shortest WDT period
 }
 
+/**
+ * Watchdog interrupt, only there to end the power-down
+ */
+ISR(WDT_vect) {}
+
 /* ───── Sensor Functions ───── */
 /**
- * Read light level from LDR sensor
+ * Convert filtered LDR counts to a light level
+ * @param adc Filtered ADC counts (0-1023, fractional)
  * @return float Light level on a 0-10 scale (0=dark, 10=bright)
  * Values are calibrated for typical ambient light conditions
  */
-float readLight() {
-  int adc = analogRead(PIN_LDR);
-  float level = mapFloat(ADC, 1200.0, -100.0, 0.0, 10.0); //calibrated the light sensor to show realistic values for ambient lighting
+float lightFromAdc(float adc) {
+  float level = mapFloat(adc, 1200.0, -100.0, 0.0, 10.0); //calibrated the light sensor to show realistic values for ambient lighting
   return constrain(level, 0.0, 10.0); //ensure the light level is shown from 0 - 10 scale
 }
 
 /**
- * Read soil moisture percentage
+ * Convert filtered soil probe counts to moisture percentage
+ * @param adc Filtered ADC counts (0-1023, fractional)
  * @return int Moisture level 0-100% (0=dry, 100=saturated)
  * ADC values calibrated for typical soil conditions
  */
-int readMoist() {
-  int adc = analogRead(PIN_SOIL);
-  int moist = map(adc, 1023, 300, 0, 100);
+int moistFromAdc(float adc) {
+  int moist = (int)(mapFloat(adc, 1023.0, 300.0, 0.0, 100.0) + 0.5f);
   return constrain(moist, 0, 100);
 }
 
@@ -260,3 +1125,11 @@ bool isRaining() {
 float mapFloat(float x, float in_min, float in_max, float out_min, float out_max) {
     return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
 }
+
+/**
+ * Milliseconds since boot including time spent powered down
+ * millis() stops in power-down, so all node timing goes through this
+ */
+uint32_t nowMs() {
+  return millis() + sleptMs;
+}
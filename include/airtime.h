@@ -0,0 +1,161 @@
+/*****************************************************************
+ * AGROSENSE - LoRa Airtime and Duty-Cycle Budget
+ *
+ * Shared by the ESP32 gateway and the Arduino field node. Header-only,
+ * C++11 constexpr (AVR toolchain), integer math only.
+ *
+ * Airtime follows the Semtech SX127x formula (AN1200.13):
+ *   Tsym      = 2^SF / BW
+ *   Tpreamble = (Npreamble + 4.25) * Tsym
+ *   Npayload  = 8 + max(ceil((8PL - 4SF + 28 + 16CRC - 20IH)
+ *                            / (4(SF - 2DE))) * (CR + 4), 0)
+ * with low data rate optimisation (DE) on when Tsym > 16 ms, which is
+ * what the LoRa library enables automatically.
+ *
+ * DutyCycle is a token bucket of airtime microseconds. Over any window
+ * of T ms it allows at most burst + permille * T us on air. With a
+ * 9 % rate and a 36 s bucket, the worst hour is 36 + 324 = 360 s,
+ * exactly the 10 % limit for the 433 MHz SRD band (DUTY_* constants
+ * in each firmware).
+ *****************************************************************/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace airtime {
+
+/* -------------------- Formula -------------------- */
+// Symbol duration in microseconds
+constexpr uint32_t symbolUs(uint8_t sf, uint32_t bw) {
+  return (uint32_t)(((1UL << sf) * 1000000UL) / bw);
+}
+
+// Low data rate optimisation, as the LoRa library sets it
+constexpr bool lowDataRate(uint8_t sf, uint32_t bw) {
+  return symbolUs(sf, bw) > 16000;
+}
+
+constexpr int32_t ceilDiv(int32_t a, int32_t b) {
+  return a <= 0 ? 0 : (a + b - 1) / b;
+}
+
+// Payload symbols including the 8 fixed header symbols
+constexpr uint32_t payloadSymbols(uint8_t sf, uint32_t bw, uint8_t cr,
+                                  bool crc, bool implicitHeader, uint8_t len) {
+  return 8 + (uint32_t)ceilDiv(8 * (int32_t)len - 4 * sf + 28 + (crc ? 16 : 0) - (implicitHeader ? 20 : 0),
+                               4 * (sf - (lowDataRate(sf, bw) ? 2 : 0))) * cr;
+}
+
+/**
+ * Time on air of one frame
+ * @param sf Spreading factor 6-12
+ * @param bw Bandwidth in Hz
+ * @param cr Coding rate denominator 5-8 (4/5 .. 4/8)
+ * @param preamble Programmed preamble length in symbols
+ * @param len Payload bytes
+ * @return uint32_t Microseconds on air
+ */
+constexpr uint32_t frameUs(uint8_t sf, uint32_t bw, uint8_t cr, uint16_t preamble,
+                           bool crc, bool implicitHeader, uint8_t len) {
+  // Preamble + 4.25 symbols, kept in quarter symbols to stay integral
+  return ((4UL * preamble + 17) + 4UL * payloadSymbols(sf, bw, cr, crc, implicitHeader, len))
+         * symbolUs(sf, bw) / 4;
+}
+
+// SX127x demodulator SNR floor: -7.5 dB at SF7, 2.5 dB lower per SF step
+constexpr float demodFloorDb(uint8_t sf) { return -5.0f - 2.5f * (sf - 6); }
+
+/* -------------------- Runtime Link Settings -------------------- */
+/**
+ * The same settings as a value, for links whose spreading factor
+ * changes at run time (adaptive data rate)
+ */
+struct Link {
+  uint8_t  sf;
+  uint32_t bw;
+  uint8_t  cr;
+  uint16_t preamble;
+  bool     crc;
+  bool     implicitHeader;
+
+  uint32_t us(uint8_t len) const { return frameUs(sf, bw, cr, preamble, crc, implicitHeader, len); }
+  uint32_t ms(uint8_t len) const { return (us(len) + 999) / 1000; }
+};
+
+/* -------------------- Compile-time Profile -------------------- */
+/**
+ * Radio settings fixed at compile time; both firmwares configure the
+ * SX127x from the same constants they compute airtime with
+ */
+template <uint8_t SF_, uint32_t BW_, uint8_t CR_, uint16_t PREAMBLE_ = 8,
+          bool CRC_ = true, bool IMPLICIT_ = false>
+struct Profile {
+  static_assert(SF_ >= 6 && SF_ <= 12, "spreading factor out of range");
+  static_assert(CR_ >= 5 && CR_ <= 8, "coding rate denominator must be 5-8");
+
+  static constexpr uint8_t  SF       = SF_;
+  static constexpr uint32_t BW       = BW_;
+  static constexpr uint8_t  CR       = CR_;
+  static constexpr uint16_t PREAMBLE = PREAMBLE_;
+  static constexpr bool     CRC      = CRC_;
+  static constexpr bool     IMPLICIT = IMPLICIT_;
+
+  static constexpr uint32_t us(uint8_t len) {
+    return frameUs(SF_, BW_, CR_, PREAMBLE_, CRC_, IMPLICIT_, len);
+  }
+  static constexpr uint32_t ms(uint8_t len) { return (us(len) + 999) / 1000; }
+
+  // Starting point for a runtime Link
+  static constexpr Link link() { return Link{SF_, BW_, CR_, PREAMBLE_, CRC_, IMPLICIT_}; }
+};
+
+/* -------------------- Duty-Cycle Token Bucket -------------------- */
+class DutyCycle {
+ public:
+  /**
+   * @param permille Long-run share of time on air (100 = 10 %)
+   * @param burstUs Bucket depth in airtime microseconds; starts full
+   */
+  DutyCycle(uint16_t permille, uint32_t burstUs)
+      : permille_(permille), burstUs_(burstUs), tokensUs_(burstUs), lastMs_(0) {}
+
+  /**
+   * Spend airtime if the budget allows it
+   * @return bool False if the frame must wait (see waitMs)
+   */
+  bool tryConsume(uint32_t airUs, uint32_t nowMs) {
+    refill(nowMs);
+    if (tokensUs_ < airUs) return false;
+    tokensUs_ -= airUs;
+    return true;
+  }
+
+  // Milliseconds until airUs of budget will be available
+  uint32_t waitMs(uint32_t airUs, uint32_t nowMs) {
+    refill(nowMs);
+    if (tokensUs_ >= airUs) return 0;
+    if (permille_ == 0) return 0xFFFFFFFFUL;
+    return (airUs - tokensUs_ + permille_ - 1) / permille_;  // 1 ms refills permille us
+  }
+
+  uint32_t availableUs(uint32_t nowMs) { refill(nowMs); return tokensUs_; }
+
+ private:
+  void refill(uint32_t nowMs) {
+    const uint32_t elapsed = nowMs - lastMs_;
+    lastMs_ = nowMs;
+    if (permille_ == 0) return;
+    // Each elapsed ms earns `permille` us; compare first so it cannot overflow
+    const uint32_t room = burstUs_ - tokensUs_;
+    if (elapsed > room / permille_) tokensUs_ = burstUs_;
+    else tokensUs_ += elapsed * permille_;
+  }
+
+  uint16_t permille_;
+  uint32_t burstUs_;
+  uint32_t tokensUs_;
+  uint32_t lastMs_;
+};
+
+}  // namespace airtime
@@ -0,0 +1,54 @@
+/*****************************************************************
+ * AGROSENSE - Jittered Exponential Backoff
+ *
+ * Retry scheduler for reconnect attempts. The ceiling doubles from
+ * BASE_MS after every failure up to MAX_MS, and each delay is drawn
+ * uniformly from [ceiling/2, ceiling) ("equal jitter") so a gateway
+ * fleet does not hammer the broker in lockstep after an outage.
+ *
+ * Header-only, no heap; the caller supplies the random word and the
+ * millisecond clock, so the same code runs on any target.
+ *****************************************************************/
+#pragma once
+
+#include <stdint.h>
+
+template <uint32_t BASE_MS, uint32_t MAX_MS>
+class Backoff {
+  static_assert(BASE_MS >= 2 && BASE_MS <= MAX_MS, "backoff bounds out of order");
+  static_assert(MAX_MS <= 0x7FFFFFFFUL, "backoff ceiling must fit millis() wrap math");
+
+ public:
+  // True once the current delay has elapsed (always true after reset())
+  bool due(uint32_t now) const { return (int32_t)(now - next_) >= 0; }
+
+  /**
+   * Record a failed attempt and schedule the next one
+   * @param now    Current millis()
+   * @param random Any uniformly distributed 32-bit value
+   * @return uint32_t Delay until the next attempt in ms
+   */
+  uint32_t fail(uint32_t now, uint32_t random) {
+    const uint32_t half = ceiling_ / 2;
+    const uint32_t wait = half + random % (ceiling_ - half);
+    next_ = now + wait;
+    ceiling_ = ceiling_ > MAX_MS / 2 ? MAX_MS : ceiling_ * 2;
+    ++failures_;
+    return wait;
+  }
+
+  // Success: next failure starts again from BASE_MS, retry allowed now
+  void reset(uint32_t now) {
+    ceiling_ = BASE_MS;
+    failures_ = 0;
+    next_ = now;
+  }
+
+  uint32_t waitFrom(uint32_t now) const { return due(now) ? 0 : next_ - now; }
+  uint16_t failures() const { return failures_; }
+
+ private:
+  uint32_t ceiling_ = BASE_MS;
+  uint32_t next_ = 0;
+  uint16_t failures_ = 0;
+};
@@ -0,0 +1,45 @@
+/*****************************************************************
+ * AGROSENSE - LoRa Channel Plan
+ *
+ * Shared by the ESP32 gateway and the Arduino field node. Header-only,
+ * C++11 constexpr (AVR toolchain).
+ *
+ * Uplink channels are 400 kHz apart from 433.0 MHz, so any bandwidth up
+ * to 250 kHz keeps them apart; channel 0 is the original single
+ * channel. The gateway listens on the first n channels at once, one per
+ * radio, and every node must be built for the same n. Each uplink goes
+ * out on one of them:
+ *   - static:  channel nodeId % n, so nodes split evenly by ID
+ *   - hopping: a hash of node ID and uplink sequence, so every node
+ *     spreads its frames over all n channels and a noisy channel costs
+ *     each node a share of its frames instead of some nodes all of them
+ * Either way the node then listens where it last transmitted (its ACKs
+ * go there too), and the gateway answers on the channel it last heard
+ * the node on. Nodes that cannot hop (legacy ASCII) stay on channel 0.
+ *****************************************************************/
+#pragma once
+
+#include <stdint.h>
+
+namespace channel {
+
+constexpr uint8_t  MAX_CHANNELS = 4;          // 433.0 - 434.2 MHz
+constexpr uint32_t BASE_HZ      = 433000000UL;
+constexpr uint32_t SPACING_HZ   = 400000UL;
+
+// Centre frequency of channel ch
+constexpr uint32_t hz(uint8_t ch) { return BASE_HZ + (uint32_t)ch * SPACING_HZ; }
+
+/**
+ * Channel a node sends uplink seq on
+ * @param n Channels the gateway listens on (1 = everything on channel 0)
+ */
+inline uint8_t uplink(uint8_t nodeId, uint16_t seq, uint8_t n, bool hopping) {
+  if (n <= 1) return 0;
+  if (!hopping) return nodeId % n;
+  // Knuth multiplicative hash: consecutive sequences land far apart
+  const uint32_t h = (((uint32_t)nodeId << 16) | seq) * 2654435761UL;
+  return (uint8_t)((h >> 24) % n);
+}
+
+}  // namespace channel
@@ -0,0 +1,209 @@
+/*****************************************************************
+ * AGROSENSE - Append-only Flash Record Queue
+ *
+ * Bounded FIFO of fixed-size records on an Arduino fs::FS (LittleFS
+ * on the gateway). Records are appended to numbered segment files of
+ * SEG_RECORDS each; a segment is never rewritten, only deleted once
+ * fully consumed. When SEG_MAX segments are in use the oldest one is
+ * dropped, so the queue keeps the newest data and a bounded footprint.
+ *
+ * Data is never updated in place: new records land in newly allocated
+ * blocks and LittleFS spreads the erases over the whole partition.
+ * The only rewritten file is the small read cursor, saved once per
+ * consume() rather than per record.
+ *
+ * A record torn by power loss is discarded on begin(); appending then
+ * continues in a fresh segment so record alignment is never lost.
+ *****************************************************************/
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <FS.h>
+
+template <size_t RECORD_LEN, uint16_t SEG_RECORDS, uint16_t SEG_MAX>
+class FlashQueue {
+  static_assert(RECORD_LEN > 0 && SEG_RECORDS > 0 && SEG_MAX >= 2, "queue geometry out of range");
+
+ public:
+  static constexpr uint32_t CAPACITY = (uint32_t)SEG_RECORDS * SEG_MAX;
+
+  /**
+   * Mount the queue directory, recovering segments and the read cursor
+   * @return bool False if the directory cannot be created
+   */
+  bool begin(fs::FS& fs, const char* dir) {
+    fs_ = &fs;
+    strncpy(dir_, dir, sizeof(dir_) - 1);
+    if (!fs.exists(dir_) && !fs.mkdir(dir_)) return false;
+
+    // Find the oldest and newest segment numbers
+    bool any = false;
+    File root = fs.open(dir_);
+    for (File f = root.openNextFile(); f; f = root.openNextFile()) {
+      const char* name = strrchr(f.name(), '/');
+      name = name ? name + 1 : f.name();
+      char* end;
+      const uint32_t n = strtoul(name, &end, 16);
+      if (end == name || *end != '\0') continue;  // Not a segment
+      if (!any || n < first_) first_ = n;
+      if (!any || n > last_) last_ = n;
+      any = true;
+    }
+    root.close();
+    char path[24];
+    cursorPath(path);
+    if (!any) {
+      fs.remove(path);  // Nothing left to point into
+      return true;
+    }
+
+    count_ = 0;
+    for (uint32_t n = first_; n <= last_; ++n) count_ += fill(n);
+    headFill_ = fill(last_);
+
+    segPath(last_, path);
+    File head = fs.open(path, "r");
+    const bool torn = head && head.size() % RECORD_LEN != 0;
+    head.close();
+    if (torn) startSegment();  // Keep appends aligned
+
+    // Resume the cursor if it still points into the oldest segment
+    uint8_t cur[6];
+    cursorPath(path);
+    File c = fs.open(path, "r");
+    if (c && c.read(cur, sizeof(cur)) == sizeof(cur)) {
+      const uint32_t seg = cur[0] | (uint32_t)cur[1] << 8 | (uint32_t)cur[2] << 16 | (uint32_t)cur[3] << 24;
+      const uint16_t idx = (uint16_t)(cur[4] | cur[5] << 8);
+      if (seg == first_ && idx <= fill(first_)) {
+        cursor_ = idx;
+        count_ -= idx;
+      }
+    }
+    c.close();
+    trim();
+    return true;
+  }
+
+  /**
+   * Append one record, dropping the oldest segment if the queue is full
+   * @return bool False if the flash write failed
+   */
+  bool append(const uint8_t* rec) {
+    if (headFill_ == SEG_RECORDS) startSegment();
+    if (last_ - first_ + 1 > SEG_MAX) dropOldest();
+
+    char path[24];
+    segPath(last_, path);
+    File f = fs_->open(path, "a");
+    if (!f) return false;
+    const bool ok = f.write(rec, RECORD_LEN) == RECORD_LEN;
+    f.close();
+    if (!ok) return false;
+    ++headFill_;
+    ++count_;
+    return true;
+  }
+
+  /**
+   * Copy up to max of the oldest records into out without removing them
+   * @return size_t Records copied (stops at a segment boundary)
+   */
+  size_t peek(uint8_t* out, size_t max) {
+    if (count_ == 0 || max == 0) return 0;
+    char path[24];
+    segPath(first_, path);
+    File f = fs_->open(path, "r");
+    if (!f) return 0;
+    size_t n = fill(f) - cursor_;
+    if (n > max) n = max;
+    f.seek((uint32_t)cursor_ * RECORD_LEN);
+    n = f.read(out, n * RECORD_LEN) / RECORD_LEN;
+    f.close();
+    return n;
+  }
+
+  // Remove the n oldest records (after they were delivered)
+  void consume(size_t n) {
+    if (n > count_) n = count_;
+    cursor_ += n;
+    count_ -= n;
+    trim();
+    saveCursor();
+  }
+
+  uint32_t count() const { return count_; }
+  uint32_t dropped() const { return dropped_; }
+
+ private:
+  void segPath(uint32_t n, char* out) const { snprintf(out, 24, "%s/%08lx", dir_, (unsigned long)n); }
+  void cursorPath(char* out) const { snprintf(out, 24, "%s/cur", dir_); }
+
+  uint16_t fill(File& f) const { return (uint16_t)(f.size() / RECORD_LEN); }
+  uint16_t fill(uint32_t n) const {
+    char path[24];
+    segPath(n, path);
+    File f = fs_->open(path, "r");
+    const uint16_t v = f ? fill(f) : 0;
+    f.close();
+    return v;
+  }
+
+  void startSegment() {
+    ++last_;
+    headFill_ = 0;
+  }
+
+  void removeSegment(uint32_t n) {
+    char path[24];
+    segPath(n, path);
+    fs_->remove(path);
+  }
+
+  void dropOldest() {
+    const uint16_t lost = fill(first_) - cursor_;
+    removeSegment(first_++);
+    cursor_ = 0;
+    count_ -= lost;
+    dropped_ += lost;
+    saveCursor();
+  }
+
+  // Delete segments that have been read to the end
+  void trim() {
+    while (first_ < last_ && cursor_ >= fill(first_)) {
+      removeSegment(first_++);
+      cursor_ = 0;
+    }
+    if (first_ == last_ && count_ == 0 && headFill_ > 0) {
+      removeSegment(first_);
+      first_ = last_ = last_ + 1;  // Fresh, not yet created segment
+      headFill_ = 0;
+      cursor_ = 0;
+    }
+  }
+
+  void saveCursor() {
+    uint8_t cur[6] = {
+      (uint8_t)first_, (uint8_t)(first_ >> 8), (uint8_t)(first_ >> 16), (uint8_t)(first_ >> 24),
+      (uint8_t)cursor_, (uint8_t)(cursor_ >> 8),
+    };
+    char path[24];
+    cursorPath(path);
+    File c = fs_->open(path, "w");
+    if (!c) return;
+    c.write(cur, sizeof(cur));
+    c.close();
+  }
+
+  fs::FS*  fs_ = nullptr;
+  char     dir_[12] = "";
+  uint32_t first_ = 0;        // Oldest segment number
+  uint32_t last_ = 0;         // Segment receiving appends
+  uint16_t headFill_ = 0;     // Records in the last segment
+  uint16_t cursor_ = 0;       // Records already consumed from the first segment
+  uint32_t count_ = 0;        // Records waiting
+  uint32_t dropped_ = 0;      // Records lost to overflow since boot
+};
@@ -0,0 +1,270 @@
+/*****************************************************************
+ * AGROSENSE - Binary Frame Authentication
+ *
+ * Shared by the ESP32 gateway and the Arduino field node. Header-only,
+ * AVR-safe (C++11, no heap): a byte-oriented AES-128 encryptor and
+ * AES-CMAC (RFC 4493) keyed with the network key. The key schedule and
+ * subkeys are built once; the S-box is the only table (256 B of RAM on
+ * the Mega, 464 B with one Cmac).
+ *
+ * With authentication on, every binary frame ends in a trailer, after
+ * any trace trailer (lora_frame.h):
+ *   [n-6..n-5] frame counter, low 16 bits (LE)
+ *   [n-4..n-1] MIC: AES-CMAC truncated to 32 bits over
+ *              direction | counter (32 bit, LE) | frame bytes
+ * Each node and the gateway's link to each node count on their own, so
+ * one node's traffic never moves another's counters. The receiver keeps
+ * the highest counter it accepted from the sender and rebuilds the upper
+ * half from it, so a frame is accepted only if it is new, at most
+ * MAX_GAP ahead, and its MIC matches that exact counter.
+ *
+ * Counters only grow across resets. Both ends keep them in blocks of a
+ * few hundred, ahead of use: a sender resumes at its reserved bound, a
+ * receiver only takes counters from the bound it stored past the last
+ * accepted one. Nothing seen before a reset passes after it, and flash
+ * is written once per block, not per frame.
+ *
+ * A receiver that lost track of its sender (that sender resumed below
+ * the stored bound, ran more than MAX_GAP ahead, or is not known at all)
+ * drops its frames until the two sync (lora_frame.h). A sync frame
+ * carries all 32 bits of its counter and passes verifySync() however far
+ * ahead it is. The node syncs at boot and when downlinks stop arriving.
+ * The gateway answers each request, and each frame from a node it
+ * restored but has not heard yet. A receiver with no record accepts a
+ * sync only, never a regular frame.
+ *
+ * verify() runs before anything parses the frame. A frame whose counter
+ * is not ahead of the last accepted one (a relay's copy, a replay) fails
+ * on the counter alone; any other frame costs one CMAC, one or two AES
+ * blocks. A relay frame wraps the signed frame unchanged, so the MIC is
+ * end to end; the relay header itself is not covered.
+ *
+ * A forger has 1 in 2^32 per frame put on air, and each try is bound to
+ * one counter value. Relays forward frames they cannot check, so a
+ * forged frame costs airtime but never moves a valve.
+ *****************************************************************/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "lora_frame.h"
+
+namespace auth {
+
+constexpr size_t KEY_LEN     = 16;
+constexpr size_t MIC_LEN     = 4;
+constexpr size_t TRAILER_LEN = 2 + MIC_LEN;
+constexpr uint16_t MAX_GAP   = 0x7FFF;      // Furthest ahead of the last counter a frame may be
+
+enum Direction : uint8_t { DIR_UPLINK = 0, DIR_DOWNLINK = 1 };
+enum Verdict : uint8_t {
+  AUTH_OK,
+  AUTH_SHORT,                            // No room for a trailer
+  AUTH_STALE,                            // Counter not ahead of the last: a copy, a replay, or
+                                         // (sync) a sender behind the receiver
+  AUTH_FORGED,                           // MIC does not match
+};
+
+/* -------------------- AES-128 -------------------- */
+constexpr uint8_t SBOX[256] = {
+  0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+  0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+  0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+  0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+  0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+  0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+  0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+  0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+  0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+  0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+  0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+  0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+  0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+  0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+  0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+  0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+inline uint8_t xtime(uint8_t x) { return (uint8_t)((x << 1) ^ ((x & 0x80) ? 0x1B : 0)); }
+
+// Forward cipher only: CMAC never decrypts
+class Aes128 {
+ public:
+  explicit Aes128(const uint8_t* key) {
+    memcpy(rk_, key, KEY_LEN);
+    uint8_t rcon = 1;
+    for (uint8_t i = 16; i < sizeof(rk_); i += 4) {
+      uint8_t t[4] = {rk_[i - 4], rk_[i - 3], rk_[i - 2], rk_[i - 1]};
+      if (i % 16 == 0) {                 // RotWord, SubWord, Rcon
+        const uint8_t t0 = t[0];
+        t[0] = SBOX[t[1]] ^ rcon;
+        t[1] = SBOX[t[2]];
+        t[2] = SBOX[t[3]];
+        t[3] = SBOX[t0];
+        rcon = xtime(rcon);
+      }
+      for (uint8_t j = 0; j < 4; ++j) rk_[i + j] = rk_[i - 16 + j] ^ t[j];
+    }
+  }
+
+  // Encrypt one 16-byte block in place (column-major state)
+  void encrypt(uint8_t* s) const {
+    addRoundKey(s, 0);
+    for (uint8_t r = 1; r < 10; ++r) {
+      subShift(s);
+      mixColumns(s);
+      addRoundKey(s, r);
+    }
+    subShift(s);
+    addRoundKey(s, 10);
+  }
+
+ private:
+  void addRoundKey(uint8_t* s, uint8_t r) const {
+    const uint8_t* k = rk_ + 16 * r;
+    for (uint8_t i = 0; i < 16; ++i) s[i] ^= k[i];
+  }
+
+  // SubBytes and ShiftRows in one pass
+  static void subShift(uint8_t* s) {
+    for (uint8_t i = 0; i < 16; ++i) s[i] = SBOX[s[i]];
+    uint8_t t = s[1];
+    s[1] = s[5]; s[5] = s[9]; s[9] = s[13]; s[13] = t;
+    t = s[2]; s[2] = s[10]; s[10] = t;
+    t = s[6]; s[6] = s[14]; s[14] = t;
+    t = s[15];
+    s[15] = s[11]; s[11] = s[7]; s[7] = s[3]; s[3] = t;
+  }
+
+  static void mixColumns(uint8_t* s) {
+    for (uint8_t c = 0; c < 16; c += 4) {
+      const uint8_t a0 = s[c], a1 = s[c + 1], a2 = s[c + 2], a3 = s[c + 3];
+      const uint8_t all = a0 ^ a1 ^ a2 ^ a3;
+      s[c]     = a0 ^ all ^ xtime(a0 ^ a1);
+      s[c + 1] = a1 ^ all ^ xtime(a1 ^ a2);
+      s[c + 2] = a2 ^ all ^ xtime(a2 ^ a3);
+      s[c + 3] = a3 ^ all ^ xtime(a3 ^ a0);
+    }
+  }
+
+  uint8_t rk_[176];                      // 11 round keys
+};
+
+/* -------------------- AES-CMAC -------------------- */
+class Cmac {
+ public:
+  explicit Cmac(const uint8_t* key) : aes_(key) {
+    uint8_t l[16] = {0};
+    aes_.encrypt(l);
+    dbl(l, k1_);
+    dbl(k1_, k2_);
+  }
+
+  /**
+   * Full 16-byte CMAC of pre (preLen bytes) followed by msg, without
+   * copying either
+   */
+  void tag(const uint8_t* pre, size_t preLen, const uint8_t* msg, size_t len, uint8_t* out) const {
+    memset(out, 0, 16);
+    uint8_t pos = 0;
+    for (size_t i = 0; i < preLen + len; ++i) {
+      if (pos == 16) {
+        aes_.encrypt(out);
+        pos = 0;
+      }
+      out[pos++] ^= i < preLen ? pre[i] : msg[i - preLen];
+    }
+    const uint8_t* k = k1_;
+    if (pos < 16) {                      // Empty or partial last block: pad
+      out[pos] ^= 0x80;
+      k = k2_;
+    }
+    for (uint8_t i = 0; i < 16; ++i) out[i] ^= k[i];
+    aes_.encrypt(out);
+  }
+
+  // Truncated MIC of a frame sent with counter
+  void mic(Direction dir, uint32_t counter, const uint8_t* buf, size_t len, uint8_t* out) const {
+    const uint8_t pre[5] = {dir, (uint8_t)counter, (uint8_t)(counter >> 8), (uint8_t)(counter >> 16),
+                            (uint8_t)(counter >> 24)};
+    uint8_t t[16];
+    tag(pre, sizeof(pre), buf, len, t);
+    memcpy(out, t, MIC_LEN);
+  }
+
+ private:
+  // Doubling in GF(2^128), for the subkeys
+  static void dbl(const uint8_t* in, uint8_t* out) {
+    const bool carry = in[0] & 0x80;
+    for (uint8_t i = 0; i < 15; ++i) out[i] = (uint8_t)((in[i] << 1) | (in[i + 1] >> 7));
+    out[15] = (uint8_t)((in[15] << 1) ^ (carry ? 0x87 : 0));
+  }
+
+  Aes128  aes_;
+  uint8_t k1_[16];
+  uint8_t k2_[16];
+};
+
+/* -------------------- Trailer -------------------- */
+/**
+ * Append the trailer to a frame of len bytes
+ * @return size_t New frame length, or 0 if buf has no room
+ */
+inline size_t sign(const Cmac& c, Direction dir, uint32_t counter, uint8_t* buf, size_t len, size_t cap) {
+  if (len == 0 || cap < len + TRAILER_LEN) return 0;
+  frame::put16(buf + len, (uint16_t)counter);
+  c.mic(dir, counter, buf, len, buf + len + 2);
+  return len + TRAILER_LEN;
+}
+
+// MIC of the first body bytes under counter equals the trailer's, in constant time
+inline bool micMatches(const Cmac& c, Direction dir, uint32_t counter, const uint8_t* buf, size_t body) {
+  uint8_t m[MIC_LEN];
+  c.mic(dir, counter, buf, body, m);
+  uint8_t diff = 0;
+  for (uint8_t i = 0; i < MIC_LEN; ++i) diff |= m[i] ^ buf[body + 2 + i];
+  return diff == 0;
+}
+
+/**
+ * Check a signed frame from a known sender, the counter first
+ * @param last Highest counter accepted from the sender; a frame may be
+ *        up to MAX_GAP ahead of it
+ * @param counter Set to the frame's full counter on AUTH_OK
+ */
+inline Verdict verify(const Cmac& c, Direction dir, const uint8_t* buf, size_t len, uint32_t last,
+                      uint32_t& counter) {
+  if (len < frame::FRAME_MIN_LEN + TRAILER_LEN) return AUTH_SHORT;
+  const size_t body = len - TRAILER_LEN;
+  const uint16_t ahead = (uint16_t)(frame::get16(buf + body) - (uint16_t)last);
+  if (ahead == 0 || ahead > MAX_GAP) return AUTH_STALE;
+  counter = last + ahead;
+  return micMatches(c, dir, counter, buf, body) ? AUTH_OK : AUTH_FORGED;
+}
+
+/**
+ * Check a sync frame, which names its full counter. The MIC goes first:
+ * AUTH_STALE here means an authentic frame from a sender behind the
+ * receiver (or its replay), which a sync back can put right.
+ * @param known last is valid; otherwise any counter passes
+ * @param counter Set to the frame's counter on AUTH_OK and AUTH_STALE
+ */
+inline Verdict verifySync(const Cmac& c, Direction dir, const uint8_t* buf, size_t len, uint32_t last, bool known,
+                          uint32_t& counter) {
+  if (len < frame::SYNC_LEN + TRAILER_LEN) return AUTH_SHORT;
+  const size_t body = len - TRAILER_LEN;
+  counter = frame::get32(buf + 4);
+  if (frame::get16(buf + body) != (uint16_t)counter) return AUTH_FORGED;
+  if (!micMatches(c, dir, counter, buf, body)) return AUTH_FORGED;
+  return known && counter <= last ? AUTH_STALE : AUTH_OK;
+}
+
+/**
+ * Next bound to store for a counter block: the first multiple of block
+ * above counter. Both a sender's reservation and a receiver's floor use it.
+ */
+inline uint32_t blockAbove(uint32_t counter, uint32_t block) { return counter - counter % block + block; }
+
+}  // namespace auth
@@ -0,0 +1,146 @@
+/*****************************************************************
+ * AGROSENSE - Compiled Irrigation Rules
+ *
+ * A rule is a small predicate table evaluated on numeric sample
+ * fields (x10 fixed point), so the per-uplink decision is a handful
+ * of integer compares with no string handling:
+ *
+ *   - close when ANY "off" term holds or the time window is shut
+ *   - open  when ALL "on" terms hold (and no "off" term does)
+ *   - otherwise keep the current state
+ *
+ * Disjoint on/off thresholds (e.g. open below 30 %, close above 35 %)
+ * give hysteresis; minimum on/off dwell times stop the valve from
+ * toggling on sensor noise. Rules are compiled from text once, when
+ * they arrive, via the parse helpers below.
+ *****************************************************************/
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+namespace rules {
+
+/* -------------------- Sample Fields -------------------- */
+enum Field : uint8_t { FIELD_TEMP, FIELD_HUM, FIELD_LIGHT, FIELD_MOIST, FIELD_RAIN, FIELD_COUNT };
+
+constexpr int16_t NONE = -32767 - 1;     // Field unavailable (sensor failed)
+
+// x10 fixed point, saturating; NaN becomes NONE
+inline int16_t toFixed10(float v) {
+  if (isnan(v)) return NONE;
+  if (v < -3276.0f) v = -3276.0f;
+  if (v >  3276.0f) v =  3276.0f;
+  return (int16_t)(v < 0 ? v * 10.0f - 0.5f : v * 10.0f + 0.5f);
+}
+
+/* -------------------- Predicate Table -------------------- */
+enum Op : uint8_t { OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE };
+
+struct Term {
+  uint8_t field;
+  uint8_t op;
+  int16_t value;                         // x10, same scale as the sample
+
+  // A missing field never satisfies a term
+  bool test(const int16_t* v) const {
+    const int16_t x = v[field];
+    if (x == NONE) return false;
+    switch (op) {
+      case OP_LT: return x <  value;
+      case OP_LE: return x <= value;
+      case OP_GT: return x >  value;
+      case OP_GE: return x >= value;
+      case OP_EQ: return x == value;
+      case OP_NE: return x != value;
+    }
+    return false;
+  }
+};
+
+constexpr uint8_t MAX_TERMS = 4;
+
+struct Rule {
+  Term     on[MAX_TERMS];                // All must hold to open
+  Term     off[MAX_TERMS];               // Any one closes
+  uint8_t  nOn;
+  uint8_t  nOff;
+  uint16_t minOnS;                       // Minimum time open before closing
+  uint16_t minOffS;                      // Minimum time closed before opening
+  uint16_t winStart;                     // Open window [start, end) in minutes of
+  uint16_t winEnd;                       // local day, may wrap; start == end: always
+
+  bool addOn(uint8_t f, uint8_t op, int16_t v)  { return add(on, nOn, f, op, v); }
+  bool addOff(uint8_t f, uint8_t op, int16_t v) { return add(off, nOff, f, op, v); }
+
+  // minute < 0: clock unknown, the window is not enforced
+  bool windowOpen(int16_t minute) const {
+    if (winStart == winEnd || minute < 0) return true;
+    if (winStart < winEnd) return minute >= winStart && minute < winEnd;
+    return minute >= winStart || minute < winEnd;
+  }
+
+  /**
+   * Next valve state for one sample
+   * @param v      Sample fields, indexed by Field
+   * @param minute Local minute of day, or -1 if unknown
+   * @param open   Current valve state
+   * @param heldS  Seconds since the valve last changed state
+   */
+  bool next(const int16_t* v, int16_t minute, bool open, uint32_t heldS) const {
+    bool close = !windowOpen(minute);
+    for (uint8_t i = 0; i < nOff && !close; ++i) close = off[i].test(v);
+
+    bool want = open;
+    if (close) {
+      want = false;
+    } else if (nOn > 0) {
+      bool all = true;
+      for (uint8_t i = 0; i < nOn && all; ++i) all = on[i].test(v);
+      if (all) want = true;
+    }
+
+    if (want == open) return open;
+    return heldS >= (open ? minOnS : minOffS) ? want : open;
+  }
+
+ private:
+  static bool add(Term* t, uint8_t& n, uint8_t f, uint8_t op, int16_t v) {
+    if (n == MAX_TERMS || f >= FIELD_COUNT || op > OP_NE) return false;
+    t[n++] = Term{f, op, v};
+    return true;
+  }
+};
+
+/* -------------------- Compile Helpers -------------------- */
+inline bool parseField(const char* s, uint8_t& f) {
+  static const char* const NAMES[FIELD_COUNT] = {"temp", "hum", "light", "moist", "rain"};
+  for (uint8_t i = 0; i < FIELD_COUNT; ++i) {
+    if (strcmp(s, NAMES[i]) == 0) { f = i; return true; }
+  }
+  return false;
+}
+
+inline bool parseOp(const char* s, uint8_t& op) {
+  static const char* const NAMES[] = {"<", "<=", ">", ">=", "=", "!="};
+  for (uint8_t i = 0; i <= OP_NE; ++i) {
+    if (strcmp(s, NAMES[i]) == 0) { op = i; return true; }
+  }
+  return false;
+}
+
+// "HH:MM" -> minute of day
+inline bool parseClock(const char* s, uint16_t& minute) {
+  if (!s || strlen(s) != 5 || s[2] != ':') return false;
+  for (uint8_t i = 0; i < 5; ++i) {
+    if (i != 2 && (s[i] < '0' || s[i] > '9')) return false;
+  }
+  const uint16_t h = (s[0] - '0') * 10 + (s[1] - '0');
+  const uint16_t m = (s[3] - '0') * 10 + (s[4] - '0');
+  if (h > 23 || m > 59) return false;
+  minute = h * 60 + m;
+  return true;
+}
+
+}  // namespace rules
@@ -0,0 +1,622 @@
+/*****************************************************************
+ * AGROSENSE - Binary LoRa Frame Format
+ *
+ * Shared by the ESP32 gateway (src/main.cpp) and the Arduino field
+ * node (arduino_code/arduino.cpp). Header-only and AVR-safe: no STL,
+ * no heap, explicit little-endian packing so both MCUs agree on the
+ * wire layout regardless of compiler struct padding.
+ *
+ * Uplink v1 (11 bytes, replaces ~75 byte ASCII packet):
+ *   [0]    header   0x80 | (version << 4) | type
+ *   [1]    node ID
+ *   [2..3] sequence number        (uint16, LE)
+ *   [4]    flags                  (FLAG_*)
+ *   [5..6] temperature  x10 °C    (int16,  LE)
+ *   [7..8] humidity     x10 %     (uint16, LE)
+ *   [9]    light level  x10       (0-100 => 0.0-10.0)
+ *   [10]   soil moisture %        (0-100)
+ *
+ * Valve command v1 (5 bytes, gateway -> node):
+ *   [0]    header
+ *   [1]    target node ID         (NODE_BROADCAST = every node)
+ *   [2..3] command sequence       (uint16, LE)
+ *   [4]    action                 (1 = open, 0 = close)
+ *
+ * Command ACK v1 (5 bytes, node -> gateway, unicast commands only):
+ *   [0]    header
+ *   [1]    node ID
+ *   [2..3] acknowledged command sequence
+ *   [4]    flags after actuation  (FLAG_*)
+ *
+ * Link ADR v1 (8-9 bytes, gateway -> node, adaptive data rate, ACKed):
+ *   [0]    header
+ *   [1]    target node ID
+ *   [2..3] command sequence       (uint16, LE)
+ *   [4]    spreading factor       (7-12)
+ *   [5]    TX power dBm           (TX_POWER_MIN..TX_POWER_MAX)
+ *   [6..7] switch delay x100 ms   (uint16, LE; 0 = right after the ACK)
+ *   [8]    bits 4-7: bandwidth code (bandwidthHz), bits 0-3: coding
+ *          rate 5-8; optional, without it bandwidth and rate stay as is
+ *
+ * Node config v1 (10 bytes, gateway -> node, ACKed):
+ *   [0]    header
+ *   [1]    target node ID
+ *   [2..3] command sequence       (uint16, LE)
+ *   [4..5] config version         (uint16, LE)
+ *   [6..7] uplink interval s      (uint16, LE; 0 = unchanged)
+ *   [8..9] heartbeat interval s   (uint16, LE; 0 = unchanged)
+ *
+ * Counter sync v1 (12 bytes, authenticated networks only): a sync
+ * request (node -> gateway) or sync (gateway -> node, ACKed)
+ *   [0]    header
+ *   [1]    node ID
+ *   [2..3] sequence               (request: uplink sequence; sync:
+ *                                  command sequence)
+ *   [4..7] this frame's auth counter, all 32 bits (uint32, LE)
+ *   [8..11] floor: lowest counter the sender takes from the receiver
+ *          next (uint32, LE)
+ * Carrying its full counter, a sync passes however far the receiver
+ * lost track of the sender; see frame_auth.h.
+ *
+ * Delta uplink v1 (6-12 bytes, report by exception):
+ *   [0]    header
+ *   [1]    node ID
+ *   [2..3] sequence number
+ *   [4]    base age: sequence - sequence of the full uplink it extends
+ *   [5]    bits 0-3: DELTA_* fields present, bits 4-7: flags (FLAG_*)
+ *   [6..]  present fields in uplink order and encoding
+ * A delta always carries every field that differs from its base by at
+ * least the deadband, so losing one delta never corrupts the rebuilt
+ * state; the receiver only needs the base.
+ *
+ * Trace trailer (2 bytes, LE, optional after uplink, delta and ACK):
+ *   node-local delay in ms (TRACE_NONE = unknown): for uplinks and
+ *   deltas the age of the sample at TX start, for ACKs the time since
+ *   the command was applied. Older decoders ignore the extra bytes; the
+ *   gateway pins the delay to its own receive clock, so no node clock
+ *   sync is needed.
+ *
+ * Relay v1 (5 bytes + the frame it carries, mesh forwarding):
+ *   [0]    header
+ *   [1]    node ID of the relay that sent this copy
+ *   [2]    bits 4-7: hops so far, bits 0-3: hops left (TTL)
+ *   [3..4] hold ms: end of the original frame to the start of this
+ *          copy, summed over all hops (uint16, LE)
+ *   [5..]  the original uplink, delta, ACK or downlink, unchanged
+ * A relay forwards each frame once, keyed by node, direction and
+ * sequence (frameId), and never wraps a relay frame twice. The gateway
+ * keeps the first copy of an uplink, direct or relayed, and drops the
+ * rest. Every hop uses the network's spreading factor.
+ *
+ * Auth trailer (6 bytes, last, on every binary frame when the network
+ * runs authenticated): frame counter and MIC, see frame_auth.h. The
+ * receiver checks and strips it before any decoder here sees the frame.
+ *
+ * A node that sets FLAG_RX_WINDOW sleeps between uplinks and listens
+ * only right after each of its own frames (class-A style): a downlink
+ * for it must start within RX_WINDOW_MS of the gateway receiving that
+ * uplink or ACK, and at most one downlink fits each window.
+ *
+ * Bit 7 of the header is always set, so a binary frame can never be
+ * mistaken for the legacy printable-ASCII "Weather:...|Temp:..." packet.
+ *****************************************************************/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+namespace frame {
+
+/* -------------------- Header -------------------- */
+constexpr uint8_t VERSION      = 1;
+constexpr uint8_t HEADER_MARK  = 0x80;   // Distinguishes binary from ASCII
+
+enum Type : uint8_t {
+  TYPE_UPLINK    = 0x1,                  // Node -> gateway sensor report
+  TYPE_VALVE_CMD = 0x2,                  // Gateway -> node valve command
+  TYPE_ACK       = 0x3,                  // Node -> gateway command ACK
+  TYPE_DELTA     = 0x4,                  // Node -> gateway changed fields only
+  TYPE_LINK_ADR  = 0x5,                  // Gateway -> node SF / TX power
+  TYPE_CONFIG    = 0x6,                  // Gateway -> node reporting cadence
+  TYPE_RELAY     = 0x7,                  // Either way, a frame forwarded by a relay
+  TYPE_SYNC_REQ  = 0x8,                  // Node -> gateway frame counters, asks for a sync
+  TYPE_SYNC      = 0x9,                  // Gateway -> node frame counters
+};
+
+constexpr uint8_t header(uint8_t type) {
+  return HEADER_MARK | (uint8_t)((VERSION & 0x07) << 4) | (type & 0x0F);
+}
+constexpr bool    isBinary(uint8_t hdr)      { return (hdr & HEADER_MARK) != 0; }
+constexpr uint8_t headerVersion(uint8_t hdr) { return (hdr >> 4) & 0x07; }
+constexpr uint8_t headerType(uint8_t hdr)    { return hdr & 0x0F; }
+constexpr bool    isDownlink(uint8_t type) {
+  return type == TYPE_VALVE_CMD || type == TYPE_LINK_ADR || type == TYPE_CONFIG || type == TYPE_SYNC;
+}
+
+/* -------------------- Addressing -------------------- */
+constexpr uint8_t NODE_LEGACY    = 0x00; // ASCII node without an ID
+constexpr uint8_t NODE_BROADCAST = 0xFF; // Downlink to every node
+
+/* -------------------- Uplink Flags -------------------- */
+constexpr uint8_t FLAG_RAINING    = 1 << 0;  // Rain sensor wet
+constexpr uint8_t FLAG_VALVE_OPEN = 1 << 1;  // Servo at open position
+constexpr uint8_t FLAG_ADR_REQ    = 1 << 2;  // No downlink in a while, confirm link settings
+constexpr uint8_t FLAG_RX_WINDOW  = 1 << 3;  // Listens only in the RX window after its frames
+
+/* -------------------- Receive Window -------------------- */
+constexpr uint16_t RX_WINDOW_MS = 400;       // Downlink must start this soon after the node's frame
+
+/* -------------------- Sentinels -------------------- */
+constexpr int16_t  TEMP_INVALID = -32767 - 1; // DHT read failed
+constexpr uint16_t HUM_INVALID  = 0xFFFF;
+
+/* -------------------- Uplink Record -------------------- */
+constexpr size_t UPLINK_LEN = 11;
+
+struct Uplink {
+  uint8_t  nodeId;
+  uint16_t seq;
+  uint8_t  flags;
+  int16_t  temp10;   // °C x10
+  uint16_t hum10;    // % x10
+  uint8_t  light10;  // 0-10 scale x10
+  uint8_t  moist;    // %
+
+  float tempC()  const { return temp10 == TEMP_INVALID ? NAN : temp10 / 10.0f; }
+  float humP()   const { return hum10 == HUM_INVALID ? NAN : hum10 / 10.0f; }
+  float light()  const { return light10 / 10.0f; }
+  bool  raining()   const { return flags & FLAG_RAINING; }
+  bool  valveOpen() const { return flags & FLAG_VALVE_OPEN; }
+};
+
+/* -------------------- Fixed-point Helpers -------------------- */
+// Round-half-away-from-zero; avoids lroundf, which avr-libc lacks
+inline long roundFixed(float x) { return (long)(x < 0 ? x - 0.5f : x + 0.5f); }
+
+inline int16_t toTemp10(float c) {
+  if (isnan(c)) return TEMP_INVALID;
+  if (c < -3276.0f) c = -3276.0f;
+  if (c >  3276.0f) c =  3276.0f;
+  return (int16_t)roundFixed(c * 10.0f);
+}
+
+inline uint16_t toHum10(float h) {
+  if (isnan(h)) return HUM_INVALID;
+  if (h < 0.0f)   h = 0.0f;
+  if (h > 100.0f) h = 100.0f;
+  return (uint16_t)roundFixed(h * 10.0f);
+}
+
+inline uint8_t toLight10(float l) {
+  if (l < 0.0f)   l = 0.0f;
+  if (l > 10.0f)  l = 10.0f;
+  return (uint8_t)roundFixed(l * 10.0f);
+}
+
+/* -------------------- Little-endian Packing -------------------- */
+inline void     put16(uint8_t* p, uint16_t v) { p[0] = v & 0xFF; p[1] = v >> 8; }
+inline uint16_t get16(const uint8_t* p)       { return (uint16_t)(p[0] | (p[1] << 8)); }
+inline void     put32(uint8_t* p, uint32_t v) { put16(p, (uint16_t)v); put16(p + 2, (uint16_t)(v >> 16)); }
+inline uint32_t get32(const uint8_t* p)       { return get16(p) | (uint32_t)get16(p + 2) << 16; }
+
+/* -------------------- Encode / Decode -------------------- */
+/**
+ * Serialize an uplink into buf
+ * @return size_t Bytes written (UPLINK_LEN), or 0 if buf is too small
+ */
+inline size_t encodeUplink(const Uplink& u, uint8_t* buf, size_t cap) {
+  if (cap < UPLINK_LEN) return 0;
+  buf[0] = header(TYPE_UPLINK);
+  buf[1] = u.nodeId;
+  put16(buf + 2, u.seq);
+  buf[4] = u.flags;
+  put16(buf + 5, (uint16_t)u.temp10);
+  put16(buf + 7, u.hum10);
+  buf[9]  = u.light10;
+  buf[10] = u.moist;
+  return UPLINK_LEN;
+}
+
+/**
+ * Parse an uplink from buf
+ * @return bool False on wrong header/version/type or short frame
+ */
+inline bool decodeUplink(const uint8_t* buf, size_t len, Uplink& u) {
+  if (len < UPLINK_LEN) return false;
+  if (!isBinary(buf[0]) || headerVersion(buf[0]) != VERSION) return false;
+  if (headerType(buf[0]) != TYPE_UPLINK) return false;
+  u.nodeId  = buf[1];
+  u.seq     = get16(buf + 2);
+  u.flags   = buf[4];
+  u.temp10  = (int16_t)get16(buf + 5);
+  u.hum10   = get16(buf + 7);
+  u.light10 = buf[9];
+  u.moist   = buf[10];
+  return true;
+}
+
+/* -------------------- Valve Command -------------------- */
+constexpr size_t VALVE_CMD_LEN = 5;
+
+struct ValveCmd {
+  uint8_t  nodeId;
+  uint16_t seq;
+  bool     open;
+
+  bool addressedTo(uint8_t id) const { return nodeId == id || nodeId == NODE_BROADCAST; }
+};
+
+inline size_t encodeValveCmd(const ValveCmd& c, uint8_t* buf, size_t cap) {
+  if (cap < VALVE_CMD_LEN) return 0;
+  buf[0] = header(TYPE_VALVE_CMD);
+  buf[1] = c.nodeId;
+  put16(buf + 2, c.seq);
+  buf[4] = c.open ? 1 : 0;
+  return VALVE_CMD_LEN;
+}
+
+inline bool decodeValveCmd(const uint8_t* buf, size_t len, ValveCmd& c) {
+  if (len < VALVE_CMD_LEN) return false;
+  if (!isBinary(buf[0]) || headerVersion(buf[0]) != VERSION) return false;
+  if (headerType(buf[0]) != TYPE_VALVE_CMD) return false;
+  c.nodeId = buf[1];
+  c.seq    = get16(buf + 2);
+  c.open   = buf[4] != 0;
+  return true;
+}
+
+/* -------------------- Command ACK -------------------- */
+constexpr size_t ACK_LEN = 5;
+
+struct Ack {
+  uint8_t  nodeId;
+  uint16_t seq;      // Sequence of the command being acknowledged
+  uint8_t  flags;    // Node state after applying it
+
+  bool valveOpen() const { return flags & FLAG_VALVE_OPEN; }
+};
+
+inline size_t encodeAck(const Ack& a, uint8_t* buf, size_t cap) {
+  if (cap < ACK_LEN) return 0;
+  buf[0] = header(TYPE_ACK);
+  buf[1] = a.nodeId;
+  put16(buf + 2, a.seq);
+  buf[4] = a.flags;
+  return ACK_LEN;
+}
+
+inline bool decodeAck(const uint8_t* buf, size_t len, Ack& a) {
+  if (len < ACK_LEN) return false;
+  if (!isBinary(buf[0]) || headerVersion(buf[0]) != VERSION) return false;
+  if (headerType(buf[0]) != TYPE_ACK) return false;
+  a.nodeId = buf[1];
+  a.seq    = get16(buf + 2);
+  a.flags  = buf[4];
+  return true;
+}
+
+/* -------------------- Bandwidth Codes -------------------- */
+constexpr uint8_t BW_CODES = 10;         // SX127x RegModemConfig1 bandwidth settings
+
+inline uint32_t bandwidthHz(uint8_t code) {
+  static const uint32_t HZ[BW_CODES] = {7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000};
+  return code < BW_CODES ? HZ[code] : 0;
+}
+
+// Code of a bandwidth in Hz, BW_CODES if the radio has no such setting
+inline uint8_t bandwidthCode(uint32_t hz) {
+  uint8_t code = 0;
+  while (code < BW_CODES && bandwidthHz(code) != hz) ++code;
+  return code;
+}
+
+/* -------------------- Link ADR -------------------- */
+constexpr size_t LINK_ADR_MIN_LEN = 8;   // Without bandwidth / coding rate
+constexpr size_t LINK_ADR_LEN = 9;
+constexpr int8_t TX_POWER_MIN = 2;       // PA_BOOST range used by ADR (dBm)
+constexpr int8_t TX_POWER_MAX = 17;      // LoRa library default, the fallback
+constexpr uint8_t SF_FALLBACK = 12;      // Most robust SF; both sides meet here when ADR loses a node
+
+struct LinkAdr {
+  uint8_t  nodeId;
+  uint16_t seq;
+  uint8_t  sf;
+  int8_t   txPower;
+  uint16_t switchIn100ms;  // Apply this long after reception
+  uint32_t bw;             // Bandwidth in Hz, 0 = unchanged
+  uint8_t  cr;             // Coding rate denominator 5-8, 0 = unchanged
+};
+
+/**
+ * Serialize a link ADR command into buf; the bandwidth / coding rate
+ * byte is only written when both are set
+ * @return size_t Bytes written, or 0 if buf is too small or bw is not a radio setting
+ */
+inline size_t encodeLinkAdr(const LinkAdr& c, uint8_t* buf, size_t cap) {
+  const bool radio = c.bw != 0 && c.cr != 0;
+  const size_t len = radio ? LINK_ADR_LEN : LINK_ADR_MIN_LEN;
+  if (cap < len || (radio && bandwidthCode(c.bw) == BW_CODES)) return 0;
+  buf[0] = header(TYPE_LINK_ADR);
+  buf[1] = c.nodeId;
+  put16(buf + 2, c.seq);
+  buf[4] = c.sf;
+  buf[5] = (uint8_t)c.txPower;
+  put16(buf + 6, c.switchIn100ms);
+  if (radio) buf[8] = (uint8_t)(bandwidthCode(c.bw) << 4) | (c.cr & 0x0F);
+  return len;
+}
+
+/**
+ * Parse a link ADR command from buf
+ * @return bool False on wrong header/type, short frame or out-of-range settings
+ */
+inline bool decodeLinkAdr(const uint8_t* buf, size_t len, LinkAdr& c) {
+  if (len < LINK_ADR_MIN_LEN) return false;
+  if (!isBinary(buf[0]) || headerVersion(buf[0]) != VERSION) return false;
+  if (headerType(buf[0]) != TYPE_LINK_ADR) return false;
+  c.nodeId        = buf[1];
+  c.seq           = get16(buf + 2);
+  c.sf            = buf[4];
+  c.txPower       = (int8_t)buf[5];
+  c.switchIn100ms = get16(buf + 6);
+  c.bw            = len >= LINK_ADR_LEN ? bandwidthHz(buf[8] >> 4) : 0;
+  c.cr            = len >= LINK_ADR_LEN ? (buf[8] & 0x0F) : 0;
+  if (len >= LINK_ADR_LEN && (c.bw == 0 || c.cr < 5 || c.cr > 8)) return false;
+  return c.sf >= 7 && c.sf <= 12 && c.txPower >= TX_POWER_MIN && c.txPower <= TX_POWER_MAX;
+}
+
+/* -------------------- Node Config -------------------- */
+constexpr size_t CONFIG_LEN = 10;
+
+struct Config {
+  uint8_t  nodeId;
+  uint16_t seq;
+  uint16_t version;        // Gateway's config version, for the node's records
+  uint16_t intervalS;      // Uplink / wake interval, 0 = unchanged
+  uint16_t heartbeatS;     // Full-frame heartbeat, 0 = unchanged
+};
+
+inline size_t encodeConfig(const Config& c, uint8_t* buf, size_t cap) {
+  if (cap < CONFIG_LEN) return 0;
+  buf[0] = header(TYPE_CONFIG);
+  buf[1] = c.nodeId;
+  put16(buf + 2, c.seq);
+  put16(buf + 4, c.version);
+  put16(buf + 6, c.intervalS);
+  put16(buf + 8, c.heartbeatS);
+  return CONFIG_LEN;
+}
+
+inline bool decodeConfig(const uint8_t* buf, size_t len, Config& c) {
+  if (len < CONFIG_LEN) return false;
+  if (!isBinary(buf[0]) || headerVersion(buf[0]) != VERSION) return false;
+  if (headerType(buf[0]) != TYPE_CONFIG) return false;
+  c.nodeId     = buf[1];
+  c.seq        = get16(buf + 2);
+  c.version    = get16(buf + 4);
+  c.intervalS  = get16(buf + 6);
+  c.heartbeatS = get16(buf + 8);
+  return true;
+}
+
+/* -------------------- Counter Sync -------------------- */
+constexpr size_t SYNC_LEN = 12;          // Longest downlink
+
+struct Sync {
+  uint8_t  nodeId;
+  uint16_t seq;
+  uint32_t counter;        // Auth counter this frame is signed with
+  uint32_t floor;          // Lowest counter the sender accepts next
+};
+
+// @param type TYPE_SYNC_REQ or TYPE_SYNC
+inline size_t encodeSync(const Sync& s, uint8_t type, uint8_t* buf, size_t cap) {
+  if (cap < SYNC_LEN) return 0;
+  buf[0] = header(type);
+  buf[1] = s.nodeId;
+  put16(buf + 2, s.seq);
+  put32(buf + 4, s.counter);
+  put32(buf + 8, s.floor);
+  return SYNC_LEN;
+}
+
+// Either direction: callers tell a request from a sync by header type
+inline bool decodeSync(const uint8_t* buf, size_t len, Sync& s) {
+  if (len < SYNC_LEN) return false;
+  if (!isBinary(buf[0]) || headerVersion(buf[0]) != VERSION) return false;
+  if (headerType(buf[0]) != TYPE_SYNC_REQ && headerType(buf[0]) != TYPE_SYNC) return false;
+  s.nodeId  = buf[1];
+  s.seq     = get16(buf + 2);
+  s.counter = get32(buf + 4);
+  s.floor   = get32(buf + 8);
+  return true;
+}
+
+/* -------------------- Delta Uplink -------------------- */
+enum DeltaField : uint8_t {
+  DELTA_TEMP  = 1 << 0,
+  DELTA_HUM   = 1 << 1,
+  DELTA_LIGHT = 1 << 2,
+  DELTA_MOIST = 1 << 3,
+};
+constexpr uint8_t DELTA_ALL     = 0x0F;
+constexpr size_t  DELTA_MIN_LEN = 6;     // Flags only
+constexpr size_t  DELTA_MAX_LEN = 12;    // Every field
+constexpr uint8_t DELTA_MAX_AGE = 0xFF;  // Base must be within 255 uplinks
+
+struct Delta {
+  uint16_t refSeq;   // Sequence of the full uplink this extends
+  uint8_t  mask;     // DELTA_* fields carried
+  Uplink   up;       // nodeId, seq and flags always valid; others per mask
+};
+
+// Minimum change worth reporting, in the uplink's fixed-point units
+struct Deadband {
+  uint16_t temp10;
+  uint16_t hum10;
+  uint8_t  light10;
+  uint8_t  moist;
+};
+
+constexpr size_t deltaLen(uint8_t mask) {
+  return DELTA_MIN_LEN + ((mask & DELTA_TEMP) ? 2 : 0) + ((mask & DELTA_HUM) ? 2 : 0) +
+         ((mask & DELTA_LIGHT) ? 1 : 0) + ((mask & DELTA_MOIST) ? 1 : 0);
+}
+
+inline uint32_t absDiff(int32_t a, int32_t b) { return a > b ? a - b : b - a; }
+
+/**
+ * Fields of `to` that moved at least their deadband away from `from`.
+ * Invalid sentinels sit far outside the valid range, so a sensor
+ * dropping out or coming back always counts as a change.
+ */
+inline uint8_t deltaMask(const Uplink& from, const Uplink& to, const Deadband& db) {
+  uint8_t m = 0;
+  if (absDiff(from.temp10, to.temp10)   >= db.temp10)  m |= DELTA_TEMP;
+  if (absDiff(from.hum10, to.hum10)     >= db.hum10)   m |= DELTA_HUM;
+  if (absDiff(from.light10, to.light10) >= db.light10) m |= DELTA_LIGHT;
+  if (absDiff(from.moist, to.moist)     >= db.moist)   m |= DELTA_MOIST;
+  return m;
+}
+
+/**
+ * Serialize a delta uplink into buf
+ * @return size_t Bytes written, or 0 if buf is too small or the base is too old
+ */
+inline size_t encodeDelta(const Delta& d, uint8_t* buf, size_t cap) {
+  const uint16_t age = d.up.seq - d.refSeq;
+  const size_t   len = deltaLen(d.mask);
+  if (cap < len || age > DELTA_MAX_AGE) return 0;
+  buf[0] = header(TYPE_DELTA);
+  buf[1] = d.up.nodeId;
+  put16(buf + 2, d.up.seq);
+  buf[4] = (uint8_t)age;
+  buf[5] = (d.mask & DELTA_ALL) | (uint8_t)(d.up.flags << 4);
+  uint8_t* p = buf + DELTA_MIN_LEN;
+  if (d.mask & DELTA_TEMP)  { put16(p, (uint16_t)d.up.temp10); p += 2; }
+  if (d.mask & DELTA_HUM)   { put16(p, d.up.hum10); p += 2; }
+  if (d.mask & DELTA_LIGHT) *p++ = d.up.light10;
+  if (d.mask & DELTA_MOIST) *p++ = d.up.moist;
+  return len;
+}
+
+/**
+ * Parse a delta uplink from buf
+ * @return bool False on wrong header/version/type or short frame
+ */
+inline bool decodeDelta(const uint8_t* buf, size_t len, Delta& d) {
+  if (len < DELTA_MIN_LEN) return false;
+  if (!isBinary(buf[0]) || headerVersion(buf[0]) != VERSION) return false;
+  if (headerType(buf[0]) != TYPE_DELTA) return false;
+  d.mask = buf[5] & DELTA_ALL;
+  if (len < deltaLen(d.mask)) return false;
+  d.up.nodeId = buf[1];
+  d.up.seq    = get16(buf + 2);
+  d.refSeq    = d.up.seq - buf[4];
+  d.up.flags  = buf[5] >> 4;
+  const uint8_t* p = buf + DELTA_MIN_LEN;
+  if (d.mask & DELTA_TEMP)  { d.up.temp10 = (int16_t)get16(p); p += 2; }
+  if (d.mask & DELTA_HUM)   { d.up.hum10 = get16(p); p += 2; }
+  if (d.mask & DELTA_LIGHT) d.up.light10 = *p++;
+  if (d.mask & DELTA_MOIST) d.up.moist = *p++;
+  return true;
+}
+
+// Rebuild the full record: state must hold the delta's base uplink
+inline void applyDelta(const Delta& d, Uplink& state) {
+  state.seq   = d.up.seq;
+  state.flags = d.up.flags;
+  if (d.mask & DELTA_TEMP)  state.temp10  = d.up.temp10;
+  if (d.mask & DELTA_HUM)   state.hum10   = d.up.hum10;
+  if (d.mask & DELTA_LIGHT) state.light10 = d.up.light10;
+  if (d.mask & DELTA_MOIST) state.moist   = d.up.moist;
+}
+
+/* -------------------- Trace Trailer -------------------- */
+constexpr size_t   TRACE_LEN  = 2;
+constexpr uint16_t TRACE_NONE = 0xFFFF;  // Unknown, or 65 s and more
+
+/**
+ * Append a trace trailer to a frame of len bytes
+ * @return size_t New frame length (unchanged if buf has no room)
+ */
+inline size_t appendTrace(uint8_t* buf, size_t len, size_t cap, uint32_t ms) {
+  if (len == 0 || cap < len + TRACE_LEN) return len;
+  put16(buf + len, ms >= TRACE_NONE ? TRACE_NONE : (uint16_t)ms);
+  return len + TRACE_LEN;
+}
+
+// Trailer of a frame whose own encoding is base bytes long
+inline uint16_t traceOf(const uint8_t* buf, size_t len, size_t base) {
+  return len >= base + TRACE_LEN ? get16(buf + base) : TRACE_NONE;
+}
+
+// Trailer of a full or delta uplink
+inline uint16_t uplinkTrace(const uint8_t* buf, size_t len) {
+  if (len < DELTA_MIN_LEN || !isBinary(buf[0])) return TRACE_NONE;
+  if (headerType(buf[0]) == TYPE_UPLINK) return traceOf(buf, len, UPLINK_LEN);
+  if (headerType(buf[0]) == TYPE_DELTA) return traceOf(buf, len, deltaLen(buf[5] & DELTA_ALL));
+  return TRACE_NONE;
+}
+
+/* -------------------- Relay -------------------- */
+constexpr size_t   RELAY_OVERHEAD    = 5;
+constexpr size_t   FRAME_MIN_LEN     = 5;    // Shortest frame a relay carries (ACK, valve command)
+constexpr uint8_t  RELAY_MAX_HOPS    = 15;   // 4-bit hop and TTL fields
+constexpr uint16_t RELAY_HOLD_MAX_MS = 300;  // Longest a relay holds a frame before forwarding
+
+struct Relay {
+  uint8_t  relayId;        // Relay that sent this copy
+  uint8_t  hops;           // Relays the frame has passed, this one included
+  uint8_t  ttl;            // Further hops allowed
+  uint16_t holdMs;
+};
+
+/**
+ * Identity of a frame for duplicate suppression: node ID, direction and
+ * sequence. Full and delta uplinks share one sequence space, as do the
+ * gateway's downlinks to a node.
+ */
+inline uint32_t frameId(const uint8_t* buf) {
+  const uint8_t kind = isDownlink(headerType(buf[0])) ? TYPE_VALVE_CMD
+                     : headerType(buf[0]) == TYPE_ACK ? TYPE_ACK : TYPE_UPLINK;
+  return (uint32_t)buf[1] << 24 | (uint32_t)kind << 16 | get16(buf + 2);
+}
+
+/**
+ * Wrap the len-byte frame at inner into buf; inner may already sit at
+ * buf + RELAY_OVERHEAD
+ * @return size_t Bytes written, or 0 if buf is too small
+ */
+inline size_t encodeRelay(const Relay& r, const uint8_t* inner, size_t len, uint8_t* buf, size_t cap) {
+  if (len < FRAME_MIN_LEN || cap < RELAY_OVERHEAD + len) return 0;
+  memmove(buf + RELAY_OVERHEAD, inner, len);
+  buf[0] = header(TYPE_RELAY);
+  buf[1] = r.relayId;
+  buf[2] = (uint8_t)((r.hops & 0x0F) << 4) | (r.ttl & 0x0F);
+  put16(buf + 3, r.holdMs);
+  return RELAY_OVERHEAD + len;
+}
+
+/**
+ * Parse a relay frame; the carried frame is left in place at
+ * buf + RELAY_OVERHEAD
+ * @return bool False on wrong header/version/type, or if it does not
+ *         carry one binary, non-relay frame
+ */
+inline bool decodeRelay(const uint8_t* buf, size_t len, Relay& r) {
+  if (len < RELAY_OVERHEAD + FRAME_MIN_LEN) return false;
+  if (!isBinary(buf[0]) || headerVersion(buf[0]) != VERSION) return false;
+  if (headerType(buf[0]) != TYPE_RELAY) return false;
+  const uint8_t inner = buf[RELAY_OVERHEAD];
+  if (!isBinary(inner) || headerType(inner) == TYPE_RELAY) return false;
+  r.relayId = buf[1];
+  r.hops    = buf[2] >> 4;
+  r.ttl     = buf[2] & 0x0F;
+  r.holdMs  = get16(buf + 3);
+  return true;
+}
+
+}  // namespace frame
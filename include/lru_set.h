@@ -0,0 +1,40 @@
+/*****************************************************************
+ * AGROSENSE - Fixed-size LRU Set
+ *
+ * Remembers the last N distinct 32-bit keys, most recent first, for
+ * duplicate suppression of relayed LoRa frames on both the gateway and
+ * the field node. Header-only, AVR-safe, no heap; a lookup is a linear
+ * scan, which beats hashing at the handful of entries it is sized for.
+ *****************************************************************/
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+template <uint8_t N>
+class LruSet {
+  static_assert(N > 0, "LruSet needs at least one slot");
+
+ public:
+  /**
+   * Record key as the most recent; the least recent drops out when full
+   * @return bool True if key was already among the last N
+   */
+  bool seen(uint32_t key) {
+    uint8_t i = 0;
+    while (i < count_ && keys_[i] != key) ++i;
+    const bool hit = i < count_;
+    if (!hit && count_ < N) ++count_;
+    if (i == N) i = N - 1;               // Miss on a full set: evict the oldest
+    memmove(keys_ + 1, keys_, i * sizeof(keys_[0]));
+    keys_[0] = key;
+    return hit;
+  }
+
+  void    clear() { count_ = 0; }
+  uint8_t count() const { return count_; }
+
+ private:
+  uint32_t keys_[N];
+  uint8_t  count_ = 0;
+};
@@ -0,0 +1,84 @@
+/*****************************************************************
+ * AGROSENSE - Lightweight Gateway Metrics
+ *
+ * Fixed-bucket histograms cheap enough for the hot path: an add is a
+ * count-leading-zeros and a few stores, no heap, no locks. Log2Hist
+ * serves both stage spans (µs) and end-to-end latencies (ms).
+ *
+ * Every metric has exactly one writer (a task or the RX ISR); a reader
+ * on another core may see one sample half applied, which is fine for
+ * monitoring.
+ *
+ * Values are cumulative since boot, so any two snapshots can be diffed
+ * for a before/after comparison. Header-only; the caller supplies the
+ * clock (the CPU cycle counter on the gateway).
+ *****************************************************************/
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+
+namespace metrics {
+
+// Durations: bucket 0 counts values below 2, bucket i [2^i, 2^(i+1)),
+// the last bucket everything above
+template <uint8_t N>
+struct Log2Hist {
+  static_assert(N >= 2 && N <= 32, "Log2Hist needs 2-32 buckets");
+
+  uint32_t n;
+  uint32_t max;
+  uint32_t sum;                          // Wraps after ~71 min of busy µs; diff snapshots
+  uint32_t b[N];
+
+  void add(uint32_t v) {
+    uint8_t i = v < 2 ? 0 : (uint8_t)(31 - __builtin_clz(v));
+    if (i >= N) i = N - 1;
+    ++b[i];
+    ++n;
+    sum += v;
+    if (v > max) max = v;
+  }
+
+  // Value below which pct % of the samples fall, interpolated linearly
+  // inside its bucket (so good to within the bucket's factor of two)
+  uint32_t percentile(uint8_t pct) const {
+    if (n == 0) return 0;
+    const uint32_t rank = (uint32_t)((uint64_t)n * pct / 100);
+    uint32_t seen = 0;
+    for (uint8_t i = 0; i < N; ++i) {
+      if (seen + b[i] > rank) {
+        const uint32_t lo = i == 0 ? 0 : 1UL << i;
+        uint32_t hi = i == N - 1 ? max : 2UL << i;
+        if (hi > max) hi = max;
+        return lo + (uint32_t)((uint64_t)(hi - lo) * (rank - seen) / b[i]);
+      }
+      seen += b[i];
+    }
+    return max;
+  }
+
+  // Buckets up to the last non-empty one, for trimmed output
+  uint8_t used() const {
+    uint8_t u = N;
+    while (u > 0 && b[u - 1] == 0) --u;
+    return u;
+  }
+};
+
+// Levels: N buckets STEP wide from LO, out-of-range values clamp to the ends
+template <int16_t LO, int16_t STEP, uint8_t N>
+struct LinearHist {
+  static_assert(STEP > 0 && N > 0, "LinearHist needs a positive step");
+
+  uint32_t b[N];
+
+  void add(float v) {
+    if (isnan(v)) return;
+    const float x = floorf((v - LO) / STEP);
+    const uint8_t i = x < 0 ? 0 : x >= N ? N - 1 : (uint8_t)x;
+    ++b[i];
+  }
+};
+
+}  // namespace metrics
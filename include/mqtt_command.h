@@ -0,0 +1,145 @@
+/*****************************************************************
+ * AGROSENSE - MQTT Command Decoding
+ *
+ * Allocation-free handling of the gateway's inbound MQTT messages.
+ *
+ * Per-node topics "<root>/<node>/<leaf>" are split in place, the node
+ * level being a number or "all". Leaves are dispatched through a
+ * compile-time route table: every entry carries the FNV-1a hash and
+ * length of its leaf, so a lookup hashes the incoming leaf once and
+ * only compares bytes on a hit.
+ *
+ * Payloads such as " true " are decoded in place on the client's
+ * buffer: surrounding whitespace is skipped and tokens match
+ * case-insensitively. Nothing is copied, so the payload does not need
+ * a terminator.
+ *****************************************************************/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace mqttcmd {
+
+/* -------------------- Topic Routes -------------------- */
+constexpr uint32_t FNV_BASIS = 2166136261UL;
+constexpr uint32_t FNV_PRIME = 16777619UL;
+
+constexpr uint32_t hashOf(const char* s, uint32_t h = FNV_BASIS) {
+  return *s ? hashOf(s + 1, (h ^ (uint8_t)*s) * FNV_PRIME) : h;
+}
+constexpr uint8_t lenOf(const char* s) { return *s ? 1 + lenOf(s + 1) : 0; }
+
+inline uint32_t hashOf(const char* s, size_t n) {
+  uint32_t h = FNV_BASIS;
+  for (size_t i = 0; i < n; ++i) h = (h ^ (uint8_t)s[i]) * FNV_PRIME;
+  return h;
+}
+
+struct Route {
+  uint32_t    hash;
+  uint8_t     len;
+  const char* topic;
+  uint8_t     id;
+};
+
+#define MQTT_ROUTE(topic, id) { mqttcmd::hashOf(topic), mqttcmd::lenOf(topic), topic, id }
+
+/**
+ * Id of the route matching the n bytes at s
+ * @return uint8_t The route's id, or none if no route matches
+ */
+template <size_t N>
+uint8_t route(const Route (&routes)[N], const char* s, size_t n, uint8_t none) {
+  const uint32_t h = hashOf(s, n);
+  for (size_t i = 0; i < N; ++i) {
+    const Route& r = routes[i];
+    if (r.hash == h && r.len == n && memcmp(r.topic, s, n) == 0) return r.id;
+  }
+  return none;
+}
+
+/* -------------------- Node Topics -------------------- */
+constexpr char ALL_NODES[] = "all";      // Node level addressing every node
+
+struct NodeTopic {
+  uint8_t     nodeId;
+  const char* leaf;                      // Everything after the node level
+  size_t      leafLen;
+};
+
+/**
+ * Split "<root>/<node>/<leaf>" without copying
+ * @param broadcast Node ID reported for the "all" level
+ * @return bool False if the root differs or the node level is not 0-255 or "all"
+ */
+inline bool splitTopic(const char* topic, const char* root, uint8_t broadcast, NodeTopic& t) {
+  const size_t rootLen = strlen(root);
+  if (strncmp(topic, root, rootLen) != 0 || topic[rootLen] != '/') return false;
+  const char* p = topic + rootLen + 1;
+  const char* slash = strchr(p, '/');
+  if (slash == nullptr || slash == p) return false;
+
+  if ((size_t)(slash - p) == sizeof(ALL_NODES) - 1 && memcmp(p, ALL_NODES, sizeof(ALL_NODES) - 1) == 0) {
+    t.nodeId = broadcast;
+  } else {
+    unsigned id = 0;
+    for (const char* d = p; d < slash; ++d) {
+      if (*d < '0' || *d > '9') return false;
+      id = id * 10 + (*d - '0');
+      if (id > 255) return false;
+    }
+    t.nodeId = (uint8_t)id;
+  }
+  t.leaf = slash + 1;
+  t.leafLen = strlen(t.leaf);
+  return true;
+}
+
+/* -------------------- Payload -------------------- */
+struct Payload {
+  const char* text;               // Body without surrounding whitespace
+  size_t      len;
+};
+
+inline bool isSpace(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+inline char upper(char c) { return c >= 'a' && c <= 'z' ? (char)(c - 'a' + 'A') : c; }
+
+inline void trim(const char*& p, size_t& n) {
+  while (n > 0 && isSpace(*p)) { ++p; --n; }
+  while (n > 0 && isSpace(p[n - 1])) --n;
+}
+
+// View of a raw payload without its surrounding whitespace
+inline Payload body(const uint8_t* buf, size_t len) {
+  Payload m = {(const char*)buf, len};
+  trim(m.text, m.len);
+  return m;
+}
+
+// Body equals token, ignoring case; token is given in upper case
+inline bool is(const Payload& m, const char* token) {
+  size_t i = 0;
+  for (; i < m.len; ++i) {
+    if (token[i] == '\0' || upper(m.text[i]) != token[i]) return false;
+  }
+  return token[i] == '\0';
+}
+
+/**
+ * Body as a non-negative whole number
+ * @return bool False if empty or not all digits
+ */
+inline bool toNumber(const Payload& m, float& v) {
+  if (m.len == 0) return false;
+  v = 0;
+  for (size_t i = 0; i < m.len; ++i) {
+    if (!isDigit(m.text[i])) return false;
+    v = v * 10 + (m.text[i] - '0');
+  }
+  return true;
+}
+
+}  // namespace mqttcmd
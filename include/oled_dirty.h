@@ -0,0 +1,71 @@
+/*****************************************************************
+ * AGROSENSE - SSD1306 Dirty-Page Tracker
+ *
+ * The SSD1306 framebuffer is organised in 8-pixel-high pages, one byte
+ * per column per page. Drawing code marks the rectangles it touched;
+ * flush() then reports, per page, the single column span that has to
+ * be resent, so a changed value costs a few dozen bytes of I2C instead
+ * of the whole 1 KB frame.
+ *
+ * Header-only, no heap; the caller does the actual I2C transfer.
+ *****************************************************************/
+#pragma once
+
+#include <stdint.h>
+
+template <uint8_t WIDTH, uint8_t PAGES>
+class DirtyPages {
+  static_assert(WIDTH > 0 && WIDTH < 0xFF, "column span must fit below the EMPTY marker");
+
+ public:
+  DirtyPages() { clear(); }
+
+  // Mark a pixel rectangle; parts outside the display are ignored
+  void mark(int16_t x, int16_t y, int16_t w, int16_t h) {
+    if (w <= 0 || h <= 0) return;
+    int16_t x1 = x + w - 1, y1 = y + h - 1;
+    if (x < 0) x = 0;
+    if (y < 0) y = 0;
+    if (x1 >= WIDTH) x1 = WIDTH - 1;
+    if (y1 >= PAGES * 8) y1 = PAGES * 8 - 1;
+    if (x > x1 || y > y1) return;
+    for (uint8_t p = y / 8; p <= y1 / 8; ++p) {
+      if (x < lo_[p]) lo_[p] = (uint8_t)x;
+      if (x1 > hi_[p] || hi_[p] == EMPTY) hi_[p] = (uint8_t)x1;
+    }
+  }
+
+  void markAll() { mark(0, 0, WIDTH, PAGES * 8); }
+
+  bool any() const {
+    for (uint8_t p = 0; p < PAGES; ++p) {
+      if (hi_[p] != EMPTY) return true;
+    }
+    return false;
+  }
+
+  /**
+   * Report and reset every dirty span
+   * @param send Called as send(page, firstColumn, lastColumn)
+   */
+  template <typename Fn>
+  void flush(Fn send) {
+    for (uint8_t p = 0; p < PAGES; ++p) {
+      if (hi_[p] != EMPTY) send(p, lo_[p], hi_[p]);
+    }
+    clear();
+  }
+
+ private:
+  static constexpr uint8_t EMPTY = 0xFF;  // hi_ value of a clean page
+
+  void clear() {
+    for (uint8_t p = 0; p < PAGES; ++p) {
+      lo_[p] = WIDTH - 1;
+      hi_[p] = EMPTY;
+    }
+  }
+
+  uint8_t lo_[PAGES];  // First dirty column per page
+  uint8_t hi_[PAGES];  // Last dirty column per page, EMPTY if clean
+};
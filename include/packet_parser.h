@@ -0,0 +1,147 @@
+/*****************************************************************
+ * AGROSENSE - Legacy ASCII Uplink Parser
+ *
+ * Single-pass, allocation-free tokenizer for the pre-binary packet
+ * format "Weather:Clear|Temp:24.3|Hum:61.0|Light level:3.2|...".
+ *
+ * The payload is split in place on '|' or ',' and every token's key
+ * is looked up in a compile-time table that maps the canonical tag
+ * and its aliases (Hm, Lux, Lx) onto one field slot. When a packet
+ * carries several aliases for the same field, the table priority
+ * decides which one wins, independent of their order on the wire.
+ *****************************************************************/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+namespace ascii {
+
+/* -------------------- Field Slots -------------------- */
+enum Field : uint8_t {
+  F_WEATHER,
+  F_TEMP,
+  F_HUM,
+  F_LIGHT,
+  F_MOIST,
+  F_VALVE,
+  F_COUNT
+};
+
+/* -------------------- Key Table -------------------- */
+struct Key {
+  const char* tag;
+  uint8_t     len;
+  Field       slot;
+  uint8_t     prio;   // 0 = canonical tag, higher = fallback alias
+};
+
+constexpr uint8_t tagLen(const char* s) { return *s ? 1 + tagLen(s + 1) : 0; }
+
+#define ASCII_KEY(tag, slot, prio) { tag, ascii::tagLen(tag), slot, prio }
+
+constexpr Key KEYS[] = {
+  ASCII_KEY("Weather",     F_WEATHER, 0),
+  ASCII_KEY("Temp",        F_TEMP,    0),
+  ASCII_KEY("Hum",         F_HUM,     0),
+  ASCII_KEY("Hm",          F_HUM,     1),
+  ASCII_KEY("Light level", F_LIGHT,   0),
+  ASCII_KEY("Lux",         F_LIGHT,   1),
+  ASCII_KEY("Lx",          F_LIGHT,   2),
+  ASCII_KEY("Moisture",    F_MOIST,   0),
+  ASCII_KEY("Valve",       F_VALVE,   0),
+};
+constexpr size_t KEY_COUNT = sizeof(KEYS) / sizeof(KEYS[0]);
+
+#undef ASCII_KEY
+
+/* -------------------- Parsed Result -------------------- */
+constexpr size_t TEXT_LEN = 16;   // Max stored length of string fields + NUL
+
+struct Fields {
+  char  weather[TEXT_LEN];
+  char  valve[TEXT_LEN];
+  float temp;
+  float hum;
+  float light;
+  float moist;
+  uint8_t present;                // Bitmask of (1 << Field) found
+};
+
+/* -------------------- Internals -------------------- */
+inline const Key* lookup(const char* k, size_t n) {
+  for (size_t i = 0; i < KEY_COUNT; ++i) {
+    if (KEYS[i].len == n && memcmp(KEYS[i].tag, k, n) == 0) return &KEYS[i];
+  }
+  return nullptr;
+}
+
+inline float toNumber(const char* v) {
+  char* end;
+  float f = strtof(v, &end);
+  return end == v ? NAN : f;      // No digits => missing, not zero
+}
+
+inline void copyText(char* dst, const char* src, size_t n) {
+  while (n > 0 && src[n - 1] == ' ') --n;
+  if (n >= TEXT_LEN) n = TEXT_LEN - 1;
+  memcpy(dst, src, n);
+  dst[n] = '\0';
+}
+
+/* -------------------- Parser -------------------- */
+/**
+ * Parse a printable-ASCII payload in place (separators become NUL)
+ * @param buf Payload bytes, modified by the call; needs room for a
+ *            terminator at buf[len]
+ * @param len Payload length
+ * @param out Parsed fields; missing numbers are NAN, missing text is ""
+ * @return uint8_t Bitmask of fields found
+ */
+inline uint8_t parse(char* buf, size_t len, Fields& out) {
+  uint8_t prio[F_COUNT];
+  memset(prio, 0xFF, sizeof(prio));
+  out.weather[0] = out.valve[0] = '\0';
+  out.temp = out.hum = out.light = out.moist = NAN;
+  out.present = 0;
+
+  size_t i = 0;
+  while (i < len) {
+    while (i < len && buf[i] == ' ') ++i;
+
+    // Token spans [i, end), key spans [i, colon)
+    size_t end = i, colon = len;
+    while (end < len && buf[end] != '|' && buf[end] != ',') {
+      if (buf[end] == ':' && colon == len) colon = end;
+      ++end;
+    }
+
+    if (colon < end) {
+      const Key* k = lookup(buf + i, colon - i);
+      if (k && k->prio < prio[k->slot]) {
+        size_t v = colon + 1;
+        while (v < end && buf[v] == ' ') ++v;
+        buf[end] = '\0';               // Terminate value for strtof
+
+        prio[k->slot] = k->prio;
+        out.present |= 1 << k->slot;
+        switch (k->slot) {
+          case F_WEATHER: copyText(out.weather, buf + v, end - v); break;
+          case F_VALVE:   copyText(out.valve,   buf + v, end - v); break;
+          case F_TEMP:    out.temp  = toNumber(buf + v); break;
+          case F_HUM:     out.hum   = toNumber(buf + v); break;
+          case F_LIGHT:   out.light = toNumber(buf + v); break;
+          case F_MOIST:   out.moist = toNumber(buf + v); break;
+          default: break;
+        }
+      }
+    }
+    i = end + 1;
+  }
+  return out.present;
+}
+
+}  // namespace ascii
@@ -0,0 +1,75 @@
+/*****************************************************************
+ * AGROSENSE - Incremental Rollup Buckets
+ *
+ * Running min / max / mean / last per field over a time bucket. The
+ * statistics merge exactly, so a long bucket (15 min) is built by
+ * folding in closed short buckets (1 min) and no raw samples are kept.
+ *
+ * Header-only, fixed size, no heap. NaN samples (failed sensor reads)
+ * are skipped per field rather than poisoning the aggregate.
+ *****************************************************************/
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+
+namespace rollup {
+
+struct Stat {
+  float    min, max, sum, last;
+  uint16_t n;
+
+  void reset() { min = max = sum = last = 0; n = 0; }
+
+  void add(float v) {
+    if (isnan(v)) return;
+    if (n == 0 || v < min) min = v;
+    if (n == 0 || v > max) max = v;
+    sum += v;
+    last = v;
+    ++n;
+  }
+
+  // Fold in a later bucket of the same field
+  void merge(const Stat& o) {
+    if (o.n == 0) return;
+    if (n == 0 || o.min < min) min = o.min;
+    if (n == 0 || o.max > max) max = o.max;
+    sum += o.sum;
+    last = o.last;
+    n += o.n;
+  }
+
+  bool  empty() const { return n == 0; }
+  float mean()  const { return n ? sum / n : NAN; }
+};
+
+template <uint8_t FIELDS>
+struct Bucket {
+  uint32_t start;        // Bucket start, epoch seconds (aligned)
+  uint16_t samples;      // Readings folded in, including partial ones
+  Stat     f[FIELDS];
+
+  void reset(uint32_t s) {
+    start = s;
+    samples = 0;
+    for (uint8_t i = 0; i < FIELDS; ++i) f[i].reset();
+  }
+
+  bool open() const { return samples != 0; }
+
+  void add(const float (&v)[FIELDS]) {
+    for (uint8_t i = 0; i < FIELDS; ++i) f[i].add(v[i]);
+    ++samples;
+  }
+
+  void merge(const Bucket& o) {
+    for (uint8_t i = 0; i < FIELDS; ++i) f[i].merge(o.f[i]);
+    samples += o.samples;
+  }
+};
+
+// Start of the SPAN-second bucket containing t
+constexpr uint32_t align(uint32_t t, uint32_t span) { return t - t % span; }
+
+}  // namespace rollup
@@ -0,0 +1,45 @@
+/*****************************************************************
+ * AGROSENSE - Fixed-size Sample Ring
+ *
+ * Keeps the last N sensor samples in a static array so the field
+ * node can sample on its own cadence and the TX path only reads
+ * already-filtered values. Header-only, AVR-safe, no heap.
+ *****************************************************************/
+#pragma once
+
+#include <stdint.h>
+
+template <typename T, uint8_t N>
+class SampleRing {
+  static_assert(N > 0, "SampleRing needs at least one slot");
+
+ public:
+  void push(T v) {
+    buf_[head_] = v;
+    head_ = (head_ + 1) % N;
+    if (count_ < N) ++count_;
+  }
+
+  // Forget all samples (e.g. they went stale while the node slept)
+  void clear() { head_ = 0; count_ = 0; }
+
+  uint8_t count() const { return count_; }
+  bool    empty() const { return count_ == 0; }
+
+  // i = 0 is the newest sample, i = count() - 1 the oldest
+  T at(uint8_t i) const { return buf_[(head_ + N - 1 - i) % N]; }
+  T latest() const { return at(0); }
+
+  // Arithmetic mean in a wider accumulator (int32 for ADC counts)
+  template <typename Acc>
+  Acc sum() const {
+    Acc s = 0;
+    for (uint8_t i = 0; i < count_; ++i) s += buf_[i];
+    return s;
+  }
+
+ private:
+  T       buf_[N];
+  uint8_t head_  = 0;
+  uint8_t count_ = 0;
+};
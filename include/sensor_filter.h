@@ -0,0 +1,77 @@
+/*****************************************************************
+ * AGROSENSE - Fixed-point Analog Filter Chain
+ *
+ * Three stages, all in static storage and integer math (AVR-safe):
+ *   1. Oversample/decimate: sum OVERSAMPLE raw ADC reads into one
+ *      value (also gains ~log4(OVERSAMPLE) bits of resolution)
+ *   2. Median of the last MEDIAN_K decimated values, rejecting the
+ *      single-sample spikes a long soil-probe lead picks up
+ *   3. EMA with alpha = 1 / 2^EMA_SHIFT for a steady trend
+ *
+ * Feed it one raw read at a time with add(); the caller spreads those
+ * reads over idle loop time instead of taking a burst per uplink.
+ *****************************************************************/
+#pragma once
+
+#include <stdint.h>
+
+template <uint8_t OVERSAMPLE, uint8_t MEDIAN_K, uint8_t EMA_SHIFT>
+class AnalogFilter {
+  static_assert(OVERSAMPLE >= 1 && OVERSAMPLE <= 64, "10-bit sums must fit uint16");
+  static_assert(MEDIAN_K >= 1 && MEDIAN_K <= 15 && (MEDIAN_K & 1), "median window must be odd");
+  static_assert(EMA_SHIFT <= 8, "EMA shift too large");
+
+  static constexpr uint8_t FRAC = 8;      // Extra fractional bits held by the EMA
+
+ public:
+  /**
+   * Feed one raw ADC read
+   * @return bool True when this read completed a decimated sample
+   */
+  bool add(uint16_t raw) {
+    acc_ += raw;
+    if (++accN_ < OVERSAMPLE) return false;
+
+    window_[head_] = acc_;
+    head_ = (head_ + 1) % MEDIAN_K;
+    if (fill_ < MEDIAN_K) ++fill_;
+    acc_ = 0;
+    accN_ = 0;
+
+    const int32_t m = (int32_t)median() << FRAC;
+    if (!primed_) {
+      ema_ = m;                           // Seed with the first value, not 0
+      primed_ = true;
+    } else {
+      ema_ += (m - ema_) >> EMA_SHIFT;
+    }
+    return true;
+  }
+
+  bool ready() const { return primed_; }
+
+  // Filtered value in raw ADC counts (fractional)
+  float counts() const { return ema_ / (float)((int32_t)OVERSAMPLE << FRAC); }
+
+ private:
+  uint16_t median() const {
+    uint16_t s[MEDIAN_K];
+    for (uint8_t i = 0; i < fill_; ++i) s[i] = window_[i];
+    // Insertion sort; K is tiny
+    for (uint8_t i = 1; i < fill_; ++i) {
+      uint16_t v = s[i];
+      uint8_t j = i;
+      for (; j > 0 && s[j - 1] > v; --j) s[j] = s[j - 1];
+      s[j] = v;
+    }
+    return s[fill_ / 2];
+  }
+
+  uint16_t acc_   = 0;
+  uint8_t  accN_  = 0;
+  uint16_t window_[MEDIAN_K];             // Decimated sums (counts x OVERSAMPLE)
+  uint8_t  head_  = 0;
+  uint8_t  fill_  = 0;
+  int32_t  ema_   = 0;                    // Q(FRAC), counts x OVERSAMPLE
+  bool     primed_ = false;
+};
@@ -0,0 +1,84 @@
+/*****************************************************************
+ * AGROSENSE - Lock-free Single-Producer/Single-Consumer Queue
+ *
+ * Fixed-capacity ring used to hand data between the gateway's
+ * FreeRTOS tasks without mutexes or heap allocation. Exactly one
+ * task (or ISR) may push and exactly one task may pop.
+ *
+ * Capacity must be a power of two; indices run freely and are
+ * masked on access, so the full ring of N slots is usable.
+ *
+ * For large items (raw radio frames) the in-place API avoids the
+ * extra copy: the producer fills acquire() then commit()s, the
+ * consumer reads front() then release()s.
+ *****************************************************************/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+template <typename T, size_t N>
+class SpscQueue {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+
+ public:
+  /**
+   * Producer side: copy item into the ring
+   * @return bool False if the ring is full (item is dropped)
+   */
+  bool push(const T& item) {
+    const uint32_t head = head_.load(std::memory_order_relaxed);
+    const uint32_t tail = tail_.load(std::memory_order_acquire);
+    if (head - tail >= N) return false;
+    slots_[head & (N - 1)] = item;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Consumer side: move the oldest item into out
+   * @return bool False if the ring is empty
+   */
+  bool pop(T& out) {
+    const uint32_t tail = tail_.load(std::memory_order_relaxed);
+    const uint32_t head = head_.load(std::memory_order_acquire);
+    if (head == tail) return false;
+    out = slots_[tail & (N - 1)];
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Producer side, in place: slot to fill, or nullptr if full.
+   * Nothing is visible to the consumer until commit().
+   */
+  T* acquire() {
+    const uint32_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) >= N) return nullptr;
+    return &slots_[head & (N - 1)];
+  }
+  void commit() { head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+  /**
+   * Consumer side, in place: oldest item, or nullptr if empty.
+   * The slot stays owned by the consumer until release().
+   */
+  T* front() {
+    const uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (head_.load(std::memory_order_acquire) == tail) return nullptr;
+    return &slots_[tail & (N - 1)];
+  }
+  void release() { tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+  bool   empty() const { return size() == 0; }
+  size_t size() const {
+    return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+  }
+  static constexpr size_t capacity() { return N; }
+
+ private:
+  T slots_[N];
+  std::atomic<uint32_t> head_{0};  // Next slot to write (producer-owned)
+  std::atomic<uint32_t> tail_{0};  // Next slot to read (consumer-owned)
+};
@@ -8,11 +8,64 @@
  * 
  * Features:
  * - Two-way LoRa communication with field nodes
- * - MQTT integration for remote monitoring and control
+ * - Acknowledged valve commands with exponential-backoff retransmit;
+ *   delivery status and latency published on IoT-G9/cmd/status
+ * - Multi-node: per-node state table, addressed valve commands and a
+ *   per-node topic tree IoT-G9/<node>/{telemetry,valve,cmd,cfg/...},
+ *   "all" addressing every node
+ * - MQTT integration for remote monitoring and control; readings are
+ *   batched into one JSON array per node and flush window, valve state
+ *   is folded into each reading and IoT-G9/<node>/valve only carries
+ *   changes; both are retained so dashboards start with the last state
+ * - Per-topic payload format: JSON, or MessagePack with numeric keys and
+ *   epoch-millisecond timestamps (decoded by the Node-RED flow)
  * - Real-time environmental monitoring (temp, humidity, light, soil)
- * - Automatic/Manual irrigation control based on conditions
- * - OLED display with custom icons for visual feedback
- * - NTP time synchronization
+ * - Automatic/Manual irrigation control based on conditions; auto mode
+ *   runs per-node rules (hysteresis, dwell times, time-of-day window)
+ *   pushed over MQTT and compiled to integer predicate tables
+ * - OLED display with custom icons for visual feedback; retained-mode
+ *   cells redraw only changed values and push only dirty SSD1306 pages,
+ *   with a separate 1 Hz clock tick
+ * - Metrics: cycle-counter spans per stage in log2 histograms, RX/TX,
+ *   CRC, drop and reconnect counters, RSSI/SNR spread, heap and stack
+ *   high-water marks, published on IoT-G9/metrics every minute
+ * - End-to-end latency tracing: node-local delays from the frame trace
+ *   trailer pinned to gateway receive times, per-hop percentiles for
+ *   sample -> publish and MQTT command -> servo -> check-in
+ * - NTP time synchronization; the clock is carried across resets in RTC
+ *   memory so readings are dated before the first sync
+ * - Fast boot: radio up and buffering before the display and network,
+ *   Wi-Fi rejoins on the BSSID/channel cached in NVS without a scan
+ * - Non-blocking Wi-Fi/MQTT reconnects with jittered exponential backoff;
+ *   radio, ACKs and auto irrigation keep running through an outage
+ * - Store-and-forward: readings that cannot be published are appended to
+ *   a bounded LittleFS queue and replayed at a fixed rate on reconnect,
+ *   keeping their original receive timestamps
+ * - Edge rollups: per-node min/max/mean/last over 1-minute and 15-minute
+ *   buckets on their own topics; raw publishing can be switched off
+ * - Pinned FreeRTOS tasks: radio on APP core, network/display on
+ *   PRO core, linked by lock-free SPSC queues so a slow broker or
+ *   Wi-Fi reconnect never stalls LoRa reception
+ * - Compact binary uplink decoding (include/lora_frame.h); the legacy
+ *   ASCII "Weather:...|Temp:..." format only with AUTH_FRAMES off
+ * - Adaptive data rate from per-node SNR: TX power per node, one shared
+ *   SF set by the weakest node and switched in step with every node
+ * - Report-by-exception delta uplinks rebuilt against each node's last
+ *   full frame, so MQTT always carries complete readings
+ * - Sleeping (FLAG_RX_WINDOW) nodes: downlinks are held per node and
+ *   released one per RX window right after that node's own frames
+ * - Remote configuration: versioned JSON settings on cfg/node and cfg/net,
+ *   kept in NVS and applied live; node cadence goes out as an ACKed
+ *   config downlink, bandwidth / coding rate as a timed link switch
+ * - Two-channel RX with an optional second SX127x on HSPI: nodes split
+ *   or hop over the channel plan (include/channel_plan.h) and each
+ *   node is answered on the channel it was last heard on
+ * - Relayed frames from out-of-range plots are unwrapped, and every
+ *   uplink is deduplicated on (node, sequence) before publishing, so a
+ *   reading heard both directly and through relays goes out once
+ * - Authenticated binary frames (include/frame_auth.h): uplinks are
+ *   checked against a per-node counter and a truncated AES-CMAC before
+ *   they are parsed, and every binary downlink is signed
  * 
  * Author: Nimesh, Pamith and Udith
  * Last Updated: May 2025
@@ -23,6 +76,8 @@
 #include <SPI.h>          // For LoRa and OLED communication
 #include <LoRa.h>         // LoRa radio functionality
 #include <WiFi.h>         // WiFi connectivity
+#include <LittleFS.h>     // Flash file system for the telemetry backlog
+#include <Preferences.h>  // NVS for the cached access point
 #include <PubSubClient.h> // MQTT client
 
 // Display and Graphics
@@ -34,6 +89,24 @@
 #include <ArduinoJson.h>      // JSON parsing/creation
 #include <time.h>             // Time functions
 #include <sys/time.h>         // System time utilities
+#include <freertos/FreeRTOS.h> // RTOS tasks and notifications
+#include <freertos/task.h>
+
+// Protocol
+#include "lora_frame.h"       // Binary LoRa uplink format
+#include "packet_parser.h"    // Allocation-free legacy ASCII parser
+#include "spsc_queue.h"       // Lock-free inter-task queues
+#include "airtime.h"          // Airtime calculator + duty-cycle budget
+#include "oled_dirty.h"       // Partial SSD1306 flushes
+#include "backoff.h"          // Reconnect scheduling
+#include "flash_queue.h"      // Store-and-forward telemetry backlog
+#include "rollup.h"           // Min/max/mean/last buckets
+#include "irrigation_rules.h" // Compiled auto-mode predicates
+#include "metrics.h"          // Stage timing histograms
+#include "mqtt_command.h"     // In-place MQTT command decoding
+#include "channel_plan.h"     // Uplink channels and node hopping
+#include "lru_set.h"          // Relayed duplicate suppression
+#include "frame_auth.h"       // Frame MIC and replay counters
 
 /* -------------------- Custom Icons (8x8 pixels) -------------------- */
 // Weather and sensor emojis (8x8 pixels)
@@ -101,12 +174,31 @@ const char* WIFI_PASS = "lfbn7105";
 const char* MQTT_HOST = "test.mosquitto.org";
 const uint16_t MQTT_PORT = 1883;
 
-// MQTT Topics
-const char* PUB_TOPIC = "IoT-G9";          // Main sensor data publication
-const char* VAL_TOPIC = "IoT-G9/valve";     // Valve status updates
-const char* CMD_TOPIC = "IoT-G9/cmd";       // Command reception
-const char* SOIL_TOPIC = "IoT-G9/soil";     // Soil threshold settings
-const char* MODE_TOPIC = "IoT-G9/mode";     // Operation mode control
+// MQTT Topics; each node's state and control live under TOPIC_ROOT/<node>/
+constexpr char TOPIC_ROOT[] = "IoT-G9";
+constexpr char TELEMETRY_LEAF[] = "telemetry";   // Retained: the node's latest readings
+constexpr char VALVE_LEAF[] = "valve";           // Retained: OPEN/CLOSE, sent on change
+constexpr size_t TOPIC_LEN = 32;                 // Longest per-node topic + NUL
+constexpr char STATUS_TOPIC[] = "IoT-G9/cmd/status"; // Command delivery reports
+constexpr char ROLLUP_SHORT_TOPIC[] = "IoT-G9/rollup/1m";  // 1-minute aggregates
+constexpr char ROLLUP_LONG_TOPIC[] = "IoT-G9/rollup/15m";  // 15-minute aggregates
+constexpr char METRICS_TOPIC[] = "IoT-G9/metrics";          // Gateway health snapshot
+constexpr char LATENCY_TOPIC[] = "IoT-G9/metrics/latency";  // Per-hop end-to-end latency
+
+// Inbound leaves below TOPIC_ROOT/<node>/, <node> being an ID or "all";
+// dispatched by hash in mqttCallback
+enum InTopic : uint8_t { IN_CMD, IN_SOIL, IN_MODE, IN_RULE, IN_NODE_CFG, IN_NET_CFG, IN_NONE };
+constexpr mqttcmd::Route IN_ROUTES[] = {
+  MQTT_ROUTE("cmd",      IN_CMD),        // TRUE/FALSE: open or close the valve
+  MQTT_ROUTE("cfg/soil", IN_SOIL),       // Whole number: stock rule at this threshold
+  MQTT_ROUTE("cfg/mode", IN_MODE),       // TRUE = auto, FALSE = manual
+  MQTT_ROUTE("cfg/rule", IN_RULE),       // JSON auto-mode rule
+  MQTT_ROUTE("cfg/node", IN_NODE_CFG),   // JSON node settings, versioned
+  MQTT_ROUTE("cfg/net",  IN_NET_CFG),    // JSON network settings, versioned ("all" only)
+};
+// One wildcard per inbound subtree; "IoT-G9/+/+" would also bring back
+// every telemetry batch and valve state the gateway publishes itself
+const char* const SUBSCRIPTIONS[] = {"IoT-G9/+/cmd", "IoT-G9/+/cfg/#"};
 
 /* -------------------- System Configuration -------------------- */
 // NTP Settings
@@ -114,379 +206,3172 @@ const char* NTP_SERVER = "pool.ntp.org";
 const long GMT_OFFSET_SEC = 5 * 3600 + 30 * 60;  // Sri Lanka GMT+5:30
 const int DAYLIGHT_OFFSET_SEC = 0;
 
-// LoRa Radio Configuration
-constexpr long RF_FREQ = 433E6;             // 433 MHz frequency band
+// LoRa Radio Configuration: primary radio on VSPI, channel 0
 constexpr uint8_t SYNC_WORD = 0xA5;         // LoRa sync word
 constexpr gpio_num_t L_CS = GPIO_NUM_5;     // Chip select
 constexpr gpio_num_t L_RST = GPIO_NUM_14;   // Reset
 constexpr gpio_num_t L_DIO0 = GPIO_NUM_26;  // Interrupt
 
+// Second SX127x on HSPI, channel 1. Probed at boot; without it the
+// gateway listens on channel 0 alone. Field nodes are built for the
+// number of channels the gateway listens on (CHANNELS there).
+constexpr bool SECOND_RADIO = true;
+constexpr uint8_t RADIOS = 2;               // Radios, hence channels, at most
+constexpr gpio_num_t L2_SCK = GPIO_NUM_25;
+constexpr gpio_num_t L2_MISO = GPIO_NUM_32;
+constexpr gpio_num_t L2_MOSI = GPIO_NUM_33;
+constexpr gpio_num_t L2_CS = GPIO_NUM_15;
+constexpr gpio_num_t L2_RST = GPIO_NUM_27;
+constexpr gpio_num_t L2_DIO0 = GPIO_NUM_4;
+
+// Link settings, must match the field nodes at boot; airtime is computed
+// from the same profile the radio is configured with
+typedef airtime::Profile<7, 125000, 5> LinkProfile;  // SF7 / 125 kHz / 4:5
+constexpr uint16_t DUTY_PERMILLE = 90;               // 9 % long-run airtime
+constexpr uint32_t DUTY_BURST_US = 36000000UL;       // 36 s bucket => <= 10 % in any hour
+
+// MQTT Publishing: readings are collected and sent as one JSON array when
+// the batch is full or its oldest reading has waited PUBLISH_FLUSH_MS
+constexpr uint32_t PUBLISH_FLUSH_MS = 1000;
+constexpr size_t PUBLISH_BATCH_MAX = 8;
+constexpr size_t PUBLISH_ITEM_MAX = 160;     // Worst-case serialized reading
+constexpr size_t PUBLISH_BUF_LEN = PUBLISH_BATCH_MAX * PUBLISH_ITEM_MAX;
+constexpr time_t VALID_EPOCH = 1600000000;   // Before this, NTP has not synced
+
+// Payload encoding per published topic. JSON keeps named keys and a
+// formatted local timestamp; MessagePack uses the one-character numeric
+// keys below and epoch milliseconds, about half the size on the wire.
+enum PayloadFormat : uint8_t { FORMAT_JSON, FORMAT_MSGPACK };
+constexpr PayloadFormat PUB_FORMAT = FORMAT_JSON;
+constexpr PayloadFormat STATUS_FORMAT = FORMAT_JSON;
+
+enum ReadingKey : uint8_t { RK_NODE, RK_WEATHER, RK_TEMP, RK_HUM, RK_LIGHT, RK_MOIST, RK_VALVE, RK_TIME };
+const char* const READING_KEYS[][8] = {
+  {"node", "weather", "temp", "hum", "light", "moist", "valve", "timestamp"},
+  {"0", "1", "2", "3", "4", "5", "6", "7"},
+};
+enum StatusKey : uint8_t { SK_NODE, SK_SEQ, SK_CMD, SK_STATUS, SK_ATTEMPTS, SK_LATENCY };
+const char* const STATUS_KEYS[][6] = {
+  {"node", "seq", "cmd", "status", "attempts", "latency_ms"},
+  {"0", "1", "2", "3", "4", "5"},
+};
+
 // OLED Display Settings
-Adafruit_SSD1306 oled(128, 64, &Wire, -1);  // 128x64 OLED
-constexpr uint32_t OLED_INTERVAL = 250;      // Display refresh interval
+constexpr uint8_t OLED_WIDTH = 128;
+constexpr uint8_t OLED_HEIGHT = 64;
+constexpr uint8_t OLED_ADDR = 0x3C;
+Adafruit_SSD1306 oled(OLED_WIDTH, OLED_HEIGHT, &Wire, -1);  // 128x64 OLED
+constexpr uint32_t OLED_INTERVAL = 250;      // Display refresh interval at boot
+constexpr uint32_t OLED_PAGE_MS = 3000;      // Time per node page when rotating
+constexpr size_t OLED_I2C_CHUNK = 32;        // Data bytes per I2C transaction
+
+// Field Node Table
+constexpr size_t MAX_NODES = 32;             // Field nodes served by this gateway
+constexpr float DEFAULT_SOIL_THRESHOLD = 30.0;
+
+// Stock auto-mode rule, rebuilt from the cfg/soil threshold: open when
+// drier than the threshold, close once AUTO_SOIL_HYSTERESIS wetter, when
+// it rains or when the light is above AUTO_LIGHT_MAX
+constexpr float AUTO_SOIL_HYSTERESIS = 5.0;
+constexpr float AUTO_LIGHT_MAX = 8.5;
+constexpr uint16_t AUTO_MIN_ON_S = 120;      // Default dwell before closing
+constexpr uint16_t AUTO_MIN_OFF_S = 300;     // Default dwell before reopening
+
+// Command Delivery (ACK + retransmit)
+// First retransmit timeout (doubles per attempt) is command + ACK airtime
+// at the current SF plus node turnaround
+constexpr uint32_t CMD_TURNAROUND_MS = 200;
+constexpr uint8_t CMD_MAX_ATTEMPTS = 5;      // Give up after this many transmissions
+// Nodes flagging FLAG_RX_WINDOW sleep between uplinks: their commands wait
+// for the window after the node's next frame, one attempt per window
+constexpr uint32_t RX_WINDOW_SWITCH_MS = 10 * 60000UL; // SF switch lead covering a few of their heartbeats
+
+// Relaying: frames seen recently, by frame::frameId, so a copy arriving
+// direct and through relays is handled once. Relays forward within
+// RELAY_HOLD_MAX_MS per hop, well inside the window at full traffic.
+constexpr uint8_t RECENT_FRAMES = 32;
+
+// Frame authentication: binary frames carry a counter and a MIC under
+// the network key, which must match the field nodes'. With it on, only
+// frames from nodes built with AUTH_FRAMES are accepted; legacy ASCII
+// uplinks are dropped. Counters are kept per node and go to NVS once per
+// AUTH_RESERVE frames: a floor above the uplinks accepted so far, which
+// is all a reboot lets through, and a reservation above the downlinks
+// sent, which a reboot resumes from.
+constexpr bool AUTH_FRAMES = true;
+const uint8_t NETWORK_KEY[auth::KEY_LEN] = {
+  0x3a, 0x91, 0x5e, 0xc4, 0x07, 0xd2, 0x6b, 0xf8, 0x21, 0x4c, 0xa7, 0x90, 0xe5, 0x1f, 0x68, 0xb3,
+};
+constexpr uint32_t AUTH_RESERVE = 256;
+constexpr size_t AUTH_LEN = AUTH_FRAMES ? auth::TRAILER_LEN : 0;  // Added to every binary frame
+
+// Adaptive Data Rate. One SX127x demodulates one SF at a time, so the SF
+// is shared by the network and set by its weakest node; TX power is per node.
+constexpr uint8_t ADR_MIN_SF = LinkProfile::SF;
+constexpr uint8_t ADR_MAX_SF = frame::SF_FALLBACK;
+constexpr float ADR_MARGIN_DB = 10.0;        // Installation margin above the demod floor
+constexpr float ADR_STEP_DB = 3.0;           // TX power granularity
+constexpr float ADR_HYSTERESIS_DB = 3.0;     // Extra headroom before a faster SF
+constexpr float ADR_ALPHA = 0.25;            // Link quality EWMA weight
+constexpr uint8_t ADR_MIN_SAMPLES = 8;       // Uplinks at current settings before acting
+constexpr uint32_t ADR_SWITCH_MIN_MS = 10000; // Lead time for a network SF switch
+constexpr uint32_t LINK_LOST_MS = 6 * 60000UL; // Node unheard this long after a switch => fall back
+constexpr uint32_t LINK_CHECK_MS = 10000;
+
+// Store-and-forward Backlog: unpublishable readings are kept in flash as
+// STORE_RECORD_LEN-byte records, STORE_SEG_RECORDS per segment file (one
+// flash block), at most STORE_SEG_MAX segments; the oldest go first
+constexpr const char* STORE_DIR = "/tq";
+constexpr size_t STORE_RECORD_LEN = 46;
+constexpr uint16_t STORE_SEG_RECORDS = 64;          // 2944 B per segment
+constexpr uint16_t STORE_SEG_MAX = 128;             // ~8k readings, ~370 KB
+constexpr uint32_t STORE_DRAIN_MS = 500;            // One replay batch per interval
+constexpr uint8_t STORE_TIME_VALID = 1 << 0;        // Record holds epoch ms, else rxMillis
+
+// Edge Rollups: per-node min/max/mean/last over wall-clock aligned
+// buckets, published as JSON when a bucket closes. Readings without a
+// valid clock (before the first NTP sync) are not aggregated.
+constexpr bool PUBLISH_RAW = true;                  // Also publish every reading on its node's telemetry topic
+constexpr uint32_t ROLLUP_SHORT_S = 60;
+constexpr uint32_t ROLLUP_LONG_S = 15 * 60;
+constexpr uint32_t ROLLUP_GRACE_S = 5;              // Wait for late readings before closing
+constexpr uint8_t ROLLUP_FIELDS = 4;                // temp, hum, light, moist
+constexpr size_t ROLLUP_BATCH_MAX = 4;              // Aggregates per publish (fits PUBLISH_BUF_LEN)
+constexpr const char* ROLLUP_DIR = "/ru";           // Offline backlog of closed buckets
+constexpr size_t ROLLUP_RECORD_LEN = 40;
+constexpr uint16_t ROLLUP_SEG_RECORDS = 64;
+constexpr uint16_t ROLLUP_SEG_MAX = 32;             // ~2k closed buckets
+constexpr int16_t ROLLUP_NONE = -32767 - 1;         // Field had no valid sample
+
+// Remote Configuration: settings pushed over MQTT are kept in NVS and only
+// taken when their version is newer than the one in place, so the retained
+// copies the broker replays on every reconnect cost no flash write and no
+// downlink. Versions compare in serial number order; 0 means never pushed.
+constexpr const char* CONFIG_NVS = "cfg";
+constexpr uint16_t OLED_MIN_MS = 50;               // Accepted display refresh range
+constexpr uint16_t OLED_MAX_MS = 10000;
+
+// Connection Manager: Wi-Fi and MQTT are (re)established one step at a
+// time from the network task, retrying with jittered exponential backoff
+constexpr uint32_t WIFI_JOIN_TIMEOUT_MS = 15000;  // Association + DHCP per attempt
+constexpr uint32_t WIFI_FAST_JOIN_MS = 4000;      // Join on the cached BSSID/channel, no scan
+constexpr uint32_t RECONNECT_BASE_MS = 1000;
+constexpr uint32_t RECONNECT_MAX_MS = 60000;
+constexpr uint16_t MQTT_SOCKET_TIMEOUT_S = 3;     // Bound on one blocking CONNACK wait
 
 // GPIO Configuration
 constexpr gpio_num_t LED_PIN = GPIO_NUM_2;   // Status LED
 
+// Task Layout (WiFi stack lives on PRO core 0, so radio gets APP core 1)
+constexpr uint32_t RADIO_STACK = 4096;
+constexpr uint32_t NET_STACK = 8192;
+constexpr uint32_t OLED_STACK = 4096;
+constexpr UBaseType_t RADIO_PRIO = 5;        // Highest: must drain FIFO promptly
+constexpr UBaseType_t NET_PRIO = 2;
+constexpr UBaseType_t OLED_PRIO = 1;
+constexpr BaseType_t RADIO_CORE = APP_CPU_NUM;
+constexpr BaseType_t NET_CORE = PRO_CPU_NUM;
+constexpr BaseType_t OLED_CORE = PRO_CPU_NUM;
+
+// Metrics: stage spans in µs from the CPU cycle counter, log2 buckets up
+// to 2^(SPAN_BUCKETS-1) µs; a snapshot goes out every METRICS_INTERVAL_MS
+constexpr uint8_t SPAN_BUCKETS = 20;
+constexpr uint8_t LATENCY_BUCKETS = 20;      // End-to-end hops in ms, up to ~9 min
+constexpr uint32_t METRICS_INTERVAL_MS = 60000;
+constexpr uint32_t LORA_SPI_HZ = 8000000;    // LoRa library default
+constexpr uint8_t REG_RX_HEADER_CNT_LSB = 0x15; // SX127x valid headers since RX entry
+constexpr uint8_t REG_RX_PACKET_CNT_LSB = 0x17; // SX127x valid (CRC good) packets since RX entry
+constexpr uint8_t REG_PKT_SNR_VALUE = 0x19;     // SX127x last packet SNR, signed quarter dB
+constexpr uint8_t REG_IRQ_FLAGS = 0x12;         // SX127x IRQ flags, cleared by the LoRa library
+constexpr uint8_t IRQ_PAYLOAD_CRC_ERROR = 0x20;
+constexpr uint8_t IRQ_RX_DONE = 0x40;
+
+// Radio task notification bits
+constexpr uint32_t NOTIFY_RX = 1 << 0;       // DIO0 RxDone fired
+constexpr uint32_t NOTIFY_CMD = 1 << 1;      // Valve command queued
+constexpr uint32_t NOTIFY_RX2 = 1 << 2;      // Second radio's DIO0 RxDone fired
+
+/* -------------------- Shared Types -------------------- */
+// Raw LoRa frame captured in the receive ISR, before any parsing
+struct RawFrame {
+  uint32_t rxMillis;                       // millis() at RxDone
+  int16_t rssi;                            // Packet RSSI (dBm)
+  int8_t snrRaw;                           // REG_PKT_SNR_VALUE: packet SNR in 0.25 dB steps
+  uint8_t channel;                         // Channel (= radio) it was heard on
+  uint8_t len;                             // Payload bytes in data[]
+  uint8_t data[256];                       // Max LoRa payload 255, +1 for parser NUL
+
+  float snr() const { return snrRaw * 0.25f; }  // dB; never in the ISR, which must not touch the FPU
+};
+
+// One decoded uplink, passed by value between tasks
+struct Reading {
+  uint8_t nodeId;                          // Node ID (0 for legacy ASCII)
+  uint16_t seq;                            // Uplink sequence number
+  uint32_t rxMillis;                       // Gateway receive time
+  int16_t rssi;                            // Packet RSSI (dBm)
+  float snr;                               // Packet SNR (dB)
+  char weather[ascii::TEXT_LEN];           // Current weather condition
+  char valve[ascii::TEXT_LEN];             // Valve state
+  float tempC;                             // Temperature in Celsius
+  float humP;                              // Humidity percentage
+  float lux;                               // Light level
+  float moistP;                            // Soil moisture percentage
+  bool raining;                            // Rain sensor wet / weather says rain
+  uint64_t epochMs;                        // Wall-clock receive time, 0 if unknown
+  uint32_t sampleAgeMs;                    // Sample age at rxMillis (trace), UINT32_MAX if unknown
+};
+
+// Control request handed from MQTT (network task) to the radio task
+enum CommandType : uint8_t {
+  CMD_VALVE,                               // flag = open
+  CMD_MODE,                                // flag = manual
+  CMD_THRESHOLD,                           // value = soil threshold %
+};
+
+struct Command {
+  CommandType type;
+  uint8_t nodeId;                          // frame::NODE_BROADCAST = all nodes
+  bool flag;
+  float value;
+  uint32_t issuedAt;                       // millis() the request arrived
+};
+
+// Compiled rule handed from MQTT (network task) to the radio task
+struct RuleUpdate {
+  uint8_t nodeId;                          // frame::NODE_BROADCAST = all nodes
+  rules::Rule rule;
+};
+
+// Settings a node is told about over LoRa, all ACKed like valve commands
+enum PendingKind : uint8_t { PENDING_VALVE, PENDING_LINK, PENDING_CONFIG, PENDING_SYNC };
+
+// Outstanding unicast command awaiting the node's ACK
+struct PendingCmd {
+  bool active;
+  PendingKind kind;
+  bool open;                               // Valve: requested state
+  uint8_t sf;                              // Link: spreading factor
+  int8_t txPower;                          // Link: node TX power (dBm)
+  bool timed;                              // Link: part of a network SF switch
+  uint32_t switchAt;                       // Link: millis() of that switch
+  uint16_t seq;
+  uint8_t attempts;                        // Transmissions so far
+  uint32_t issuedAt;                       // Valve: millis() the request arrived
+  uint32_t firstTx;                        // millis() of first transmission
+  uint32_t nextTx;                         // millis() of next retransmit
+};
+
+// Valve change waiting for the node to report it in an uplink
+struct CheckIn {
+  bool active;
+  bool open;
+  uint32_t issuedAt;                       // millis() the request arrived
+};
+
+// Uplink quality as heard by the gateway, for ADR
+struct LinkState {
+  float snr;                               // EWMA of packet SNR (dB)
+  float rssi;                              // EWMA of packet RSSI (dBm)
+  uint8_t samples;                         // Uplinks since the last settings change
+  uint8_t sf;                              // SF last heard on (0 = given up)
+  int8_t txPower;                          // Node TX power last confirmed
+};
+
+// Per-node settings pushed on cfg/node
+struct NodeConfig {
+  uint16_t version;                        // 0 = never pushed
+  uint16_t intervalS;                      // Node uplink/wake interval, 0 = node's own
+  uint16_t heartbeatS;                     // Node full-frame heartbeat, 0 = node's own
+  float soil;                              // Stock rule: open below this moisture %
+  float lightMax;                          // Stock rule: close above this light level
+};
+
+// Network-wide settings pushed on all/cfg/net
+struct NetConfig {
+  uint16_t version;                        // 0 = never pushed
+  uint8_t sfMin;                           // Range ADR may move the shared SF in
+  uint8_t sfMax;
+  uint32_t bw;                             // Shared bandwidth (Hz), 0 = as booted
+  uint8_t cr;                              // Shared coding rate 4/cr, 0 = as booted
+  uint16_t oledMs;                         // Display refresh interval
+};
+
+// Keys present in a pushed blob; absent ones keep their current value
+enum ConfigField : uint8_t {
+  CFG_INTERVAL  = 1 << 0,
+  CFG_HEARTBEAT = 1 << 1,
+  CFG_SOIL      = 1 << 2,
+  CFG_LIGHT     = 1 << 3,
+  CFG_SF        = 1 << 4,
+  CFG_BW        = 1 << 5,
+  CFG_CR        = 1 << 6,
+  CFG_OLED      = 1 << 7,
+};
+
+// Settings handed from MQTT (network task) to the radio task
+struct ConfigUpdate {
+  uint8_t nodeId;                          // frame::NODE_BROADCAST = all nodes
+  uint8_t fields;                          // CFG_* keys present
+  NodeConfig config;
+};
+
+struct NetConfigUpdate {
+  uint8_t fields;                          // CFG_* keys present
+  NetConfig config;
+};
+
+// A node's pushed settings as kept in NVS
+struct ConfigRecord {
+  uint8_t nodeId;
+  NodeConfig config;
+};
+
+// A node's frame counter bounds, as kept in NVS
+struct CounterRecord {
+  uint8_t nodeId;
+  uint32_t upFloor;                        // Uplinks from here on were never accepted
+  uint32_t downReserved;                   // Downlinks from here on were never sent
+};
+
+// Command outcome handed from the radio task to the network task
+enum DeliveryStatus : uint8_t { DELIVERED, FAILED, SUPERSEDED };
+
+struct DeliveryReport {
+  uint8_t nodeId;
+  uint16_t seq;
+  bool open;                               // Requested valve state
+  DeliveryStatus status;
+  uint8_t attempts;
+  uint32_t latencyMs;                      // First TX to ACK (DELIVERED only)
+};
+
+// A node's valve state as last reported and as last taken by the broker
+struct ValveState {
+  uint8_t nodeId;
+  char live[ascii::TEXT_LEN];
+  char sent[ascii::TEXT_LEN];
+};
+
+// Per-node record owned by the radio task. The hot lookup key lives in
+// a separate dense nodeIds[] array so a scan touches one cache line.
+struct NodeState {
+  Reading last;                            // Last decoded uplink
+  uint32_t lastSeen;                       // millis() of last uplink
+  rules::Rule rule;                        // Compiled auto-mode rule
+  bool manualMode;                         // Operation mode flag
+  bool lastCommand;                        // Last valve command state
+  bool switched;                           // lastCommand was ever changed
+  uint32_t switchedAt;                     // millis() of that change (dwell timing)
+  PendingCmd pending;                      // Unacknowledged valve command
+  PendingCmd linkCmd;                      // Unacknowledged link ADR command
+  PendingCmd cfgCmd;                       // Unacknowledged node config
+  PendingCmd syncCmd;                      // Unacknowledged counter sync
+  NodeConfig config;                       // Pushed settings
+  bool configSynced;                       // Node confirmed config's relayed fields
+  uint8_t channel;                         // Channel last heard on; downlinks go there
+  uint8_t hops;                            // Relays its last frame passed, 0 = heard directly
+  uint8_t relayId;                         // Relay that delivered it, when hops > 0
+  uint32_t upCounter;                      // Highest frame counter accepted from it
+  uint32_t upFloor;                        // In NVS: after a reboot only counters from here pass
+  bool upKnown;                            // upCounter valid (synced or restored); else syncs only
+  bool upResync;                           // Restored, not heard since: a stale frame gets a sync
+  uint32_t downCounter;                    // Next downlink counter for it
+  uint32_t downReserved;                   // Counters below this are reserved in NVS
+  CheckIn checkIn;                         // Valve change not yet seen in an uplink
+  LinkState link;                          // Uplink quality and settings
+  frame::Uplink base;                      // Last full binary uplink (delta base)
+  bool hasBase;
+  bool rxWindow;                           // Sleeps, listens only after its own frames
+  bool windowUsed;                         // A downlink already went into the current window
+  uint32_t windowAt;                       // millis() of its last frame (window start)
+};
+
+// Rollup state per node, owned by the network task
+struct NodeRollup {
+  uint8_t nodeId;
+  rollup::Bucket<ROLLUP_FIELDS> shortB;    // Current 1-minute bucket
+  rollup::Bucket<ROLLUP_FIELDS> longB;     // Current 15-minute bucket, fed by closed shortB
+};
+
+enum NetState : uint8_t { NET_WIFI_DOWN, NET_WIFI_JOINING, NET_MQTT_DOWN, NET_ONLINE };
+
+typedef metrics::Log2Hist<SPAN_BUCKETS> SpanHist;
+typedef metrics::Log2Hist<LATENCY_BUCKETS> LatencyHist;
+
+// Gateway counters and stage timings; the comment names each field's writer
+struct Metrics {
+  uint32_t rxFrames[RADIOS];               // ISR / radio: frames captured, per radio
+  uint32_t crcErrors[RADIOS];              // ISR / radio: frames the radio dropped on CRC
+  uint32_t decodeDrops;                    // Radio: binary frames that did not decode
+  uint32_t queueDrops;                     // Radio: readings lost to a full publish queue
+  uint32_t relayedFrames;                  // Radio: frames that arrived through a relay
+  uint32_t duplicates;                     // Radio: copies of a recent frame, dropped
+  uint32_t authUnsigned;                   // Radio: frames without a valid trailer (ASCII, short)
+  uint32_t authForged;                     // Radio: frames whose MIC did not match
+  uint32_t authUnknown;                    // Radio: frames from nodes not synced yet
+  uint32_t txFrames;                       // Radio: downlinks sent
+  uint32_t txFails;                        // Radio: downlinks refused (budget or radio)
+  uint32_t publishFails;                   // Net: batches the broker did not take
+  uint32_t wifiJoins;                      // Net: successful Wi-Fi joins
+  uint32_t mqttConnects;                   // Net: successful MQTT connects
+  SpanHist isr;                            // ISR: FIFO copy
+  SpanHist rx;                             // Radio: one frame, decode to auto mode
+  SpanHist tx;                             // Radio: one blocking downlink
+  SpanHist publish;                        // Net: one telemetry batch
+  SpanHist callback;                       // Net: one MQTT message
+  SpanHist draw;                           // Display: re-render of changed cells
+  SpanHist flush;                          // Display: I2C push of dirty pages
+  metrics::LinearHist<-140, 10, 12> rssi;  // Radio: dBm, -140 to -20
+  metrics::LinearHist<-20, 4, 8> snr;      // Radio: dB, -20 to +12
+  // End-to-end hops in ms, node delays pinned to gateway receive times
+  LatencyHist sampleRx;                    // Radio: node sample -> gateway RX
+  LatencyHist rxPublish;                   // Net: gateway RX -> broker took it
+  LatencyHist samplePublish;               // Net: node sample -> broker took it
+  LatencyHist cmdQueue;                    // Radio: request -> radio task has it
+  LatencyHist cmdDeliver;                  // Radio: radio task -> node applied it
+  LatencyHist cmdActuate;                  // Radio: request -> node applied it (servo)
+  LatencyHist cmdAck;                      // Radio: node applied -> ACK received
+  LatencyHist cmdCheckIn;                  // Radio: request -> uplink shows the state
+};
+
+// Times the enclosing scope into a histogram
+struct Span {
+  SpanHist& h;
+  uint32_t c0;
+  explicit Span(SpanHist& hist);
+  ~Span();
+};
+
+// Last access point joined, kept in NVS so a cold boot skips the scan
+struct ApCache {
+  bool valid;
+  uint8_t bssid[6];
+  uint8_t channel;
+};
+
+// Wall clock kept in RTC memory, which survives every reset that does not
+// cut power (brownout, watchdog, panic); check rejects power-on garbage
+struct ClockKeep {
+  uint32_t magic;
+  uint32_t epoch;                          // Last saved wall-clock second
+  uint32_t check;                          // magic ^ epoch
+};
+
 /* -------------------- Global Variables -------------------- */
 // Communication Objects
 WiFiClient net;
 PubSubClient mqtt(net);
 
-// System State
-volatile bool packetReady = false;          // LoRa packet received flag
-bool isManualMode = true;                  // Operation mode flag
-bool lastCommand = false;                   // Last valve command state
-static float soilThreshold = 30.0;          // Moisture threshold
+// Connection state, owned by the network task
+NetState netState = NET_WIFI_DOWN;
+Backoff<RECONNECT_BASE_MS, RECONNECT_MAX_MS> wifiBackoff;
+Backoff<RECONNECT_BASE_MS, RECONNECT_MAX_MS> mqttBackoff;
+uint32_t wifiJoinStart = 0;
+bool timeConfigured = false;
+ApCache apCache = {};
+bool wifiFastJoin = false;                  // Current join uses apCache
+Preferences prefs;
+
+constexpr uint32_t CLOCK_MAGIC = 0x41475243; // "AGRC"
+RTC_NOINIT_ATTR ClockKeep clockKeep;
+
+// Telemetry backlog, owned by the network task
+FlashQueue<STORE_RECORD_LEN, STORE_SEG_RECORDS, STORE_SEG_MAX> backlog;
+bool backlogReady = false;
+uint16_t bootSession = 0;                   // Tags records whose time is still unknown
+
+// Metrics, one writer per field (see Metrics)
+Metrics stats = {};
+uint32_t cyclesPerUs = 240;                 // CPU MHz, read in setup()
+
+// Per-node valve topics, owned by the network task
+ValveState valveStates[MAX_NODES];
+size_t valveStateCount = 0;
+
+// Rollups, owned by the network task
+NodeRollup rollups[MAX_NODES];
+size_t rollupCount = 0;
+FlashQueue<ROLLUP_RECORD_LEN, ROLLUP_SEG_RECORDS, ROLLUP_SEG_MAX> rollupBacklog;
+bool rollupBacklogReady = false;
+uint8_t rollupOut[2][MAX_NODES][ROLLUP_RECORD_LEN]; // Closed buckets per span awaiting publish
+size_t rollupOutCount[2] = {0, 0};
 
-// Sensor Data
-String weather = "N/A";                     // Current weather condition
-String valve = "N/A";                       // Valve state
-float tempC = NAN;                         // Temperature in Celsius
-float humP = NAN;                          // Humidity percentage
-float lux = NAN;                           // Light level
-float moistP = NAN;                        // Soil moisture percentage
+// Tasks
+TaskHandle_t radioTaskHandle = nullptr;
+TaskHandle_t netTaskHandle = nullptr;
+TaskHandle_t oledTaskHandle = nullptr;
+
+// Inter-task queues (each has exactly one producer and one consumer)
+SpscQueue<RawFrame, 8> rxRing;              // LoRa ISR -> radio
+SpscQueue<Reading, 8> publishQueue;         // radio -> network
+SpscQueue<Reading, 4> displayQueue;         // radio -> display
+SpscQueue<Command, 8> commandQueue;         // network -> radio
+SpscQueue<RuleUpdate, 4> ruleQueue;         // network -> radio
+SpscQueue<ConfigUpdate, 4> configQueue;     // network -> radio
+SpscQueue<NetConfigUpdate, 2> netConfigQueue; // network -> radio
+SpscQueue<DeliveryReport, 8> statusQueue;   // radio -> network
+
+// Radio task state
+uint8_t nodeIds[MAX_NODES];                 // Node ID of each occupied slot
+NodeState nodes[MAX_NODES];                 // State per slot, same index
+size_t nodeCount = 0;
+NodeState nodeDefaults = {};                // Template for newly seen nodes
+LruSet<RECENT_FRAMES> recentFrames;         // Radio task: frameId of the last frames handled
+const auth::Cmac frameKey(NETWORK_KEY);     // Key schedule and subkeys, built once
+volatile uint32_t rxOverflows = 0;          // Frames lost to a full rxRing
+uint8_t crcSeen = 0;                        // CRC errors already counted since RX entry
+uint16_t cmdSeq = 0;                        // Next valve command sequence
+airtime::DutyCycle dutyCycle(DUTY_PERMILLE, DUTY_BURST_US);
+airtime::Link radioLink = LinkProfile::link(); // Current settings, moved by ADR and cfg/net
+bool sfSwitching = false;                   // Network link switch scheduled
+airtime::Link nextLink = LinkProfile::link(); // Settings being switched to
+LoRaClass radio2;                           // Second SX127x (SECOND_RADIO)
+SPIClass radioSpi2(HSPI);
+uint8_t rxChannels = 1;                     // Channels listened on, 2 once radio2 answered
+volatile uint32_t rx2At = 0;                // millis() of radio2's last RxDone
+uint32_t sfSwitchAt = 0;                    // millis() of the switch
+uint32_t sfChangedAt = 0;                   // millis() of the last switch
+NetConfig netConfig = {};                   // Pushed network settings (see seedNodeDefaults)
+Preferences cfgStore;                       // NVS for pushed settings and the radio link
+bool configDirty = false;                   // Pushed settings changed since the last NVS write
+
+// Display refresh interval, set by the radio task from cfg/net
+volatile uint32_t oledInterval = OLED_INTERVAL;
 
 /* -------------------- Function Prototypes -------------------- */
+// Tasks
+void radioTask(void*);
+TickType_t radioPass(uint32_t bits);
+void networkTask(void*);
+void displayTask(void*);
+
 // Network Functions
-void connectWiFi();
-void connectMQTT();
+bool serviceConnection(uint32_t now);
+void onWiFiLost(uint32_t now);
+bool connectMQTT();
+void loadApCache();
+void saveApCache();
+void restoreClock();
+void keepClock();
+void applyTimeZone();
 void mqttCallback(char* topic, byte* payload, unsigned int len);
+void handleRuleMessage(uint8_t nodeId, const byte* payload, unsigned len);
+bool compileRule(JsonObjectConst, rules::Rule&);
+bool compileTerms(JsonArrayConst, rules::Rule&, bool on);
+void handleConfigMessage(uint8_t nodeId, bool network, const byte* payload, unsigned len);
+bool parseNodeConfig(JsonObjectConst, ConfigUpdate&);
+bool parseNetConfig(JsonObjectConst, NetConfigUpdate&);
+
+// Radio Functions
+void handleUplink(RawFrame&);
+bool authenticate(RawFrame&);
+void acceptCounter(NodeState&, uint32_t counter);
+size_t signDownlink(NodeState&, uint8_t* pkt, size_t len, size_t cap);
+void handleSyncRequest(uint8_t id, const frame::Sync&, const RawFrame&, const frame::Relay&);
+void resyncNode(uint8_t id, NodeState&, const RawFrame&);
+void sendSyncCommand(uint8_t id, NodeState&);
+void applyCommand(const Command&);
+NodeState* findNode(uint8_t id, bool create);
+void seedNodeDefaults();
+void runAutoMode(uint8_t id, NodeState&);
+void applyRule(const RuleUpdate&);
+rules::Rule stockRule(float soilThreshold, float lightMax);
+void sendValveCommand(uint8_t id, bool open, const char* origin, uint32_t issuedAt);
+bool transmitCommand(uint8_t id, NodeState&, const PendingCmd&);
+bool transmitFrame(uint8_t channel, const uint8_t* pkt, size_t len);
+void listen(uint8_t channel);
+void configureRadio(LoRaClass&);
+LoRaClass& radioFor(uint8_t channel);
+void serviceSecondRadio();
+uint8_t radioRegister(uint8_t reg, SPIClass& bus = SPI, uint8_t cs = L_CS);
+void handleAck(const frame::Ack&, uint32_t rxMillis, uint32_t appliedAgo);
+uint32_t since(uint32_t from, uint32_t to);
+uint32_t commandRtoMs(const airtime::Link&, size_t len, uint8_t hops);
+TickType_t serviceRetransmits();
+void serviceCommand(uint8_t id, NodeState&, PendingCmd&, uint32_t now, uint32_t& nextDue);
+bool windowOpen(const NodeState&, uint32_t now);
+void openWindow(NodeState&, bool rxWindow, uint32_t rxMillis);
+void reportDelivery(uint8_t id, const PendingCmd&, DeliveryStatus, uint32_t now);
+
+// Link Adaptation
+void adaptLink(uint8_t id, NodeState&, const RawFrame&, bool adrReq);
+void adaptNetwork();
+float linkHeadroom(const LinkState&, uint8_t sf);
+int8_t targetPower(const LinkState&, uint8_t sf);
+void sendLinkCommand(uint8_t id, NodeState&, uint8_t sf, int8_t txPower, bool timed);
+void beginLinkSwitch(const airtime::Link& to);
+TickType_t serviceLink();
+uint32_t lostAfterMs(const NodeState&);
+void loadLink();
+void saveLink();
+
+// Remote Configuration
+void applyConfig(const ConfigUpdate&);
+void mergeConfig(uint8_t id, NodeState&, const ConfigUpdate&);
+void applyNetConfig(const NetConfigUpdate&);
+bool relayed(const NodeConfig&);
+void sendConfigCommand(uint8_t id, NodeState&);
+void restoreConfigs();
+void saveConfigs();
+void restoreCounters();
+void saveCounters();
+bool newerVersion(uint16_t v, uint16_t current);
 
 // Data Processing
-void publishJSON();
-String extractStr(const String&, const String&);
-float extractFloat(const String&, const String&);
-String getTimestamp();
-char weatherIconAscii(const String&, float);
+void readingFromUplink(const frame::Uplink&, Reading&);
+bool rebuildUplink(const uint8_t*, size_t, frame::Uplink&);
+void decodeAsciiUplink(char*, size_t, Reading&);
+bool publishTelemetry(const Reading*, size_t, bool live);
+void publishMetrics();
+void publishLatency();
+void nodeTopic(char* buf, size_t cap, uint8_t nodeId, const char* leaf);
+void noteValve(uint8_t nodeId, const char* valve);
+void publishValves();
+size_t serializePayload(const JsonDocument&, PayloadFormat, char*, size_t);
+void publishDelivery(const DeliveryReport&);
+bool containsNoCase(const char*, const char*);
+const char* timestampFor(uint64_t epochMs);
+uint64_t epochMsFor(uint32_t rxMillis);
+
+// Store-and-forward
+void spillReadings(const Reading*, size_t);
+void drainBacklog(uint32_t now);
+void packReading(const Reading&, uint8_t*);
+void unpackReading(const uint8_t*, Reading&);
+
+// Rollups
+void rollupAdd(const Reading&);
+void serviceRollups(bool online);
+void closeShort(NodeRollup&);
+void closeLong(NodeRollup&);
+void queueRollup(uint8_t span, const NodeRollup&, const rollup::Bucket<ROLLUP_FIELDS>&);
+int16_t rollupFixed(float);
+void flushRollups(bool online);
+bool publishRollups(const uint8_t* recs, size_t n);
+char weatherIconAscii(const char*, float);
 
 // Display Functions
-void drawOLED();
+void drawOLED(const Reading&);
+void drawClock(time_t now);
+void drawCell(uint8_t cell, const char* text);
+void drawWeatherIcon(char kind);
+void flushOLED();
+
+// LoRa Interrupt Handler: copies the frame out of the radio FIFO into
+// rxRing before the next packet can overwrite it, then wakes the radio task
+void IRAM_ATTR onPacketISR(int size) {
+  Span span(stats.isr);
+  stats.rxFrames[0]++;
+
+  // Frames failing CRC never reach this callback, but the radio counts
+  // their headers: valid headers minus valid packets is the CRC error
+  // count since the last listen()
+  const uint8_t crc = radioRegister(REG_RX_HEADER_CNT_LSB) - radioRegister(REG_RX_PACKET_CNT_LSB);
+  stats.crcErrors[0] += (uint8_t)(crc - crcSeen);
+  crcSeen = crc;
+
+  RawFrame* f = rxRing.acquire();
+  if (f == nullptr) {
+    rxOverflows = rxOverflows + 1;  // Ring full; frame stays in FIFO and is lost
+    return;
+  }
+  f->rxMillis = millis();
+  f->rssi = LoRa.packetRssi();
+  f->snrRaw = (int8_t)radioRegister(REG_PKT_SNR_VALUE);  // packetSnr() converts with the FPU
+  f->channel = 0;
+  uint8_t n = 0;
+  while (n < size && n < sizeof(f->data) - 1 && LoRa.available()) f->data[n++] = (uint8_t)LoRa.read();
+  f->len = n;
+  rxRing.commit();
+
+  BaseType_t woken = pdFALSE;
+  xTaskNotifyFromISR(radioTaskHandle, NOTIFY_RX, eSetBits, &woken);
+  portYIELD_FROM_ISR(woken);
+}
 
-// LoRa Interrupt Handler
-void IRAM_ATTR onPacketISR(int) { packetReady = true; }
+// Second radio's DIO0: RxDone (CRC good or not), and TxDone while it
+// sends our downlinks. The LoRa library's own handler only serves the
+// primary radio, so the radio task tells them apart and reads the frame
+// (serviceSecondRadio)
+void IRAM_ATTR onPacket2ISR() {
+  rx2At = millis();
+  BaseType_t woken = pdFALSE;
+  xTaskNotifyFromISR(radioTaskHandle, NOTIFY_RX2, eSetBits, &woken);
+  portYIELD_FROM_ISR(woken);
+}
 
 void setup() {
   // Initialize Serial communication
   Serial.begin(115200);
+  cyclesPerUs = getCpuFrequencyMhz();
+
+  // Wall clock from before the reset, so readings are dated right away
+  applyTimeZone();
+  restoreClock();
   
   // Configure LED pin
   pinMode(LED_PIN, OUTPUT);
   digitalWrite(LED_PIN, LOW);
+
+  // Initialize LoRa radio first: the field keeps talking through a reboot,
+  // and every frame is buffered from here on while the rest comes up
+  SPI.begin();
+  LoRa.setPins(L_CS, L_RST, L_DIO0);
+  
+  if(!LoRa.begin(channel::hz(0))) {
+    Serial.println("LoRa initialization failed");
+    while(true);  // Halt if LoRa init fails
+  }
+  
+  // Configure LoRa parameters (explicitly, so they cannot drift from the
+  // nodes); a link moved by ADR or cfg/net is resumed from NVS, where the
+  // nodes still are
+  loadLink();
+  configureRadio(LoRa);
+
+  // Second radio on its own bus, listening on channel 1
+  if (SECOND_RADIO) {
+    radioSpi2.begin(L2_SCK, L2_MISO, L2_MOSI, L2_CS);
+    radio2.setSPI(radioSpi2);
+    radio2.setPins(L2_CS, L2_RST, L2_DIO0);
+    if (radio2.begin(channel::hz(1))) {
+      configureRadio(radio2);
+      rxChannels = 2;
+    } else {
+      Serial.println("Second LoRa radio not found, channel 0 only");
+    }
+  }
+
+  // The radio task must exist before the ISR can notify it
+  xTaskCreatePinnedToCore(radioTask, "radio", RADIO_STACK, nullptr, RADIO_PRIO, &radioTaskHandle, RADIO_CORE);
+  LoRa.onReceive(onPacketISR);
+  if (rxChannels > 1) attachInterrupt(digitalPinToInterrupt(L2_DIO0), onPacket2ISR, RISING);
+  for (uint8_t ch = 0; ch < rxChannels; ++ch) listen(ch);
   
   // Initialize I2C for OLED
   Wire.begin();
   Wire.setClock(400000);
   
   // Initialize OLED display
-  oled.begin(SSD1306_SWITCHCAPVCC, 0x3C);
+  oled.begin(SSD1306_SWITCHCAPVCC, OLED_ADDR);
   oled.setTextColor(SSD1306_WHITE);
   oled.setTextSize(2);
   oled.clearDisplay();
   oled.println("Aulak nane");
   oled.display();
 
-  // Setup WiFi and NTP time sync
-  connectWiFi();
-  configTime(GMT_OFFSET_SEC, DAYLIGHT_OFFSET_SEC, NTP_SERVER);
-  struct tm timeinfo;
-  if (!getLocalTime(&timeinfo)) {
-    Serial.println("NTP Time Sync Failed");
-  } else {
-    Serial.println(&timeinfo, "NTP Time: %Y-%m-%d %H:%M:%S");
+  // Network and display tasks; the network one joins Wi-Fi in the background
+  xTaskCreatePinnedToCore(networkTask, "net", NET_STACK, nullptr, NET_PRIO, &netTaskHandle, NET_CORE);
+  xTaskCreatePinnedToCore(displayTask, "oled", OLED_STACK, nullptr, OLED_PRIO, &oledTaskHandle, OLED_CORE);
+  
+  Serial.println("Gateway ready");
+}
+
+void loop() {
+  // All work runs in the pinned tasks
+  vTaskDelete(nullptr);
+}
+
+/* -------------------- Tasks -------------------- */
+/**
+ * Radio task (APP core, high priority)
+ * Wakes on DIO0 RxDone or a queued command; never touches the network
+ */
+void radioTask(void*) {
+  seedNodeDefaults();
+  restoreConfigs();
+  restoreCounters();
+  TickType_t wait = portMAX_DELAY;
+
+  for (;;) {
+    // Sleep until RX, a queued command, or the next retransmit is due
+    uint32_t bits = 0;
+    xTaskNotifyWait(0, UINT32_MAX, &bits, wait);
+    wait = radioPass(bits);
+  }
+}
+
+/**
+ * One radio task wakeup: captured frames, queued commands, rules and
+ * settings, then the retransmit and link timers
+ * @param bits Notification bits (NOTIFY_*) that woke the task
+ * @return TickType_t Ticks until the next pass is due on its own
+ */
+TickType_t radioPass(uint32_t bits) {
+  static uint32_t reportedOverflows = 0;
+
+  // Drain every frame the ISR captured, not just the latest one
+  if (bits & NOTIFY_RX) {
+    while (RawFrame* f = rxRing.front()) {
+      {
+        Span span(stats.rx);
+        handleUplink(*f);
+      }
+      rxRing.release();
+    }
+    if (rxOverflows != reportedOverflows) {
+      reportedOverflows = rxOverflows;
+      Serial.printf("RX ring overflow, %u frames lost so far\n", (unsigned)reportedOverflows);
+    }
+  }
+  if (bits & NOTIFY_RX2) serviceSecondRadio();
+
+  Command cmd;
+  while (commandQueue.pop(cmd)) {
+    stats.cmdQueue.add(since(cmd.issuedAt, millis()));
+    applyCommand(cmd);
   }
+  RuleUpdate upd;
+  while (ruleQueue.pop(upd)) applyRule(upd);
+  ConfigUpdate cfg;
+  while (configQueue.pop(cfg)) applyConfig(cfg);
+  NetConfigUpdate net;
+  while (netConfigQueue.pop(net)) applyNetConfig(net);
+  if (configDirty) saveConfigs();  // One NVS write for everything above
+
+  const TickType_t wait = serviceRetransmits();
+  const TickType_t linkWait = serviceLink();
+  return linkWait < wait ? linkWait : wait;
+}
+
+/**
+ * Network task (PRO core)
+ * Owns WiFi and the MQTT client; reconnects are a non-blocking state
+ * machine with jittered exponential backoff
+ */
+void networkTask(void*) {
+  // The connection manager owns reconnects; NTP is started on first join
+  WiFi.persistent(false);  // No flash write of the credentials on every join
+  WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(false);
+  loadApCache();
 
   // Configure MQTT
   mqtt.setServer(MQTT_HOST, MQTT_PORT);
   mqtt.setCallback(mqttCallback);
+  mqtt.setBufferSize(PUBLISH_BUF_LEN + 64);  // Batch plus MQTT header and topic
+  mqtt.setSocketTimeout(MQTT_SOCKET_TIMEOUT_S);
 
-  // Initialize LoRa radio
-  SPI.begin();
-  LoRa.setPins(L_CS, L_RST, L_DIO0);
-  
-  if(!LoRa.begin(RF_FREQ)) {
-    Serial.println("LoRa initialization failed");
-    while(true);  // Halt if LoRa init fails
+  // Mount the backlog; an unformatted partition is formatted once
+  bootSession = (uint16_t)esp_random();
+  backlogReady = LittleFS.begin(true) && backlog.begin(LittleFS, STORE_DIR);
+  rollupBacklogReady = backlogReady && rollupBacklog.begin(LittleFS, ROLLUP_DIR);
+  if (backlogReady) {
+    Serial.printf("Backlog: %lu readings, %lu rollups waiting\n",
+                  (unsigned long)backlog.count(), (unsigned long)rollupBacklog.count());
+  } else {
+    Serial.println("Backlog: flash unavailable, offline readings will be lost");
   }
-  
-  // Configure LoRa parameters
-  LoRa.setSyncWord(SYNC_WORD);
-  LoRa.enableCrc();
-  LoRa.onReceive(onPacketISR);
-  LoRa.receive();
-  
-  Serial.println("Gateway ready");
-}
 
-void loop() {
-  // Maintain network connections
-  if(WiFi.status()!=WL_CONNECTED) connectWiFi();
-  if(!mqtt.connected()) connectMQTT();
-  mqtt.loop();
-
-  // Process LoRa packets when received
-  if(packetReady){
-    packetReady = false;
-    String raw;
-    
-    // Read and validate incoming LoRa data
-    while(LoRa.available()){
-      char c = char(LoRa.read());
-      if(c >= 32 && c <= 126) raw += c;  // Only accept printable ASCII
-    }
-
-    // Extract sensor data from LoRa packet
-    weather = extractStr(raw, "Weather:");
-    tempC   = extractFloat(raw, "Temp:");
-    humP    = extractFloat(raw, "Hum:"); 
-    if(isnan(humP)) humP = extractFloat(raw, "Hm:");
-    
-    // Handle multiple possible light level tags
-    lux = extractFloat(raw, "Light level:");
-    if(isnan(lux)) lux = extractFloat(raw, "Lux:");
-    if(isnan(lux)) lux = extractFloat(raw, "Lx:");
-    
-    moistP = extractFloat(raw, "Moisture:");
-    valve  = extractStr(raw, "Valve:");
-    
-    // Publish sensor data to MQTT and update display
-    mqtt.publish(VAL_TOPIC, valve.c_str());
-    Serial.printf("RX: %s | T %.1f | H %.1f | L %.1f | M %.0f%% | V %s\n",
-                  weather.c_str(), tempC, humP, lux, moistP, valve.c_str());
-    publishJSON();
-    drawOLED();
-
-    // Automated valve control logic (when in auto mode)
-    if (!isManualMode) {
-      const float SUNLIGHT_THRESHOLD = 8.5;  // Lux threshold for too sunny
-      
-      // Check environmental conditions
-      const bool isDry = moistP < soilThreshold;
-      String weatherUpper = weather;
-      weatherUpper.toUpperCase();
-      const bool isRaining = weather.length() > 0 && weatherUpper.indexOf("RAIN") != -1;
-      const bool isTooSunny = lux > SUNLIGHT_THRESHOLD;
-      
-      // Determine if valve state should change
-      bool newCommand = (isDry && !isRaining && !isTooSunny);
-      
-      if (newCommand != lastCommand) {
-        lastCommand = newCommand;
-        String cmd = newCommand ? "TRUE" : "FALSE";
-        
-        // Configure LoRa for transmission
-        LoRa.idle();
-        const int maxRetries = 3;
-        
-        // Send command multiple times for reliability
-        for (int i = 0; i < maxRetries; ++i) {
-          if (LoRa.beginPacket() && LoRa.print("CMD:" + cmd) && LoRa.endPacket()) {
-            Serial.println("Auto CMD sent (burst " + String(i + 1) + "): " + cmd);
-          } else {
-            Serial.println("LoRa CMD Send Failed (burst " + String(i + 1) + ")");
-          }
-          delay(50);  // Small delay between retries to avoid collisions
+  static Reading batch[PUBLISH_BATCH_MAX];
+  size_t batchCount = 0;
+  uint32_t batchStart = 0;
+
+  for (;;) {
+    // Advance the connection state machine; never waits for the network
+    const bool online = serviceConnection(millis());
+    keepClock();
+
+    // Coalesce decoded readings into one publish per flush window; a
+    // batch that cannot be published goes to the flash backlog instead
+    while (batchCount < PUBLISH_BATCH_MAX && publishQueue.pop(batch[batchCount])) {
+      Reading& r = batch[batchCount];
+      r.epochMs = epochMsFor(r.rxMillis);
+      rollupAdd(r);
+      noteValve(r.nodeId, r.valve);
+      if (batchCount++ == 0) batchStart = millis();
+    }
+    if (!PUBLISH_RAW) {
+      batchCount = 0;  // Rollups only
+    } else if (batchCount == PUBLISH_BATCH_MAX || (batchCount > 0 && millis() - batchStart >= PUBLISH_FLUSH_MS)) {
+      if (online && publishTelemetry(batch, batchCount, true)) {
+        const uint32_t now = millis();
+        for (size_t i = 0; i < batchCount; ++i) {
+          const Reading& r = batch[i];
+          stats.rxPublish.add(since(r.rxMillis, now));
+          if (r.sampleAgeMs != UINT32_MAX) stats.samplePublish.add(since(r.rxMillis, now) + r.sampleAgeMs);
         }
-        LoRa.receive();
+      } else {
+        spillReadings(batch, batchCount);
       }
+      batchCount = 0;
+    }
+    serviceRollups(online);
+    if (online) {
+      publishValves();
+      drainBacklog(millis());
     }
-    
-    // Return to listening mode
-    LoRa.receive();
+    DeliveryReport d;
+    while (online && statusQueue.pop(d)) publishDelivery(d);
+    static uint32_t lastMetrics = 0;
+    if (online && millis() - lastMetrics >= METRICS_INTERVAL_MS) {
+      lastMetrics = millis();
+      publishMetrics();
+      publishLatency();
+    }
+    vTaskDelay(pdMS_TO_TICKS(10));
   }
 }
 
-void connectWiFi(){
-  Serial.print("Wi-Fi: "); WiFi.begin(WIFI_SSID, WIFI_PASS);
-  while(WiFi.status()!=WL_CONNECTED){Serial.print('.');delay(300);}
-  Serial.println(" connected  IP="+WiFi.localIP().toString());
-  digitalWrite(LED_PIN,HIGH);
-}
+/**
+ * Display task (PRO core, lowest priority)
+ * Wakes every oledInterval, re-renders only the cells whose text changed
+ * and flushes only the pages they touch; idle passes cost no I2C at all
+ */
+void displayTask(void*) {
+  // Display-local copy of the newest reading per node
+  static Reading latest[MAX_NODES];
+  size_t count = 0, page = 0;
+  uint32_t pageStart = 0;
+  time_t shownSecond = 0;
+
+  for (;;) {
+    Reading r;
+    bool fresh = false;
+    while (displayQueue.pop(r)) {
+      size_t i = 0;
+      while (i < count && latest[i].nodeId != r.nodeId) ++i;
+      if (i == count) {
+        if (count == MAX_NODES) continue;
+        ++count;
+      }
+      latest[i] = r;
+      if (i == page) fresh = true;
+    }
+
+    // Rotate through nodes when more than one is reporting
+    if (count > 1 && millis() - pageStart >= OLED_PAGE_MS) {
+      page = (page + 1) % count;
+      pageStart = millis();
+      fresh = true;
+    }
+    if (fresh) {
+      Span span(stats.draw);
+      drawOLED(latest[page]);
+    }
 
-void connectMQTT(){
-  while(!mqtt.connected()){
-    Serial.print("MQTT… ");
-    if(mqtt.connect("ESP32-LoRa-GW")){
-      Serial.println("connected");
-      mqtt.subscribe(CMD_TOPIC);
-      mqtt.subscribe(SOIL_TOPIC);
-      mqtt.subscribe(MODE_TOPIC);  // Subscribe to mode control topic
-    }else{
-      Serial.print(mqtt.state()); Serial.println(" retry"); delay(2000);
+    // 1 Hz clock tick, independent of packets
+    const time_t now = time(nullptr);
+    if (now != shownSecond) {
+      shownSecond = now;
+      drawClock(now);
     }
+    flushOLED();
+    vTaskDelay(pdMS_TO_TICKS(oledInterval));
   }
 }
 
-void mqttCallback(char* topic, byte* payload, unsigned len) {
-  // Convert payload to string and normalize format
-  String msg;
-  for (uint32_t i = 0; i < len; i++) msg += (char)payload[i];
-  msg.trim(); 
-  msg.toUpperCase();  // Normalize to uppercase for case-insensitive comparison
-  
-  /*-------------------- Mode Control Handler --------------------*/
-  if (strcmp(topic, MODE_TOPIC) == 0) {
-    // FALSE = Manual Mode, TRUE = Auto Mode
-    if (msg == "FALSE") {
-      isManualMode = true;
-      Serial.println("Switching to manual mode");
-    } else if (msg == "TRUE") {
-      isManualMode = false;
-      Serial.println("Switching to auto mode");
-    }
+/* -------------------- Radio Functions -------------------- */
+/**
+ * Decode one frame from rxRing; the slot is parsed in place
+ */
+void handleUplink(RawFrame& f) {
+  // A relayed copy is handled as the frame it carries; the relay path
+  // (this copy's airtime and the hold at each relay) counts towards the
+  // node's delays. Our own downlinks coming back through a relay are not
+  // for us.
+  frame::Relay relay = {};
+  uint32_t pathMs = 0;
+  if (frame::decodeRelay(f.data, f.len, relay)) {
+    if (frame::isDownlink(frame::headerType(f.data[frame::RELAY_OVERHEAD]))) return;
+    stats.relayedFrames++;
+    pathMs = radioLink.ms(f.len) + relay.holdMs;
+    f.len -= frame::RELAY_OVERHEAD;
+    memmove(f.data, f.data + frame::RELAY_OVERHEAD, f.len);
+  }
+  const uint32_t frameMs = radioLink.ms(f.len);  // As sent, trailer included
+  if (!authenticate(f)) return;
+  frame::Sync sync;
+  if (AUTH_FRAMES && frame::headerType(f.data[0]) == frame::TYPE_SYNC_REQ) {
+    if (frame::decodeSync(f.data, f.len, sync)) handleSyncRequest(sync.nodeId, sync, f, relay);
     return;
   }
-  
-  /*-------------------- Soil Threshold Handler --------------------*/
-  if (strcmp(topic, SOIL_TOPIC) == 0) {
-    // Validate that message contains only digits
-    bool isInt = true;
-    for (uint32_t i = 0; i < msg.length(); ++i) {
-      if (!isDigit(msg[i])) { 
-        isInt = false; 
-        break; 
-      }
+
+  // Binary frames always have bit 7 of the header set; anything else
+  // is treated as a legacy ASCII packet
+  Reading r;
+  frame::Uplink up;
+  const bool binary = f.len > 0 && frame::isBinary(f.data[0]);
+  if (binary) {
+    // First copy wins, whether direct or relayed
+    if (f.len >= frame::FRAME_MIN_LEN && recentFrames.seen(frame::frameId(f.data))) {
+      stats.duplicates++;
+      return;
+    }
+    frame::Ack ack;
+    if (frame::decodeAck(f.data, f.len, ack)) {
+      // Trace: time since the node applied the command, at its TX start
+      const uint16_t held = frame::traceOf(f.data, f.len, frame::ACK_LEN);
+      handleAck(ack, f.rxMillis, held == frame::TRACE_NONE ? UINT32_MAX : held + frameMs + pathMs);
+      return;
     }
-    // Update threshold if valid number received
-    if (isInt && msg.length() > 0) {
-      soilThreshold = msg.toFloat();
-      Serial.printf("Soil threshold set to %.1f\n", soilThreshold);
+    if (!rebuildUplink(f.data, f.len, up)) {
+      Serial.println("RX: binary frame dropped");
+      stats.decodeDrops++;
       return;
     }
+    readingFromUplink(up, r);
+  } else {
+    decodeAsciiUplink((char*)f.data, f.len, r);
   }
+  r.rxMillis = f.rxMillis;
+  r.rssi = f.rssi;
+  r.snr = f.snr();
+  const uint16_t age = binary ? frame::uplinkTrace(f.data, f.len) : frame::TRACE_NONE;
+  r.sampleAgeMs = age == frame::TRACE_NONE ? UINT32_MAX : age + frameMs + pathMs;
+  if (age != frame::TRACE_NONE) stats.sampleRx.add(r.sampleAgeMs);
 
-  /*-------------------- Valve Control Handler --------------------*/
-  if (strcmp(topic, CMD_TOPIC) == 0 && isManualMode) {
-    if (msg == "TRUE" || msg == "FALSE") {
-      Serial.println("Manual CMD from MQTT: " + msg);
-      
-      // Update last command state
-      lastCommand = (msg == "TRUE");
-      
-      // Configure LoRa for transmission
-      LoRa.idle();
-      const int maxRetries = 3;  // Number of transmission attempts
-      
-      // Send command multiple times for reliability
-      for (int i = 0; i < maxRetries; ++i) {
-        if (LoRa.beginPacket() && LoRa.print("CMD:" + msg) && LoRa.endPacket()) {
-          Serial.println("Manual CMD sent (burst " + String(i + 1) + "): " + msg);
-        } else {
-          Serial.println("LoRa CMD send failed (burst " + String(i + 1) + ")");
-        }
-        delay(50);  // Small delay between retries to avoid collisions
-      }
-      
-      // Return to receiving mode
-      LoRa.receive();
+  NodeState* node = findNode(r.nodeId, true);
+  if (node == nullptr) {
+    Serial.printf("RX: node table full, node %u ignored\n", r.nodeId);
+    return;
+  }
+  node->last = r;
+  node->lastSeen = r.rxMillis;
+  node->channel = f.channel;
+  node->hops = relay.hops;
+  node->relayId = relay.relayId;
+  openWindow(*node, binary && (up.flags & frame::FLAG_RX_WINDOW), r.rxMillis);
+
+  // The node checking in with the commanded state closes the control loop
+  CheckIn& c = node->checkIn;
+  if (c.active && (strcmp(r.valve, "OPEN") == 0) == c.open) {
+    stats.cmdCheckIn.add(since(c.issuedAt, r.rxMillis));
+    c.active = false;
+  }
+
+  Serial.printf("RX: #%u | %s | T %.1f | H %.1f | L %.1f | M %.0f%% | V %s | RSSI %d SNR %.1f\n",
+                r.nodeId, r.weather, r.tempC, r.humP, r.lux, r.moistP, r.valve, r.rssi, r.snr);
+  if (relay.hops > 0) Serial.printf("RX: #%u via relay #%u, %u hop(s)\n", r.nodeId, relay.relayId, relay.hops);
+
+  // Hand off to network and display; a full queue drops rather than blocks
+  if (!publishQueue.push(r)) {
+    Serial.println("Publish queue full, reading dropped");
+    stats.queueDrops++;
+  }
+  stats.rssi.add(f.rssi);
+  stats.snr.add(f.snr());
+  displayQueue.push(r);
+
+  // Link quality drives ADR; legacy ASCII nodes cannot be steered
+  if (binary) adaptLink(r.nodeId, *node, f, up.flags & frame::FLAG_ADR_REQ);
+
+  // Settings the node has not confirmed (pushed while it slept, a failed
+  // delivery, or a gateway reboot) ride the window after this frame
+  if (binary && !node->configSynced && !node->cfgCmd.active && relayed(node->config)) {
+    sendConfigCommand(r.nodeId, *node);
+  }
+
+  // Automated valve control logic (when in auto mode)
+  if (!node->manualMode) runAutoMode(r.nodeId, *node);
+}
+
+/**
+ * Check a frame's auth trailer against its node's uplink counter and
+ * strip it, before anything parses the frame. A copy or replay is
+ * rejected on the counter alone; a node not synced yet is heard only
+ * through a sync request, and gets a slot only once one checked out, so
+ * a forged flood cannot fill the table.
+ * @return bool False if the frame was dropped
+ */
+bool authenticate(RawFrame& f) {
+  if (!AUTH_FRAMES) return true;
+  if (f.len < frame::FRAME_MIN_LEN || !frame::isBinary(f.data[0])) {
+    stats.authUnsigned++;
+    return false;
+  }
+  const uint8_t id = f.data[1];
+  NodeState* node = findNode(id, false);
+  const bool known = node != nullptr && node->upKnown;
+  const bool sync = frame::headerType(f.data[0]) == frame::TYPE_SYNC_REQ;
+  if (!known && !sync) {
+    stats.authUnknown++;
+    return false;
+  }
+  uint32_t counter;
+  const auth::Verdict v = sync ? auth::verifySync(frameKey, auth::DIR_UPLINK, f.data, f.len, known ? node->upCounter : 0,
+                                                  known, counter)
+                               : auth::verify(frameKey, auth::DIR_UPLINK, f.data, f.len, node->upCounter, counter);
+  if (v != auth::AUTH_OK) {
+    if (v == auth::AUTH_STALE) {
+      // A node behind us (reset below our floor, or wiped) or a replay;
+      // a sync back moves the node on and costs a replay nothing
+      if (sync || node->upResync) resyncNode(id, *node, f);
+      stats.duplicates++;
+    } else if (v == auth::AUTH_FORGED) {
+      stats.authForged++;
+    } else {
+      stats.authUnsigned++;
     }
+    return false;
   }
+
+  if (node == nullptr) node = findNode(id, true);
+  if (node != nullptr) acceptCounter(*node, counter);
+  f.len -= auth::TRAILER_LEN;
+  return true;
 }
 
-void publishJSON(){
-  JsonDocument doc;
-  doc["weather"] = weather;
-  doc["temp"] = tempC;
-  doc["hum"] = humP;
-  doc["light"] = lux;
-  doc["moist"] = moistP;
-  doc["timestamp"] = getTimestamp();
-  char buf[256]; size_t n = serializeJson(doc, buf);
-  mqtt.publish(PUB_TOPIC, buf, n);
+/**
+ * Take a counter that checked out as the node's last. Crossing the floor
+ * in NVS moves it to the next block first, so after a reboot nothing up
+ * to here passes again.
+ */
+void acceptCounter(NodeState& node, uint32_t counter) {
+  node.upCounter = counter;
+  node.upKnown = true;
+  node.upResync = false;
+  if (counter >= node.upFloor) {
+    node.upFloor = auth::blockAbove(counter, AUTH_RESERVE);
+    saveCounters();
+  }
 }
 
-void drawOLED() {
-  static uint32_t last = 0;
-  if (millis() - last < OLED_INTERVAL) return;
-  last = millis();
+/**
+ * Append the auth trailer to a binary downlink for node under its next
+ * counter
+ * @return size_t New length, or len with AUTH_FRAMES off
+ */
+size_t signDownlink(NodeState& node, uint8_t* pkt, size_t len, size_t cap) {
+  if (!AUTH_FRAMES) return len;
+  if (node.downCounter >= node.downReserved) {
+    // Reserve before use: a reset must never resume below a sent counter
+    node.downReserved = auth::blockAbove(node.downCounter, AUTH_RESERVE);
+    saveCounters();
+  }
+  return auth::sign(frameKey, auth::DIR_DOWNLINK, node.downCounter++, pkt, len, cap);
+}
 
-  oled.clearDisplay();
+/**
+ * A node (re)joining asks for a sync: its uplink counter is accepted as
+ * it stands, downlinks to it skip to its floor, and the sync it gets
+ * back tells it ours. The frame also says where to answer it.
+ */
+void handleSyncRequest(uint8_t id, const frame::Sync& s, const RawFrame& f, const frame::Relay& relay) {
+  NodeState* node = findNode(id, false);
+  if (node == nullptr) {
+    Serial.printf("RX: node table full, node %u ignored\n", id);
+    return;
+  }
+  if (s.floor > node->downCounter) node->downCounter = s.floor;
+  node->lastSeen = f.rxMillis;
+  node->channel = f.channel;
+  node->hops = relay.hops;
+  node->relayId = relay.relayId;
+  openWindow(*node, node->rxWindow, f.rxMillis);
+  Serial.printf("SYNC node %u: up %u, down from %u\n", id, (unsigned)node->upCounter, (unsigned)node->downCounter);
+  sendSyncCommand(id, *node);
+}
 
-  // Title
-  oled.setTextSize(1);
-  oled.setTextColor(SSD1306_WHITE);
-  oled.setCursor(35, 0);
-  oled.println("AGROSENSE");
-  oled.drawLine(0, 9, 128, 9, SSD1306_WHITE);  // Underline
-
-  // --- Icons and Readings ---
-  oled.setTextSize(1);
-
-  // Temperature reading with thermometer emoji
-  oled.drawBitmap(2, 17, temp_emoji, 8, 8, SSD1306_WHITE);
-  oled.setCursor(12, 18);
-  oled.printf("%.1fC", tempC);
-
-  // Humidity reading with droplet emoji
-  oled.drawBitmap(64, 17, humid_emoji, 8, 8, SSD1306_WHITE);
-  oled.setCursor(74, 18);
-  oled.printf("%.1f%%", humP);
-
-  // Light level with sun emoji
-  oled.drawBitmap(2, 30, sun_emoji, 8, 8, SSD1306_WHITE);
-  oled.setCursor(12, 31);
-  oled.printf("%.1f lx", lux);
-
-  // Moisture reading with moisture emoji
-  oled.drawBitmap(64, 30, moist_emoji, 8, 8, SSD1306_WHITE);
-  oled.setCursor(74, 31);
-  oled.printf("%.0f%%", moistP);
-  // Weather status with dynamic weather icon
-  oled.setCursor(0, 44);
-  oled.printf("Weather: %s", weather.c_str());
-  
-  // Draw weather icon based on conditions
-  String weatherUpper = weather;
-  weatherUpper.toUpperCase();
-  if (weatherUpper.indexOf("RAIN") != -1) {
-    oled.drawBitmap(100, 42, rain_emoji, 8, 8, SSD1306_WHITE);
-  } else if (lux > 9) {
-    oled.drawBitmap(100, 42, sun_emoji, 8, 8, SSD1306_WHITE);
-  } else {
-    // Default cloud-like pattern for other conditions
-    oled.fillCircle(104, 46, 3, SSD1306_WHITE);
-    oled.fillCircle(100, 46, 2, SSD1306_WHITE);
-    oled.fillCircle(108, 46, 2, SSD1306_WHITE);
+/**
+ * Answer a frame from a node that is behind us with a sync. The frame
+ * did not check out, so at most one sync is outstanding per node and a
+ * replay costs one downlink; before the node is heard again after our
+ * reboot it also says which channel the node is on.
+ */
+void resyncNode(uint8_t id, NodeState& node, const RawFrame& f) {
+  if (node.syncCmd.active) return;
+  if (node.upResync) node.channel = f.channel;
+  openWindow(node, node.rxWindow, f.rxMillis);
+  sendSyncCommand(id, node);
+}
+
+/**
+ * Queue a counter sync for the node; it rides the valve command
+ * ACK/retransmit path, ahead of anything else queued for the node
+ */
+void sendSyncCommand(uint8_t id, NodeState& node) {
+  const uint32_t now = millis();
+  PendingCmd& p = node.syncCmd;
+  if (p.active) reportDelivery(id, p, SUPERSEDED, now);
+  p = PendingCmd{};
+  p.active = true;
+  p.kind = PENDING_SYNC;
+  p.seq = cmdSeq++;
+  p.firstTx = now;
+  p.nextTx = now;
+  serviceRetransmits();
+}
+
+// Settings every newly seen node starts from
+void seedNodeDefaults() {
+  nodeDefaults.config = NodeConfig{0, 0, 0, DEFAULT_SOIL_THRESHOLD, AUTO_LIGHT_MAX};
+  nodeDefaults.configSynced = true;
+  nodeDefaults.rule = stockRule(DEFAULT_SOIL_THRESHOLD, AUTO_LIGHT_MAX);
+  nodeDefaults.manualMode = true;
+  nodeDefaults.link.txPower = frame::TX_POWER_MAX;
+  netConfig = NetConfig{0, ADR_MIN_SF, ADR_MAX_SF, 0, 0, OLED_INTERVAL};
+}
+
+/**
+ * Look up a node's slot by ID
+ * @param create Claim a free slot (seeded from nodeDefaults) if unknown
+ * @return NodeState* nullptr if unknown and not created, or table full
+ */
+NodeState* findNode(uint8_t id, bool create) {
+  for (size_t i = 0; i < nodeCount; ++i) {
+    if (nodeIds[i] == id) return &nodes[i];
+  }
+  if (!create || nodeCount == MAX_NODES) return nullptr;
+  nodeIds[nodeCount] = id;
+  nodes[nodeCount] = nodeDefaults;
+  return &nodes[nodeCount++];
+}
+
+/**
+ * Apply an MQTT control request to one node or, for NODE_BROADCAST,
+ * to every known node and the defaults for nodes not yet seen
+ */
+void applyCommand(const Command& c) {
+  // A broadcast valve command moves only the nodes in manual mode: one
+  // broadcast frame when all of them (and any not yet seen) are, else a
+  // unicast to each that is. Never a table entry for the broadcast ID.
+  if (c.nodeId == frame::NODE_BROADCAST && c.type == CMD_VALVE) {
+    bool all = nodeDefaults.manualMode;
+    for (size_t i = 0; i < nodeCount; ++i) {
+      if (!nodes[i].manualMode) all = false;
+      else nodes[i].lastCommand = c.flag;
+    }
+    if (all) {
+      sendValveCommand(frame::NODE_BROADCAST, c.flag, "Manual", c.issuedAt);
+      return;
+    }
+    for (size_t i = 0; i < nodeCount; ++i) {
+      if (nodes[i].manualMode) sendValveCommand(nodeIds[i], c.flag, "Manual", c.issuedAt);
+    }
+    return;
   }
 
-  // Time and valve state at bottom
-  struct tm timeinfo;
-  if (getLocalTime(&timeinfo)) {
-    char timeStr[9];
-    strftime(timeStr, sizeof(timeStr), "%H:%M:%S", &timeinfo);
-    oled.setCursor(0, 54);
-    oled.printf("%s", timeStr);
+  if (c.nodeId == frame::NODE_BROADCAST) {
+    for (size_t i = 0; i < nodeCount; ++i) {
+      Command one = c;
+      one.nodeId = nodeIds[i];
+      applyCommand(one);
+    }
+    if (c.type == CMD_MODE) nodeDefaults.manualMode = c.flag;
+    if (c.type == CMD_THRESHOLD) {
+      nodeDefaults.config.soil = c.value;
+      nodeDefaults.rule = stockRule(c.value, nodeDefaults.config.lightMax);
+    }
+    return;
   }
 
-  // Valve state
-  oled.setCursor(70, 54);
-  oled.printf("V:%s", valve.c_str());
+  NodeState* node = findNode(c.nodeId, true);
+  if (node == nullptr) return;
 
-  oled.display();
+  switch (c.type) {
+    case CMD_MODE:
+      node->manualMode = c.flag;
+      Serial.printf("Node %u switching to %s mode\n", c.nodeId, c.flag ? "manual" : "auto");
+      break;
+    case CMD_THRESHOLD:
+      // Installs the stock rule at the new threshold, replacing any custom
+      // rule; kept with the node's settings, outside the version order
+      node->config.soil = c.value;
+      node->rule = stockRule(c.value, node->config.lightMax);
+      configDirty = true;
+      Serial.printf("Node %u soil threshold set to %.1f\n", c.nodeId, c.value);
+      break;
+    case CMD_VALVE:
+      // Manual valve commands are ignored while the node is in auto mode
+      if (!node->manualMode) return;
+      node->lastCommand = c.flag;
+      sendValveCommand(c.nodeId, c.flag, "Manual", c.issuedAt);
+      break;
+  }
 }
 
-char weatherIconAscii(const String& w,float luxVal){
-  String u=w; u.toUpperCase();
-  if (u.indexOf("RAIN")!=-1) return 'R';        // Rain
-  if (luxVal>9)              return 'S';        // Sunny / bright
-  return 'C';                                   // Cloud/other
+/**
+ * Auto mode: evaluate the node's compiled rule on the numeric fields of
+ * its latest reading and command the valve when the decision changes
+ */
+void runAutoMode(uint8_t id, NodeState& node) {
+  const Reading& r = node.last;
+  int16_t v[rules::FIELD_COUNT];
+  v[rules::FIELD_TEMP]  = rules::toFixed10(r.tempC);
+  v[rules::FIELD_HUM]   = rules::toFixed10(r.humP);
+  v[rules::FIELD_LIGHT] = rules::toFixed10(r.lux);
+  v[rules::FIELD_MOIST] = rules::toFixed10(r.moistP);
+  v[rules::FIELD_RAIN]  = r.raining ? 10 : 0;
+
+  int16_t minute = -1;  // Window not enforced until the clock is valid
+  const time_t now = time(nullptr);
+  if (now >= VALID_EPOCH) {
+    struct tm t;
+    localtime_r(&now, &t);
+    minute = t.tm_hour * 60 + t.tm_min;
+  }
+
+  const uint32_t heldS = node.switched ? (millis() - node.switchedAt) / 1000 : UINT32_MAX;
+  const bool newCommand = node.rule.next(v, minute, node.lastCommand, heldS);
+  if (newCommand != node.lastCommand) {
+    node.lastCommand = newCommand;
+    node.switched = true;
+    node.switchedAt = millis();
+    sendValveCommand(id, newCommand, "Auto", r.rxMillis);  // Issued by this uplink
+  }
+}
+
+// Install a rule received over MQTT on one node or, broadcast, on all
+// known nodes and the defaults for nodes seen later
+void applyRule(const RuleUpdate& u) {
+  if (u.nodeId == frame::NODE_BROADCAST) {
+    for (size_t i = 0; i < nodeCount; ++i) nodes[i].rule = u.rule;
+    nodeDefaults.rule = u.rule;
+    Serial.println("Auto rule installed on all nodes");
+    return;
+  }
+  NodeState* node = findNode(u.nodeId, true);
+  if (node == nullptr) return;
+  node->rule = u.rule;
+  Serial.printf("Node %u auto rule installed\n", u.nodeId);
 }
 
-String extractStr(const String& s,const String& tag){
-  int i=s.indexOf(tag); if(i==-1) return "";
-  i+=tag.length(); while(i<s.length()&&s[i]==' ') ++i;
-  int j=s.indexOf('|',i); if(j==-1) j=s.indexOf(',',i); if(j==-1) j=s.length();
-  return s.substring(i,j);
+rules::Rule stockRule(float soilThreshold, float lightMax) {
+  rules::Rule rule = {};
+  rule.addOn(rules::FIELD_MOIST, rules::OP_LT, rules::toFixed10(soilThreshold));
+  rule.addOff(rules::FIELD_MOIST, rules::OP_GE, rules::toFixed10(soilThreshold + AUTO_SOIL_HYSTERESIS));
+  rule.addOff(rules::FIELD_RAIN, rules::OP_EQ, 10);
+  rule.addOff(rules::FIELD_LIGHT, rules::OP_GT, rules::toFixed10(lightMax));
+  rule.minOnS = AUTO_MIN_ON_S;
+  rule.minOffS = AUTO_MIN_OFF_S;
+  return rule;
 }
 
-float extractFloat(const String& s,const String& tag){ return extractStr(s,tag).toFloat(); }
+/**
+ * Send a valve command from the radio task.
+ * Unicast commands are sent once and retransmitted with exponential
+ * backoff by serviceRetransmits() until the node ACKs. Legacy ASCII
+ * nodes (ID 0) and broadcasts cannot ACK, so they get a short burst;
+ * sleeping nodes would miss it and get a unicast copy each instead.
+ */
+void sendValveCommand(uint8_t id, bool open, const char* origin, uint32_t issuedAt) {
+  Serial.printf("%s CMD to node %u: %s\n", origin, id, open ? "TRUE" : "FALSE");
+  const uint32_t now = millis();
+
+  // Arm the check-in for every node this moves to a new state
+  for (size_t i = 0; i < nodeCount; ++i) {
+    NodeState& n = nodes[i];
+    if (id != frame::NODE_BROADCAST && nodeIds[i] != id) continue;
+    if ((strcmp(n.last.valve, "OPEN") == 0) != open) n.checkIn = CheckIn{true, open, issuedAt};
+  }
+
+  // Downlink counters are per node, so no one frame passes for all of
+  // them: each node gets its own signed, ACKed copy
+  if (AUTH_FRAMES && id == frame::NODE_BROADCAST) {
+    for (size_t i = 0; i < nodeCount; ++i) {
+      if (nodeIds[i] != frame::NODE_LEGACY) sendValveCommand(nodeIds[i], open, origin, issuedAt);
+    }
+    return;
+  }
+
+  if (id == frame::NODE_LEGACY || id == frame::NODE_BROADCAST) {
+    uint8_t pkt[16];
+    size_t len;
+    if (id == frame::NODE_LEGACY) {
+      len = strlcpy((char*)pkt, open ? "CMD:TRUE" : "CMD:FALSE", sizeof(pkt));
+    } else {
+      len = frame::encodeValveCmd(frame::ValveCmd{id, cmdSeq++, open}, pkt, sizeof(pkt));
+    }
+
+    // Broadcasts go out on every channel, legacy nodes only know channel 0
+    const uint8_t channels = id == frame::NODE_BROADCAST ? rxChannels : 1;
+    for (uint8_t ch = 0; ch < channels; ++ch) {
+      // Configure LoRa for transmission
+      radioFor(ch).idle();
+      const int maxRetries = 3;  // Number of transmission attempts
+
+      // Send command multiple times for reliability
+      for (int i = 0; i < maxRetries; ++i) {
+        if (!transmitFrame(ch, pkt, len)) {
+          Serial.printf("LoRa CMD send failed (channel %u, burst %d)\n", ch, i + 1);
+        }
+        vTaskDelay(pdMS_TO_TICKS(50));  // Small delay between retries to avoid collisions
+      }
+
+      // Return to receiving mode
+      listen(ch);
+    }
+
+    if (id == frame::NODE_BROADCAST) {
+      for (size_t i = 0; i < nodeCount; ++i) {
+        if (nodes[i].rxWindow) sendValveCommand(nodeIds[i], open, origin, issuedAt);
+      }
+    }
+    return;
+  }
+
+  NodeState* node = findNode(id, true);
+  if (node == nullptr) return;
+
+  // A newer command replaces any still-unacknowledged one
+  if (node->pending.active) reportDelivery(id, node->pending, SUPERSEDED, now);
+
+  PendingCmd& p = node->pending;
+  p.active = true;
+  p.open = open;
+  p.seq = cmdSeq++;
+  p.attempts = 0;
+  p.issuedAt = issuedAt;
+  p.firstTx = now;
+  p.nextTx = now;
+  serviceRetransmits();
+}
+
+/**
+ * Blocking single-frame TX on one channel's radio, charged against the
+ * duty-cycle budget (one budget for both channels)
+ * @return bool False if the budget or the radio refused the frame
+ */
+bool transmitFrame(uint8_t channel, const uint8_t* pkt, size_t len) {
+  Span span(stats.tx);
+  LoRaClass& radio = radioFor(channel);
+  const bool sent = dutyCycle.tryConsume(radioLink.us(len), millis()) &&
+                    radio.beginPacket() && radio.write(pkt, len) && radio.endPacket();
+  if (sent) {
+    stats.txFrames++;
+  } else {
+    stats.txFails++;
+  }
+  return sent;
+}
+
+// Back to continuous RX; the radio restarts its packet counters here
+void listen(uint8_t channel) {
+  if (channel == 0) crcSeen = 0;
+  radioFor(channel).receive();
+}
+
+// Link settings shared by both radios; only the frequency differs
+void configureRadio(LoRaClass& radio) {
+  radio.setSyncWord(SYNC_WORD);
+  radio.setSpreadingFactor(radioLink.sf);
+  radio.setSignalBandwidth(radioLink.bw);
+  radio.setCodingRate4(radioLink.cr);
+  radio.setPreambleLength(LinkProfile::PREAMBLE);
+  radio.enableCrc();
+}
+
+// Radio listening on, and answering on, a channel
+LoRaClass& radioFor(uint8_t channel) {
+  return channel == 1 && rxChannels > 1 ? radio2 : LoRa;
+}
+
+/**
+ * Read the frame the second radio signalled. Its FIFO holds the latest
+ * frame only, so one arriving before this runs replaces the previous.
+ * A TxDone has left no flag: endPacket() cleared it.
+ */
+void serviceSecondRadio() {
+  static RawFrame f;                       // Off the radio task stack
+  const uint8_t irq = radioRegister(REG_IRQ_FLAGS, radioSpi2, L2_CS);
+  if (!(irq & IRQ_RX_DONE)) return;        // Our own downlink's TxDone
+  const int size = radio2.parsePacket();  // Clears the IRQ; standby after a good frame
+  if (size <= 0) {
+    if (irq & IRQ_PAYLOAD_CRC_ERROR) stats.crcErrors[1]++;
+    listen(1);
+    return;
+  }
+  stats.rxFrames[1]++;
+  f.rxMillis = rx2At;
+  f.rssi = radio2.packetRssi();
+  f.snrRaw = (int8_t)lroundf(radio2.packetSnr() * 4);
+  f.channel = 1;
+  uint8_t n = 0;
+  while (n < size && n < sizeof(f.data) - 1 && radio2.available()) f.data[n++] = (uint8_t)radio2.read();
+  f.len = n;
+  listen(1);                               // Before any downlink handleUplink sends on it
+
+  Span span(stats.rx);
+  handleUplink(f);
+}
+
+/**
+ * Read one SX127x register the LoRa library does not expose. Only called
+ * where the library itself talks to that radio: the primary's RX
+ * callback, the radio task for the second radio.
+ * @param bus, cs The radio's SPI bus and chip select, the primary's by default
+ */
+uint8_t IRAM_ATTR radioRegister(uint8_t reg, SPIClass& bus, uint8_t cs) {
+  bus.beginTransaction(SPISettings(LORA_SPI_HZ, MSBFIRST, SPI_MODE0));
+  digitalWrite(cs, LOW);
+  bus.transfer(reg & 0x7F);
+  const uint8_t v = bus.transfer(0x00);
+  digitalWrite(cs, HIGH);
+  bus.endTransaction();
+  return v;
+}
+
+IRAM_ATTR Span::Span(SpanHist& hist) : h(hist), c0(ESP.getCycleCount()) {}
+IRAM_ATTR Span::~Span() { h.add((ESP.getCycleCount() - c0) / cyclesPerUs); }
+
+/**
+ * Transmit one copy of a pending command and return to RX
+ * @return bool False if it could not be sent (budget exhausted or radio error)
+ */
+bool transmitCommand(uint8_t id, NodeState& node, const PendingCmd& p) {
+  uint8_t pkt[frame::SYNC_LEN + AUTH_LEN];
+  size_t len;
+  if (p.kind == PENDING_SYNC) {
+    // Counters as of this copy: the one it is signed with, and the floor
+    // of the node's uplinks
+    len = frame::encodeSync(frame::Sync{id, p.seq, node.downCounter, node.upCounter + 1}, frame::TYPE_SYNC, pkt,
+                            sizeof(pkt));
+  } else if (p.kind == PENDING_LINK) {
+    // Countdown is re-encoded on every copy so all nodes switch with us
+    const uint32_t left = p.timed ? p.switchAt - millis() : 0;
+    const airtime::Link& to = p.timed ? nextLink : radioLink;
+    len = frame::encodeLinkAdr(frame::LinkAdr{id, p.seq, p.sf, p.txPower, (uint16_t)((left + 99) / 100), to.bw, to.cr},
+                               pkt, sizeof(pkt));
+  } else if (p.kind == PENDING_CONFIG) {
+    // The node's settings as they are now
+    const NodeConfig& c = node.config;
+    len = frame::encodeConfig(frame::Config{id, p.seq, c.version, c.intervalS, c.heartbeatS}, pkt, sizeof(pkt));
+  } else {
+    len = frame::encodeValveCmd(frame::ValveCmd{id, p.seq, p.open}, pkt, sizeof(pkt));
+  }
+  len = signDownlink(node, pkt, len, sizeof(pkt));
+
+  // On the channel the node was last heard on, which it listens on
+  radioFor(node.channel).idle();
+  bool sent = transmitFrame(node.channel, pkt, len);
+  if (!sent) Serial.printf("LoRa CMD send failed (node %u, seq %u)\n", id, p.seq);
+  listen(node.channel);
+  return sent;
+}
+
+/**
+ * (Re)transmit every pending command whose timer expired. Nothing goes
+ * to a node ahead of its unACKed sync, which it would drop, and an
+ * always-on node has one command in flight at a time, as a sleeping
+ * node gets one per window: the rest wait for its ACK or its failure.
+ * @return TickType_t Ticks until the next retransmit is due
+ */
+TickType_t serviceRetransmits() {
+  const uint32_t now = millis();
+  uint32_t nextDue = UINT32_MAX;
+
+  for (size_t i = 0; i < nodeCount; ++i) {
+    NodeState& node = nodes[i];
+    PendingCmd* const cmds[] = {&node.syncCmd, &node.pending, &node.linkCmd, &node.cfgCmd};
+    for (PendingCmd* p : cmds) {
+      serviceCommand(nodeIds[i], node, *p, now, nextDue);
+      if (p->active && (p == &node.syncCmd || !node.rxWindow)) break;
+    }
+  }
+  return nextDue == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(nextDue);
+}
+
+/**
+ * Retransmit one pending command if its timer expired. Commands for a
+ * sleeping node are instead sent in its RX window, whatever the timer.
+ * @param nextDue Lowered to the ms until this command's next retransmit
+ */
+void serviceCommand(uint8_t id, NodeState& node, PendingCmd& p, uint32_t now, uint32_t& nextDue) {
+  if (!p.active) return;
+
+  // A switch command is meaningless once the switch has happened
+  const bool expired = p.timed && (int32_t)(now - p.switchAt) >= 0;
+  const bool due = node.rxWindow ? windowOpen(node, now) : (int32_t)(now - p.nextTx) >= 0;
+  if (due || expired) {
+    if (p.attempts >= CMD_MAX_ATTEMPTS || expired) {
+      reportDelivery(id, p, FAILED, now);
+      p.active = false;
+      return;
+    }
+    // Out of airtime: retry as soon as the budget covers this frame,
+    // without spending one of the command's attempts
+    static const uint8_t LEN[] = {frame::VALVE_CMD_LEN, frame::LINK_ADR_LEN, frame::CONFIG_LEN, frame::SYNC_LEN};
+    const uint8_t len = LEN[p.kind] + AUTH_LEN;
+    const uint32_t budgetWait = dutyCycle.waitMs(radioLink.us(len), now);
+    if (budgetWait > 0) {
+      p.nextTx = now + budgetWait;
+    } else if (node.rxWindow) {
+      // One downlink per window; its ACK, if any, reopens the window
+      transmitCommand(id, node, p);
+      p.attempts++;
+      node.windowUsed = true;
+    } else {
+      transmitCommand(id, node, p);
+
+      // Exponential backoff with up to 25% jitter so nodes that lost
+      // the same command do not ACK-collide on every retry
+      const uint32_t rto = commandRtoMs(radioLink, len, node.hops) << p.attempts;
+      p.attempts++;
+      p.nextTx = millis() + rto + random(rto / 4 + 1);
+    }
+  }
+
+  // Until the node's next frame only a switch deadline needs a wakeup
+  if (node.rxWindow && !windowOpen(node, now)) {
+    if (p.timed && p.switchAt - now < nextDue) nextDue = p.switchAt - now;
+    return;
+  }
+  const uint32_t left = p.nextTx - now;
+  if (left < nextDue) nextDue = left;
+}
+
+// A sleeping node hears a downlink only if it starts within RX_WINDOW_MS
+// of the node's frame, and only one fits before the node reopens it
+bool windowOpen(const NodeState& node, uint32_t now) {
+  return !node.windowUsed && now - node.windowAt < frame::RX_WINDOW_MS;
+}
+
+/**
+ * Note a frame from the node: a sleeping node now listens for a moment
+ * @param rxWindow Node flagged FLAG_RX_WINDOW (always-on nodes do not)
+ */
+void openWindow(NodeState& node, bool rxWindow, uint32_t rxMillis) {
+  node.rxWindow = rxWindow;
+  node.windowAt = rxMillis;
+  node.windowUsed = false;
+}
+
+/**
+ * Match an ACK to the node's pending command; stale ACKs are ignored
+ * @param appliedAgo ms between the node applying the command and our RX
+ *                   (trace trailer plus airtime), UINT32_MAX if unknown
+ */
+void handleAck(const frame::Ack& ack, uint32_t rxMillis, uint32_t appliedAgo) {
+  NodeState* node = findNode(ack.nodeId, false);
+  if (node == nullptr) return;
+  openWindow(*node, ack.flags & frame::FLAG_RX_WINDOW, rxMillis);  // Next queued downlink can follow
+
+  // Node confirms its actual valve position either way
+  strlcpy(node->last.valve, ack.valveOpen() ? "OPEN" : "CLOSE", sizeof(node->last.valve));
+
+  PendingCmd& y = node->syncCmd;
+  if (y.active && y.seq == ack.seq) {
+    reportDelivery(ack.nodeId, y, DELIVERED, rxMillis);
+    y.active = false;
+    return;
+  }
+
+  PendingCmd& k = node->cfgCmd;
+  if (k.active && k.seq == ack.seq) {
+    node->configSynced = true;
+    reportDelivery(ack.nodeId, k, DELIVERED, rxMillis);
+    k.active = false;
+    return;
+  }
+
+  PendingCmd& l = node->linkCmd;
+  if (l.active && l.seq == ack.seq) {
+    // Node has the new power now; SNR measured before it no longer applies
+    node->link.txPower = l.txPower;
+    node->link.samples = 0;
+    reportDelivery(ack.nodeId, l, DELIVERED, rxMillis);
+    l.active = false;
+    return;
+  }
+
+  PendingCmd& p = node->pending;
+  if (!p.active || p.seq != ack.seq) return;
+  if (appliedAgo != UINT32_MAX) {
+    const uint32_t appliedAt = rxMillis - appliedAgo;
+    stats.cmdDeliver.add(since(p.firstTx, appliedAt));
+    stats.cmdActuate.add(since(p.issuedAt, appliedAt));
+    stats.cmdAck.add(since(appliedAt, rxMillis));
+  }
+  reportDelivery(ack.nodeId, p, DELIVERED, rxMillis);
+  p.active = false;
+}
+
+// First retransmit timeout: command, ACK and node turnaround, plus both
+// forwarded copies and the relays' hold times for every hop on the path
+// @param len Command length, with its auth trailer
+uint32_t commandRtoMs(const airtime::Link& link, size_t len, uint8_t hops) {
+  const size_t ack = frame::ACK_LEN + AUTH_LEN;
+  const uint32_t direct = link.ms(len) + link.ms(ack) + CMD_TURNAROUND_MS;
+  const uint32_t hop = link.ms(frame::RELAY_OVERHEAD + len) + link.ms(frame::RELAY_OVERHEAD + ack) +
+                       2 * frame::RELAY_HOLD_MAX_MS;
+  return direct + hops * hop;
+}
+
+// Elapsed ms on the shared millis() clock; estimates that land before
+// their start (airtime rounding) count as zero
+uint32_t since(uint32_t from, uint32_t to) {
+  return (int32_t)(to - from) < 0 ? 0 : to - from;
+}
+
+void reportDelivery(uint8_t id, const PendingCmd& p, DeliveryStatus status, uint32_t now) {
+  DeliveryReport d = {id, p.seq, p.open, status, p.attempts, now - p.firstTx};
+  static const char* const KIND_NAMES[] = {"CMD", "ADR", "CFG", "SYNC"};
+  Serial.printf("%s node %u seq %u: %s after %u tx, %u ms\n", KIND_NAMES[p.kind], id, p.seq,
+                status == DELIVERED ? "ACK" : status == FAILED ? "FAILED" : "superseded",
+                p.attempts, (unsigned)d.latencyMs);
+  if (p.kind == PENDING_VALVE) statusQueue.push(d);  // Only valve commands are user-visible
+}
+
+/* -------------------- Link Adaptation -------------------- */
+/**
+ * Fold one uplink into the node's link quality and adapt its TX power,
+ * or the network SF when this node is the one limiting it
+ * @param adrReq Node has not heard us in a while and asks for its settings
+ */
+void adaptLink(uint8_t id, NodeState& node, const RawFrame& f, bool adrReq) {
+  LinkState& l = node.link;
+  if (l.samples == 0 || l.sf != radioLink.sf) {
+    l.snr = f.snr();
+    l.rssi = f.rssi;
+    l.samples = 0;
+  } else {
+    l.snr += ADR_ALPHA * (f.snr() - l.snr);
+    l.rssi += ADR_ALPHA * (f.rssi - l.rssi);
+  }
+  l.sf = radioLink.sf;
+  if (l.samples < UINT8_MAX) l.samples++;
+
+  // Through a relay the SNR is the last hop's, not the node's: the node
+  // keeps its power, and the relay's own link stands for the path when
+  // the network SF is chosen
+  if (node.hops > 0) l.samples = 0;
+
+  if (node.linkCmd.active || sfSwitching) return;
+  if (adrReq) {
+    sendLinkCommand(id, node, radioLink.sf, l.txPower, false);
+    return;
+  }
+  if (node.hops > 0 || l.samples < ADR_MIN_SAMPLES) return;
+
+  adaptNetwork();
+  if (sfSwitching) return;
+  const int8_t power = targetPower(l, radioLink.sf);
+  if (power != l.txPower) sendLinkCommand(id, node, radioLink.sf, power, false);
+}
+
+/**
+ * Step the shared SF up when the weakest node runs out of margin at full
+ * power, or down when every node could afford the faster one, within the
+ * pushed range; below it the SF steps up regardless
+ */
+void adaptNetwork() {
+  float worst = INFINITY;
+  for (size_t i = 0; i < nodeCount; ++i) {
+    const LinkState& l = nodes[i].link;
+    if (nodeIds[i] == frame::NODE_LEGACY || l.sf != radioLink.sf || l.samples < ADR_MIN_SAMPLES) continue;
+    worst = fminf(worst, linkHeadroom(l, radioLink.sf));
+  }
+  if (worst == INFINITY) return;
+
+  const float stepDb = airtime::demodFloorDb(radioLink.sf - 1) - airtime::demodFloorDb(radioLink.sf);
+  airtime::Link to = radioLink;
+  if ((worst < 0 || radioLink.sf < netConfig.sfMin) && radioLink.sf < netConfig.sfMax) {
+    to.sf++;
+    beginLinkSwitch(to);
+  } else if (worst >= stepDb + ADR_HYSTERESIS_DB && radioLink.sf > netConfig.sfMin) {
+    to.sf--;
+    beginLinkSwitch(to);
+  }
+}
+
+/**
+ * SNR margin left at sf if the node transmitted at full power, after the
+ * installation margin; negative means the link is not reliable there
+ */
+float linkHeadroom(const LinkState& l, uint8_t sf) {
+  const float snrAtMax = l.snr + (frame::TX_POWER_MAX - l.txPower);
+  return snrAtMax - airtime::demodFloorDb(sf) - ADR_MARGIN_DB;
+}
+
+// Lowest TX power keeping the installation margin at sf, in ADR_STEP_DB steps
+int8_t targetPower(const LinkState& l, uint8_t sf) {
+  if (l.samples == 0) return frame::TX_POWER_MAX;
+  const int steps = (int)floorf(linkHeadroom(l, sf) / ADR_STEP_DB);
+  const int power = frame::TX_POWER_MAX - steps * (int)ADR_STEP_DB;
+  return (int8_t)constrain(power, frame::TX_POWER_MIN, frame::TX_POWER_MAX);
+}
+
+/**
+ * Queue a link ADR command; it rides the valve command ACK/retransmit path
+ * @param timed Part of a network SF switch at sfSwitchAt
+ */
+void sendLinkCommand(uint8_t id, NodeState& node, uint8_t sf, int8_t txPower, bool timed) {
+  const uint32_t now = millis();
+  PendingCmd& p = node.linkCmd;
+  if (p.active) reportDelivery(id, p, SUPERSEDED, now);
+
+  Serial.printf("ADR node %u: SF%u %d dBm (SNR %.1f RSSI %.0f)\n", id, sf, txPower, node.link.snr, node.link.rssi);
+  p = PendingCmd{};
+  p.active = true;
+  p.kind = PENDING_LINK;
+  p.sf = sf;
+  p.txPower = txPower;
+  p.timed = timed;
+  p.switchAt = sfSwitchAt;
+  p.seq = cmdSeq++;
+  p.firstTx = now;
+  p.nextTx = now;
+  serviceRetransmits();
+}
+
+/**
+ * Schedule a network-wide link change (SF, or bandwidth / coding rate
+ * from cfg/net). Every node heard on the current SF gets a timed command,
+ * with its TX power re-planned for the new SF, and the gateway retunes
+ * at the same moment. A new bandwidth moves the noise floor, so nodes go
+ * to full power and ADR trims them again from fresh samples.
+ */
+void beginLinkSwitch(const airtime::Link& to) {
+  const uint32_t now = millis();
+  // Lead time covers a full retransmit series on the slower of both links
+  // to the farthest node, or several wakes when a sleeping node has to be told
+  const airtime::Link& worst = to.us(frame::LINK_ADR_LEN) > radioLink.us(frame::LINK_ADR_LEN) ? to : radioLink;
+  uint8_t hops = 0;
+  for (size_t i = 0; i < nodeCount; ++i) {
+    if (nodes[i].hops > hops) hops = nodes[i].hops;
+  }
+  const uint32_t rto = commandRtoMs(worst, frame::LINK_ADR_LEN + AUTH_LEN, hops);
+  uint32_t lead = rto * ((1UL << CMD_MAX_ATTEMPTS) - 1) + CMD_TURNAROUND_MS;
+  if (lead < ADR_SWITCH_MIN_MS) lead = ADR_SWITCH_MIN_MS;
+
+  // Sleeping nodes only hear their command after one of their uplinks
+  for (size_t i = 0; i < nodeCount; ++i) {
+    if (nodes[i].rxWindow && nodes[i].link.sf == radioLink.sf) lead = RX_WINDOW_SWITCH_MS;
+  }
+
+  sfSwitching = true;
+  nextLink = to;
+  sfSwitchAt = now + lead;
+  Serial.printf("ADR: network SF%u %lu Hz 4/%u -> SF%u %lu Hz 4/%u in %u ms\n", radioLink.sf,
+                (unsigned long)radioLink.bw, radioLink.cr, to.sf, (unsigned long)to.bw, to.cr,
+                (unsigned)(sfSwitchAt - now));
+
+  const bool rescaled = to.bw != radioLink.bw;
+  for (size_t i = 0; i < nodeCount; ++i) {
+    NodeState& node = nodes[i];
+    if (nodeIds[i] == frame::NODE_LEGACY || node.link.sf != radioLink.sf) continue;
+    const int8_t power = rescaled ? frame::TX_POWER_MAX : targetPower(node.link, to.sf);
+    sendLinkCommand(nodeIds[i], node, to.sf, power, true);
+  }
+}
+
+/**
+ * Retune at a scheduled switch, move to pushed bandwidth / coding rate,
+ * and fall back to the most robust SF when a node has not been heard
+ * since the last switch
+ * @return TickType_t Ticks until this needs to run again
+ */
+TickType_t serviceLink() {
+  const uint32_t now = millis();
+  if (sfSwitching) {
+    if ((int32_t)(now - sfSwitchAt) < 0) return pdMS_TO_TICKS(sfSwitchAt - now);
+    sfSwitching = false;
+    sfChangedAt = now;
+    if (nextLink.bw != radioLink.bw) {
+      // SNR measured at the old bandwidth no longer applies
+      for (size_t i = 0; i < nodeCount; ++i) nodes[i].link.samples = 0;
+    }
+    radioLink = nextLink;
+    for (uint8_t ch = 0; ch < rxChannels; ++ch) {
+      configureRadio(radioFor(ch));
+      listen(ch);
+    }
+    saveLink();
+    Serial.printf("ADR: network now on SF%u %lu Hz 4/%u\n", radioLink.sf, (unsigned long)radioLink.bw, radioLink.cr);
+  }
+
+  // Pushed bandwidth / coding rate, also after a fallback or a reboot
+  const uint32_t bw = netConfig.bw ? netConfig.bw : radioLink.bw;
+  const uint8_t cr = netConfig.cr ? netConfig.cr : radioLink.cr;
+  if (bw != radioLink.bw || cr != radioLink.cr) {
+    airtime::Link to = radioLink;
+    to.bw = bw;
+    to.cr = cr;
+    beginLinkSwitch(to);
+    return pdMS_TO_TICKS(sfSwitchAt - now);
+  }
+  if (radioLink.sf == frame::SF_FALLBACK) return portMAX_DELAY;
+
+  for (size_t i = 0; i < nodeCount; ++i) {
+    const NodeState& node = nodes[i];
+    LinkState& l = nodes[i].link;
+    if (nodeIds[i] == frame::NODE_LEGACY || l.sf == 0) continue;
+    if ((int32_t)(node.lastSeen - sfChangedAt) >= 0 || now - sfChangedAt < lostAfterMs(node)) continue;
+    // Missed the switch; it will fall back on its own, so meet it there
+    Serial.printf("ADR: node %u lost since link switch\n", nodeIds[i]);
+    l.sf = 0;
+    l.txPower = frame::TX_POWER_MAX;
+    airtime::Link to = radioLink;
+    to.sf = frame::SF_FALLBACK;
+    beginLinkSwitch(to);
+    return pdMS_TO_TICKS(sfSwitchAt - now);
+  }
+  return pdMS_TO_TICKS(LINK_CHECK_MS);
+}
+
+// Silence after a switch that means a node missed it: a few of its
+// heartbeats, which a pushed config may have stretched
+uint32_t lostAfterMs(const NodeState& node) {
+  const uint32_t beats = 3UL * node.config.heartbeatS * 1000;
+  return beats > LINK_LOST_MS ? beats : LINK_LOST_MS;
+}
+
+// Resume the link the network was last switched to; the boot profile if
+// none is stored or it does not check out
+void loadLink() {
+  cfgStore.begin(CONFIG_NVS, false);
+  uint8_t v[3];
+  if (cfgStore.getBytes("link", v, sizeof(v)) != sizeof(v)) return;
+  if (v[0] < ADR_MIN_SF || v[0] > frame::SF_FALLBACK || frame::bandwidthHz(v[1]) == 0 || v[2] < 5 || v[2] > 8) return;
+  radioLink.sf = v[0];
+  radioLink.bw = frame::bandwidthHz(v[1]);
+  radioLink.cr = v[2];
+  Serial.printf("Link: resuming SF%u %lu Hz 4/%u\n", radioLink.sf, (unsigned long)radioLink.bw, radioLink.cr);
+}
+
+void saveLink() {
+  const uint8_t v[3] = {radioLink.sf, frame::bandwidthCode(radioLink.bw), radioLink.cr};
+  cfgStore.putBytes("link", v, sizeof(v));
+}
+
+/* -------------------- Remote Configuration -------------------- */
+/**
+ * Install pushed node settings on one node or, broadcast, on every known
+ * node and the defaults for nodes seen later
+ */
+void applyConfig(const ConfigUpdate& u) {
+  if (u.nodeId == frame::NODE_BROADCAST) {
+    for (size_t i = 0; i < nodeCount; ++i) mergeConfig(nodeIds[i], nodes[i], u);
+    mergeConfig(frame::NODE_BROADCAST, nodeDefaults, u);
+    return;
+  }
+  NodeState* node = findNode(u.nodeId, true);
+  if (node != nullptr) mergeConfig(u.nodeId, *node, u);
+}
+
+/**
+ * Fold a pushed blob into one node's settings, unless the node already
+ * has that version or a newer one. Interval and heartbeat are the node's
+ * to apply and go out over LoRa; soil and light rebuild the stock rule,
+ * replacing a custom one as cfg/soil does.
+ */
+void mergeConfig(uint8_t id, NodeState& node, const ConfigUpdate& u) {
+  NodeConfig& c = node.config;
+  if (!newerVersion(u.config.version, c.version)) return;
+  c.version = u.config.version;
+  if (u.fields & CFG_INTERVAL) c.intervalS = u.config.intervalS;
+  if (u.fields & CFG_HEARTBEAT) c.heartbeatS = u.config.heartbeatS;
+  if (u.fields & CFG_SOIL) c.soil = u.config.soil;
+  if (u.fields & CFG_LIGHT) c.lightMax = u.config.lightMax;
+  if (u.fields & (CFG_SOIL | CFG_LIGHT)) node.rule = stockRule(c.soil, c.lightMax);
+  configDirty = true;
+
+  if (u.fields & (CFG_INTERVAL | CFG_HEARTBEAT)) {
+    node.configSynced = false;
+    // Nodes heard since boot are told now, others after their next frame
+    if (id != frame::NODE_BROADCAST && id != frame::NODE_LEGACY && node.lastSeen != 0) sendConfigCommand(id, node);
+  }
+  if (id != frame::NODE_BROADCAST) Serial.printf("Node %u config v%u installed\n", id, c.version);
+}
+
+/**
+ * Install pushed network settings. ADR keeps the SF inside the new range
+ * from its next decision on, serviceLink() switches every node to a new
+ * bandwidth / coding rate, and the display picks up its interval on its
+ * next wake.
+ */
+void applyNetConfig(const NetConfigUpdate& u) {
+  NetConfig& c = netConfig;
+  if (!newerVersion(u.config.version, c.version)) return;
+  c.version = u.config.version;
+  if (u.fields & CFG_SF) {
+    c.sfMin = u.config.sfMin;
+    c.sfMax = u.config.sfMax;
+  }
+  if (u.fields & CFG_BW) c.bw = u.config.bw;
+  if (u.fields & CFG_CR) c.cr = u.config.cr;
+  if (u.fields & CFG_OLED) c.oledMs = u.config.oledMs;
+  oledInterval = c.oledMs;
+  configDirty = true;
+  Serial.printf("Network config v%u installed: SF%u-%u, %lu Hz 4/%u, display %u ms\n", c.version, c.sfMin,
+                c.sfMax, (unsigned long)(c.bw ? c.bw : radioLink.bw), c.cr ? c.cr : radioLink.cr, c.oledMs);
+}
+
+// Settings the node applies itself, as opposed to the gateway's stock rule
+bool relayed(const NodeConfig& c) {
+  return c.intervalS != 0 || c.heartbeatS != 0;
+}
+
+/**
+ * Queue a config downlink with the node's relayed settings; it rides the
+ * valve command ACK/retransmit path
+ */
+void sendConfigCommand(uint8_t id, NodeState& node) {
+  const uint32_t now = millis();
+  PendingCmd& p = node.cfgCmd;
+  if (p.active) reportDelivery(id, p, SUPERSEDED, now);
+
+  Serial.printf("CFG node %u: v%u, interval %u s, heartbeat %u s\n", id, node.config.version,
+                node.config.intervalS, node.config.heartbeatS);
+  p = PendingCmd{};
+  p.active = true;
+  p.kind = PENDING_CONFIG;
+  p.seq = cmdSeq++;
+  p.firstTx = now;
+  p.nextTx = now;
+  serviceRetransmits();
+}
+
+/**
+ * Settings from before the reset. Nodes are not known to have the relayed
+ * part (a delivery may have failed), so each gets it once more after its
+ * first frame.
+ */
+void restoreConfigs() {
+  NodeConfig defaults;
+  if (cfgStore.getBytes("all", &defaults, sizeof(defaults)) == sizeof(defaults)) {
+    nodeDefaults.config = defaults;
+    nodeDefaults.rule = stockRule(defaults.soil, defaults.lightMax);
+    nodeDefaults.configSynced = !relayed(defaults);
+  }
+  NetConfig net;
+  if (cfgStore.getBytes("net", &net, sizeof(net)) == sizeof(net)) {
+    netConfig = net;
+    oledInterval = net.oledMs;
+  }
+
+  static ConfigRecord recs[MAX_NODES];
+  const size_t n = cfgStore.getBytes("nodes", recs, sizeof(recs)) / sizeof(ConfigRecord);
+  for (size_t i = 0; i < n; ++i) {
+    NodeState* node = findNode(recs[i].nodeId, true);
+    if (node == nullptr) break;
+    node->config = recs[i].config;
+    node->rule = stockRule(node->config.soil, node->config.lightMax);
+    node->configSynced = !relayed(node->config);
+  }
+  Serial.printf("Config: network v%u, defaults v%u, %u nodes restored\n", netConfig.version,
+                nodeDefaults.config.version, (unsigned)n);
+}
+
+// Write every node's settings, the defaults and the network settings
+void saveConfigs() {
+  static ConfigRecord recs[MAX_NODES];
+  for (size_t i = 0; i < nodeCount; ++i) recs[i] = ConfigRecord{nodeIds[i], nodes[i].config};
+  if (nodeCount > 0) cfgStore.putBytes("nodes", recs, nodeCount * sizeof(ConfigRecord));
+  cfgStore.putBytes("all", &nodeDefaults.config, sizeof(NodeConfig));
+  cfgStore.putBytes("net", &netConfig, sizeof(NetConfig));
+  configDirty = false;
+}
+
+/**
+ * Frame counters from before the reset. Each node's uplinks pass again
+ * from its stored floor on, above anything accepted before; a node
+ * that resumed below it is sent a sync by its first frame. Downlinks
+ * resume at the reserved bound.
+ */
+void restoreCounters() {
+  static CounterRecord recs[MAX_NODES];
+  const size_t n = cfgStore.getBytes("ctr", recs, sizeof(recs)) / sizeof(CounterRecord);
+  for (size_t i = 0; i < n; ++i) {
+    NodeState* node = findNode(recs[i].nodeId, true);
+    if (node == nullptr) break;
+    node->upFloor = recs[i].upFloor;
+    node->upCounter = recs[i].upFloor - 1;
+    node->upKnown = true;
+    node->upResync = true;
+    node->downCounter = recs[i].downReserved;
+    node->downReserved = recs[i].downReserved;
+  }
+}
+
+// Write every synced node's counter bounds; once per AUTH_RESERVE frames a node
+void saveCounters() {
+  static CounterRecord recs[MAX_NODES];
+  size_t n = 0;
+  for (size_t i = 0; i < nodeCount; ++i) {
+    if (nodes[i].upKnown) recs[n++] = CounterRecord{nodeIds[i], nodes[i].upFloor, nodes[i].downReserved};
+  }
+  cfgStore.putBytes("ctr", recs, n * sizeof(CounterRecord));
+}
+
+// Serial number order on 16 bits, so versions may wrap; 0 is never pushed
+bool newerVersion(uint16_t v, uint16_t current) {
+  return v != 0 && (current == 0 || (int16_t)(v - current) > 0);
+}
+
+/**
+ * One step of the Wi-Fi/MQTT connection manager
+ * Each call does at most one bounded connect attempt and returns; failed
+ * attempts are rescheduled by the backoff timers, so radio handling and
+ * auto irrigation on the other core carry on through outages.
+ * @return bool True when MQTT is connected and publishing is possible
+ */
+bool serviceConnection(uint32_t now) {
+  switch (netState) {
+    case NET_WIFI_DOWN:
+      if (!wifiBackoff.due(now)) return false;
+      WiFi.disconnect();
+      wifiFastJoin = apCache.valid;
+      if (wifiFastJoin) {
+        Serial.printf("Wi-Fi: fast join, channel %u\n", apCache.channel);
+        WiFi.begin(WIFI_SSID, WIFI_PASS, apCache.channel, apCache.bssid);
+      } else {
+        Serial.println("Wi-Fi: joining");
+        WiFi.begin(WIFI_SSID, WIFI_PASS);
+      }
+      wifiJoinStart = now;
+      netState = NET_WIFI_JOINING;
+      return false;
+
+    case NET_WIFI_JOINING:
+      if (WiFi.status() == WL_CONNECTED) {
+        Serial.println("Wi-Fi: connected  IP=" + WiFi.localIP().toString());
+        digitalWrite(LED_PIN, HIGH);
+        wifiBackoff.reset(now);
+        mqttBackoff.reset(now);
+        saveApCache();
+        stats.wifiJoins++;
+        if (!timeConfigured) {
+          configTime(GMT_OFFSET_SEC, DAYLIGHT_OFFSET_SEC, NTP_SERVER);  // Syncs in the background
+          timeConfigured = true;
+        }
+        netState = NET_MQTT_DOWN;
+      } else if (wifiFastJoin && now - wifiJoinStart >= WIFI_FAST_JOIN_MS) {
+        // AP moved or changed channel: scan right away, no backoff
+        Serial.println("Wi-Fi: fast join failed, scanning");
+        apCache.valid = false;
+        netState = NET_WIFI_DOWN;
+      } else if (now - wifiJoinStart >= WIFI_JOIN_TIMEOUT_MS) {
+        const uint32_t wait = wifiBackoff.fail(now, esp_random());
+        Serial.printf("Wi-Fi: join timed out, retry in %lu ms\n", (unsigned long)wait);
+        netState = NET_WIFI_DOWN;
+      }
+      return false;
+
+    case NET_MQTT_DOWN:
+      if (WiFi.status() != WL_CONNECTED) {
+        onWiFiLost(now);
+        return false;
+      }
+      if (!mqttBackoff.due(now)) return false;
+      if (connectMQTT()) {
+        stats.mqttConnects++;
+        mqttBackoff.reset(now);
+        netState = NET_ONLINE;
+        return true;
+      }
+      {
+        const uint32_t wait = mqttBackoff.fail(now, esp_random());
+        Serial.printf("MQTT: rc=%d, retry in %lu ms\n", mqtt.state(), (unsigned long)wait);
+      }
+      return false;
+
+    case NET_ONLINE:
+      if (WiFi.status() != WL_CONNECTED) {
+        onWiFiLost(now);
+        return false;
+      }
+      if (!mqtt.loop()) {
+        Serial.printf("MQTT: connection lost (rc=%d)\n", mqtt.state());
+        netState = NET_MQTT_DOWN;
+        return false;
+      }
+      return true;
+  }
+  return false;
+}
+
+// Drop the session and start a fresh join after the backoff delay
+void onWiFiLost(uint32_t now) {
+  Serial.println("Wi-Fi: connection lost");
+  digitalWrite(LED_PIN, LOW);
+  mqtt.disconnect();
+  wifiBackoff.fail(now, esp_random());
+  netState = NET_WIFI_DOWN;
+}
+
+// Read the access point of the last successful join from NVS
+void loadApCache() {
+  prefs.begin("wifi", false);
+  apCache.channel = prefs.getUChar("ch", 0);
+  apCache.valid = prefs.getBytes("bssid", apCache.bssid, sizeof(apCache.bssid)) == sizeof(apCache.bssid) &&
+                  apCache.channel != 0;
+}
+
+// Remember the joined access point; flash is only written when it changed
+void saveApCache() {
+  const uint8_t* bssid = WiFi.BSSID();
+  const uint8_t channel = (uint8_t)WiFi.channel();
+  if (bssid == nullptr) return;
+  if (apCache.valid && apCache.channel == channel && memcmp(apCache.bssid, bssid, sizeof(apCache.bssid)) == 0) return;
+  memcpy(apCache.bssid, bssid, sizeof(apCache.bssid));
+  apCache.channel = channel;
+  apCache.valid = true;
+  prefs.putBytes("bssid", apCache.bssid, sizeof(apCache.bssid));
+  prefs.putUChar("ch", channel);
+}
+
+// Single MQTT connect attempt; blocks at most for the socket timeouts
+bool connectMQTT(){
+  Serial.print("MQTT… ");
+  if(!mqtt.connect("ESP32-LoRa-GW")) return false;
+  Serial.println("connected");
+  for (const char* filter : SUBSCRIPTIONS) mqtt.subscribe(filter);
+  return true;
+}
+
+void mqttCallback(char* topic, byte* payload, unsigned len) {
+  Span span(stats.callback);
+  mqttcmd::NodeTopic t;
+  if (!mqttcmd::splitTopic(topic, TOPIC_ROOT, frame::NODE_BROADCAST, t)) return;
+  const uint8_t in = mqttcmd::route(IN_ROUTES, t.leaf, t.leafLen, IN_NONE);
+
+  // Rules and settings are JSON and case-sensitive; handed over whole
+  if (in == IN_RULE) {
+    handleRuleMessage(t.nodeId, payload, len);
+    return;
+  }
+  if (in == IN_NODE_CFG || in == IN_NET_CFG) {
+    handleConfigMessage(t.nodeId, in == IN_NET_CFG, payload, len);
+    return;
+  }
+
+  // Decoded in place, case-insensitive
+  const mqttcmd::Payload msg = mqttcmd::body(payload, len);
+  Command cmd = {};
+  cmd.nodeId = t.nodeId;
+
+  /*-------------------- Mode Control Handler --------------------*/
+  if (in == IN_MODE) {
+    // FALSE = Manual Mode, TRUE = Auto Mode
+    const bool manual = mqttcmd::is(msg, "FALSE");
+    if (!manual && !mqttcmd::is(msg, "TRUE")) return;
+    cmd.type = CMD_MODE;
+    cmd.flag = manual;
+  }
+
+  /*-------------------- Soil Threshold Handler --------------------*/
+  else if (in == IN_SOIL) {
+    // Whole numbers only
+    if (!mqttcmd::toNumber(msg, cmd.value)) return;
+    cmd.type = CMD_THRESHOLD;
+  }
+
+  /*-------------------- Valve Control Handler --------------------*/
+  else if (in == IN_CMD) {
+    const bool open = mqttcmd::is(msg, "TRUE");
+    if (!open && !mqttcmd::is(msg, "FALSE")) return;
+    Serial.printf("Manual CMD from MQTT for node %u: %s\n", t.nodeId, open ? "TRUE" : "FALSE");
+    cmd.type = CMD_VALVE;
+    cmd.flag = open;
+  }
+
+  else return;
+
+  // Radio task owns the node table and LoRa chip; queue and wake it
+  cmd.issuedAt = millis();
+  if (commandQueue.push(cmd)) {
+    xTaskNotify(radioTaskHandle, NOTIFY_CMD, eSetBits);
+  } else {
+    Serial.println("Command queue full, request dropped");
+  }
+}
+
+/**
+ * Compile a rule upload and queue it for the radio task, e.g.
+ *   {"on":[["moist","<",30]],
+ *    "off":[["moist",">=",38],["rain","=",1],["light",">",8.5]],
+ *    "min_on":120, "min_off":600, "window":["05:00","09:30"]}
+ * Fields are temp, hum, light, moist and rain (0/1); ops are
+ * < <= > >= = !=; dwell times are seconds.
+ * @param nodeId Node from the topic, NODE_BROADCAST for all nodes
+ */
+void handleRuleMessage(uint8_t nodeId, const byte* payload, unsigned len) {
+  JsonDocument doc;
+  if (deserializeJson(doc, payload, len)) {
+    Serial.println("Rule rejected: invalid JSON");
+    return;
+  }
+  RuleUpdate u;
+  u.nodeId = nodeId;
+  if (!compileRule(doc.as<JsonObjectConst>(), u.rule)) {
+    Serial.println("Rule rejected: bad term, window or dwell");
+    return;
+  }
+  if (ruleQueue.push(u)) {
+    xTaskNotify(radioTaskHandle, NOTIFY_CMD, eSetBits);
+  } else {
+    Serial.println("Rule queue full, rule dropped");
+  }
+}
+
+bool compileRule(JsonObjectConst o, rules::Rule& rule) {
+  rule = rules::Rule{};
+  if (!compileTerms(o["on"], rule, true) || !compileTerms(o["off"], rule, false)) return false;
+  if (rule.nOn == 0 && rule.nOff == 0) return false;
+  const uint32_t minOn = o["min_on"] | (uint32_t)AUTO_MIN_ON_S;
+  const uint32_t minOff = o["min_off"] | (uint32_t)AUTO_MIN_OFF_S;
+  if (minOn > UINT16_MAX || minOff > UINT16_MAX) return false;
+  rule.minOnS = (uint16_t)minOn;
+  rule.minOffS = (uint16_t)minOff;
+
+  JsonArrayConst w = o["window"];
+  if (!w.isNull()) {
+    if (w.size() != 2) return false;
+    if (!rules::parseClock(w[0] | "", rule.winStart) || !rules::parseClock(w[1] | "", rule.winEnd)) return false;
+  }
+  return true;
+}
+
+// Each term is [field, op, value]; a missing list is empty
+bool compileTerms(JsonArrayConst terms, rules::Rule& rule, bool on) {
+  for (JsonVariantConst t : terms) {
+    JsonArrayConst a = t;
+    uint8_t field, op;
+    if (a.size() != 3 || !a[2].is<float>()) return false;
+    if (!rules::parseField(a[0] | "", field) || !rules::parseOp(a[1] | "", op)) return false;
+    const int16_t value = rules::toFixed10(a[2].as<float>());
+    if (!(on ? rule.addOn(field, op, value) : rule.addOff(field, op, value))) return false;
+  }
+  return true;
+}
+
+/**
+ * Parse a settings blob and queue it for the radio task, e.g.
+ *   cfg/node: {"v":4, "interval":30, "heartbeat":300, "soil":28, "light_max":8.5}
+ *   cfg/net:  {"v":2, "sf":[7,10], "bw":125000, "cr":5, "oled_ms":500}
+ * "v" is required and must be newer than the settings in place; every
+ * other key is optional and left as it is when absent. interval and
+ * heartbeat are seconds.
+ * @param network cfg/net, only accepted on the "all" topic
+ */
+void handleConfigMessage(uint8_t nodeId, bool network, const byte* payload, unsigned len) {
+  JsonDocument doc;
+  if (deserializeJson(doc, payload, len)) {
+    Serial.println("Config rejected: invalid JSON");
+    return;
+  }
+  bool queued;
+  if (network) {
+    NetConfigUpdate u = {};
+    if (nodeId != frame::NODE_BROADCAST || !parseNetConfig(doc.as<JsonObjectConst>(), u)) {
+      Serial.println("Config rejected: bad version, key or value");
+      return;
+    }
+    queued = netConfigQueue.push(u);
+  } else {
+    ConfigUpdate u = {};
+    u.nodeId = nodeId;
+    if (!parseNodeConfig(doc.as<JsonObjectConst>(), u)) {
+      Serial.println("Config rejected: bad version, key or value");
+      return;
+    }
+    queued = configQueue.push(u);
+  }
+  if (queued) {
+    xTaskNotify(radioTaskHandle, NOTIFY_CMD, eSetBits);
+  } else {
+    Serial.println("Config queue full, config dropped");
+  }
+}
+
+/**
+ * Read one optional numeric key
+ * @param field Set in fields when the key is present
+ * @return bool False if present but not a number within [lo, hi]
+ */
+template <typename T>
+bool configValue(JsonVariantConst v, T lo, T hi, uint8_t field, uint8_t& fields, T& out) {
+  if (v.isNull()) return true;
+  if (!v.is<T>() || v.as<T>() < lo || v.as<T>() > hi) return false;
+  out = v.as<T>();
+  fields |= field;
+  return true;
+}
+
+bool parseNodeConfig(JsonObjectConst o, ConfigUpdate& u) {
+  NodeConfig& c = u.config;
+  uint8_t versioned = 0;
+  return configValue<uint16_t>(o["v"], 1, UINT16_MAX, 1, versioned, c.version) && versioned &&
+         configValue<uint16_t>(o["interval"], 1, UINT16_MAX, CFG_INTERVAL, u.fields, c.intervalS) &&
+         configValue<uint16_t>(o["heartbeat"], 1, UINT16_MAX, CFG_HEARTBEAT, u.fields, c.heartbeatS) &&
+         configValue<float>(o["soil"], 0, 100, CFG_SOIL, u.fields, c.soil) &&
+         configValue<float>(o["light_max"], 0, 10, CFG_LIGHT, u.fields, c.lightMax) &&
+         u.fields != 0;
+}
+
+bool parseNetConfig(JsonObjectConst o, NetConfigUpdate& u) {
+  NetConfig& c = u.config;
+  uint8_t versioned = 0;
+  if (!configValue<uint16_t>(o["v"], 1, UINT16_MAX, 1, versioned, c.version) || !versioned) return false;
+
+  // SF range as [min, max]
+  JsonArrayConst sf = o["sf"];
+  if (!sf.isNull()) {
+    uint8_t ends = 0;
+    if (sf.size() != 2 || !configValue<uint8_t>(sf[0], ADR_MIN_SF, ADR_MAX_SF, 1, ends, c.sfMin) ||
+        !configValue<uint8_t>(sf[1], c.sfMin, ADR_MAX_SF, 2, ends, c.sfMax) || ends != 3) {
+      return false;
+    }
+    u.fields |= CFG_SF;
+  }
+  if (!configValue<uint32_t>(o["bw"], 1, UINT32_MAX, CFG_BW, u.fields, c.bw)) return false;
+  if ((u.fields & CFG_BW) && frame::bandwidthCode(c.bw) == frame::BW_CODES) return false;
+  return configValue<uint8_t>(o["cr"], 5, 8, CFG_CR, u.fields, c.cr) &&
+         configValue<uint16_t>(o["oled_ms"], OLED_MIN_MS, OLED_MAX_MS, CFG_OLED, u.fields, c.oledMs) &&
+         u.fields != 0;
+}
+
+/**
+ * Convert a rebuilt binary uplink into the gateway's reading
+ */
+void readingFromUplink(const frame::Uplink& up, Reading& r) {
+  r.nodeId = up.nodeId;
+  r.seq    = up.seq;
+  strlcpy(r.weather, up.raining() ? "Raining" : "Clear", sizeof(r.weather));
+  r.tempC  = up.tempC();
+  r.humP   = up.humP();
+  r.lux    = up.light();
+  r.moistP = up.moist;
+  strlcpy(r.valve, up.valveOpen() ? "OPEN" : "CLOSE", sizeof(r.valve));
+  r.raining = up.raining();
+}
+
+/**
+ * Produce a complete uplink record. A full frame becomes the node's delta
+ * base; a delta is applied on top of that base, which it must name.
+ * @return bool False if malformed, or a delta whose base was never received
+ */
+bool rebuildUplink(const uint8_t* buf, size_t n, frame::Uplink& up) {
+  if (frame::decodeUplink(buf, n, up)) {
+    NodeState* node = findNode(up.nodeId, true);
+    if (node != nullptr) {
+      node->base = up;
+      node->hasBase = true;
+    }
+    return true;
+  }
+
+  frame::Delta d;
+  if (!frame::decodeDelta(buf, n, d)) return false;
+  NodeState* node = findNode(d.up.nodeId, false);
+  if (node == nullptr || !node->hasBase || node->base.seq != d.refSeq) {
+    // Missed the full frame it extends; the next heartbeat resyncs
+    Serial.printf("RX: delta #%u from node %u has no base #%u\n", d.up.seq, d.up.nodeId, d.refSeq);
+    return false;
+  }
+  up = node->base;
+  frame::applyDelta(d, up);
+  return true;
+}
+
+/**
+ * Legacy fallback for nodes still sending the ASCII tag format.
+ * Parses in place; buf needs one spare byte past n for the terminator.
+ */
+void decodeAsciiUplink(char* buf, size_t n, Reading& r) {
+  // Only accept printable ASCII, compacting in place
+  size_t len = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (buf[i] >= 32 && buf[i] <= 126) buf[len++] = buf[i];
+  }
+
+  ascii::Fields f;
+  ascii::parse(buf, len, f);
+  r.nodeId = 0;
+  r.seq    = 0;
+  memcpy(r.weather, f.weather, sizeof(r.weather));
+  memcpy(r.valve, f.valve, sizeof(r.valve));
+  r.tempC  = f.temp;
+  r.humP   = f.hum;
+  r.lux    = f.light;
+  r.moistP = f.moist;
+  r.raining = containsNoCase(r.weather, "RAIN");  // Once here, not per rule check
+}
+
+// TOPIC_ROOT/<node>/<leaf>
+void nodeTopic(char* buf, size_t cap, uint8_t nodeId, const char* leaf) {
+  snprintf(buf, cap, "%s/%u/%s", TOPIC_ROOT, nodeId, leaf);
+}
+
+/**
+ * Publish a batch of readings as one array per node on its telemetry
+ * topic, in PUB_FORMAT, serialized into a buffer reused across calls.
+ * Live batches are retained so a dashboard connecting later gets each
+ * node's latest readings at once; backlog replays are older than that
+ * and are not. The valve state travels in each reading.
+ * @param live Fresh readings rather than a backlog replay
+ * @return bool False if the broker did not take every node's array; the
+ *              caller keeps the whole batch, so arrays that did go out
+ *              are sent again, as with any replay
+ */
+bool publishTelemetry(const Reading* batch, size_t n, bool live){
+  Span span(stats.publish);
+  static char buf[PUBLISH_BUF_LEN];
+  const char* const* key = READING_KEYS[PUB_FORMAT];
+
+  for (size_t first = 0; first < n; ++first) {
+    // One array per node, built when its first reading comes up
+    const uint8_t id = batch[first].nodeId;
+    bool seen = false;
+    for (size_t j = 0; j < first && !seen; ++j) seen = batch[j].nodeId == id;
+    if (seen) continue;
+
+    JsonDocument doc;
+    JsonArray arr = doc.to<JsonArray>();
+    size_t count = 0;
+    for (size_t i = first; i < n; ++i) {
+      const Reading& r = batch[i];
+      if (r.nodeId != id) continue;
+      ++count;
+      JsonObject o = arr.add<JsonObject>();
+      o[key[RK_NODE]] = r.nodeId;
+      o[key[RK_WEATHER]] = r.weather;
+      o[key[RK_TEMP]] = r.tempC;
+      o[key[RK_HUM]] = r.humP;
+      o[key[RK_LIGHT]] = r.lux;
+      o[key[RK_MOIST]] = r.moistP;
+      o[key[RK_VALVE]] = r.valve;
+      if (PUB_FORMAT == FORMAT_JSON) {
+        o[key[RK_TIME]] = timestampFor(r.epochMs);
+      } else if (r.epochMs) {
+        o[key[RK_TIME]] = r.epochMs;
+      } else {
+        o[key[RK_TIME]] = nullptr;  // NTP not synced
+      }
+    }
+
+    const size_t len = serializePayload(doc, PUB_FORMAT, buf, sizeof(buf));
+    if (len == 0) {
+      Serial.printf("Publish of %u readings for node %u too large, dropped\n", (unsigned)count, id);
+      continue;  // Retrying cannot help
+    }
+    char topic[TOPIC_LEN];
+    nodeTopic(topic, sizeof(topic), id, TELEMETRY_LEAF);
+    if (!mqtt.publish(topic, (const uint8_t*)buf, len, live)) {
+      stats.publishFails++;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Remember a node's reported valve state for publishValves()
+void noteValve(uint8_t nodeId, const char* valve){
+  if (valve[0] == '\0') return;
+  size_t i = 0;
+  while (i < valveStateCount && valveStates[i].nodeId != nodeId) ++i;
+  if (i == valveStateCount) {
+    if (valveStateCount == MAX_NODES) return;
+    valveStates[valveStateCount++] = ValveState{nodeId, "", ""};
+  }
+  strlcpy(valveStates[i].live, valve, sizeof(valveStates[i].live));
+}
+
+// Retained valve state per node, sent only when the live state differs
+// from the last one the broker took (also catches up after an outage)
+void publishValves(){
+  char topic[TOPIC_LEN];
+  for (size_t i = 0; i < valveStateCount; ++i) {
+    ValveState& v = valveStates[i];
+    if (strcmp(v.live, v.sent) == 0) continue;
+    nodeTopic(topic, sizeof(topic), v.nodeId, VALVE_LEAF);
+    if (!mqtt.publish(topic, v.live, true)) return;
+    strlcpy(v.sent, v.live, sizeof(v.sent));
+  }
+}
+
+void publishDelivery(const DeliveryReport& d){
+  static const char* const STATUS_NAMES[] = {"delivered", "failed", "superseded"};
+  const char* const* key = STATUS_KEYS[STATUS_FORMAT];
+  JsonDocument doc;
+  doc[key[SK_NODE]] = d.nodeId;
+  doc[key[SK_SEQ]] = d.seq;
+  if (STATUS_FORMAT == FORMAT_JSON) {
+    doc[key[SK_CMD]] = d.open ? "TRUE" : "FALSE";
+    doc[key[SK_STATUS]] = STATUS_NAMES[d.status];
+  } else {
+    doc[key[SK_CMD]] = d.open;
+    doc[key[SK_STATUS]] = (uint8_t)d.status;
+  }
+  doc[key[SK_ATTEMPTS]] = d.attempts;
+  if (d.status == DELIVERED) doc[key[SK_LATENCY]] = d.latencyMs;
+  char buf[128];
+  size_t n = serializePayload(doc, STATUS_FORMAT, buf, sizeof(buf));
+  if (n > 0) mqtt.publish(STATUS_TOPIC, (const uint8_t*)buf, n);
+}
+
+// Span histogram as [count, sum µs, max µs, bucket 0, bucket 1, ...],
+// trailing empty buckets left out
+void addSpan(JsonObject o, const char* name, const SpanHist& h) {
+  JsonArray a = o[name].to<JsonArray>();
+  a.add(h.n);
+  a.add(h.sum);
+  a.add(h.max);
+  for (uint8_t i = 0; i < h.used(); ++i) a.add(h.b[i]);
+}
+
+/**
+ * Publish the metrics snapshot on METRICS_TOPIC. All counters are
+ * cumulative since boot ("up", seconds); see README for the layout.
+ */
+void publishMetrics() {
+  static char buf[PUBLISH_BUF_LEN];
+  JsonDocument doc;
+  doc["up"] = millis() / 1000;
+
+  JsonArray heap = doc["heap"].to<JsonArray>();
+  heap.add(ESP.getFreeHeap());
+  heap.add(ESP.getMinFreeHeap());
+  JsonArray stack = doc["stack"].to<JsonArray>();  // Free bytes at the high-water mark
+  stack.add(uxTaskGetStackHighWaterMark(radioTaskHandle));
+  stack.add(uxTaskGetStackHighWaterMark(netTaskHandle));
+  stack.add(uxTaskGetStackHighWaterMark(oledTaskHandle));
+
+  JsonArray rx = doc["rx"].to<JsonArray>();
+  rx.add(stats.rxFrames[0] + stats.rxFrames[1]);
+  rx.add(stats.crcErrors[0] + stats.crcErrors[1]);
+  rx.add(rxOverflows);
+  rx.add(stats.decodeDrops);
+  rx.add(stats.queueDrops);
+  JsonArray relay = doc["relay"].to<JsonArray>();  // [relayed frames, duplicates]
+  relay.add(stats.relayedFrames);
+  relay.add(stats.duplicates);
+  JsonArray au = doc["auth"].to<JsonArray>();      // [unsigned, forged, unknown node]
+  au.add(stats.authUnsigned);
+  au.add(stats.authForged);
+  au.add(stats.authUnknown);
+  JsonArray ch = doc["ch"].to<JsonArray>();        // Frames per channel
+  for (uint8_t i = 0; i < rxChannels; ++i) ch.add(stats.rxFrames[i]);
+  JsonArray tx = doc["tx"].to<JsonArray>();
+  tx.add(stats.txFrames);
+  tx.add(stats.txFails);
+  JsonArray net = doc["net"].to<JsonArray>();
+  net.add(stats.publishFails);
+  net.add(stats.wifiJoins);
+  net.add(stats.mqttConnects);
+  net.add(backlog.count());
+
+  JsonObject t = doc["t"].to<JsonObject>();
+  addSpan(t, "isr", stats.isr);
+  addSpan(t, "rx", stats.rx);
+  addSpan(t, "tx", stats.tx);
+  addSpan(t, "pub", stats.publish);
+  addSpan(t, "cb", stats.callback);
+  addSpan(t, "draw", stats.draw);
+  addSpan(t, "flush", stats.flush);
+
+  JsonArray rssi = doc["rssi"].to<JsonArray>();
+  for (uint32_t v : stats.rssi.b) rssi.add(v);
+  JsonArray snr = doc["snr"].to<JsonArray>();
+  for (uint32_t v : stats.snr.b) snr.add(v);
+
+  const size_t len = serializePayload(doc, FORMAT_JSON, buf, sizeof(buf));
+  if (len > 0) mqtt.publish(METRICS_TOPIC, (const uint8_t*)buf, len);
+}
+
+// Hop latency as [count, p50, p90, p99, max] in ms
+void addLatency(JsonDocument& doc, const char* name, const LatencyHist& h) {
+  JsonArray a = doc[name].to<JsonArray>();
+  a.add(h.n);
+  a.add(h.percentile(50));
+  a.add(h.percentile(90));
+  a.add(h.percentile(99));
+  a.add(h.max);
+}
+
+/**
+ * Publish per-hop latency percentiles on LATENCY_TOPIC, cumulative since
+ * boot. Telemetry: sample -> gateway RX -> broker. Commands: request ->
+ * radio task -> node applies it (servo) -> ACK, plus request -> the node
+ * checking in with the new state.
+ */
+void publishLatency() {
+  JsonDocument doc;
+  doc["up"] = millis() / 1000;
+  addLatency(doc, "sample_rx", stats.sampleRx);
+  addLatency(doc, "rx_pub", stats.rxPublish);
+  addLatency(doc, "sample_pub", stats.samplePublish);
+  addLatency(doc, "cmd_queue", stats.cmdQueue);
+  addLatency(doc, "cmd_deliver", stats.cmdDeliver);
+  addLatency(doc, "cmd_actuate", stats.cmdActuate);
+  addLatency(doc, "cmd_ack", stats.cmdAck);
+  addLatency(doc, "cmd_checkin", stats.cmdCheckIn);
+
+  char buf[512];
+  const size_t len = serializePayload(doc, FORMAT_JSON, buf, sizeof(buf));
+  if (len > 0) mqtt.publish(LATENCY_TOPIC, (const uint8_t*)buf, len);
+}
+
+/**
+ * Serialize doc in the given format
+ * @return size_t Bytes written, or 0 if it does not fit in cap
+ */
+size_t serializePayload(const JsonDocument& doc, PayloadFormat fmt, char* buf, size_t cap) {
+  if (fmt == FORMAT_MSGPACK) {
+    return measureMsgPack(doc) <= cap ? serializeMsgPack(doc, buf, cap) : 0;
+  }
+  return measureJson(doc) < cap ? serializeJson(doc, buf, cap) : 0;
+}
+
+/* -------------------- Retained-mode Display -------------------- */
+// Cells are fixed text boxes on the static layout (title rule and emoji);
+// each remembers its text so unchanged values are never redrawn
+struct Cell {
+  int16_t x, y, w, h;
+  bool centered;
+};
+
+enum CellId : uint8_t {
+  CELL_TITLE, CELL_TEMP, CELL_HUM, CELL_LIGHT, CELL_MOIST,
+  CELL_WEATHER, CELL_ICON, CELL_CLOCK, CELL_VALVE, CELL_COUNT
+};
+
+const Cell CELLS[CELL_COUNT] = {
+  {0, 0, 128, 8, true},      // Title
+  {12, 18, 52, 8, false},    // Temperature
+  {74, 18, 54, 8, false},    // Humidity
+  {12, 31, 52, 8, false},    // Light
+  {74, 31, 54, 8, false},    // Moisture
+  {0, 44, 96, 8, false},     // Weather text
+  {98, 42, 13, 8, false},    // Weather icon
+  {0, 54, 64, 8, false},     // Clock
+  {70, 54, 58, 8, false},    // Valve state
+};
+
+constexpr uint8_t CHAR_W = 6;                 // Built-in 5x7 font, size 1
+char cellText[CELL_COUNT][OLED_WIDTH / CHAR_W + 1];
+bool layoutDrawn = false;
+DirtyPages<OLED_WIDTH, OLED_HEIGHT / 8> dirty;
+
+/**
+ * Render a reading into the retained layout. The static parts are drawn
+ * once; afterwards only cells whose text differs are touched.
+ */
+void drawOLED(const Reading& r) {
+  if (!layoutDrawn) {
+    oled.clearDisplay();
+    oled.setTextSize(1);
+    oled.setTextColor(SSD1306_WHITE);
+    oled.setTextWrap(false);
+    oled.drawLine(0, 9, 128, 9, SSD1306_WHITE);  // Underline
+    oled.drawBitmap(2, 17, temp_emoji, 8, 8, SSD1306_WHITE);
+    oled.drawBitmap(64, 17, humid_emoji, 8, 8, SSD1306_WHITE);
+    oled.drawBitmap(2, 30, sun_emoji, 8, 8, SSD1306_WHITE);
+    oled.drawBitmap(64, 30, moist_emoji, 8, 8, SSD1306_WHITE);
+    memset(cellText, 0, sizeof(cellText));
+    dirty.markAll();
+    layoutDrawn = true;
+    drawClock(time(nullptr));
+  }
+
+  char text[sizeof(cellText[0])];
+  if (r.nodeId != frame::NODE_LEGACY) {
+    snprintf(text, sizeof(text), "AGROSENSE #%u", r.nodeId);
+  } else {
+    strlcpy(text, "AGROSENSE", sizeof(text));
+  }
+  drawCell(CELL_TITLE, text);
+
+  snprintf(text, sizeof(text), "%.1fC", r.tempC);
+  drawCell(CELL_TEMP, text);
+  snprintf(text, sizeof(text), "%.1f%%", r.humP);
+  drawCell(CELL_HUM, text);
+  snprintf(text, sizeof(text), "%.1f lx", r.lux);
+  drawCell(CELL_LIGHT, text);
+  snprintf(text, sizeof(text), "%.0f%%", r.moistP);
+  drawCell(CELL_MOIST, text);
+  char weather[sizeof("Weather: ") + sizeof(r.weather)];  // drawCell() clips to the cell
+  snprintf(weather, sizeof(weather), "Weather: %s", r.weather);
+  drawCell(CELL_WEATHER, weather);
+  drawWeatherIcon(weatherIconAscii(r.weather, r.lux));
+  snprintf(text, sizeof(text), "V:%s", r.valve);
+  drawCell(CELL_VALVE, text);
+}
+
+// Clock cell; reads the system time without waiting for NTP
+void drawClock(time_t now) {
+  if (!layoutDrawn) return;  // Keep the splash until the first reading
+  char text[9] = "";
+  if (now >= VALID_EPOCH) {
+    struct tm timeinfo;
+    localtime_r(&now, &timeinfo);
+    strftime(text, sizeof(text), "%H:%M:%S", &timeinfo);
+  }
+  drawCell(CELL_CLOCK, text);
+}
+
+/**
+ * Redraw one text cell if its content changed, clipped to the cell width
+ */
+void drawCell(uint8_t id, const char* text) {
+  char* shown = cellText[id];
+  const Cell& c = CELLS[id];
+  const size_t maxChars = c.w / CHAR_W;
+  if (strncmp(shown, text, maxChars) == 0 && strlen(shown) == strnlen(text, maxChars)) return;
+  strlcpy(shown, text, maxChars + 1);
+
+  oled.fillRect(c.x, c.y, c.w, c.h, SSD1306_BLACK);
+  const int16_t len = (int16_t)strlen(shown);
+  oled.setCursor(c.centered ? c.x + (c.w - len * CHAR_W) / 2 : c.x, c.y);
+  oled.print(shown);
+  dirty.mark(c.x, c.y, c.w, c.h);
+}
+
+// Weather icon cell: 'R' rain drops, 'S' sun, 'C' cloud
+void drawWeatherIcon(char kind) {
+  char* shown = cellText[CELL_ICON];
+  if (shown[0] == kind) return;
+  shown[0] = kind;
+  shown[1] = '\0';
+
+  const Cell& c = CELLS[CELL_ICON];
+  oled.fillRect(c.x, c.y, c.w, c.h, SSD1306_BLACK);
+  if (kind == 'R') {
+    oled.drawBitmap(100, 42, rain_emoji, 8, 8, SSD1306_WHITE);
+  } else if (kind == 'S') {
+    oled.drawBitmap(100, 42, sun_emoji, 8, 8, SSD1306_WHITE);
+  } else {
+    // Default cloud-like pattern for other conditions
+    oled.fillCircle(104, 46, 3, SSD1306_WHITE);
+    oled.fillCircle(100, 46, 2, SSD1306_WHITE);
+    oled.fillCircle(108, 46, 2, SSD1306_WHITE);
+  }
+  dirty.mark(c.x, c.y, c.w, c.h);
+}
+
+/**
+ * Send only the dirty column span of each dirty page to the SSD1306
+ * using its page addressing window
+ */
+void flushOLED() {
+  if (!dirty.any()) return;
+  Span span(stats.flush);
+  const uint8_t* fb = oled.getBuffer();
+  dirty.flush([fb](uint8_t page, uint8_t col0, uint8_t col1) {
+    oled.ssd1306_command(SSD1306_COLUMNADDR);
+    oled.ssd1306_command(col0);
+    oled.ssd1306_command(col1);
+    oled.ssd1306_command(SSD1306_PAGEADDR);
+    oled.ssd1306_command(page);
+    oled.ssd1306_command(page);
+
+    const uint8_t* data = fb + page * OLED_WIDTH + col0;
+    size_t left = col1 - col0 + 1;
+    while (left > 0) {
+      const size_t n = left < OLED_I2C_CHUNK ? left : OLED_I2C_CHUNK;
+      Wire.beginTransmission(OLED_ADDR);
+      Wire.write((uint8_t)0x40);  // Co = 0, D/C = 1: data stream
+      Wire.write(data, n);
+      Wire.endTransmission();
+      data += n;
+      left -= n;
+    }
+  });
+}
+
+char weatherIconAscii(const char* w,float luxVal){
+  if (containsNoCase(w,"RAIN")) return 'R';     // Rain
+  if (luxVal>9)                 return 'S';     // Sunny / bright
+  return 'C';                                   // Cloud/other
+}
+
+// Case-insensitive substring test; needle must be uppercase
+bool containsNoCase(const char* s, const char* needle) {
+  for (; *s; ++s) {
+    const char* a = s;
+    const char* b = needle;
+    while (*a && *b && toupper((unsigned char)*a) == *b) { ++a; ++b; }
+    if (!*b) return true;
+  }
+  return false;
+}
+
+/* -------------------- Store-and-forward -------------------- */
+// Append readings the broker did not take to the flash backlog
+void spillReadings(const Reading* batch, size_t n) {
+  if (!backlogReady) {
+    Serial.printf("Offline, %u readings lost\n", (unsigned)n);
+    return;
+  }
+  uint8_t rec[STORE_RECORD_LEN];
+  for (size_t i = 0; i < n; ++i) {
+    packReading(batch[i], rec);
+    if (!backlog.append(rec)) Serial.println("Backlog: flash write failed");
+  }
+}
+
+/**
+ * Replay at most one batch of the backlog per STORE_DRAIN_MS, oldest
+ * first, so a long outage does not flood the broker or starve live data
+ */
+void drainBacklog(uint32_t now) {
+  static uint32_t lastDrain = 0;
+  static uint8_t recs[PUBLISH_BATCH_MAX * STORE_RECORD_LEN];
+  static Reading replay[PUBLISH_BATCH_MAX];
+  if (!backlogReady || backlog.count() == 0 || now - lastDrain < STORE_DRAIN_MS) return;
+  lastDrain = now;
+
+  const size_t n = backlog.peek(recs, PUBLISH_BATCH_MAX);
+  for (size_t i = 0; i < n; ++i) unpackReading(recs + i * STORE_RECORD_LEN, replay[i]);
+  if (n > 0 && publishTelemetry(replay, n, false)) backlog.consume(n);
+
+  // Closed rollups, one span per publish
+  if (!rollupBacklogReady) return;
+  size_t m = rollupBacklog.peek(recs, ROLLUP_BATCH_MAX);
+  for (size_t i = 1; i < m; ++i) {
+    if (recs[i * ROLLUP_RECORD_LEN + 1] != recs[1]) {
+      m = i;
+      break;
+    }
+  }
+  if (m > 0 && publishRollups(recs, m)) rollupBacklog.consume(m);
+}
+
+/**
+ * Backlog record, little-endian:
+ *   [0] node [1] flags [2..3] seq [4..11] epoch ms (or rxMillis)
+ *   [12..13] boot session [14..15] temp10 [16..17] hum10 [18..19] lux10
+ *   [20..21] moist10 [22..37] weather [38..45] valve
+ * A reading taken before NTP synced keeps its rxMillis and boot session,
+ * so it can still be dated if it is replayed before the next reboot.
+ */
+void packReading(const Reading& r, uint8_t* p) {
+  memset(p, 0, STORE_RECORD_LEN);
+  const bool timed = r.epochMs != 0;
+  const uint64_t ms = timed ? r.epochMs : r.rxMillis;
+  p[0] = r.nodeId;
+  p[1] = timed ? STORE_TIME_VALID : 0;
+  frame::put16(p + 2, r.seq);
+  for (uint8_t i = 0; i < 8; ++i) p[4 + i] = (uint8_t)(ms >> (8 * i));
+  frame::put16(p + 12, bootSession);
+  frame::put16(p + 14, (uint16_t)frame::toTemp10(r.tempC));
+  frame::put16(p + 16, frame::toHum10(r.humP));
+  const float lux = r.lux < 0 ? 0 : r.lux > 6553.0f ? 6553.0f : r.lux;
+  frame::put16(p + 18, (uint16_t)frame::roundFixed(lux * 10.0f));
+  frame::put16(p + 20, frame::toHum10(r.moistP));
+  memcpy(p + 22, r.weather, strnlen(r.weather, 15));
+  memcpy(p + 38, r.valve, strnlen(r.valve, 7));
+}
+
+void unpackReading(const uint8_t* p, Reading& r) {
+  r = Reading{};
+  r.nodeId = p[0];
+  r.seq = frame::get16(p + 2);
+  uint64_t ms = 0;
+  for (uint8_t i = 0; i < 8; ++i) ms |= (uint64_t)p[4 + i] << (8 * i);
+  if (p[1] & STORE_TIME_VALID) {
+    r.epochMs = ms;
+  } else if (frame::get16(p + 12) == bootSession) {
+    r.rxMillis = (uint32_t)ms;
+    r.epochMs = epochMsFor(r.rxMillis);  // Dated now if NTP has synced since
+  }
+  const int16_t t10 = (int16_t)frame::get16(p + 14);
+  const uint16_t h10 = frame::get16(p + 16);
+  const uint16_t m10 = frame::get16(p + 20);
+  r.tempC = t10 == frame::TEMP_INVALID ? NAN : t10 / 10.0f;
+  r.humP = h10 == frame::HUM_INVALID ? NAN : h10 / 10.0f;
+  r.lux = frame::get16(p + 18) / 10.0f;
+  r.moistP = m10 == frame::HUM_INVALID ? NAN : m10 / 10.0f;
+  memcpy(r.weather, p + 22, 15);
+  memcpy(r.valve, p + 38, 7);
+}
+
+/* -------------------- Edge Rollups -------------------- */
+// Fold a reading into its node's current 1-minute bucket
+void rollupAdd(const Reading& r) {
+  if (r.epochMs == 0) return;  // Buckets are wall-clock aligned
+  const uint32_t t = (uint32_t)(r.epochMs / 1000);
+
+  NodeRollup* e = nullptr;
+  for (size_t i = 0; i < rollupCount; ++i) {
+    if (rollups[i].nodeId == r.nodeId) e = &rollups[i];
+  }
+  if (e == nullptr) {
+    if (rollupCount == MAX_NODES) return;
+    e = &rollups[rollupCount++];
+    e->nodeId = r.nodeId;
+    e->shortB.reset(0);
+    e->longB.reset(0);
+  }
+
+  const uint32_t start = rollup::align(t, ROLLUP_SHORT_S);
+  if (e->shortB.open() && e->shortB.start != start) closeShort(*e);
+  if (!e->shortB.open()) e->shortB.reset(start);
+  const float v[ROLLUP_FIELDS] = {r.tempC, r.humP, r.lux, r.moistP};
+  e->shortB.add(v);
+}
+
+/**
+ * Close buckets whose span (plus grace) has passed, even for nodes that
+ * went quiet, then publish or spill what closed
+ */
+void serviceRollups(bool online) {
+  static time_t lastCheck = 0;
+  const time_t now = time(nullptr);
+  if (now < VALID_EPOCH || now == lastCheck) return;
+  lastCheck = now;
+
+  for (size_t i = 0; i < rollupCount; ++i) {
+    NodeRollup& e = rollups[i];
+    if (e.shortB.open() && (uint32_t)now >= e.shortB.start + ROLLUP_SHORT_S + ROLLUP_GRACE_S) closeShort(e);
+    if (e.longB.open() && (uint32_t)now >= e.longB.start + ROLLUP_LONG_S + ROLLUP_GRACE_S) closeLong(e);
+  }
+  flushRollups(online);
+}
+
+// Emit the 1-minute bucket and fold it into the 15-minute one
+void closeShort(NodeRollup& e) {
+  const uint32_t longStart = rollup::align(e.shortB.start, ROLLUP_LONG_S);
+  if (e.longB.open() && e.longB.start != longStart) closeLong(e);
+  if (!e.longB.open()) e.longB.reset(longStart);
+  e.longB.merge(e.shortB);
+  queueRollup(0, e, e.shortB);
+  e.shortB.reset(0);
+}
+
+void closeLong(NodeRollup& e) {
+  queueRollup(1, e, e.longB);
+  e.longB.reset(0);
+}
+
+// Fixed-point per field value; NaN and empty fields become ROLLUP_NONE
+int16_t rollupFixed(float v) {
+  if (isnan(v)) return ROLLUP_NONE;
+  if (v < -3276.0f) v = -3276.0f;
+  if (v > 3276.0f) v = 3276.0f;
+  return (int16_t)frame::roundFixed(v * 10.0f);
+}
+
+/**
+ * Rollup record, little-endian:
+ *   [0] node [1] span (0 = 1 min, 1 = 15 min) [2..5] start epoch s
+ *   [6..7] readings, then per field (temp, hum, light, moist)
+ *   min, max, mean, last as int16 x10
+ */
+void queueRollup(uint8_t span, const NodeRollup& e, const rollup::Bucket<ROLLUP_FIELDS>& b) {
+  if (rollupOutCount[span] == MAX_NODES) flushRollups(netState == NET_ONLINE);
+  uint8_t* p = rollupOut[span][rollupOutCount[span]++];
+  p[0] = e.nodeId;
+  p[1] = span;
+  frame::put16(p + 2, (uint16_t)b.start);
+  frame::put16(p + 4, (uint16_t)(b.start >> 16));
+  frame::put16(p + 6, b.samples);
+  for (uint8_t f = 0; f < ROLLUP_FIELDS; ++f) {
+    const rollup::Stat& st = b.f[f];
+    uint8_t* q = p + 8 + f * 8;
+    frame::put16(q + 0, (uint16_t)(st.empty() ? ROLLUP_NONE : rollupFixed(st.min)));
+    frame::put16(q + 2, (uint16_t)(st.empty() ? ROLLUP_NONE : rollupFixed(st.max)));
+    frame::put16(q + 4, (uint16_t)rollupFixed(st.mean()));
+    frame::put16(q + 6, (uint16_t)(st.empty() ? ROLLUP_NONE : rollupFixed(st.last)));
+  }
+}
+
+// Publish closed buckets, spilling to flash whatever the broker refuses
+void flushRollups(bool online) {
+  for (uint8_t span = 0; span < 2; ++span) {
+    const size_t n = rollupOutCount[span];
+    for (size_t i = 0; i < n; i += ROLLUP_BATCH_MAX) {
+      const size_t m = n - i < ROLLUP_BATCH_MAX ? n - i : ROLLUP_BATCH_MAX;
+      if (online && publishRollups(rollupOut[span][i], m)) continue;
+      for (size_t k = 0; k < m && rollupBacklogReady; ++k) rollupBacklog.append(rollupOut[span][i + k]);
+    }
+    rollupOutCount[span] = 0;
+  }
+}
+
+/**
+ * Publish rollup records of one span as a JSON array; start is epoch ms
+ * so dashboards can plot it directly
+ * @return bool False if the broker did not take the batch
+ */
+bool publishRollups(const uint8_t* recs, size_t n) {
+  static const char* const STAT_NAMES[] = {"min", "max", "mean", "last"};
+  static char buf[PUBLISH_BUF_LEN];
+  const char* const* key = READING_KEYS[FORMAT_JSON];
+  const uint8_t fieldKeys[ROLLUP_FIELDS] = {RK_TEMP, RK_HUM, RK_LIGHT, RK_MOIST};
+  const bool isLong = recs[1] != 0;
+
+  JsonDocument doc;
+  JsonArray arr = doc.to<JsonArray>();
+  for (size_t i = 0; i < n; ++i) {
+    const uint8_t* p = recs + i * ROLLUP_RECORD_LEN;
+    const uint32_t start = frame::get16(p + 2) | (uint32_t)frame::get16(p + 4) << 16;
+    JsonObject o = arr.add<JsonObject>();
+    o[key[RK_NODE]] = p[0];
+    o["start"] = (uint64_t)start * 1000;
+    o["span"] = isLong ? ROLLUP_LONG_S : ROLLUP_SHORT_S;
+    o["n"] = frame::get16(p + 6);
+    for (uint8_t f = 0; f < ROLLUP_FIELDS; ++f) {
+      JsonObject st = o[key[fieldKeys[f]]].to<JsonObject>();
+      for (uint8_t k = 0; k < 4; ++k) {
+        const int16_t v = (int16_t)frame::get16(p + 8 + f * 8 + k * 2);
+        if (v == ROLLUP_NONE) {
+          st[STAT_NAMES[k]] = nullptr;
+        } else {
+          st[STAT_NAMES[k]] = v / 10.0f;
+        }
+      }
+    }
+  }
+
+  const size_t len = serializePayload(doc, FORMAT_JSON, buf, sizeof(buf));
+  if (len == 0) return true;  // Oversized; retrying cannot help
+  return mqtt.publish(isLong ? ROLLUP_LONG_TOPIC : ROLLUP_SHORT_TOPIC, (const uint8_t*)buf, len);
+}
+
+/**
+ * Local time string for a wall-clock stamp, "NTP_ERR" before the clock
+ * was ever valid. Only reformats when the second changes, so a batch
+ * stamped in the same second costs one strftime.
+ * @param epochMs Unix time in ms, as Reading::epochMs
+ */
+const char* timestampFor(uint64_t epochMs) {
+  static char buffer[20];
+  static time_t cached = 0;
+
+  const time_t t = (time_t)(epochMs / 1000);
+  if (t < VALID_EPOCH) return "NTP_ERR";
+  if (t != cached) {
+    struct tm timeinfo;
+    localtime_r(&t, &timeinfo);
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &timeinfo);
+    cached = t;
+  }
+  return buffer;
+}
+
+/**
+ * Restart the wall clock from RTC memory after a reset that kept power.
+ * It resumes at the last saved second plus one for the reboot, so
+ * timestamps and rule windows work until NTP steps it back into line.
+ */
+void restoreClock() {
+  if (time(nullptr) >= VALID_EPOCH) return;  // Kept across the reset already
+  const ClockKeep k = clockKeep;
+  if (k.magic != CLOCK_MAGIC || (k.magic ^ k.epoch) != k.check || k.epoch < VALID_EPOCH) return;
+  struct timeval tv = {(time_t)k.epoch + 1, 0};
+  settimeofday(&tv, nullptr);
+  Serial.printf("Clock restored from RTC: %s\n", timestampFor((uint64_t)tv.tv_sec * 1000));
+}
+
+// Save the wall clock to RTC memory once per second while it is valid
+void keepClock() {
+  const time_t now = time(nullptr);
+  if (now < VALID_EPOCH || (uint32_t)now == clockKeep.epoch) return;
+  clockKeep.magic = CLOCK_MAGIC;
+  clockKeep.epoch = (uint32_t)now;
+  clockKeep.check = CLOCK_MAGIC ^ (uint32_t)now;
+}
+
+// Local time zone as configTime() sets it, needed before the first join
+void applyTimeZone() {
+  const long west = -(GMT_OFFSET_SEC + DAYLIGHT_OFFSET_SEC);  // POSIX offsets count west
+  const long a = labs(west);
+  char tz[20];
+  snprintf(tz, sizeof(tz), "UTC%c%ld:%02ld", west < 0 ? '-' : '+', a / 3600, a / 60 % 60);
+  setenv("TZ", tz, 1);
+  tzset();
+}
 
-String getTimestamp() {
-  struct tm timeinfo;
-  if (!getLocalTime(&timeinfo)) return "NTP_ERR";
-  char buffer[20];
-  strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &timeinfo);
-  return String(buffer);
+// Wall-clock epoch milliseconds of a reading, 0 before NTP sync
+uint64_t epochMsFor(uint32_t rxMillis) {
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  if (tv.tv_sec < VALID_EPOCH) return 0;
+  return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000 - (millis() - rxMillis);
 }
 
 void (*_dummy)(char*,byte*,unsigned)=mqttCallback;
\ No newline at end of file
@@ -0,0 +1,22 @@
+// Host shim: drawing calls are accepted and ignored
+#pragma once
+
+#include "Arduino.h"
+
+class Adafruit_GFX : public Print {
+ public:
+  Adafruit_GFX(int16_t w, int16_t h) : w_(w), h_(h) {}
+  void drawLine(int16_t, int16_t, int16_t, int16_t, uint16_t) {}
+  void drawBitmap(int16_t, int16_t, const uint8_t*, int16_t, int16_t, uint16_t) {}
+  void fillRect(int16_t, int16_t, int16_t, int16_t, uint16_t) {}
+  void fillCircle(int16_t, int16_t, int16_t, uint16_t) {}
+  void setCursor(int16_t, int16_t) {}
+  void setTextSize(uint8_t) {}
+  void setTextColor(uint16_t) {}
+  void setTextWrap(bool) {}
+  size_t write(uint8_t) override { return 1; }
+  size_t write(const uint8_t*, size_t n) override { return n; }
+
+ protected:
+  int16_t w_, h_;
+};
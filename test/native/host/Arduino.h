@@ -0,0 +1,307 @@
+/*****************************************************************
+ * AGROSENSE - Host Arduino Core Shim
+ *
+ * Just enough of the Arduino core (AVR and ESP32 flavours) to compile
+ * src/main.cpp and arduino_code/arduino.cpp on the build host. Time is
+ * the virtual host::clock, pins read host::pins, Serial is silent
+ * unless host::serialEcho is set.
+ *
+ * String follows the Arduino WString allocation pattern (one exact-
+ * size realloc per growth, no small-string buffer), so the allocation
+ * counts the benchmarks report track what the firmware does on the
+ * MCU heap.
+ *****************************************************************/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+
+#include "host.h"
+
+using std::min;
+using std::max;
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+/* -------------------- Attributes and Constants -------------------- */
+#define IRAM_ATTR
+#define RTC_NOINIT_ATTR
+#define RTC_DATA_ATTR
+#define PROGMEM
+#define F(s) (s)
+
+#define LOW          0
+#define HIGH         1
+#define INPUT        0
+#define OUTPUT       1
+#define INPUT_PULLUP 2
+#define DEFAULT      1
+#define CHANGE       1
+#define FALLING      2
+#define RISING       3
+#define DEC          10
+#define HEX          16
+
+#define A0 54                            // Mega 2560 numbering
+#define A1 55
+#define LED_BUILTIN 13
+
+typedef enum {
+  GPIO_NUM_2 = 2, GPIO_NUM_4 = 4, GPIO_NUM_5 = 5, GPIO_NUM_12 = 12, GPIO_NUM_13 = 13,
+  GPIO_NUM_14 = 14, GPIO_NUM_15 = 15, GPIO_NUM_16 = 16, GPIO_NUM_17 = 17, GPIO_NUM_25 = 25,
+  GPIO_NUM_26 = 26, GPIO_NUM_27 = 27, GPIO_NUM_32 = 32, GPIO_NUM_33 = 33,
+} gpio_num_t;
+
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 38)
+inline size_t strlcpy(char* dst, const char* src, size_t cap) {
+  const size_t len = strlen(src);
+  if (cap) {
+    const size_t n = len < cap - 1 ? len : cap - 1;
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+  }
+  return len;
+}
+#endif
+
+/* -------------------- String -------------------- */
+class String {
+ public:
+  String(const char* s = "") { assign(s ? s : "", s ? strlen(s) : 0); }
+  String(const String& o) { assign(o.buf_ ? o.buf_ : "", o.len_); }
+  String(String&& o) noexcept : buf_(o.buf_), cap_(o.cap_), len_(o.len_) { o.buf_ = nullptr; o.cap_ = o.len_ = 0; }
+  explicit String(char c) { char s[2] = {c, '\0'}; assign(s, 1); }
+  explicit String(int v, int base = DEC) { number((long)v, base); }
+  explicit String(unsigned v, int base = DEC) { number((unsigned long)v, base); }
+  explicit String(long v, int base = DEC) { number(v, base); }
+  explicit String(unsigned long v, int base = DEC) { number(v, base); }
+  explicit String(double v, int decimals = 2) {
+    char s[40];
+    snprintf(s, sizeof(s), "%.*f", decimals, v);
+    assign(s, strlen(s));
+  }
+  ~String() { free(buf_); }
+
+  String& operator=(const String& o) { if (this != &o) assign(o.buf_ ? o.buf_ : "", o.len_); return *this; }
+  String& operator=(String&& o) noexcept {
+    if (this != &o) {
+      free(buf_);
+      buf_ = o.buf_; cap_ = o.cap_; len_ = o.len_;
+      o.buf_ = nullptr; o.cap_ = o.len_ = 0;
+    }
+    return *this;
+  }
+  String& operator=(const char* s) { assign(s ? s : "", s ? strlen(s) : 0); return *this; }
+
+  bool reserve(unsigned n) {
+    if (buf_ && cap_ >= n) return true;
+    char* p = (char*)realloc(buf_, n + 1);
+    if (!p) return false;
+    if (!buf_) p[0] = '\0';
+    buf_ = p;
+    cap_ = n;
+    return true;
+  }
+
+  bool concat(const char* s, unsigned n) {
+    if (!reserve(len_ + n)) return false;
+    memcpy(buf_ + len_, s, n);
+    len_ += n;
+    buf_[len_] = '\0';
+    return true;
+  }
+  String& operator+=(const String& o) { concat(o.c_str(), o.len_); return *this; }
+  String& operator+=(const char* s) { concat(s, strlen(s)); return *this; }
+  String& operator+=(char c) { concat(&c, 1); return *this; }
+
+  friend String operator+(const String& a, const String& b) { String r(a); r += b; return r; }
+  friend String operator+(const String& a, const char* b) { String r(a); r += b; return r; }
+  friend String operator+(const char* a, const String& b) { String r(a); r += b; return r; }
+
+  bool operator==(const String& o) const { return len_ == o.len_ && strcmp(c_str(), o.c_str()) == 0; }
+  bool operator==(const char* s) const { return strcmp(c_str(), s) == 0; }
+  bool operator!=(const String& o) const { return !(*this == o); }
+  bool operator!=(const char* s) const { return !(*this == s); }
+  char operator[](unsigned i) const { return i < len_ ? buf_[i] : '\0'; }
+
+  const char* c_str() const { return buf_ ? buf_ : ""; }
+  unsigned length() const { return len_; }
+  bool isEmpty() const { return len_ == 0; }
+
+  int indexOf(char c, unsigned from = 0) const {
+    if (from >= len_) return -1;
+    const char* p = strchr(c_str() + from, c);
+    return p ? (int)(p - c_str()) : -1;
+  }
+  int indexOf(const char* s, unsigned from = 0) const {
+    if (from > len_) return -1;
+    const char* p = strstr(c_str() + from, s);
+    return p ? (int)(p - c_str()) : -1;
+  }
+  int indexOf(const String& s, unsigned from = 0) const { return indexOf(s.c_str(), from); }
+
+  String substring(unsigned from) const { return substring(from, len_); }
+  String substring(unsigned from, unsigned to) const {
+    if (from > to) std::swap(from, to);
+    if (from > len_) from = len_;
+    if (to > len_) to = len_;
+    String r;
+    r.assign(c_str() + from, to - from);
+    return r;
+  }
+
+  void trim() {
+    if (!buf_ || len_ == 0) return;
+    unsigned a = 0, b = len_;
+    while (a < b && isspace((unsigned char)buf_[a])) ++a;
+    while (b > a && isspace((unsigned char)buf_[b - 1])) --b;
+    len_ = b - a;
+    memmove(buf_, buf_ + a, len_);
+    buf_[len_] = '\0';
+  }
+  void toUpperCase() { for (unsigned i = 0; i < len_; ++i) buf_[i] = (char)toupper((unsigned char)buf_[i]); }
+  void toLowerCase() { for (unsigned i = 0; i < len_; ++i) buf_[i] = (char)tolower((unsigned char)buf_[i]); }
+  long toInt() const { return atol(c_str()); }
+  float toFloat() const { return (float)atof(c_str()); }
+
+ private:
+  void assign(const char* s, unsigned n) {
+    if (!reserve(n)) return;
+    memmove(buf_, s, n);
+    len_ = n;
+    buf_[len_] = '\0';
+  }
+  void number(long v, int base) {
+    char s[24];
+    if (base == HEX) snprintf(s, sizeof(s), "%lx", v); else snprintf(s, sizeof(s), "%ld", v);
+    assign(s, strlen(s));
+  }
+  void number(unsigned long v, int base) {
+    char s[24];
+    snprintf(s, sizeof(s), base == HEX ? "%lx" : "%lu", v);
+    assign(s, strlen(s));
+  }
+
+  char*    buf_ = nullptr;
+  unsigned cap_ = 0;
+  unsigned len_ = 0;
+};
+
+/* -------------------- Print / Serial -------------------- */
+namespace host {
+inline bool serialEcho = false;         // Mirror Serial output to stdout
+}
+
+class Print {
+ public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) { return write(&c, 1); }
+  virtual size_t write(const uint8_t* p, size_t n) {
+    if (host::serialEcho) fwrite(p, 1, n, stdout);
+    return n;
+  }
+
+  size_t print(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+  size_t print(const String& s) { return print(s.c_str()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int v, int base = DEC) { return print((long)v, base); }
+  size_t print(unsigned v, int base = DEC) { return print((unsigned long)v, base); }
+  size_t print(long v, int base = DEC) { return printf(base == HEX ? "%lX" : "%ld", v); }
+  size_t print(unsigned long v, int base = DEC) { return printf(base == HEX ? "%lX" : "%lu", v); }
+  size_t print(double v, int decimals = 2) { return printf("%.*f", decimals, v); }
+
+  template <typename T> size_t println(const T& v) { return print(v) + println(); }
+  template <typename T> size_t println(const T& v, int fmt) { return print(v, fmt) + println(); }
+  size_t println() { return print("\r\n"); }
+
+  size_t printf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+    if (!host::serialEcho) return 0;
+    va_list ap;
+    va_start(ap, fmt);
+    const int n = vprintf(fmt, ap);
+    va_end(ap);
+    return n < 0 ? 0 : (size_t)n;
+  }
+};
+
+class Stream : public Print {
+ public:
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+  virtual int peek() { return -1; }
+};
+
+class HardwareSerial : public Stream {
+ public:
+  void begin(unsigned long) {}
+  void flush() {}
+  explicit operator bool() const { return true; }
+};
+
+inline HardwareSerial Serial;
+
+/* -------------------- Time -------------------- */
+inline unsigned long millis() { return host::clock.ms(); }
+inline unsigned long micros() { return (unsigned long)host::clock.us; }
+inline void delay(unsigned long ms) { host::clock.advanceMs(ms); }
+inline void delayMicroseconds(unsigned us) { host::clock.advanceUs(us); }
+inline void yield() {}
+
+/* -------------------- Pins -------------------- */
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t pin, uint8_t v) { if (pin < 70) host::pins.digital[pin] = v; }
+inline int  digitalRead(uint8_t pin) { return pin < 70 ? host::pins.digital[pin] : LOW; }
+inline int  analogRead(uint8_t pin) { return pin < 70 ? host::pins.analog[pin] : 0; }
+inline void analogReference(uint8_t) {}
+inline void attachInterrupt(uint8_t pin, void (*isr)(), int) { if (pin < 70) host::pins.isr[pin] = isr; }
+inline void detachInterrupt(uint8_t pin) { if (pin < 70) host::pins.isr[pin] = nullptr; }
+inline uint8_t digitalPinToInterrupt(uint8_t pin) { return pin; }
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+/* -------------------- Math Helpers -------------------- */
+template <typename T, typename L, typename H>
+T constrain(T x, L lo, H hi) { return x < lo ? (T)lo : x > hi ? (T)hi : x; }
+
+inline long map(long x, long inMin, long inMax, long outMin, long outMax) {
+  return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+namespace host {
+inline Rng arduinoRng = {0x9E3779B9u};
+}
+inline long random(long hi) { return hi > 0 ? (long)host::arduinoRng.below((uint32_t)hi) : 0; }
+inline long random(long lo, long hi) { return hi > lo ? lo + random(hi - lo) : lo; }
+inline void randomSeed(unsigned long s) { host::arduinoRng.s = s ? (uint32_t)s : 1; }
+inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+/* -------------------- ESP32 Extras -------------------- */
+inline uint32_t esp_random() { return host::arduinoRng.next(); }
+inline uint32_t getCpuFrequencyMhz() { return 240; }
+
+inline void configTime(long, int, const char*, const char* = nullptr, const char* = nullptr) {}
+inline bool getLocalTime(struct tm* info, uint32_t = 5000) {
+  const time_t now = time(nullptr);
+  localtime_r(&now, info);
+  return true;
+}
+
+// Cycle counter runs on real time at 240 MHz, so the firmware's Span
+// histograms measure host execution time
+class EspClass {
+ public:
+  uint32_t getCycleCount() { return (uint32_t)(host::nowNs() * 240 / 1000); }
+  uint32_t getFreeHeap() { return 0; }
+  uint32_t getMinFreeHeap() { return 0; }
+};
+
+inline EspClass ESP;
@@ -0,0 +1,15 @@
+// Host shim: DHT sensor reading host::pins.temp / host::pins.hum
+#pragma once
+
+#include "Arduino.h"
+
+#define DHT11 11
+#define DHT22 22
+
+class DHT {
+ public:
+  DHT(uint8_t, uint8_t) {}
+  void begin() {}
+  float readTemperature() { return host::pins.temp; }
+  float readHumidity() { return host::pins.hum; }
+};
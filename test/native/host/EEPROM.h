@@ -0,0 +1,30 @@
+// Host shim: AVR EEPROM as an erased 4 KB array
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+class EEPROMClass {
+ public:
+  static constexpr int SIZE = 4096;        // ATmega2560
+  uint8_t cells[SIZE];
+
+  EEPROMClass() { memset(cells, 0xFF, sizeof(cells)); }
+  uint8_t read(int addr) const { return cells[addr]; }
+  void update(int addr, uint8_t v) { cells[addr] = v; }
+  void write(int addr, uint8_t v) { cells[addr] = v; }
+  int length() const { return SIZE; }
+
+  template <typename T>
+  T& get(int addr, T& t) const {
+    memcpy(&t, cells + addr, sizeof(T));
+    return t;
+  }
+  template <typename T>
+  const T& put(int addr, const T& t) {
+    memcpy(cells + addr, &t, sizeof(T));
+    return t;
+  }
+};
+
+inline EEPROMClass EEPROM;
@@ -0,0 +1,32 @@
+// Host shim: a file system with no files; FlashQueue compiles, mounts
+// fail and the gateway runs without a backlog
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace fs {
+
+class File {
+ public:
+  explicit operator bool() const { return false; }
+  size_t size() const { return 0; }
+  bool seek(uint32_t) { return false; }
+  size_t read(uint8_t*, size_t) { return 0; }
+  size_t write(const uint8_t*, size_t) { return 0; }
+  const char* name() const { return ""; }
+  File openNextFile() { return File(); }
+  void close() {}
+};
+
+class FS {
+ public:
+  File open(const char*, const char* = "r") { return File(); }
+  bool exists(const char*) { return false; }
+  bool mkdir(const char*) { return false; }
+  bool remove(const char*) { return false; }
+};
+
+}  // namespace fs
+
+using fs::File;
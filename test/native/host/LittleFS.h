@@ -0,0 +1,11 @@
+// Host shim: LittleFS that never mounts
+#pragma once
+
+#include "FS.h"
+
+class LittleFSFS : public fs::FS {
+ public:
+  bool begin(bool = false) { return false; }
+};
+
+inline LittleFSFS LittleFS;
@@ -0,0 +1,175 @@
+/*****************************************************************
+ * AGROSENSE - Host LoRa Shim
+ *
+ * Stands in for sandeepmistry/LoRa. The radio keeps its settings so
+ * every transmission is timed with include/airtime.h exactly as the
+ * firmware budgets it:
+ *   - a blocking endPacket() advances the virtual clock by the frame's
+ *     airtime and raises the DIO0 pin's attachInterrupt() handler, as
+ *     TxDone does on hardware; an async one fires the TxDone callback
+ *     right away
+ *   - each frame sent goes to a fixed log (tx[]) the harness inspects
+ *   - inject() loads a frame into the FIFO and runs the RxDone callback,
+ *     the same path a DIO0 interrupt takes on hardware; without one it
+ *     raises the DIO0 pin's attachInterrupt() handler instead, and
+ *     parsePacket() then hands the frame over
+ * Any number of instances may exist, one per radio.
+ *****************************************************************/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "Arduino.h"
+#include "SPI.h"
+#include "../../../include/airtime.h"
+
+class LoRaClass : public Stream {
+ public:
+  static constexpr size_t LOG_LEN = 64;
+
+  struct Tx {
+    uint64_t startUs;                    // Virtual time the frame went on air
+    uint32_t airUs;
+    uint32_t freq;
+    uint8_t  sf;
+    int8_t   power;
+    uint8_t  len;
+    uint8_t  data[255];
+  };
+
+  enum Mode : uint8_t { MODE_SLEEP, MODE_IDLE, MODE_RX, MODE_TX };
+
+  static constexpr uint8_t REG_IRQ_FLAGS = 0x12;      // Registers the gateway reads directly
+  static constexpr uint8_t REG_PKT_SNR_VALUE = 0x19;
+  static constexpr uint8_t IRQ_RX_DONE = 0x40;
+
+  /* ---------- Library API ---------- */
+  int  begin(long freq) { freq_ = freq; mode = MODE_IDLE; return 1; }
+  void end() { mode = MODE_SLEEP; }
+  void setPins(int, int, int dio0) { dio0_ = dio0; }
+  void setSPI(SPIClass& bus) { bus_ = &bus; }
+  void setSPIFrequency(uint32_t) {}
+  void setFrequency(long freq) { freq_ = freq; }
+  void setSyncWord(int w) { syncWord = (uint8_t)w; }
+  void setSpreadingFactor(int sf) { link.sf = (uint8_t)sf; }
+  void setSignalBandwidth(long bw) { link.bw = (uint32_t)bw; }
+  void setCodingRate4(int cr) { link.cr = (uint8_t)cr; }
+  void setPreambleLength(long n) { link.preamble = (uint16_t)n; }
+  void setTxPower(int dbm, int = 1) { txPower = (int8_t)dbm; }
+  void enableCrc() { link.crc = true; }
+  void disableCrc() { link.crc = false; }
+  void onReceive(void (*cb)(int)) { onRx_ = cb; }
+  void onTxDone(void (*cb)()) { onTx_ = cb; }
+  void receive(int = 0) { mode = MODE_RX; }
+  void idle() { mode = MODE_IDLE; }
+  void sleep() { mode = MODE_SLEEP; }
+
+  int beginPacket(int implicitHeader = false) {
+    if (mode == MODE_TX) return 0;
+    link.implicitHeader = implicitHeader;
+    mode = MODE_IDLE;
+    txLen_ = 0;
+    return 1;
+  }
+  size_t write(uint8_t b) override { return write(&b, 1); }
+  size_t write(const uint8_t* p, size_t n) override {
+    if (n > sizeof(txBuf_) - txLen_) n = sizeof(txBuf_) - txLen_;
+    memcpy(txBuf_ + txLen_, p, n);
+    txLen_ += n;
+    return n;
+  }
+  int endPacket(bool async = false) {
+    Tx& t = tx[txCount++ % LOG_LEN];
+    t.startUs = host::clock.us;
+    t.airUs = link.us((uint8_t)txLen_);
+    t.freq = (uint32_t)freq_;
+    t.sf = link.sf;
+    t.power = txPower;
+    t.len = (uint8_t)txLen_;
+    memcpy(t.data, txBuf_, txLen_);
+    if (async) {
+      mode = MODE_IDLE;                  // TxDone right away, airtime is the caller's to model
+      if (onTx_) onTx_();
+    } else {
+      host::clock.advanceUs(t.airUs);    // Blocks for the time on air
+      mode = MODE_IDLE;
+      if (void (*isr)() = dio0Isr()) isr();  // TxDone; the library clears its flag after
+    }
+    return 1;
+  }
+
+  // Frame inject() left for a radio without RxDone callback, then standby
+  int parsePacket(int = 0) {
+    if (!rxDone_) return 0;
+    rxDone_ = false;
+    bus_->regs[REG_IRQ_FLAGS] = 0;
+    mode = MODE_IDLE;
+    return (int)rxLen_;
+  }
+
+  int  packetRssi() { return rssi_; }
+  float packetSnr() { return snr_; }
+  int available() override { return (int)(rxLen_ - rxPos_); }
+  int read() override { return rxPos_ < rxLen_ ? rxBuf_[rxPos_++] : -1; }
+  int peek() override { return rxPos_ < rxLen_ ? rxBuf_[rxPos_] : -1; }
+
+  /* ---------- Harness API ---------- */
+  /**
+   * Deliver one frame as the radio would: FIFO loaded, RxDone callback
+   * run in "interrupt" context
+   * @return bool False if the radio was not listening (frame lost)
+   */
+  bool inject(const uint8_t* p, size_t n, int16_t rssi, float snr) {
+    void (*isr)() = dio0Isr();
+    if (mode != MODE_RX || (onRx_ == nullptr && isr == nullptr)) return false;
+    if (n > sizeof(rxBuf_)) n = sizeof(rxBuf_);
+    memcpy(rxBuf_, p, n);
+    rxLen_ = n;
+    rxPos_ = 0;
+    rssi_ = rssi;
+    snr_ = snr;
+    bus_->regs[REG_PKT_SNR_VALUE] = (uint8_t)(int8_t)lroundf(snr * 4);
+    if (onRx_) {
+      onRx_((int)n);
+    } else {
+      rxDone_ = true;
+      bus_->regs[REG_IRQ_FLAGS] = IRQ_RX_DONE;
+      isr();
+    }
+    return true;
+  }
+
+  // Most recent frame sent, nullptr if none since clearLog()
+  const Tx* lastTx() const { return txCount ? &tx[(txCount - 1) % LOG_LEN] : nullptr; }
+  void clearLog() { txCount = 0; }
+
+  airtime::Link link = {7, 125000, 5, 8, false, false};
+  int8_t   txPower = 17;
+  uint8_t  syncWord = 0x12;
+  Mode     mode = MODE_SLEEP;
+  Tx       tx[LOG_LEN];
+  uint32_t txCount = 0;                  // Frames sent; tx[] holds the newest LOG_LEN
+
+  long frequency() const { return freq_; }
+
+ private:
+  void (*dio0Isr() const)() { return dio0_ >= 0 && dio0_ < 70 ? host::pins.isr[dio0_] : nullptr; }
+
+  SPIClass* bus_ = &SPI;
+  long    freq_ = 0;
+  int     dio0_ = -1;
+  bool    rxDone_ = false;
+  void  (*onRx_)(int) = nullptr;
+  void  (*onTx_)() = nullptr;
+  uint8_t txBuf_[255];
+  size_t  txLen_ = 0;
+  uint8_t rxBuf_[255];
+  size_t  rxLen_ = 0;
+  size_t  rxPos_ = 0;
+  int16_t rssi_ = 0;
+  float   snr_ = 0;
+};
+
+inline LoRaClass LoRa;
@@ -0,0 +1,53 @@
+// Host shim: NVS namespace kept in memory for the test binary's run, so
+// what a test saves can be restored as after a reboot. Fixed slots: no
+// allocation on the save paths.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+class Preferences {
+ public:
+  static constexpr size_t SLOTS = 8;
+  static constexpr size_t KEY_LEN = 16;      // NVS keys are at most 15 characters
+  static constexpr size_t VALUE_LEN = 2048;
+
+  bool begin(const char*, bool = false) { return true; }
+  void end() {}
+  uint8_t getUChar(const char* key, uint8_t def = 0) {
+    uint8_t v;
+    return getBytes(key, &v, 1) == 1 ? v : def;
+  }
+  size_t putUChar(const char* key, uint8_t v) { return putBytes(key, &v, 1); }
+  size_t getBytes(const char* key, void* buf, size_t cap) {
+    const Slot* s = find(key);
+    if (s == nullptr || s->len > cap) return 0;
+    memcpy(buf, s->data, s->len);
+    return s->len;
+  }
+  size_t putBytes(const char* key, const void* buf, size_t n) {
+    Slot* s = find(key);
+    if (s == nullptr) s = find("");
+    if (s == nullptr || n > VALUE_LEN || strlen(key) >= KEY_LEN) return 0;
+    strcpy(s->key, key);
+    memcpy(s->data, buf, n);
+    s->len = n;
+    return n;
+  }
+
+ private:
+  struct Slot {
+    char key[KEY_LEN];
+    uint8_t data[VALUE_LEN];
+    size_t len;
+  };
+  Slot slots_[SLOTS] = {};
+
+  Slot* find(const char* key) {
+    for (Slot& s : slots_) {
+      if (strcmp(s.key, key) == 0) return &s;
+    }
+    return nullptr;
+  }
+};
@@ -0,0 +1,50 @@
+// Host shim: MQTT client that accepts every publish and keeps the last
+// one per call in a fixed buffer (no allocation, like the real client)
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "WiFi.h"
+
+class PubSubClient {
+ public:
+  typedef void (*Callback)(char*, uint8_t*, unsigned int);
+
+  explicit PubSubClient(WiFiClient&) {}
+  PubSubClient& setServer(const char*, uint16_t) { return *this; }
+  PubSubClient& setCallback(Callback cb) { callback = cb; return *this; }
+  bool setBufferSize(uint16_t n) { bufferSize = n; return true; }
+  PubSubClient& setSocketTimeout(uint16_t) { return *this; }
+  bool connect(const char*) { return up = true; }
+  void disconnect() { up = false; }
+  bool connected() const { return up; }
+  bool loop() { return up; }
+  int state() const { return up ? 0 : -1; }
+  bool subscribe(const char*) { return true; }
+
+  bool publish(const char* topic, const uint8_t* p, size_t n, bool retained = false) {
+    if (n + strlen(topic) + 7 > bufferSize) return false;  // As the real client: must fit its buffer
+    ++published;
+    publishedBytes += n;
+    strncpy(lastTopic, topic, sizeof(lastTopic) - 1);
+    lastRetained = retained;
+    lastLen = n < sizeof(last) ? n : sizeof(last);
+    memcpy(last, p, lastLen);
+    return true;
+  }
+  bool publish(const char* topic, const char* s, bool retained = false) {
+    return publish(topic, (const uint8_t*)s, strlen(s), retained);
+  }
+
+  Callback callback = nullptr;
+  uint16_t bufferSize = 256;
+  bool     up = false;
+  uint32_t published = 0;
+  uint64_t publishedBytes = 0;
+  char     lastTopic[64] = "";
+  uint8_t  last[2048];
+  size_t   lastLen = 0;
+  bool     lastRetained = false;
+};
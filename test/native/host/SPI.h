@@ -0,0 +1,38 @@
+// Host shim: SPI bus whose register reads (address byte, then a read)
+// return regs[], which the LoRa shim fills as a radio would
+#pragma once
+
+#include <stdint.h>
+
+#define MSBFIRST  1
+#define SPI_MODE0 0
+#define HSPI      2
+#define VSPI      3
+
+struct SPISettings {
+  SPISettings(uint32_t = 4000000, uint8_t = MSBFIRST, uint8_t = SPI_MODE0) {}
+};
+
+class SPIClass {
+ public:
+  explicit SPIClass(uint8_t = VSPI) {}
+  void begin() {}
+  void begin(int8_t, int8_t, int8_t, int8_t = -1) {}
+  void end() {}
+  void beginTransaction(const SPISettings&) { addr_ = -1; }
+  void endTransaction() {}
+  uint8_t transfer(uint8_t b) {
+    if (addr_ < 0) {
+      addr_ = b & 0x7F;
+      return 0;
+    }
+    return regs[addr_];
+  }
+
+  uint8_t regs[128] = {};
+
+ private:
+  int addr_ = -1;
+};
+
+inline SPIClass SPI;
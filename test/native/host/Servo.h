@@ -0,0 +1,17 @@
+// Host shim: servo keeps its last angle
+#pragma once
+
+#include <stdint.h>
+
+class Servo {
+ public:
+  uint8_t attach(int) { attached_ = true; return 1; }
+  void detach() { attached_ = false; }
+  void write(int angle) { angle_ = angle; }
+  int read() const { return angle_; }
+  bool attached() const { return attached_; }
+
+ private:
+  bool attached_ = false;
+  int angle_ = 0;
+};
@@ -0,0 +1,36 @@
+// Host shim: Wi-Fi station that stays disconnected unless the harness
+// sets WiFi.connected
+#pragma once
+
+#include "Arduino.h"
+
+#define WL_CONNECTED    3
+#define WL_DISCONNECTED 6
+#define WIFI_STA        1
+
+class IPAddress {
+ public:
+  String toString() const { return String("127.0.0.1"); }
+};
+
+class WiFiClient {};
+
+class WiFiClass {
+ public:
+  void persistent(bool) {}
+  void mode(int) {}
+  void setAutoReconnect(bool) {}
+  void begin(const char*, const char*, int32_t = 0, const uint8_t* = nullptr) {}
+  void disconnect() {}
+  int status() const { return connected ? WL_CONNECTED : WL_DISCONNECTED; }
+  IPAddress localIP() const { return IPAddress(); }
+  const uint8_t* BSSID() { return bssid_; }
+  int32_t channel() const { return 1; }
+
+  bool connected = false;
+
+ private:
+  uint8_t bssid_[6] = {};
+};
+
+inline WiFiClass WiFi;
@@ -0,0 +1,20 @@
+// Host shim: I2C bus, counts the bytes the display flush pushes
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+class TwoWire {
+ public:
+  void begin() {}
+  void setClock(uint32_t) {}
+  void beginTransmission(uint8_t) { ++transactions; }
+  size_t write(uint8_t) { ++bytes; return 1; }
+  size_t write(const uint8_t*, size_t n) { bytes += n; return n; }
+  uint8_t endTransmission(bool = true) { return 0; }
+
+  uint32_t transactions = 0;
+  uint32_t bytes = 0;
+};
+
+inline TwoWire Wire;
@@ -0,0 +1,92 @@
+/*****************************************************************
+ * AGROSENSE - Heap Allocation Probe
+ *
+ * Counts every malloc/calloc/realloc/free in the process by
+ * interposing the C allocator (glibc only: it forwards to the
+ * __libc_* entry points). operator new, Arduino String and
+ * ArduinoJson's default allocator all end up here, so a benchmark can
+ * report bytes and calls per packet or per cycle and assert that a
+ * path stays allocation-free.
+ *
+ * Defines the allocator symbols: include from exactly one translation
+ * unit per test binary. Elsewhere the counters stay at zero and
+ * host::allocTracked() is false.
+ *****************************************************************/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace host {
+
+struct AllocStats {
+  uint64_t calls;                        // malloc/calloc/realloc calls
+  uint64_t bytes;                        // Bytes requested by those calls
+  int64_t  live;                         // Bytes currently held (usable size)
+};
+
+inline AllocStats allocs = {};
+
+// Difference of two snapshots, for one measured region
+inline AllocStats allocsSince(const AllocStats& from) {
+  return AllocStats{allocs.calls - from.calls, allocs.bytes - from.bytes, allocs.live - from.live};
+}
+
+constexpr bool allocTracked() {
+#if defined(__GLIBC__)
+  return true;
+#else
+  return false;
+#endif
+}
+
+}  // namespace host
+
+#if defined(__GLIBC__)
+#include <stdlib.h>
+#include <malloc.h>
+
+// Same exception specification as glibc's own declarations
+extern "C" {
+void* __libc_malloc(size_t) __THROW;
+void* __libc_calloc(size_t, size_t) __THROW;
+void* __libc_realloc(void*, size_t) __THROW;
+void  __libc_free(void*) __THROW;
+
+void* malloc(size_t n) __THROW {
+  void* p = __libc_malloc(n);
+  if (p) {
+    host::allocs.calls++;
+    host::allocs.bytes += n;
+    host::allocs.live += malloc_usable_size(p);
+  }
+  return p;
+}
+
+void* calloc(size_t n, size_t size) __THROW {
+  void* p = __libc_calloc(n, size);
+  if (p) {
+    host::allocs.calls++;
+    host::allocs.bytes += n * size;
+    host::allocs.live += malloc_usable_size(p);
+  }
+  return p;
+}
+
+void* realloc(void* old, size_t n) __THROW {
+  const size_t was = old ? malloc_usable_size(old) : 0;
+  void* p = __libc_realloc(old, n);
+  if (p || n == 0) {
+    host::allocs.calls++;
+    host::allocs.bytes += n;
+    host::allocs.live += (p ? (int64_t)malloc_usable_size(p) : 0) - (int64_t)was;
+  }
+  return p;
+}
+
+void free(void* p) __THROW {
+  if (p) host::allocs.live -= malloc_usable_size(p);
+  __libc_free(p);
+}
+}
+#endif
@@ -0,0 +1,22 @@
+// Host shim: the few ATmega2560 registers and bits the field node uses
+#pragma once
+
+#include <stdint.h>
+
+inline volatile uint8_t ADCSRA = 0;
+inline volatile uint8_t MCUSR = 0;
+inline volatile uint8_t WDTCSR = 0;
+
+#define WDP0 0
+#define WDP1 1
+#define WDP2 2
+#define WDE  3
+#define WDCE 4
+#define WDP3 5
+#define WDIE 6
+#define WDRF 3
+
+inline void cli() {}
+inline void sei() {}
+
+#define ISR(vector) void vector##_handler()
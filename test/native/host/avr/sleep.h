@@ -0,0 +1,12 @@
+// Host shim: power-down returns at once; the firmware adds the nominal
+// sleep time to its own clock
+#pragma once
+
+#include "io.h"
+
+#define SLEEP_MODE_PWR_DOWN 2
+
+inline void set_sleep_mode(uint8_t) {}
+inline void sleep_enable() {}
+inline void sleep_disable() {}
+inline void sleep_cpu() {}
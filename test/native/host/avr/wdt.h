@@ -0,0 +1,7 @@
+// Host shim: watchdog control
+#pragma once
+
+#include "io.h"
+
+inline void wdt_disable() {}
+inline void wdt_reset() {}
@@ -0,0 +1,61 @@
+/*****************************************************************
+ * AGROSENSE - Host Microbenchmark Runner
+ *
+ * Times a body over n iterations on the real clock and counts the heap
+ * traffic it causes (alloc_probe.h), after a short untimed warm-up.
+ * One line per benchmark on stdout:
+ *
+ *   [bench] binary uplink       412.3 ns/frame   0.0 B/frame   0.00 allocs/frame
+ *
+ * Host nanoseconds are only comparable on the same machine and build;
+ * allocation counts are exact and portable, so tests assert on those.
+ *****************************************************************/
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "host.h"
+#include "alloc_probe.h"
+
+namespace bench {
+
+struct Result {
+  double nsPer;                          // Wall-clock ns per iteration
+  double bytesPer;                       // Heap bytes requested per iteration
+  double callsPer;                       // Allocator calls per iteration
+  uint32_t calls;                        // Allocator calls in the whole run
+  int32_t liveDelta;                     // Heap still held after the run (leak check)
+};
+
+inline void report(const char* name, const char* unit, const Result& r) {
+  if (host::allocTracked()) {
+    printf("[bench] %-24s %10.1f ns/%-7s %8.1f B/%-7s %6.2f allocs/%s\n",
+           name, r.nsPer, unit, r.bytesPer, unit, r.callsPer, unit);
+  } else {
+    printf("[bench] %-24s %10.1f ns/%-7s (allocations not tracked on this host)\n", name, r.nsPer, unit);
+  }
+}
+
+/**
+ * Run body(i) for i in [0, n) and report it
+ * @param unit What one iteration is ("frame", "batch", ...)
+ */
+template <typename F>
+Result run(const char* name, const char* unit, uint32_t n, F&& body) {
+  const uint32_t warm = n / 10 < 100 ? n / 10 : 100;
+  for (uint32_t i = 0; i < warm; ++i) body(i);
+
+  const host::AllocStats a0 = host::allocs;
+  const uint64_t t0 = host::nowNs();
+  for (uint32_t i = 0; i < n; ++i) body(warm + i);
+  const uint64_t t1 = host::nowNs();
+  const host::AllocStats a = host::allocsSince(a0);
+
+  Result r = {(double)(t1 - t0) / n, (double)a.bytes / n, (double)a.calls / n,
+              (uint32_t)a.calls, (int32_t)a.live};
+  report(name, unit, r);
+  return r;
+}
+
+}  // namespace bench
@@ -0,0 +1,19 @@
+// Host shim: FreeRTOS types and tick conversion (1 tick = 1 ms)
+#pragma once
+
+#include <stdint.h>
+
+typedef int          BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t     TickType_t;
+typedef void*        TaskHandle_t;
+
+#define pdFALSE 0
+#define pdTRUE  1
+#define pdPASS  1
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFFUL)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portYIELD_FROM_ISR(woken) ((void)(woken))
+
+#define PRO_CPU_NUM 0
+#define APP_CPU_NUM 1
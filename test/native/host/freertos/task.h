@@ -0,0 +1,36 @@
+// Host shim: tasks are never started, the harness calls the functions
+// they run; notifications and delays only touch the virtual clock
+#pragma once
+
+#include "FreeRTOS.h"
+#include "../host.h"
+
+typedef enum { eNoAction, eSetBits, eIncrement, eSetValueWithOverwrite } eNotifyAction;
+
+namespace host {
+inline uint32_t taskNotifications = 0;  // Bits sent to any task
+inline int taskHandles[4];              // Distinct non-null handles
+}
+
+inline BaseType_t xTaskCreatePinnedToCore(void (*)(void*), const char*, uint32_t, void*, UBaseType_t,
+                                          TaskHandle_t* handle, BaseType_t core) {
+  if (handle) *handle = &host::taskHandles[core & 3];
+  return pdPASS;
+}
+inline void vTaskDelete(TaskHandle_t) {}
+inline void vTaskDelay(TickType_t ticks) { host::clock.advanceMs(ticks); }
+inline UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t) { return 0; }
+
+inline BaseType_t xTaskNotify(TaskHandle_t, uint32_t bits, eNotifyAction) {
+  host::taskNotifications |= bits;
+  return pdPASS;
+}
+inline BaseType_t xTaskNotifyFromISR(TaskHandle_t t, uint32_t bits, eNotifyAction a, BaseType_t* woken) {
+  if (woken) *woken = pdFALSE;
+  return xTaskNotify(t, bits, a);
+}
+inline BaseType_t xTaskNotifyWait(uint32_t, uint32_t, uint32_t* bits, TickType_t) {
+  if (bits) *bits = host::taskNotifications;
+  host::taskNotifications = 0;
+  return pdTRUE;
+}
@@ -0,0 +1,93 @@
+/*****************************************************************
+ * AGROSENSE - Gateway Harness
+ *
+ * Drives the gateway firmware on the host without its tasks: boot,
+ * feed frames through the real RX callback, run radio task passes, and
+ * collect what the radio hands to the network and display tasks.
+ * Include after src/main.cpp.
+ *****************************************************************/
+#pragma once
+
+#include <stdio.h>
+
+#include "host.h"
+
+namespace gw {
+
+// Boot once per test binary: radio configured from the firmware's profile
+inline void boot() {
+  static bool booted = false;
+  if (booted) return;
+  booted = true;
+  setup();
+  mqtt.setBufferSize(PUBLISH_BUF_LEN + 64);  // As networkTask configures it
+}
+
+// Forget every node and counter, as after a reboot
+// @param channels Channels listened on, 2 with the second radio
+inline void reset(uint8_t channels = 1) {
+  boot();
+  Reading r;
+  while (publishQueue.pop(r)) {}
+  while (displayQueue.pop(r)) {}
+  DeliveryReport d;
+  while (statusQueue.pop(d)) {}
+  Command c;
+  while (commandQueue.pop(c)) {}
+  RuleUpdate u;
+  while (ruleQueue.pop(u)) {}
+  ConfigUpdate cu;
+  while (configQueue.pop(cu)) {}
+  NetConfigUpdate nu;
+  while (netConfigQueue.pop(nu)) {}
+  while (rxRing.front()) rxRing.release();
+
+  nodeCount = 0;
+  nodeDefaults = NodeState{};
+  seedNodeDefaults();
+  stats = Metrics{};
+  rxOverflows = 0;
+  recentFrames.clear();
+  cmdSeq = 0;
+  valveStateCount = 0;
+  dutyCycle = airtime::DutyCycle(DUTY_PERMILLE, DUTY_BURST_US);
+  radioLink = LinkProfile::link();
+  nextLink = radioLink;
+  sfSwitching = false;
+  sfChangedAt = millis();
+  configDirty = false;
+  oledInterval = OLED_INTERVAL;
+  rxChannels = channels;
+  for (uint8_t ch = 0; ch < rxChannels; ++ch) {
+    configureRadio(radioFor(ch));
+    listen(ch);
+    radioFor(ch).clearLog();
+  }
+}
+
+// A node that synced before: its uplinks from counter 1 and our
+// downlinks from 1 pass, as after a sync both sides sent under 0
+inline NodeState* join(uint8_t id) {
+  NodeState* node = findNode(id, true);
+  node->upKnown = true;
+  node->downCounter = 1;
+  return node;
+}
+
+// Radio task wakeup after RxDone; returns ticks until its next own wakeup
+inline TickType_t service() { return radioPass(NOTIFY_RX); }
+
+// Readings handed to the network task since the last call; the display
+// copy is discarded
+inline size_t drainReadings(Reading* out = nullptr, size_t max = 0) {
+  size_t n = 0;
+  Reading r;
+  while (publishQueue.pop(r)) {
+    if (out && n < max) out[n] = r;
+    ++n;
+  }
+  while (displayQueue.pop(r)) {}
+  return n;
+}
+
+}  // namespace gw
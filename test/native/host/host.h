@@ -0,0 +1,67 @@
+/*****************************************************************
+ * AGROSENSE - Host Harness Core
+ *
+ * State shared by the native shims in this directory: a virtual
+ * clock behind millis()/micros(), the sensor and pin values the field
+ * node reads, and the wall-clock timer the benchmarks use.
+ *
+ * The clock only moves when the harness (or a blocking shim call such
+ * as delay() or a synchronous LoRa TX) advances it, so every run of a
+ * benchmark or simulation is deterministic.
+ *****************************************************************/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <chrono>
+
+namespace host {
+
+/* -------------------- Virtual Clock -------------------- */
+struct Clock {
+  uint64_t us;
+
+  uint32_t ms() const { return (uint32_t)(us / 1000); }
+  void advanceUs(uint64_t d) { us += d; }
+  void advanceMs(uint32_t d) { us += (uint64_t)d * 1000; }
+  // Never moves backwards: events that are already past are ignored
+  void atLeastUs(uint64_t t) { if (t > us) us = t; }
+};
+
+inline Clock clock = {};
+
+/* -------------------- Node Inputs -------------------- */
+struct Pins {
+  float    temp;                         // DHT reading, NaN = read failure
+  float    hum;
+  uint16_t analog[70];                   // analogRead() by pin number
+  uint8_t  digital[70];                  // digitalRead() by pin number
+  void   (*isr[70])();                   // attachInterrupt() handlers by pin number
+};
+
+inline Pins pins = {24.0f, 60.0f, {}, {}, {}};
+
+/* -------------------- Wall-clock Timer -------------------- */
+// Real elapsed time for benchmarks; the virtual clock is not involved
+inline uint64_t nowNs() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Deterministic xorshift32 for the harness, independent of random()
+struct Rng {
+  uint32_t s;
+
+  uint32_t next() {
+    s ^= s << 13;
+    s ^= s >> 17;
+    s ^= s << 5;
+    return s;
+  }
+  // Uniform in [0, n)
+  uint32_t below(uint32_t n) { return n ? next() % n : 0; }
+  // Uniform in [0, 1)
+  double unit() { return (next() >> 8) * (1.0 / 16777216.0); }
+};
+
+}  // namespace host
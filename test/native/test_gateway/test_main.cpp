@@ -0,0 +1,541 @@
+/*****************************************************************
+ * AGROSENSE - Gateway Host Benchmarks
+ *
+ * src/main.cpp built against test/native/host and driven through its
+ * own entry points: frames enter via the RX callback and leave as
+ * readings on the publish queue, MQTT messages enter via mqttCallback,
+ * payloads leave via the PubSubClient shim and downlinks via the LoRa
+ * shim's TX log.
+ *
+ * Reports ns and heap traffic per packet, per command and per batch.
+ * The radio path must stay allocation-free (long-running gateways
+ * fragment their heap otherwise); that is asserted, timings are only
+ * printed. Uplinks are signed as their node would sign them; the
+ * rejection benchmarks time how cheaply forged, replayed and unsigned
+ * frames are dropped.
+ *****************************************************************/
+#include <unity.h>
+
+#include "bench.h"
+#include "../../../src/main.cpp"
+#include "gateway_harness.h"
+
+constexpr uint32_t FRAMES = 20000;         // Per uplink benchmark
+constexpr uint8_t BENCH_NODES = 16;        // Distinct node IDs in the traffic
+constexpr int16_t BENCH_RSSI = -98;
+constexpr float BENCH_SNR = 4.0;           // Full power is the ADR target here: no downlinks
+
+// Uplink i of node (i % BENCH_NODES) + 1, with slowly moving readings
+frame::Uplink benchUplink(uint32_t i) {
+  frame::Uplink up;
+  up.nodeId = (uint8_t)(i % BENCH_NODES + 1);
+  up.seq = (uint16_t)(i / BENCH_NODES);
+  up.flags = (i & 64) ? frame::FLAG_VALVE_OPEN : 0;
+  up.temp10 = (int16_t)(240 + i % 37);
+  up.hum10 = (uint16_t)(610 + i % 53);
+  up.light10 = (uint8_t)(i % 100);
+  up.moist = (uint8_t)(40 + i % 20);
+  return up;
+}
+
+uint32_t upCounters[256];                  // Last frame counter per node ID
+
+// Append the auth trailer under the node's next counter; a node signs
+// only once the gateway knows it
+size_t signFrame(uint8_t* pkt, size_t len, size_t cap) {
+  if (upCounters[pkt[1]] == 0 && findNode(pkt[1], false) == nullptr) gw::join(pkt[1]);
+  return auth::sign(frameKey, auth::DIR_UPLINK, ++upCounters[pkt[1]], pkt, len, cap);
+}
+
+// Deliver a frame exactly as given
+void injectRaw(const uint8_t* pkt, size_t len) {
+  LoRa.inject(pkt, len, BENCH_RSSI, BENCH_SNR);
+  host::clock.advanceMs(50);
+}
+
+// Deliver an unsigned binary frame as its node sends it
+void injectFrame(const uint8_t* pkt, size_t len) {
+  uint8_t buf[frame::DELTA_MAX_LEN + frame::TRACE_LEN + auth::TRAILER_LEN];
+  memcpy(buf, pkt, len);
+  injectRaw(buf, signFrame(buf, len, sizeof(buf)));
+}
+
+void setUp() {
+  gw::reset();
+  memset(upCounters, 0, sizeof(upCounters));
+}
+void tearDown() {}
+
+/* -------------------- Uplink Decoding -------------------- */
+void test_binary_uplink() {
+  static uint8_t frames[256][frame::UPLINK_LEN + frame::TRACE_LEN];
+  for (uint32_t i = 0; i < 256; ++i) {
+    const size_t n = frame::encodeUplink(benchUplink(i), frames[i], sizeof(frames[i]));
+    frame::appendTrace(frames[i], n, sizeof(frames[i]), 1200);
+  }
+
+  size_t readings = 0;
+  const bench::Result r = bench::run("binary uplink", "frame", FRAMES, [&](uint32_t i) {
+    injectFrame(frames[i % 256], sizeof(frames[0]));
+    gw::service();
+    readings += gw::drainReadings();
+  });
+
+  TEST_ASSERT_EQUAL_UINT32(0, stats.decodeDrops);
+  TEST_ASSERT_EQUAL_UINT32(BENCH_NODES, nodeCount);
+  TEST_ASSERT_EQUAL_UINT32(0, LoRa.txCount);  // ADR left the links alone
+  TEST_ASSERT_TRUE(readings >= FRAMES);
+  if (host::allocTracked()) TEST_ASSERT_EQUAL_UINT32(0, r.calls);
+}
+
+void test_delta_uplink() {
+  // Full frames first so every node has a delta base
+  uint8_t pkt[frame::DELTA_MAX_LEN + frame::TRACE_LEN];
+  frame::Uplink base[BENCH_NODES];
+  for (uint8_t n = 0; n < BENCH_NODES; ++n) {
+    base[n] = benchUplink(n);
+    injectFrame(pkt, frame::encodeUplink(base[n], pkt, sizeof(pkt)));
+    gw::service();
+  }
+  gw::drainReadings();
+
+  static uint8_t frames[256][frame::DELTA_MAX_LEN + frame::TRACE_LEN];
+  static size_t lens[256];
+  for (uint32_t i = 0; i < 256; ++i) {
+    const frame::Uplink& b = base[i % BENCH_NODES];
+    frame::Delta d = {b.seq, (uint8_t)(1 + i % frame::DELTA_ALL), b};
+    d.up.seq = (uint16_t)(b.seq + 1 + i / BENCH_NODES);
+    d.up.moist = (uint8_t)(b.moist + 3);
+    d.up.temp10 = (int16_t)(b.temp10 + 8);
+    lens[i] = frame::appendTrace(frames[i], frame::encodeDelta(d, frames[i], sizeof(frames[i])),
+                                 sizeof(frames[i]), 900);
+  }
+
+  const bench::Result r = bench::run("delta uplink", "frame", FRAMES, [&](uint32_t i) {
+    injectFrame(frames[i % 256], lens[i % 256]);
+    gw::service();
+    gw::drainReadings();
+  });
+
+  TEST_ASSERT_EQUAL_UINT32(0, stats.decodeDrops);
+  if (host::allocTracked()) TEST_ASSERT_EQUAL_UINT32(0, r.calls);
+}
+
+// Unsigned legacy packets cannot be trusted with AUTH_FRAMES on
+void test_ascii_uplink() {
+  static const char* const PACKETS[] = {
+    "Weather:Clear|Temp:24.3|Hum:61.0|Light level:3.2|Moisture:45|Valve:CLOSE",
+    "Weather:Raining,Temp:19.8,Hm:88.5,Lux:1.1,Moisture:71,Valve:OPEN",
+    "Temp:27.1|Lx:9.4|Hum:40.2|Moisture:12|Weather:Clear|Valve:CLOSE",
+  };
+
+  size_t readings = 0;
+  const bench::Result r = bench::run("ASCII uplink dropped", "frame", FRAMES, [&](uint32_t i) {
+    const char* p = PACKETS[i % 3];
+    injectRaw((const uint8_t*)p, strlen(p));
+    gw::service();
+    readings += gw::drainReadings();
+  });
+
+  TEST_ASSERT_NULL(findNode(frame::NODE_LEGACY, false));
+  TEST_ASSERT_EQUAL_UINT32(0, readings);
+  TEST_ASSERT_TRUE(stats.authUnsigned >= FRAMES);
+  if (host::allocTracked()) TEST_ASSERT_EQUAL_UINT32(0, r.calls);
+}
+
+// A flood of forged frames under fresh node IDs, then forgeries and
+// replays of a genuine frame: none is parsed, published or given a node
+// slot
+void test_forged_uplink() {
+  static uint8_t frames[256][frame::UPLINK_LEN + frame::TRACE_LEN + auth::TRAILER_LEN];
+  for (uint32_t i = 0; i < 256; ++i) {
+    frame::Uplink up = benchUplink(i);
+    up.nodeId = (uint8_t)(100 + i % 100);
+    size_t n = frame::appendTrace(frames[i], frame::encodeUplink(up, frames[i], sizeof(frames[i])), sizeof(frames[i]), 0);
+    n = auth::sign(frameKey, auth::DIR_UPLINK, 1, frames[i], n, sizeof(frames[i]));
+    frames[i][n - 1] ^= 0x5A;            // MIC off by one byte
+  }
+
+  size_t readings = 0;
+  const bench::Result forged = bench::run("forged uplink dropped", "frame", FRAMES, [&](uint32_t i) {
+    injectRaw(frames[i % 256], sizeof(frames[0]));
+    gw::service();
+    readings += gw::drainReadings();
+  });
+  TEST_ASSERT_EQUAL_UINT32(0, readings);
+  TEST_ASSERT_EQUAL_UINT32(0, nodeCount);
+  TEST_ASSERT_TRUE(stats.authUnknown >= FRAMES);      // Not synced: dropped before any AES
+  if (host::allocTracked()) TEST_ASSERT_EQUAL_UINT32(0, forged.calls);
+
+  uint8_t pkt[sizeof(frames[0])];
+  const size_t n = signFrame(pkt, frame::encodeUplink(benchUplink(2), pkt, sizeof(pkt)), sizeof(pkt));
+  pkt[n - 1] ^= 0x5A;
+  injectRaw(pkt, n);                                  // Node 3 is known now: the MIC is checked
+  gw::service();
+  TEST_ASSERT_EQUAL_UINT32(0, gw::drainReadings());
+  TEST_ASSERT_EQUAL_UINT32(1, stats.authForged);
+  pkt[n - 1] ^= 0x5A;
+  injectRaw(pkt, n);
+  gw::service();
+  TEST_ASSERT_EQUAL_UINT32(1, gw::drainReadings());
+
+  const bench::Result replay = bench::run("replayed uplink dropped", "frame", FRAMES, [&](uint32_t) {
+    injectRaw(pkt, n);
+    gw::service();
+    readings += gw::drainReadings();
+  });
+  TEST_ASSERT_EQUAL_UINT32(0, readings);
+  TEST_ASSERT_TRUE(stats.duplicates >= FRAMES);
+  if (host::allocTracked()) TEST_ASSERT_EQUAL_UINT32(0, replay.calls);
+
+  // A stale counter with a recomputed MIC is still a replay
+  const uint32_t copies = stats.duplicates;
+  const size_t body = n - auth::TRAILER_LEN;
+  frame::put16(pkt + body, (uint16_t)(upCounters[3] - 1));
+  frameKey.mic(auth::DIR_UPLINK, upCounters[3] - 1, pkt, body, pkt + body + 2);
+  injectRaw(pkt, n);
+  gw::service();
+  TEST_ASSERT_EQUAL_UINT32(0, gw::drainReadings());
+  TEST_ASSERT_EQUAL_UINT32(copies + 1, stats.duplicates);
+}
+
+/* -------------------- Auto-mode Rules -------------------- */
+void test_rule_evaluation() {
+  const rules::Rule rule = stockRule(DEFAULT_SOIL_THRESHOLD, AUTO_LIGHT_MAX);
+  int16_t samples[64][rules::FIELD_COUNT];
+  host::Rng rng = {12345};
+  for (auto& s : samples) {
+    s[rules::FIELD_TEMP] = (int16_t)(150 + rng.below(200));
+    s[rules::FIELD_HUM] = (int16_t)(300 + rng.below(600));
+    s[rules::FIELD_LIGHT] = (int16_t)rng.below(101);
+    s[rules::FIELD_MOIST] = (int16_t)(rng.below(1000));
+    s[rules::FIELD_RAIN] = (int16_t)(rng.below(4) == 0 ? 10 : 0);
+  }
+
+  bool open = false;
+  uint32_t toggles = 0;
+  bench::run("rule evaluation", "sample", 1000000, [&](uint32_t i) {
+    const bool next = rule.next(samples[i % 64], (int16_t)(i % 1440), open, i % 600);
+    toggles += next != open;
+    open = next;
+  });
+  TEST_ASSERT_TRUE(toggles > 0);
+}
+
+// Upload, JSON parse and compile to a predicate table
+void test_rule_upload() {
+  static char msg[] =
+      "{\"on\":[[\"moist\",\"<\",30]],"
+      "\"off\":[[\"moist\",\">=\",38],[\"rain\",\"=\",1],[\"light\",\">\",8.5]],"
+      "\"min_on\":120,\"min_off\":600,\"window\":[\"05:00\",\"09:30\"]}";
+  char topic[32];
+  strlcpy(topic, "IoT-G9/3/cfg/rule", sizeof(topic));
+
+  uint32_t queued = 0;
+  bench::run("rule upload (JSON)", "msg", 5000, [&](uint32_t) {
+    mqttCallback(topic, (byte*)msg, strlen(msg));
+    RuleUpdate u;
+    while (ruleQueue.pop(u)) queued++;
+  });
+  TEST_ASSERT_TRUE(queued > 0);
+}
+
+/* -------------------- MQTT Commands -------------------- */
+void test_mqtt_command() {
+  static char payload[] = " true ";
+  char topic[32];
+  strlcpy(topic, "IoT-G9/3/cmd", sizeof(topic));
+
+  uint32_t queued = 0;
+  Command c = {};
+  const bench::Result r = bench::run("MQTT valve command", "msg", 20000, [&](uint32_t) {
+    mqttCallback(topic, (byte*)payload, strlen(payload));
+    while (commandQueue.pop(c)) queued++;
+  });
+  TEST_ASSERT_EQUAL_UINT32(20000 + 100, queued);  // Warm-up included
+  TEST_ASSERT_EQUAL_UINT8(CMD_VALVE, c.type);
+  TEST_ASSERT_EQUAL_UINT8(3, c.nodeId);
+  TEST_ASSERT_TRUE(c.flag);
+  if (host::allocTracked()) TEST_ASSERT_EQUAL_UINT32(0, r.calls);
+
+  // Broadcast valve command: only the node in manual mode is commanded
+  uint8_t pkt[frame::UPLINK_LEN];
+  injectFrame(pkt, frame::encodeUplink(benchUplink(4), pkt, sizeof(pkt)));  // Node 5
+  injectFrame(pkt, frame::encodeUplink(benchUplink(5), pkt, sizeof(pkt)));  // Node 6
+  gw::service();
+  gw::drainReadings();
+  findNode(6, false)->manualMode = false;                  // Auto mode: not commanded
+  const size_t known = nodeCount;
+  applyCommand(Command{CMD_VALVE, frame::NODE_BROADCAST, true, 0, (uint32_t)millis()});
+  TEST_ASSERT_EQUAL_UINT32(known, nodeCount);
+  TEST_ASSERT_NULL(findNode(frame::NODE_BROADCAST, false));
+  TEST_ASSERT_TRUE(findNode(5, false)->pending.active);
+  TEST_ASSERT_FALSE(findNode(6, false)->pending.active);
+}
+
+void test_mqtt_dispatch() {
+  static char threshold[] = "42";
+  static char bad[] = "TRUEISH";
+  char topic[32];
+
+  strlcpy(topic, "IoT-G9/all/cfg/soil", sizeof(topic));
+  mqttCallback(topic, (byte*)threshold, 2);
+  strlcpy(topic, "IoT-G9/all/cfg/mode", sizeof(topic));
+  mqttCallback(topic, (byte*)bad, strlen(bad));           // Rejected: not a token
+  static const char* const UNKNOWN[] = {"IoT-G9/3/cmdx", "IoT-G9/x/cmd", "IoT-G9/256/cmd", "IoT-G9//cmd",
+                                        "IoT-G9/3", "IoT-G10/3/cmd"};
+  for (const char* u : UNKNOWN) {
+    strlcpy(topic, u, sizeof(topic));
+    mqttCallback(topic, (byte*)bad, 4);                   // Rejected: "TRUE" on a topic nobody handles
+  }
+
+  Command c;
+  TEST_ASSERT_TRUE(commandQueue.pop(c));
+  TEST_ASSERT_EQUAL_UINT8(CMD_THRESHOLD, c.type);
+  TEST_ASSERT_EQUAL_UINT8(frame::NODE_BROADCAST, c.nodeId);
+  TEST_ASSERT_TRUE(c.value == 42.0f);
+  TEST_ASSERT_FALSE(commandQueue.pop(c));
+}
+
+/* -------------------- Remote Configuration -------------------- */
+void test_config_relay() {
+  uint8_t pkt[frame::UPLINK_LEN];
+  injectFrame(pkt, frame::encodeUplink(benchUplink(4), pkt, sizeof(pkt)));  // Node 5 heard
+  gw::service();
+  gw::drainReadings();
+
+  ConfigUpdate u = {};
+  u.nodeId = 5;
+  u.fields = CFG_INTERVAL | CFG_HEARTBEAT | CFG_SOIL;
+  u.config = NodeConfig{3, 30, 300, 25, AUTO_LIGHT_MAX};
+  TEST_ASSERT_TRUE(configQueue.push(u));
+  radioPass(NOTIFY_CMD);
+
+  frame::Config c;
+  const LoRaClass::Tx* t = LoRa.lastTx();
+  TEST_ASSERT_NOT_NULL(t);
+  TEST_ASSERT_TRUE(frame::decodeConfig(t->data, t->len, c));
+  uint32_t counter;
+  TEST_ASSERT_EQUAL_UINT32(frame::CONFIG_LEN + AUTH_LEN, t->len);
+  TEST_ASSERT_EQUAL_INT(auth::AUTH_OK, auth::verify(frameKey, auth::DIR_DOWNLINK, t->data, t->len, 0, counter));
+  TEST_ASSERT_EQUAL_UINT32(1, counter);                   // Node 5's own counter, as after its sync
+  TEST_ASSERT_EQUAL_UINT8(5, c.nodeId);
+  TEST_ASSERT_EQUAL_UINT16(3, c.version);
+  TEST_ASSERT_EQUAL_UINT16(30, c.intervalS);
+  TEST_ASSERT_EQUAL_UINT16(300, c.heartbeatS);
+  NodeState* node = findNode(5, false);
+  TEST_ASSERT_FALSE(node->configSynced);
+  TEST_ASSERT_EQUAL_INT(rules::toFixed10(25), node->rule.on[0].value);
+  TEST_ASSERT_FALSE(configDirty);                         // Saved in the same pass
+
+  const uint32_t sent = LoRa.txCount;
+  u.config.version = 2;                                   // Older: a retained replay, ignored
+  u.config.intervalS = 90;
+  TEST_ASSERT_TRUE(configQueue.push(u));
+  radioPass(NOTIFY_CMD);
+  TEST_ASSERT_EQUAL_UINT32(sent, LoRa.txCount);
+  TEST_ASSERT_EQUAL_UINT16(30, node->config.intervalS);
+
+  host::clock.advanceMs(1000);
+  injectFrame(pkt, frame::encodeAck(frame::Ack{5, c.seq, 0}, pkt, sizeof(pkt)));
+  gw::service();
+  TEST_ASSERT_TRUE(node->configSynced);
+  TEST_ASSERT_FALSE(node->cfgCmd.active);
+}
+
+/* -------------------- Counter Sync -------------------- */
+// A node the gateway never heard joins by sync request; after a reboot
+// its old frames do not pass again, and the first one heard gets a sync
+void test_counter_sync() {
+  uint8_t pkt[frame::SYNC_LEN + auth::TRAILER_LEN];
+  size_t n = frame::encodeSync(frame::Sync{9, 0, 1000, 40}, frame::TYPE_SYNC_REQ, pkt, sizeof(pkt));
+  injectRaw(pkt, auth::sign(frameKey, auth::DIR_UPLINK, 1000, pkt, n, sizeof(pkt)));
+  gw::service();
+  NodeState* node = findNode(9, false);
+  TEST_ASSERT_NOT_NULL(node);
+  TEST_ASSERT_EQUAL_UINT32(1000, node->upCounter);
+
+  frame::Sync s;
+  uint32_t counter;
+  const LoRaClass::Tx* t = LoRa.lastTx();
+  TEST_ASSERT_NOT_NULL(t);
+  TEST_ASSERT_EQUAL_UINT32(frame::SYNC_LEN + AUTH_LEN, t->len);
+  TEST_ASSERT_EQUAL_INT(auth::AUTH_OK, auth::verifySync(frameKey, auth::DIR_DOWNLINK, t->data, t->len, 0, false, counter));
+  TEST_ASSERT_TRUE(frame::decodeSync(t->data, frame::SYNC_LEN, s));
+  TEST_ASSERT_EQUAL_UINT8(frame::TYPE_SYNC, frame::headerType(t->data[0]));
+  TEST_ASSERT_EQUAL_UINT32(40, s.counter);                // Our downlinks go on from the node's floor
+  TEST_ASSERT_EQUAL_UINT32(1001, s.floor);
+
+  upCounters[9] = 1000;
+  uint8_t up[frame::UPLINK_LEN + auth::TRAILER_LEN];
+  injectFrame(up, frame::encodeAck(frame::Ack{9, s.seq, 0}, up, sizeof(up)));
+  gw::service();
+  TEST_ASSERT_FALSE(node->syncCmd.active);
+  frame::Uplink u = benchUplink(8);
+  n = signFrame(up, frame::encodeUplink(u, up, sizeof(up)), sizeof(up));
+  injectRaw(up, n);
+  gw::service();
+  TEST_ASSERT_EQUAL_UINT32(1, gw::drainReadings());
+
+  // Reboot: counters come back from NVS, a block ahead of what was accepted
+  nodeCount = 0;
+  restoreCounters();
+  node = findNode(9, false);
+  TEST_ASSERT_NOT_NULL(node);
+  TEST_ASSERT_TRUE(node->downCounter > s.counter);
+  const uint32_t sent = LoRa.txCount;
+  const uint32_t copies = stats.duplicates;
+  injectRaw(up, n);                                       // Replay of the last frame before it
+  gw::service();
+  injectRaw(up, n);
+  gw::service();
+  TEST_ASSERT_EQUAL_UINT32(0, gw::drainReadings());
+  TEST_ASSERT_EQUAL_UINT32(copies + 2, stats.duplicates);
+  TEST_ASSERT_EQUAL_UINT32(sent + 1, LoRa.txCount);      // One sync, not one per copy
+  TEST_ASSERT_TRUE(node->syncCmd.active);
+  TEST_ASSERT_TRUE(frame::decodeSync(LoRa.lastTx()->data, frame::SYNC_LEN, s));
+  sendValveCommand(9, true, "Manual", millis());          // Held back: the node would drop it
+  TEST_ASSERT_EQUAL_UINT32(sent + 1, LoRa.txCount);
+  TEST_ASSERT_TRUE(node->pending.active);
+
+  upCounters[9] = node->upFloor - 1;                      // The node, synced again
+  injectFrame(up, frame::encodeAck(frame::Ack{9, s.seq, 0}, up, sizeof(up)));
+  gw::service();
+  TEST_ASSERT_FALSE(node->syncCmd.active);
+  TEST_ASSERT_EQUAL_UINT32(sent + 2, LoRa.txCount);      // Then the valve command
+  frame::ValveCmd vc;
+  TEST_ASSERT_TRUE(frame::decodeValveCmd(LoRa.lastTx()->data, LoRa.lastTx()->len - AUTH_LEN, vc));
+  u.seq++;
+  injectFrame(up, frame::encodeUplink(u, up, sizeof(up)));
+  gw::service();
+  TEST_ASSERT_EQUAL_UINT32(1, gw::drainReadings());
+}
+
+/* -------------------- Relaying -------------------- */
+void test_relay_dedup() {
+  uint8_t pkt[frame::RELAY_OVERHEAD + frame::UPLINK_LEN + frame::TRACE_LEN + auth::TRAILER_LEN];
+  size_t n = frame::encodeUplink(benchUplink(6), pkt, sizeof(pkt));   // Node 7
+  n = signFrame(pkt, frame::appendTrace(pkt, n, sizeof(pkt), 500), sizeof(pkt));
+  injectRaw(pkt, n);
+  gw::service();
+  TEST_ASSERT_EQUAL_UINT32(1, gw::drainReadings());
+  NodeState* node = findNode(7, false);
+  TEST_ASSERT_EQUAL_UINT8(0, node->hops);
+
+  // The same uplink through a relay: dropped before publishing
+  const frame::Relay via = {20, 1, 2, 120};
+  injectRaw(pkt, frame::encodeRelay(via, pkt, n, pkt, sizeof(pkt)));
+  gw::service();
+  TEST_ASSERT_EQUAL_UINT32(0, gw::drainReadings());
+  TEST_ASSERT_EQUAL_UINT32(1, stats.duplicates);
+
+  // The next one comes only through the relay; the relay path counts
+  // towards the sample's age
+  n = frame::appendTrace(pkt, frame::encodeUplink(benchUplink(6 + BENCH_NODES), pkt, sizeof(pkt)), sizeof(pkt), 500);
+  n = signFrame(pkt, n, sizeof(pkt));
+  const size_t wrapped = frame::encodeRelay(via, pkt, n, pkt, sizeof(pkt));
+  injectRaw(pkt, wrapped);
+  gw::service();
+  Reading r = {};
+  TEST_ASSERT_EQUAL_UINT32(1, gw::drainReadings(&r, 1));
+  TEST_ASSERT_EQUAL_UINT8(7, r.nodeId);
+  TEST_ASSERT_EQUAL_UINT32(500 + radioLink.ms(n) + radioLink.ms(wrapped) + 120, r.sampleAgeMs);
+  TEST_ASSERT_EQUAL_UINT8(1, node->hops);
+  TEST_ASSERT_EQUAL_UINT8(20, node->relayId);
+  TEST_ASSERT_EQUAL_UINT32(2, stats.relayedFrames);
+
+  // Our own downlink forwarded back is not an uplink
+  const uint32_t drops = stats.decodeDrops;
+  n = frame::encodeValveCmd(frame::ValveCmd{7, 3, true}, pkt, sizeof(pkt));
+  injectRaw(pkt, frame::encodeRelay(via, pkt, n, pkt, sizeof(pkt)));
+  gw::service();
+  TEST_ASSERT_EQUAL_UINT32(0, gw::drainReadings());
+  TEST_ASSERT_EQUAL_UINT32(drops, stats.decodeDrops);
+  TEST_ASSERT_TRUE(commandRtoMs(radioLink, frame::VALVE_CMD_LEN, 1) > commandRtoMs(radioLink, frame::VALVE_CMD_LEN, 0));
+}
+
+/* -------------------- Publishing -------------------- */
+void test_publish_batch() {
+  Reading batch[PUBLISH_BATCH_MAX];
+  for (size_t i = 0; i < PUBLISH_BATCH_MAX; ++i) {
+    readingFromUplink(benchUplink(i), batch[i]);
+    batch[i].rxMillis = millis();
+    batch[i].epochMs = epochMsFor(batch[i].rxMillis);
+  }
+
+  const uint32_t before = mqtt.published;
+  const bench::Result r = bench::run("telemetry batch of 8", "batch", 5000, [&](uint32_t) {
+    publishTelemetry(batch, PUBLISH_BATCH_MAX, true);
+  });
+  printf("[bench] telemetry batch payload   %u B on %s\n", (unsigned)mqtt.lastLen, mqtt.lastTopic);
+
+  TEST_ASSERT_EQUAL_UINT32(PUBLISH_BATCH_MAX * (5000 + 100), mqtt.published - before);  // One topic per node
+  TEST_ASSERT_EQUAL_STRING("IoT-G9/8/telemetry", mqtt.lastTopic);
+  TEST_ASSERT_TRUE(mqtt.lastRetained);
+  TEST_ASSERT_TRUE(mqtt.lastLen > 0 && mqtt.lastLen < PUBLISH_BUF_LEN);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.publishFails);
+  TEST_ASSERT_EQUAL_INT32(0, r.liveDelta);
+}
+
+void test_valve_topics() {
+  noteValve(1, "OPEN");
+  noteValve(2, "CLOSE");
+  uint32_t before = mqtt.published;
+  publishValves();
+  TEST_ASSERT_EQUAL_UINT32(2, mqtt.published - before);
+  TEST_ASSERT_EQUAL_STRING("IoT-G9/2/valve", mqtt.lastTopic);
+  TEST_ASSERT_TRUE(mqtt.lastRetained);
+
+  before = mqtt.published;
+  noteValve(2, "CLOSE");
+  publishValves();                                        // Unchanged: nothing sent
+  TEST_ASSERT_EQUAL_UINT32(0, mqtt.published - before);
+  noteValve(1, "CLOSE");
+  publishValves();
+  TEST_ASSERT_EQUAL_UINT32(1, mqtt.published - before);
+  TEST_ASSERT_EQUAL_STRING("IoT-G9/1/valve", mqtt.lastTopic);
+}
+
+void test_metrics_snapshot() {
+  // Some traffic so every histogram has buckets to print
+  uint8_t pkt[frame::UPLINK_LEN + frame::TRACE_LEN];
+  for (uint32_t i = 0; i < 200; ++i) {
+    const size_t n = frame::encodeUplink(benchUplink(i), pkt, sizeof(pkt));
+    injectFrame(pkt, frame::appendTrace(pkt, n, sizeof(pkt), 700));
+    gw::service();
+  }
+  gw::drainReadings();
+
+  size_t metricsLen = 0, latencyLen = 0;
+  const bench::Result r = bench::run("metrics + latency", "snapshot", 2000, [&](uint32_t) {
+    publishMetrics();
+    metricsLen = strcmp(mqtt.lastTopic, METRICS_TOPIC) == 0 ? mqtt.lastLen : metricsLen;
+    publishLatency();
+    latencyLen = strcmp(mqtt.lastTopic, LATENCY_TOPIC) == 0 ? mqtt.lastLen : latencyLen;
+  });
+  printf("[bench] snapshot payloads         %u B metrics, %u B latency\n",
+         (unsigned)metricsLen, (unsigned)latencyLen);
+
+  TEST_ASSERT_TRUE(metricsLen > 0 && metricsLen < PUBLISH_BUF_LEN);
+  TEST_ASSERT_TRUE(latencyLen > 0 && latencyLen < 512);
+  TEST_ASSERT_EQUAL_INT32(0, r.liveDelta);
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST(test_binary_uplink);
+  RUN_TEST(test_delta_uplink);
+  RUN_TEST(test_ascii_uplink);
+  RUN_TEST(test_forged_uplink);
+  RUN_TEST(test_rule_evaluation);
+  RUN_TEST(test_rule_upload);
+  RUN_TEST(test_mqtt_command);
+  RUN_TEST(test_mqtt_dispatch);
+  RUN_TEST(test_config_relay);
+  RUN_TEST(test_counter_sync);
+  RUN_TEST(test_relay_dedup);
+  RUN_TEST(test_publish_batch);
+  RUN_TEST(test_valve_topics);
+  RUN_TEST(test_metrics_snapshot);
+  return UNITY_END();
+}
@@ -0,0 +1,229 @@
+/*****************************************************************
+ * AGROSENSE - Field Node Host Benchmarks
+ *
+ * arduino_code/arduino.cpp built against test/native/host and run
+ * through setup()/loop() on the virtual clock, one pass per ms while
+ * awake; power-down returns at once and only moves the node's
+ * sleptMs. Downlinks are injected into the RX window through the real
+ * RxDone callback, signed as the gateway signs them.
+ *
+ * Reports host time and heap traffic per wake cycle and per command,
+ * plus airtime per hour. The uplink cycle must not allocate (the Mega
+ * has 8 KB of RAM and no way to defragment it); that is asserted.
+ * Host ints are 32 bit, so AVR int-width effects do not show here.
+ *****************************************************************/
+#include <unity.h>
+
+#include "bench.h"
+#include "../../../arduino_code/arduino.cpp"
+
+constexpr uint32_t CYCLES = 120;           // Wake cycles per run (2 h at WAKE_INTERVAL)
+
+host::Rng sensorRng = {2024};
+uint32_t gwCounter = 0;                    // Gateway's last downlink counter, the sync's
+
+// Append the auth trailer under the gateway's next counter
+size_t signDownlink(uint8_t* pkt, size_t len, size_t cap) {
+  return auth::sign(frameKey, auth::DIR_DOWNLINK, ++gwCounter, pkt, len, cap);
+}
+
+// Slow random walk on every input, so some wakes cross a deadband
+void driftSensors() {
+  host::pins.temp += (sensorRng.below(21) - 10) * 0.02f;
+  host::pins.hum += (sensorRng.below(21) - 10) * 0.05f;
+  host::pins.analog[PIN_LDR] = (uint16_t)constrain((int)host::pins.analog[PIN_LDR] + (int)sensorRng.below(9) - 4, 0, 1023);
+  host::pins.analog[PIN_SOIL] = (uint16_t)constrain((int)host::pins.analog[PIN_SOIL] + (int)sensorRng.below(9) - 4, 300, 1023);
+}
+
+// One loop() pass, then 1 ms of awake time
+void step() {
+  loop();
+  delay(1);
+}
+
+// Run until the node is powered down again, i.e. one wake cycle
+uint32_t wakeCycle() {
+  uint32_t passes = 0;
+  const uint32_t slept = sleptMs;
+  while (sleptMs == slept && passes < 10 * WAKE_INTERVAL) {
+    if (passes % 1000 == 0) driftSensors();
+    step();
+    ++passes;
+  }
+  return passes;
+}
+
+// Run until the RX window after the node's own frame is open
+bool waitForWindow() {
+  for (uint32_t i = 0; i < 10 * WAKE_INTERVAL; ++i) {
+    step();
+    if (radioState == RECEIVING && LoRa.mode == LoRaClass::MODE_RX) return true;
+  }
+  return false;
+}
+
+// Answer the sync request the node sends after boot as the gateway
+// does, under gwCounter, and let the node ACK it
+void syncNode() {
+  TEST_ASSERT_TRUE(waitForWindow());
+  frame::Sync req;
+  const LoRaClass::Tx* t = LoRa.lastTx();
+  TEST_ASSERT_NOT_NULL(t);
+  TEST_ASSERT_TRUE(frame::decodeSync(t->data, t->len, req));
+  TEST_ASSERT_EQUAL_UINT8(frame::TYPE_SYNC_REQ, frame::headerType(t->data[0]));
+
+  uint8_t pkt[frame::SYNC_LEN + auth::TRAILER_LEN];
+  const size_t n = frame::encodeSync(frame::Sync{NODE_ID, 1, gwCounter, req.counter + 1}, frame::TYPE_SYNC, pkt,
+                                     sizeof(pkt));
+  LoRa.inject(pkt, auth::sign(frameKey, auth::DIR_DOWNLINK, gwCounter, pkt, n, sizeof(pkt)), -90, 7.0f);
+  const uint32_t sent = LoRa.txCount;
+  while (LoRa.txCount == sent && radioState != SLEEPING) step();
+  frame::Ack ack;
+  TEST_ASSERT_TRUE(frame::decodeAck(LoRa.lastTx()->data, LoRa.lastTx()->len, ack));
+  TEST_ASSERT_TRUE(downKnown);
+  TEST_ASSERT_FALSE(syncDue);
+}
+
+void setUp() {
+  static bool booted = false;
+  if (booted) return;
+  booted = true;
+  host::pins.digital[PIN_RAIN] = HIGH;     // Dry
+  host::pins.analog[PIN_LDR] = 600;
+  host::pins.analog[PIN_SOIL] = 700;
+  setup();
+  syncNode();
+  for (uint32_t i = 0; i < 3; ++i) wakeCycle();  // Filters settled, first full frame out
+}
+void tearDown() {}
+
+/* -------------------- Wake Cycle -------------------- */
+void test_wake_cycle() {
+  LoRa.clearLog();
+  uint64_t airUs = 0, bytes = 0;
+  uint32_t passes = 0, frames = 0;
+  const uint32_t t0 = nowMs();
+
+  const bench::Result r = bench::run("wake cycle", "cycle", CYCLES, [&](uint32_t) {
+    const uint32_t sent = LoRa.txCount;
+    passes += wakeCycle();
+    for (uint32_t i = sent; i < LoRa.txCount; ++i) {
+      const LoRaClass::Tx& t = LoRa.tx[i % LoRaClass::LOG_LEN];
+      airUs += t.airUs;
+      bytes += t.len;
+      ++frames;
+    }
+  });
+
+  const double hours = (nowMs() - t0) / 3600000.0;
+  printf("[bench] wake cycle detail      %.0f loop passes/cycle, %u frames, %.1f B/frame, "
+         "%.0f ms airtime/h (%.3f %% duty)\n",
+         (double)passes / (CYCLES + CYCLES / 10), (unsigned)frames, frames ? (double)bytes / frames : 0.0,
+         airUs / 1000.0 / hours, airUs / 1000.0 / hours / 36000.0);
+
+  TEST_ASSERT_TRUE(frames > 0);
+  TEST_ASSERT_TRUE(frames <= CYCLES + CYCLES / 10);  // At most one uplink per wake
+  if (host::allocTracked()) TEST_ASSERT_EQUAL_UINT32(0, r.calls);
+}
+
+/* -------------------- Downlinks -------------------- */
+void test_binary_command() {
+  uint8_t cmd[frame::VALVE_CMD_LEN + auth::TRAILER_LEN];
+  uint16_t seq = 100;
+  uint32_t acks = 0;
+
+  bench::run("binary valve command", "cmd", 50, [&](uint32_t i) {
+    host::pins.temp += (i & 1) ? 1.0f : -1.0f;  // Guarantees an uplink, hence a window
+    TEST_ASSERT_TRUE(waitForWindow());
+    size_t n = frame::encodeValveCmd(frame::ValveCmd{NODE_ID, seq++, (i & 1) != 0}, cmd, sizeof(cmd));
+    n = signDownlink(cmd, n, sizeof(cmd));
+    LoRa.inject(cmd, n, -90, 7.0f);
+    const uint32_t sent = LoRa.txCount;
+    while (LoRa.txCount == sent && radioState != SLEEPING) step();
+    frame::Ack ack;
+    const LoRaClass::Tx* t = LoRa.lastTx();
+    if (LoRa.txCount > sent && frame::decodeAck(t->data, t->len, ack) && ack.seq == seq - 1) ++acks;
+    wakeCycle();
+  });
+
+  TEST_ASSERT_EQUAL_UINT32(50 + 5, acks);    // Warm-up passes included
+  TEST_ASSERT_TRUE(valve.read() == 0 || valve.read() == 90);
+}
+
+// Unsigned ASCII commands and replays of a signed one never reach the valve
+void test_legacy_command() {
+  static const char* const CMDS[] = {"CMD:TRUE", "cmd:false "};
+  uint8_t old[frame::VALVE_CMD_LEN + auth::TRAILER_LEN];
+  const bool open = valveState == "OPEN";
+  const size_t oldLen = signDownlink(old, frame::encodeValveCmd(frame::ValveCmd{NODE_ID, 7, !open}, old, sizeof(old)),
+                                     sizeof(old));
+  ++gwCounter;                             // The gateway has moved on since
+
+  uint8_t cmd[frame::VALVE_CMD_LEN + auth::TRAILER_LEN];
+  const size_t n = signDownlink(cmd, frame::encodeValveCmd(frame::ValveCmd{NODE_ID, 8, open}, cmd, sizeof(cmd)),
+                                sizeof(cmd));
+  TEST_ASSERT_TRUE(waitForWindow());
+  LoRa.inject(cmd, n, -90, 7.0f);
+  step();
+  wakeCycle();
+
+  const uint32_t sent = LoRa.txCount;
+  bench::run("dropped ASCII / replay", "cmd", 50, [&](uint32_t i) {
+    host::pins.temp += (i & 1) ? 1.0f : -1.0f;
+    TEST_ASSERT_TRUE(waitForWindow());
+    if (i % 3 == 0) {
+      LoRa.inject(old, oldLen, -90, 7.0f);
+    } else if (i % 3 == 1) {
+      LoRa.inject(cmd, n, -90, 7.0f);
+    } else {
+      LoRa.inject((const uint8_t*)CMDS[open ? 1 : 0], strlen(CMDS[0]), -90, 7.0f);
+    }
+    step();
+    wakeCycle();
+  });
+  TEST_ASSERT_EQUAL_STRING(open ? "OPEN" : "CLOSE", valveState.c_str());
+  TEST_ASSERT_TRUE(LoRa.txCount - sent <= 55);  // Own uplinks only, no ACKs
+}
+
+/* -------------------- Frame Construction -------------------- */
+void test_frame_construction() {
+  frame::Uplink base = {NODE_ID, 0, 0, 245, 612, 31, 44};
+  uint8_t pkt[frame::DELTA_MAX_LEN + frame::TRACE_LEN];
+  uint32_t deltas = 0;
+
+  bench::run("uplink/delta encode", "frame", 1000000, [&](uint32_t i) {
+    frame::Uplink up = base;
+    up.seq = (uint16_t)i;
+    up.temp10 = (int16_t)(base.temp10 + i % 13);
+    up.moist = (uint8_t)(base.moist + i % 5);
+    const frame::Delta d = {base.seq, frame::deltaMask(base, up, DEADBAND), up};
+    const size_t n = d.mask == 0 || d.mask == frame::DELTA_ALL ? frame::encodeUplink(up, pkt, sizeof(pkt))
+                                                               : frame::encodeDelta(d, pkt, sizeof(pkt));
+    deltas += n != frame::UPLINK_LEN;
+    frame::appendTrace(pkt, n, sizeof(pkt), i % 5000);
+  });
+  TEST_ASSERT_TRUE(deltas > 0);
+
+  // Directly comparable on the Mega with AUTH_BENCH
+  uint8_t signedPkt[frame::UPLINK_LEN + frame::TRACE_LEN + auth::TRAILER_LEN];
+  const size_t n = frame::appendTrace(signedPkt, frame::encodeUplink(base, signedPkt, sizeof(signedPkt)),
+                                      sizeof(signedPkt), 1200);
+  const bench::Result r = bench::run("uplink sign (AES-CMAC)", "frame", 100000, [&](uint32_t i) {
+    auth::sign(frameKey, auth::DIR_UPLINK, i, signedPkt, n, sizeof(signedPkt));
+  });
+  if (host::allocTracked()) TEST_ASSERT_EQUAL_UINT32(0, r.calls);
+  uint32_t counter;
+  const size_t len = auth::sign(frameKey, auth::DIR_UPLINK, 0x12345, signedPkt, n, sizeof(signedPkt));
+  TEST_ASSERT_EQUAL_INT(auth::AUTH_OK, auth::verify(frameKey, auth::DIR_UPLINK, signedPkt, len, 0x12300, counter));
+  TEST_ASSERT_EQUAL_UINT32(0x12345, counter);
+  TEST_ASSERT_EQUAL_INT(auth::AUTH_STALE, auth::verify(frameKey, auth::DIR_UPLINK, signedPkt, len, counter, counter));
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST(test_wake_cycle);
+  RUN_TEST(test_binary_command);
+  RUN_TEST(test_legacy_command);
+  RUN_TEST(test_frame_construction);
+  return UNITY_END();
+}
@@ -0,0 +1,389 @@
+/*****************************************************************
+ * AGROSENSE - LoRa Channel Simulator
+ *
+ * Event-driven model of the channels shared by N field nodes and the
+ * gateway firmware, in virtual µs. Nodes build their frames with the
+ * real lora_frame.h encoders (full frame every fullEvery uplinks,
+ * deltas between), sign them as AUTH_FRAMES nodes do, joined to the
+ * gateway as after a counter sync, and time them with airtime.h; the
+ * gateway is src/main.cpp itself, fed through the LoRa shim and run one
+ * radio task pass per event.
+ *
+ * Nodes pick each uplink's channel from include/channel_plan.h; with
+ * two channels the gateway hears channel 1 on its second radio.
+ *
+ * A frame is lost when
+ *   - another frame on the same channel and SF overlaps it and is not
+ *     at least captureDb weaker (INFINITY: any overlap kills both, pure
+ *     ALOHA)
+ *   - the gateway listens on another SF, at its start or its end
+ *   - it overlaps a transmission of that channel's gateway radio (the
+ *     SX127x is half duplex)
+ * Downlinks reach their node unless it is transmitting itself or tuned
+ * to another channel; other nodes cannot interfere there, as the model
+ * has no node-to-node geometry. Nodes listen continuously on the
+ * channel they last sent on, ACK every downlink and apply LINK_ADR
+ * settings when the command says.
+ *
+ * Include after src/main.cpp and gateway_harness.h.
+ *****************************************************************/
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "host.h"
+
+namespace sim {
+
+constexpr uint8_t  MAX_NODES = 32;
+constexpr uint8_t  MAX_FRAME = frame::DELTA_MAX_LEN + frame::TRACE_LEN + AUTH_LEN;  // Longest node frame
+constexpr uint8_t  MAX_AIR = 2 * MAX_NODES;        // Frames in flight at once
+constexpr uint8_t  GW_TX_LOG = 8;                  // Recent gateway transmissions kept for half duplex
+constexpr uint32_t ACK_TURNAROUND_US = 20000;      // Node RX-to-TX, well inside CMD_TURNAROUND_MS
+constexpr int16_t  RSSI_AT_MAX = -98;              // dBm at the gateway from a node at TX_POWER_MAX
+constexpr float    SNR_FIXED = 4.0;                // Full power is the ADR target here: no downlinks
+
+struct Config {
+  uint8_t  nodes;
+  uint32_t intervalMs;                   // Mean time between uplinks per node
+  bool     poisson;                      // Exponential gaps; otherwise periodic with ±10 % jitter
+  uint8_t  fullEvery;                    // Full frame every n uplinks, deltas between (1: no deltas)
+  float    captureDb;                    // Power margin that survives an overlap
+  float    pathSpreadDb;                 // Node RSSIs spread uniformly over this range
+  bool     adr;                          // Node SNRs spread 5-16 dB so ADR lowers power; else SNR_FIXED
+  uint8_t  channels;                     // Gateway channels, 0 = 1; call gw::reset() with the same
+  bool     hopping;                      // Hop per uplink; else fixed by node ID
+  uint32_t seed;
+};
+
+struct Stats {
+  uint32_t uplinks;                      // Uplinks put on air
+  uint32_t delivered;                    // ... decoded by the gateway's radio
+  uint32_t collided;
+  uint32_t wrongSf;
+  uint32_t halfDuplex;
+  uint32_t orphanDeltas;                 // Deltas delivered whose base frame was lost
+  uint32_t readings;                     // Readings the gateway handed to the network task
+  uint32_t downlinks;                    // Gateway transmissions
+  uint32_t downlinksHeard;
+  uint32_t acks;                         // ACKs put on air
+  uint32_t acksDelivered;
+  uint64_t uplinkAirUs;
+  uint64_t gwNs;                         // Host time spent in the gateway firmware
+  uint32_t gwPasses;
+  uint64_t simUs;                        // Virtual time covered
+
+  double pdr() const { return uplinks ? (double)delivered / uplinks : 0; }
+  // Offered load G in frames per frame time
+  double load() const { return simUs ? (double)uplinkAirUs / simUs : 0; }
+};
+
+struct Node {
+  uint8_t  id;
+  uint16_t seq;
+  uint32_t counter;                      // Last frame counter signed with
+  frame::Uplink now;                     // Current readings
+  frame::Uplink base;                    // Last full frame sent
+  bool     heardBase;                    // Gateway decoded `base`
+  uint8_t  sf;
+  int8_t   power;
+  uint8_t  channel;                      // Tuned to: the last channel sent on
+  float    rssiAtMax;
+  float    snrAtMax;
+  uint64_t nextUs;                       // Next uplink start
+  uint64_t txStartUs;                    // Its own last transmission
+  uint64_t txEndUs;
+  bool     ackDue;
+  uint16_t ackSeq;
+  uint8_t  ackFlags;
+  uint64_t ackAtUs;
+  bool     adrPending;
+  uint8_t  adrSf;
+  int8_t   adrPower;
+  uint64_t adrAtUs;
+};
+
+struct Frame {
+  uint64_t startUs;
+  uint64_t endUs;
+  uint8_t  node;                         // Index into nodes[]
+  uint8_t  channel;
+  uint8_t  sf;
+  uint8_t  gwSf;                         // Gateway SF when it started
+  float    rssi;
+  float    snr;
+  bool     ack;
+  bool     delta;
+  bool     full;
+  uint16_t refSeq;
+  uint16_t seq;
+  bool     collided;
+  uint8_t  len;
+  uint8_t  data[MAX_FRAME];
+};
+
+class Channel {
+ public:
+  explicit Channel(const Config& c) : cfg_(c), rng_{c.seed ? c.seed : 1} {
+    if (cfg_.nodes > MAX_NODES) cfg_.nodes = MAX_NODES;
+    if (cfg_.fullEvery == 0) cfg_.fullEvery = 1;
+    if (cfg_.channels == 0) cfg_.channels = 1;
+    if (cfg_.channels > RADIOS) cfg_.channels = RADIOS;
+    const uint64_t t0 = host::clock.us;
+    for (uint8_t i = 0; i < cfg_.nodes; ++i) {
+      Node& n = nodes_[i];
+      memset(&n, 0, sizeof(n));
+      n.id = (uint8_t)(i + 1);
+      n.now = frame::Uplink{n.id, 0, 0, (int16_t)(200 + rng_.below(80)), (uint16_t)(500 + rng_.below(300)),
+                            (uint8_t)rng_.below(100), (uint8_t)(30 + rng_.below(40))};
+      n.sf = LoRa.link.sf;
+      n.power = frame::TX_POWER_MAX;
+      n.rssiAtMax = RSSI_AT_MAX - cfg_.pathSpreadDb / 2 + (float)rng_.unit() * cfg_.pathSpreadDb;
+      n.snrAtMax = cfg_.adr ? 5.0f + (float)rng_.unit() * 11.0f : SNR_FIXED;
+      n.nextUs = t0 + (uint64_t)(rng_.unit() * cfg_.intervalMs * 1000.0);  // Random phase
+      if (AUTH_FRAMES) gw::join(n.id);
+    }
+    for (uint8_t ch = 0; ch < RADIOS; ++ch) txSeen_[ch] = radioFor(ch).txCount;
+    gwWakeUs_ = t0;
+  }
+
+  // Run the channel and the gateway for d µs of virtual time
+  void run(uint64_t d) {
+    const uint64_t end = host::clock.us + d;
+    const uint64_t t0 = host::clock.us;
+    for (;;) {
+      // Earliest of: a frame leaving the air, the gateway's own wakeup,
+      // a node starting to transmit; ends go first on ties
+      uint8_t air = MAX_AIR;
+      for (uint8_t i = 0; i < airCount_; ++i) {
+        if (air == MAX_AIR || air_[i].endUs < air_[air].endUs) air = i;
+      }
+      uint8_t tx = MAX_NODES;
+      uint64_t txAt = UINT64_MAX;
+      for (uint8_t i = 0; i < cfg_.nodes; ++i) {
+        const uint64_t t = nextTxUs(nodes_[i]);
+        if (t < txAt) { txAt = t; tx = i; }
+      }
+      const uint64_t endAt = air == MAX_AIR ? UINT64_MAX : air_[air].endUs;
+
+      if (endAt <= gwWakeUs_ && endAt <= txAt) {
+        if (endAt > end) break;
+        land(air);
+      } else if (gwWakeUs_ <= txAt) {
+        if (gwWakeUs_ > end) break;
+        host::clock.atLeastUs(gwWakeUs_);
+        gateway(0);
+      } else {
+        if (txAt > end) break;
+        transmit(tx, txAt);
+      }
+    }
+    host::clock.atLeastUs(end);
+    stats.simUs += host::clock.us - t0;
+  }
+
+  Stats stats = {};
+  Node nodes_[MAX_NODES];
+
+ private:
+  uint64_t nextTxUs(const Node& n) const {
+    const uint64_t t = n.ackDue && n.ackAtUs < n.nextUs ? n.ackAtUs : n.nextUs;
+    return t < n.txEndUs ? n.txEndUs : t;  // One frame at a time per radio
+  }
+
+  uint32_t airUs(uint8_t sf, uint8_t len) const {
+    airtime::Link l = LinkProfile::link();
+    l.sf = sf;
+    return l.us(len);
+  }
+
+  uint64_t gapUs() {
+    const double mean = cfg_.intervalMs * 1000.0;
+    if (cfg_.poisson) return (uint64_t)(-log(1.0 - rng_.unit()) * mean) + 1;
+    return (uint64_t)(mean * (0.9 + 0.2 * rng_.unit()));
+  }
+
+  // Slow drift, so deltas carry a varying set of fields
+  void drift(frame::Uplink& u) {
+    u.temp10 = (int16_t)(u.temp10 + (int)rng_.below(7) - 3);
+    u.hum10 = (uint16_t)(u.hum10 + (int)rng_.below(11) - 5);
+    if (rng_.below(4) == 0) u.moist = (uint8_t)constrain((int)u.moist + (int)rng_.below(3) - 1, 0, 100);
+  }
+
+  // Node i puts its next frame on air at t
+  void transmit(uint8_t i, uint64_t t) {
+    Node& n = nodes_[i];
+    if (n.adrPending && t >= n.adrAtUs) {
+      n.adrPending = false;
+      n.sf = n.adrSf;
+      n.power = n.adrPower;
+    }
+    if (airCount_ == MAX_AIR) {             // Cannot happen with MAX_NODES senders, but never overrun
+      n.nextUs = t + gapUs();
+      return;
+    }
+
+    Frame& f = air_[airCount_++];
+    f = Frame{};
+    f.startUs = t;
+    f.node = i;
+    f.sf = n.sf;
+    f.gwSf = LoRa.link.sf;
+    const float jitter = (float)(rng_.unit() - 0.5) * 2.0f;
+    f.rssi = n.rssiAtMax - (frame::TX_POWER_MAX - n.power) + jitter;
+    f.snr = n.snrAtMax - (frame::TX_POWER_MAX - n.power) + jitter;
+
+    size_t len;
+    if (n.ackDue && n.ackAtUs <= t) {
+      n.ackDue = false;
+      f.ack = true;
+      len = frame::encodeAck(frame::Ack{n.id, n.ackSeq, n.ackFlags}, f.data, sizeof(f.data));
+      stats.acks++;
+    } else {
+      drift(n.now);
+      n.now.seq = n.seq++;
+      f.seq = n.now.seq;
+      if (n.now.seq % cfg_.fullEvery == 0) {
+        len = frame::encodeUplink(n.now, f.data, sizeof(f.data));
+        n.base = n.now;
+        n.heardBase = false;
+        f.full = true;
+      } else {
+        const frame::Delta d = {n.base.seq, frame::deltaMask(n.base, n.now, frame::Deadband{}), n.now};
+        len = frame::encodeDelta(d, f.data, sizeof(f.data));
+        f.delta = true;
+        f.refSeq = d.refSeq;
+      }
+      n.channel = channel::uplink(n.id, f.seq, cfg_.channels, cfg_.hopping);
+      n.nextUs = t + gapUs();
+    }
+    f.channel = n.channel;                  // ACKs go where the downlink came
+    f.len = (uint8_t)frame::appendTrace(f.data, len, sizeof(f.data), 0);
+    if (AUTH_FRAMES) f.len = (uint8_t)auth::sign(frameKey, auth::DIR_UPLINK, ++n.counter, f.data, f.len, sizeof(f.data));
+    f.endUs = t + airUs(f.sf, f.len);
+    n.txStartUs = f.startUs;
+    n.txEndUs = f.endUs;
+    if (!f.ack) {
+      stats.uplinks++;
+      stats.uplinkAirUs += f.endUs - f.startUs;
+    }
+    if (n.nextUs < f.endUs) n.nextUs = f.endUs;  // One frame at a time per radio
+
+    // Every frame still on air overlaps this one
+    for (uint8_t k = 0; k + 1 < airCount_; ++k) {
+      Frame& o = air_[k];
+      if (o.sf != f.sf || o.channel != f.channel) continue;
+      if (!(o.rssi >= f.rssi + cfg_.captureDb)) f.collided = true;
+      if (!(f.rssi >= o.rssi + cfg_.captureDb)) o.collided = true;
+    }
+  }
+
+  bool overlapsGatewayTx(const Frame& f) const {
+    for (uint8_t k = 0; k < GW_TX_LOG; ++k) {
+      const uint64_t s = gwTxStart_[f.channel][k], e = gwTxEnd_[f.channel][k];
+      if (e > s && s < f.endUs && e > f.startUs) return true;
+    }
+    return false;
+  }
+
+  // Frame k leaves the air: resolve it and hand it to the gateway
+  void land(uint8_t k) {
+    const Frame f = air_[k];
+    air_[k] = air_[--airCount_];
+    host::clock.atLeastUs(f.endUs);
+    Node& n = nodes_[f.node];
+
+    LoRaClass& radio = radioFor(f.channel);
+    bool ok = false;
+    if (f.collided) {
+      stats.collided++;
+    } else if (f.sf != f.gwSf || f.sf != radio.link.sf) {
+      stats.wrongSf++;
+    } else if (overlapsGatewayTx(f) || !radio.inject(f.data, f.len, (int16_t)lroundf(f.rssi), f.snr)) {
+      stats.halfDuplex++;
+    } else {
+      ok = true;
+    }
+    if (!ok) return;
+
+    if (f.ack) {
+      stats.acksDelivered++;
+    } else {
+      stats.delivered++;
+      if (f.full && n.base.seq == f.seq) n.heardBase = true;
+      if (f.delta && !(n.heardBase && n.base.seq == f.refSeq)) stats.orphanDeltas++;
+    }
+    gateway(f.channel ? NOTIFY_RX2 : NOTIFY_RX);
+  }
+
+  // One radio task pass, then whatever it put on air
+  void gateway(uint32_t bits) {
+    uint32_t raised = 0;
+    xTaskNotifyWait(0, UINT32_MAX, &raised, 0);  // DIO0 handlers since the last pass, as the task collects them
+    const uint64_t t0 = host::nowNs();
+    const TickType_t wait = radioPass(bits | raised);
+    stats.gwNs += host::nowNs() - t0;
+    stats.gwPasses++;
+    stats.readings += gw::drainReadings();
+    gwWakeUs_ = wait == portMAX_DELAY ? UINT64_MAX : host::clock.us + (uint64_t)wait * 1000;
+
+    for (uint8_t ch = 0; ch < cfg_.channels; ++ch) {
+      const LoRaClass& radio = radioFor(ch);
+      for (; txSeen_[ch] < radio.txCount; ++txSeen_[ch]) {
+        const LoRaClass::Tx& t = radio.tx[txSeen_[ch] % LoRaClass::LOG_LEN];
+        const uint64_t endUs = t.startUs + t.airUs;
+        gwTxStart_[ch][gwTxNext_[ch]] = t.startUs;
+        gwTxEnd_[ch][gwTxNext_[ch]] = endUs;
+        gwTxNext_[ch] = (uint8_t)((gwTxNext_[ch] + 1) % GW_TX_LOG);
+        stats.downlinks++;
+        deliverDownlink(t, endUs, ch);
+      }
+    }
+  }
+
+  void deliverDownlink(const LoRaClass::Tx& t, uint64_t endUs, uint8_t ch) {
+    frame::LinkAdr la = {};
+    frame::ValveCmd vc = {};
+    uint8_t id;
+    uint16_t seq;
+    const bool adr = frame::decodeLinkAdr(t.data, t.len, la);
+    if (adr) {
+      id = la.nodeId;
+      seq = la.seq;
+    } else if (frame::decodeValveCmd(t.data, t.len, vc)) {
+      id = vc.nodeId;
+      seq = vc.seq;
+    } else {
+      return;
+    }
+    if (id == 0 || id > cfg_.nodes) return;
+    Node& n = nodes_[id - 1];
+    if (n.sf != t.sf || n.channel != ch) return;                     // Tuned elsewhere
+    if (n.txStartUs < endUs && n.txEndUs > t.startUs) return;        // Busy sending
+    stats.downlinksHeard++;
+    if (adr) {
+      n.adrPending = true;
+      n.adrSf = la.sf;
+      n.adrPower = la.txPower;
+      n.adrAtUs = endUs + (uint64_t)la.switchIn100ms * 100000;
+    }
+    n.ackDue = true;
+    n.ackSeq = seq;
+    n.ackFlags = !adr && vc.open ? frame::FLAG_VALVE_OPEN : 0;
+    n.ackAtUs = endUs + ACK_TURNAROUND_US;
+  }
+
+  Config   cfg_;
+  host::Rng rng_;
+  Frame    air_[MAX_AIR];
+  uint8_t  airCount_ = 0;
+  uint32_t txSeen_[RADIOS] = {};
+  uint64_t gwWakeUs_ = 0;
+  uint64_t gwTxStart_[RADIOS][GW_TX_LOG] = {};  // Per gateway radio
+  uint64_t gwTxEnd_[RADIOS][GW_TX_LOG] = {};
+  uint8_t  gwTxNext_[RADIOS] = {};
+};
+
+}  // namespace sim
@@ -0,0 +1,149 @@
+/*****************************************************************
+ * AGROSENSE - LoRa Traffic Simulation
+ *
+ * The gateway firmware against a simulated field (channel_sim.h):
+ *   - pure ALOHA sanity check of the channel model against exp(-2G)
+ *   - delta frames lost to a missing base match the gateway's drops
+ *   - capacity sweep over node count and uplink interval, with
+ *     capture, ADR downlinks and their ACKs on the same channel
+ *   - the same load over two channels, nodes fixed or hopping, against
+ *     one channel
+ * Results are deterministic for a given seed; the sweep only asserts
+ * the small deployments the gateway is sized for.
+ *****************************************************************/
+#include <unity.h>
+
+#include "../../../src/main.cpp"
+#include "gateway_harness.h"
+#include "channel_sim.h"
+
+constexpr uint64_t HOUR_US = 3600ULL * 1000000;
+
+void setUp() { gw::reset(); }
+void tearDown() {}
+
+void printRun(const char* name, const sim::Config& c, const sim::Stats& s) {
+  printf("[sim] %-8s %2u nodes %3u s %u ch: PDR %.3f  G %.3f  lost %u coll / %u SF / %u duplex  "
+         "dl %u (%u heard, %u ACKed)  %.0f ns/pass\n",
+         name, c.nodes, (unsigned)(c.intervalMs / 1000), c.channels ? c.channels : 1, s.pdr(), s.load(),
+         (unsigned)s.collided,
+         (unsigned)s.wrongSf, (unsigned)s.halfDuplex, (unsigned)s.downlinks, (unsigned)s.downlinksHeard,
+         (unsigned)s.acksDelivered, s.gwPasses ? (double)s.gwNs / s.gwPasses : 0.0);
+}
+
+/* -------------------- Channel Model -------------------- */
+void test_pure_aloha() {
+  constexpr double G = 0.25;
+  constexpr uint32_t FRAMES = 20000;
+  const double frameMs = LinkProfile::us(frame::UPLINK_LEN + frame::TRACE_LEN + AUTH_LEN) / 1000.0;
+  sim::Config c = {};
+  c.nodes = sim::MAX_NODES;
+  c.intervalMs = (uint32_t)(c.nodes * frameMs / G);
+  c.poisson = true;
+  c.fullEvery = 1;                       // Fixed-length frames
+  c.captureDb = INFINITY;
+  c.seed = 7;
+
+  sim::Channel ch(c);
+  ch.run((uint64_t)FRAMES * c.intervalMs * 1000 / c.nodes);
+  const sim::Stats& s = ch.stats;
+  printRun("aloha", c, s);
+  printf("[sim] aloha    expected PDR exp(-2G) = %.3f\n", exp(-2 * s.load()));
+
+  TEST_ASSERT_TRUE(s.uplinks > FRAMES * 9 / 10);
+  TEST_ASSERT_TRUE(fabs(s.pdr() - exp(-2 * s.load())) < 0.03);
+  TEST_ASSERT_EQUAL_UINT32(0, s.downlinks);
+  TEST_ASSERT_EQUAL_UINT32(s.delivered, s.readings);
+}
+
+/* -------------------- Delta Resync -------------------- */
+void test_delta_base_loss() {
+  sim::Config c = {};
+  c.nodes = 24;
+  c.intervalMs = 5000;
+  c.fullEvery = 4;
+  c.captureDb = 6;
+  c.pathSpreadDb = 20;
+  c.seed = 11;
+
+  sim::Channel ch(c);
+  ch.run(HOUR_US);
+  const sim::Stats& s = ch.stats;
+  printRun("delta", c, s);
+
+  TEST_ASSERT_TRUE(s.orphanDeltas > 0);
+  TEST_ASSERT_EQUAL_UINT32(s.orphanDeltas, stats.decodeDrops);
+  TEST_ASSERT_EQUAL_UINT32(s.delivered - s.orphanDeltas, s.readings);
+}
+
+/* -------------------- Capacity -------------------- */
+void test_capacity_sweep() {
+  static const uint8_t NODES[] = {4, 8, 16, 32};
+  static const uint32_t INTERVALS_MS[] = {60000, 10000};
+
+  for (uint32_t interval : INTERVALS_MS) {
+    for (uint8_t n : NODES) {
+      gw::reset();
+      sim::Config c = {};
+      c.nodes = n;
+      c.intervalMs = interval;
+      c.fullEvery = 4;
+      c.captureDb = 6;
+      c.pathSpreadDb = 20;
+      c.adr = true;
+      c.seed = 1000u + n;
+
+      sim::Channel ch(c);
+      ch.run(2 * HOUR_US);
+      const sim::Stats& s = ch.stats;
+      printRun("sweep", c, s);
+
+      TEST_ASSERT_TRUE(s.downlinksHeard > 0);  // ADR found power to save
+      TEST_ASSERT_TRUE(s.acksDelivered > 0);
+      if (n <= 4) TEST_ASSERT_TRUE(s.pdr() > 0.95);
+    }
+  }
+}
+
+/* -------------------- Channel Plan -------------------- */
+void test_two_channels() {
+  static const char* const NAMES[] = {"single", "fixed", "hopping"};
+  double pdr[3];
+  for (uint8_t run = 0; run < 3; ++run) {
+    sim::Config c = {};
+    c.nodes = 32;
+    c.intervalMs = 10000;
+    c.fullEvery = 4;
+    c.captureDb = 6;
+    c.pathSpreadDb = 20;
+    c.adr = true;
+    c.channels = run == 0 ? 1 : 2;
+    c.hopping = run == 2;
+    c.seed = 1032;
+    gw::reset(c.channels);
+
+    sim::Channel ch(c);
+    ch.run(2 * HOUR_US);
+    const sim::Stats& s = ch.stats;
+    printRun(NAMES[run], c, s);
+    pdr[run] = s.pdr();
+
+    TEST_ASSERT_TRUE(s.acksDelivered > 0);        // Downlinks found their node's channel
+    TEST_ASSERT_EQUAL_UINT32(0, stats.crcErrors[1]);  // Our own downlinks' TxDone is not a bad frame
+    if (run > 0) {
+      TEST_ASSERT_TRUE(stats.rxFrames[1] > stats.rxFrames[0] / 2);
+      TEST_ASSERT_TRUE(stats.rxFrames[0] > stats.rxFrames[1] / 2);
+    }
+  }
+  TEST_ASSERT_TRUE(pdr[1] > pdr[0] + 0.05);
+  TEST_ASSERT_TRUE(pdr[2] > pdr[0] + 0.05);
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST(test_pure_aloha);
+  RUN_TEST(test_delta_base_loss);
+  RUN_TEST(test_capacity_sweep);
+  RUN_TEST(test_two_channels);
+  return UNITY_END();
+}